@@ -0,0 +1,244 @@
+<?php
+
+/**
+ * HTTP load generator for Phalcon\Server\Http and Phalcon\Server\Simple
+ *
+ * Keeps --concurrency connections busy over loopback, each one with up to --pipeline
+ * requests in flight, and prints the throughput and the latency percentiles as JSON.
+ *
+ *	php bench.php --port=8989 --path=/ --concurrency=64 --duration=10 --keepalive=1 --pipeline=1 --body=0
+ */
+
+$options = getopt('', [
+	'host:', 'port:', 'path:', 'method:', 'concurrency:', 'duration:', 'requests:',
+	'keepalive:', 'pipeline:', 'body:', 'warmup:', 'timeout:', 'label:'
+]);
+
+$config = [
+	'host'        => isset($options['host']) ? $options['host'] : '127.0.0.1',
+	'port'        => isset($options['port']) ? (int)$options['port'] : 8989,
+	'path'        => isset($options['path']) ? $options['path'] : '/',
+	'method'      => isset($options['method']) ? strtoupper($options['method']) : null,
+	'concurrency' => isset($options['concurrency']) ? max(1, (int)$options['concurrency']) : 32,
+	'duration'    => isset($options['duration']) ? (float)$options['duration'] : 10.0,
+	'requests'    => isset($options['requests']) ? (int)$options['requests'] : 0,
+	'keepalive'   => isset($options['keepalive']) ? (bool)(int)$options['keepalive'] : true,
+	'pipeline'    => isset($options['pipeline']) ? max(1, (int)$options['pipeline']) : 1,
+	'body'        => isset($options['body']) ? max(0, (int)$options['body']) : 0,
+	'warmup'      => isset($options['warmup']) ? (float)$options['warmup'] : 1.0,
+	'timeout'     => isset($options['timeout']) ? (float)$options['timeout'] : 5.0,
+	'label'       => isset($options['label']) ? $options['label'] : null,
+];
+
+/* Without keep-alive every request needs its own connection, nothing can be pipelined */
+if (!$config['keepalive']) {
+	$config['pipeline'] = 1;
+}
+/* A fixed number of requests is measured from the first one */
+if ($config['requests']) {
+	$config['warmup'] = 0;
+}
+if (!$config['method']) {
+	$config['method'] = $config['body'] ? 'POST' : 'GET';
+}
+
+function bench_request(array $config)
+{
+	$request = $config['method'] . ' ' . $config['path'] . " HTTP/1.1\r\n"
+		. 'Host: ' . $config['host'] . ':' . $config['port'] . "\r\n"
+		. 'Connection: ' . ($config['keepalive'] ? 'keep-alive' : 'close') . "\r\n";
+
+	if ($config['body']) {
+		$request .= "Content-Type: application/octet-stream\r\n"
+			. 'Content-Length: ' . $config['body'] . "\r\n\r\n"
+			. str_repeat('x', $config['body']);
+	} else {
+		$request .= "\r\n";
+	}
+
+	return $request;
+}
+
+function bench_connect(array $config)
+{
+	$socket = @stream_socket_client('tcp://' . $config['host'] . ':' . $config['port'], $errno, $errstr, $config['timeout'], STREAM_CLIENT_CONNECT | STREAM_CLIENT_ASYNC_CONNECT);
+	if (!$socket) {
+		return null;
+	}
+	stream_set_blocking($socket, false);
+
+	return ['socket' => $socket, 'out' => '', 'in' => '', 'sent' => [], 'closed' => false];
+}
+
+/**
+ * Length of the first complete response of the buffer, 0 while it is incomplete
+ */
+function bench_response_length($buffer, &$status, $closed)
+{
+	$end = strpos($buffer, "\r\n\r\n");
+	if ($end === false) {
+		return 0;
+	}
+
+	$head = substr($buffer, 0, $end);
+	$status = (int)substr($head, 9, 3);
+
+	if (preg_match('/\r\ncontent-length:\s*(\d+)/i', $head, $matches)) {
+		$length = $end + 4 + (int)$matches[1];
+		return strlen($buffer) >= $length ? $length : 0;
+	}
+
+	if (preg_match('/\r\ntransfer-encoding:\s*chunked/i', $head)) {
+		$last = strpos($buffer, "\r\n0\r\n\r\n", $end);
+		if ($last === false && substr($buffer, $end + 4, 5) === "0\r\n\r\n") {
+			return $end + 9;
+		}
+		return $last === false ? 0 : $last + 7;
+	}
+
+	/* A response without a length ends with the connection */
+	return $closed ? strlen($buffer) : 0;
+}
+
+function bench_percentile(array $sorted, $percentile)
+{
+	if (!$sorted) {
+		return 0;
+	}
+
+	return $sorted[min(count($sorted) - 1, (int)ceil($percentile / 100 * count($sorted)) - 1)];
+}
+
+$request = bench_request($config);
+$connections = [];
+$latencies = [];
+$statuses = [];
+$errors = ['connect' => 0, 'read' => 0, 'timeout' => 0];
+$completed = 0;
+$bytes = 0;
+$issued = 0;
+
+$start = microtime(true);
+$measure_from = $start + $config['warmup'];
+$stop_at = $config['requests'] ? INF : $measure_from + $config['duration'];
+
+while (true) {
+	$now = microtime(true);
+	$sending = $now < $stop_at && (!$config['requests'] || $issued < $config['requests']);
+
+	/* Keep every connection open and full */
+	for ($i = 0; $sending && $i < $config['concurrency']; $i++) {
+		if (!isset($connections[$i])) {
+			$connections[$i] = bench_connect($config);
+			if (!$connections[$i]) {
+				unset($connections[$i]);
+				$errors['connect']++;
+				continue;
+			}
+		}
+
+		while (count($connections[$i]['sent']) < $config['pipeline'] && (!$config['requests'] || $issued < $config['requests'])) {
+			$connections[$i]['out'] .= $request;
+			$connections[$i]['sent'][] = $now;
+			$issued++;
+		}
+	}
+
+	if (!$connections || (!$sending && !array_filter($connections, function ($c) { return $c['sent']; }))) {
+		break;
+	}
+
+	$read = $write = [];
+	foreach ($connections as $i => $connection) {
+		$read[$i] = $connection['socket'];
+		if ($connection['out'] !== '') {
+			$write[$i] = $connection['socket'];
+		}
+	}
+	$except = null;
+
+	if (@stream_select($read, $write, $except, 0, 100000) === false) {
+		break;
+	}
+
+	foreach ($write as $i => $socket) {
+		$written = @fwrite($socket, $connections[$i]['out']);
+		if ($written) {
+			$connections[$i]['out'] = (string)substr($connections[$i]['out'], $written);
+		}
+	}
+
+	$now = microtime(true);
+
+	foreach ($read as $i => $socket) {
+		$data = @fread($socket, 65536);
+		if ($data === '' || $data === false) {
+			$connections[$i]['closed'] = true;
+		} else {
+			$connections[$i]['in'] .= $data;
+			$bytes += strlen($data);
+		}
+
+		/* Responses come back in the order of the requests */
+		while ($connections[$i]['sent'] && ($length = bench_response_length($connections[$i]['in'], $status, $connections[$i]['closed']))) {
+			$sent_at = array_shift($connections[$i]['sent']);
+			$connections[$i]['in'] = (string)substr($connections[$i]['in'], $length);
+
+			if ($sent_at >= $measure_from && ($config['requests'] || $now <= $stop_at)) {
+				$latencies[] = (int)(($now - $sent_at) * 1000000);
+				$statuses[$status] = isset($statuses[$status]) ? $statuses[$status] + 1 : 1;
+				$completed++;
+			}
+		}
+
+		if ($connections[$i]['closed'] || (!$config['keepalive'] && !$connections[$i]['sent'])) {
+			if ($connections[$i]['sent'] && $connections[$i]['closed']) {
+				$errors['read'] += count($connections[$i]['sent']);
+			}
+			fclose($socket);
+			unset($connections[$i]);
+		}
+	}
+
+	/* Requests the server never answered */
+	foreach ($connections as $i => $connection) {
+		if ($connection['sent'] && $now - $connection['sent'][0] > $config['timeout']) {
+			$errors['timeout'] += count($connection['sent']);
+			fclose($connection['socket']);
+			unset($connections[$i]);
+		}
+	}
+
+	if ($config['requests'] && $completed >= $config['requests']) {
+		break;
+	}
+}
+
+$elapsed = $config['requests'] ? microtime(true) - $measure_from : $config['duration'];
+sort($latencies);
+ksort($statuses);
+
+echo json_encode([
+	'label'       => $config['label'],
+	'target'      => $config['host'] . ':' . $config['port'] . $config['path'],
+	'method'      => $config['method'],
+	'concurrency' => $config['concurrency'],
+	'keepalive'   => $config['keepalive'],
+	'pipeline'    => $config['pipeline'],
+	'body'        => $config['body'],
+	'duration'    => round($elapsed, 3),
+	'requests'    => $completed,
+	'throughput'  => $elapsed > 0 ? round($completed / $elapsed, 1) : 0,
+	'bytes_in'    => $bytes,
+	'statuses'    => (object)$statuses,
+	'errors'      => $errors,
+	'latency_us'  => [
+		'min'  => $latencies ? $latencies[0] : 0,
+		'mean' => $latencies ? (int)(array_sum($latencies) / count($latencies)) : 0,
+		'p50'  => bench_percentile($latencies, 50),
+		'p90'  => bench_percentile($latencies, 90),
+		'p99'  => bench_percentile($latencies, 99),
+		'p999' => bench_percentile($latencies, 99.9),
+		'max'  => $latencies ? $latencies[count($latencies) - 1] : 0,
+	],
+]), PHP_EOL;
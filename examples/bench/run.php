@@ -0,0 +1,139 @@
+<?php
+
+/**
+ * Runs bench.php against server.php for every combination of the lists given
+ * and writes one JSON document with all the results, stdout by default.
+ *
+ *	php run.php --scenario=hello,mvc,orm,simple --concurrency=1,64 --keepalive=1,0 --pipeline=1,16 --body=0,16384 --duration=10 --output=results.json
+ */
+
+$options = getopt('', ['scenario:', 'concurrency:', 'keepalive:', 'pipeline:', 'body:', 'duration:', 'warmup:', 'workers:', 'port:', 'output:']);
+
+function run_list($options, $name, $default)
+{
+	return array_map('trim', explode(',', isset($options[$name]) ? $options[$name] : $default));
+}
+
+$scenarios = [
+	'hello'  => ['server' => 'http', 'path' => '/hello'],
+	'mvc'    => ['server' => 'http', 'path' => '/bench/index'],
+	'orm'    => ['server' => 'http', 'path' => '/bench/robots'],
+	'simple' => ['server' => 'simple', 'path' => '/'],
+];
+
+$selected = run_list($options, 'scenario', 'hello,mvc,orm,simple');
+$port = isset($options['port']) ? (int)$options['port'] : 8989;
+$workers = isset($options['workers']) ? (int)$options['workers'] : 2;
+$duration = isset($options['duration']) ? (float)$options['duration'] : 10;
+$warmup = isset($options['warmup']) ? (float)$options['warmup'] : 1;
+$php = escapeshellarg(PHP_BINARY);
+
+function run_wait_port($port, $timeout)
+{
+	for ($waited = 0; $waited < $timeout; $waited += 0.1) {
+		$socket = @stream_socket_client('tcp://127.0.0.1:' . $port, $errno, $errstr, 0.1);
+		if ($socket) {
+			fclose($socket);
+			return true;
+		}
+		usleep(100000);
+	}
+
+	return false;
+}
+
+function run_start_server($php, $type, $port, $workers)
+{
+	$command = 'exec ' . $php . ' ' . escapeshellarg(__DIR__ . '/server.php') . ' ' . $type . ' --port=' . $port . ' --workers=' . $workers;
+	$process = proc_open($command, [0 => ['pipe', 'r'], 1 => ['file', '/dev/null', 'w'], 2 => ['file', '/dev/null', 'w']], $pipes);
+
+	if (!is_resource($process) || !run_wait_port($type == 'simple' ? 8080 : $port, 10)) {
+		fwrite(STDERR, "Unable to start the $type server\n");
+		exit(1);
+	}
+
+	return [$process, $pipes];
+}
+
+function run_stop_server($type, $process, array $pipes)
+{
+	if ($type == 'simple') {
+		fwrite($pipes[0], '!');
+	}
+	fclose($pipes[0]);
+
+	$status = proc_get_status($process);
+	if ($status['running']) {
+		/* The master stops its workers on SIGINT */
+		proc_terminate($process, 2);
+	}
+	proc_close($process);
+	sleep(1);
+}
+
+$results = [];
+$running = null;
+
+foreach ($selected as $scenario) {
+	if (!isset($scenarios[$scenario])) {
+		fwrite(STDERR, "Unknown scenario $scenario\n");
+		continue;
+	}
+	$type = $scenarios[$scenario]['server'];
+
+	if (!$running || $running[0] != $type) {
+		if ($running) {
+			run_stop_server($running[0], $running[1], $running[2]);
+		}
+		list($process, $pipes) = run_start_server($php, $type, $port, $workers);
+		$running = [$type, $process, $pipes];
+	}
+
+	foreach (run_list($options, 'concurrency', '1,64') as $concurrency) {
+		foreach (run_list($options, 'keepalive', '1,0') as $keepalive) {
+			foreach (run_list($options, 'pipeline', '1,16') as $pipeline) {
+				foreach (run_list($options, 'body', '0,16384') as $body) {
+					/* Pipelining needs keep-alive, Simple answers a read and not a request */
+					if ($pipeline > 1 && (!$keepalive || $type == 'simple')) {
+						continue;
+					}
+
+					$label = sprintf('%s c%d k%d p%d b%d', $scenario, $concurrency, $keepalive, $pipeline, $body);
+					fwrite(STDERR, $label . "\n");
+
+					$output = shell_exec($php . ' ' . escapeshellarg(__DIR__ . '/bench.php')
+						. ' --port=' . ($type == 'simple' ? 8080 : $port)
+						. ' --path=' . escapeshellarg($scenarios[$scenario]['path'])
+						. ' --concurrency=' . (int)$concurrency
+						. ' --keepalive=' . (int)$keepalive
+						. ' --pipeline=' . (int)$pipeline
+						. ' --body=' . (int)$body
+						. ' --duration=' . $duration
+						. ' --warmup=' . $warmup
+						. ' --label=' . escapeshellarg($label));
+
+					$result = json_decode($output, true);
+					$results[] = $result ? ['scenario' => $scenario, 'server' => $type] + $result : ['scenario' => $scenario, 'label' => $label, 'error' => trim($output)];
+				}
+			}
+		}
+	}
+}
+
+if ($running) {
+	run_stop_server($running[0], $running[1], $running[2]);
+}
+
+$document = json_encode([
+	'php'     => PHP_VERSION,
+	'phalcon' => Phalcon\Version::get(),
+	'workers' => $workers,
+	'date'    => date('c'),
+	'results' => $results,
+], JSON_PRETTY_PRINT);
+
+if (isset($options['output'])) {
+	file_put_contents($options['output'], $document . PHP_EOL);
+} else {
+	echo $document, PHP_EOL;
+}
@@ -0,0 +1,120 @@
+<?php
+
+/**
+ * Applications driven by bench.php
+ *
+ *	php server.php http --port=8989 --workers=2 [--keepalive=1] [--coroutine=0]
+ *	php server.php simple
+ *
+ * Phalcon\Server\Http answers the three scenarios:
+ *	/hello            a bare application returning a response, the cost of the server itself
+ *	/bench/index      router and dispatcher to a controller action
+ *	/bench/robots     the same with a Phalcon\Mvc\Model query on SQLite
+ * Phalcon\Server\Simple listens on 8080 and answers every read with a fixed response,
+ * write '!' on its standard input to stop it.
+ */
+
+$options = getopt('', ['port:', 'workers:', 'keepalive:', 'coroutine:', 'database:']);
+$type = isset($argv[1]) && $argv[1][0] != '-' ? $argv[1] : 'http';
+$database = isset($options['database']) ? $options['database'] : sys_get_temp_dir() . '/phalcon-bench.sqlite';
+
+const BENCH_HELLO = 'Hello World!';
+
+class BenchHelloApplication extends Phalcon\Application
+{
+	public function handle($uri = NULL)
+	{
+		if (strncmp($uri, '/hello', 6) === 0) {
+			return new Phalcon\Http\Response(BENCH_HELLO);
+		}
+
+		return $this->mvc->handle($uri);
+	}
+}
+
+class BenchController extends Phalcon\Mvc\Controller
+{
+	public function indexAction()
+	{
+		return $this->response->setContent(BENCH_HELLO);
+	}
+
+	public function robotsAction()
+	{
+		$robots = BenchRobots::find(['type = ?0', 'bind' => ['mechanical'], 'limit' => 10]);
+
+		return $this->response->setJsonContent($robots->toArray());
+	}
+}
+
+class BenchRobots extends Phalcon\Mvc\Model
+{
+	public function getSource()
+	{
+		return 'robots';
+	}
+}
+
+class BenchSimpleApplication extends Phalcon\Application
+{
+	public function handle($data = NULL)
+	{
+		return "HTTP/1.1 200 OK\r\nContent-Length: " . strlen(BENCH_HELLO) . "\r\n\r\n" . BENCH_HELLO;
+	}
+}
+
+/**
+ * The rows are written once, every worker opens its own connection after the fork
+ */
+function bench_database($database)
+{
+	$connection = new Phalcon\Db\Adapter\Pdo\Sqlite(['dbname' => $database]);
+	$connection->execute('DROP TABLE IF EXISTS robots');
+	$connection->execute('CREATE TABLE robots (id INTEGER PRIMARY KEY, name VARCHAR(70) NOT NULL, type VARCHAR(32) NOT NULL, year INTEGER NOT NULL)');
+
+	$connection->begin();
+	for ($i = 1; $i <= 1000; $i++) {
+		$connection->insert('robots', ['Robot ' . $i, $i % 3 ? 'mechanical' : 'virtual', 1950 + $i % 70], ['name', 'type', 'year']);
+	}
+	$connection->commit();
+	$connection->close();
+}
+
+if ($type == 'simple') {
+	$server = new Phalcon\Server\Simple();
+	$server->start(new BenchSimpleApplication);
+	exit;
+}
+
+bench_database($database);
+
+$di = new Phalcon\Di\FactoryDefault();
+$di->setShared('db', function () use ($database) {
+	return new Phalcon\Db\Adapter\Pdo\Sqlite(['dbname' => $database]);
+});
+$di->setShared('router', function () {
+	$router = new Phalcon\Mvc\Router(false);
+	$router->add('/bench/:action', ['controller' => 'bench', 'action' => 1]);
+	return $router;
+});
+$di->setShared('dispatcher', function () {
+	$dispatcher = new Phalcon\Mvc\Dispatcher();
+	$dispatcher->setDefaultNamespace('');
+	return $dispatcher;
+});
+
+$mvc = new Phalcon\Mvc\Application($di);
+$mvc->useImplicitView(false);
+$di->setShared('mvc', $mvc);
+
+$application = new BenchHelloApplication();
+$application->setDI($di);
+
+$server = new Phalcon\Server\Http([
+	'host'      => '127.0.0.1',
+	'port'      => isset($options['port']) ? (int)$options['port'] : 8989,
+	'worker'    => isset($options['workers']) ? (int)$options['workers'] : 2,
+	'keepalive' => isset($options['keepalive']) ? (bool)(int)$options['keepalive'] : true,
+	'coroutine' => isset($options['coroutine']) ? (bool)(int)$options['coroutine'] : false,
+]);
+$server->start($application);
@@ -408,6 +408,7 @@ kernel/list.c \
 kernel/session.c \
 kernel/variables.c \
 kernel/framework/orm.c \
+kernel/framework/dispatcher.c \
 kernel/framework/router.c \
 kernel/framework/url.c \
 kernel/assert.c \
@@ -1159,7 +1160,7 @@ server/exception.c"
 				[
 					PHP_ADD_LIBRARY_WITH_PATH(websockets, $i/$PHP_LIBDIR, PHALCON_SHARED_LIBADD)
 					AC_DEFINE(PHALCON_USE_WEBSOCKET, 1, [Have WebSocket support])
-					phalcon_sources="$phalcon_sources websocket/connection.c websocket/server.c websocket/client.c websocket/eventloopinterface.c "
+					phalcon_sources="$phalcon_sources websocket/connection.c websocket/server.c websocket/client.c websocket/eventloopinterface.c websocket/ring.c "
 				],[
 					AC_MSG_ERROR([Wrong websockets version or library not found])
 				],[
@@ -1174,6 +1175,26 @@ server/exception.c"
 		if test -z "$WEBSOCKET_DIR"; then
 			AC_MSG_ERROR([libwebsockets library not found])
 		fi
+
+		dnl The lws options are enum members, the preprocessor can not see them
+		AC_MSG_CHECKING([for libwebsockets listen socket sharing])
+		old_CPPFLAGS=$CPPFLAGS
+		CPPFLAGS="$CPPFLAGS -I$WEBSOCKET_DIR/include"
+		AC_TRY_COMPILE(
+		[
+			#include <libwebsockets.h>
+		],[
+			lws_sock_file_fd_type fd;
+			unsigned long options = LWS_SERVER_OPTION_ALLOW_LISTEN_SHARE;
+			fd.filefd = 0;
+			return lws_adopt_descriptor_vhost(lws_get_vhost_by_name(NULL, "default"), LWS_ADOPT_RAW_FILE_DESC, fd, NULL, NULL) == NULL && options;
+		],[
+			AC_DEFINE([PHALCON_USE_WEBSOCKET_WORKERS], 1, [Have libwebsockets listen socket sharing])
+			AC_MSG_RESULT([yes])
+		],[
+			AC_MSG_RESULT([no, the websocket server runs a single process])
+		])
+		CPPFLAGS=$old_CPPFLAGS
 	fi
 
 	AC_MSG_CHECKING([Include non-free minifiers])
@@ -1287,10 +1308,35 @@ server/exception.c"
 		], [
 			AC_DEFINE([PHALCON_USE_SERVER], 1, [Have epoll support])
 			AC_MSG_RESULT([yes])
-			phalcon_sources="$phalcon_sources server/utils.c server/core.c server.c server/http.c"
+			phalcon_sources="$phalcon_sources kernel/coroutine.c kernel/lthread/lthread.c kernel/lthread/lthread_sched.c kernel/lthread/lthread_socket.c kernel/lthread/lthread_io.c kernel/lthread/lthread_poller.c kernel/lthread/lthread_compute.c server/utils.c server/core.c server/metrics.c server/static.c server/compress.c server/multipart.c server/limiter.c server.c server/http.c"
 		], [
 			AC_MSG_RESULT([no])
 		])
+
+		AC_MSG_CHECKING([for zlib.h])
+		ZLIB_DIR=
+		for i in /usr/local /usr; do
+			if test -r $i/include/zlib.h; then
+				ZLIB_DIR=$i
+				break
+			fi
+		done
+
+		if test -n "$ZLIB_DIR"; then
+			AC_MSG_RESULT([found in $ZLIB_DIR])
+			PHP_ADD_INCLUDE($ZLIB_DIR/include)
+			PHP_CHECK_LIBRARY(z, deflateInit2_,
+			[
+				PHP_ADD_LIBRARY_WITH_PATH(z, $ZLIB_DIR/$PHP_LIBDIR, PHALCON_SHARED_LIBADD)
+				AC_DEFINE(PHALCON_USE_ZLIB, 1, [Have zlib support])
+			],[
+				AC_MSG_WARN([deflateInit2_ not found in -lz, responses will not be compressed])
+			],[
+				-L$ZLIB_DIR/$PHP_LIBDIR
+			])
+		else
+			AC_MSG_RESULT([no])
+		fi
 	fi
 
 	LIBS="$LIBS -pthread -lrt"
@@ -39,6 +39,7 @@
 #include "kernel/operators.h"
 #include "kernel/string.h"
 #include "kernel/exception.h"
+#include "kernel/framework/dispatcher.h"
 
 #include "interned-strings.h"
 
@@ -698,6 +699,10 @@ PHP_METHOD(Phalcon_Dispatcher, dispatch){
 	do {
 		zval finished = {}, namespace_name = {}, handler_name = {}, action_name = {}, camelize = {}, camelized_class = {}, camelized_namespace = {};
 		zval handler_class = {}, has_service = {}, was_fresh = {}, action_method = {}, action_params = {}, params = {}, tmp_params = {}, *param, logic_binding = {}, reflection_method = {};
+		phalcon_dispatcher_handler *handler_entry;
+		phalcon_dispatcher_action *action_entry;
+		zend_string *handler_namespace = NULL;
+		int handler_cacheable, handler_flags = 0;
 		zval reflection_parameters = {}, *reflection_parameter, call_object = {}, value = {}, e = {}, exception = {};
 		zend_class_entry *reflection_method_ce;
 		zend_string *param_key;
@@ -795,41 +800,67 @@ PHP_METHOD(Phalcon_Dispatcher, dispatch){
 		}
 
 		/**
-		 * We don't camelize the classes if they are in namespaces
+		 * The class resolved for the same names before is reused
 		 */
-		if (!phalcon_memnstr_str(&handler_name, SL("\\"))) {
+		handler_entry = NULL;
+		if (Z_TYPE(handler_name) == IS_STRING && (Z_TYPE(handler_suffix) == IS_STRING || Z_TYPE(handler_suffix) == IS_NULL)
+			&& (Z_TYPE(namespace_name) == IS_STRING || !zend_is_true(&namespace_name))) {
+			handler_cacheable = 1;
+			handler_namespace = zend_is_true(&namespace_name) ? Z_STR(namespace_name) : NULL;
+			handler_flags = 0;
 			phalcon_read_property(&camelize, getThis(), SL("_camelizeController"), PH_READONLY);
-			if (!zend_is_true(&camelize)) {
-				ZVAL_COPY(&camelized_class, &handler_name);
-			} else {
-				phalcon_camelize(&camelized_class, &handler_name);
+			if (zend_is_true(&camelize)) {
+				handler_flags |= PHALCON_DISPATCHER_CAMELIZE_HANDLER;
+			}
+			phalcon_read_property(&camelize, getThis(), SL("_camelizeNamespace"), PH_READONLY);
+			if (zend_is_true(&camelize)) {
+				handler_flags |= PHALCON_DISPATCHER_CAMELIZE_NAMESPACE;
 			}
-		} else if (phalcon_start_with_str(&handler_name, SL("\\"))) {
-			ZVAL_STRINGL(&camelized_class, Z_STRVAL(handler_name)+1, Z_STRLEN(handler_name)-1);
+			handler_entry = phalcon_dispatcher_find_handler(Z_STR(handler_name), handler_namespace, Z_TYPE(handler_suffix) == IS_STRING ? Z_STR(handler_suffix) : NULL, handler_flags);
 		} else {
-			ZVAL_COPY(&camelized_class, &handler_name);
+			handler_cacheable = 0;
 		}
 
-		/**
-		 * Create the complete controller class name prepending the namespace
-		 */
-		if (zend_is_true(&namespace_name)) {
-			phalcon_read_property(&camelize, getThis(), SL("_camelizeNamespace"), PH_READONLY);
-			if (!zend_is_true(&camelize)) {
-				ZVAL_COPY(&camelized_namespace, &namespace_name);
+		if (handler_entry) {
+			ZVAL_STR_COPY(&handler_class, handler_entry->handler_class);
+		} else {
+			/**
+			 * We don't camelize the classes if they are in namespaces
+			 */
+			if (!phalcon_memnstr_str(&handler_name, SL("\\"))) {
+				phalcon_read_property(&camelize, getThis(), SL("_camelizeController"), PH_READONLY);
+				if (!zend_is_true(&camelize)) {
+					ZVAL_COPY(&camelized_class, &handler_name);
+				} else {
+					phalcon_camelize(&camelized_class, &handler_name);
+				}
+			} else if (phalcon_start_with_str(&handler_name, SL("\\"))) {
+				ZVAL_STRINGL(&camelized_class, Z_STRVAL(handler_name)+1, Z_STRLEN(handler_name)-1);
 			} else {
-				phalcon_camelize(&camelized_namespace, &namespace_name);
+				ZVAL_COPY(&camelized_class, &handler_name);
 			}
-			if (phalcon_end_with_str(&camelized_namespace, SL("\\"))) {
-				PHALCON_CONCAT_VVV(&handler_class, &camelized_namespace, &camelized_class, &handler_suffix);
+
+			/**
+			 * Create the complete controller class name prepending the namespace
+			 */
+			if (zend_is_true(&namespace_name)) {
+				phalcon_read_property(&camelize, getThis(), SL("_camelizeNamespace"), PH_READONLY);
+				if (!zend_is_true(&camelize)) {
+					ZVAL_COPY(&camelized_namespace, &namespace_name);
+				} else {
+					phalcon_camelize(&camelized_namespace, &namespace_name);
+				}
+				if (phalcon_end_with_str(&camelized_namespace, SL("\\"))) {
+					PHALCON_CONCAT_VVV(&handler_class, &camelized_namespace, &camelized_class, &handler_suffix);
+				} else {
+					PHALCON_CONCAT_VSVV(&handler_class, &camelized_namespace, "\\", &camelized_class, &handler_suffix);
+				}
+				zval_ptr_dtor(&camelized_namespace);
 			} else {
-				PHALCON_CONCAT_VSVV(&handler_class, &camelized_namespace, "\\", &camelized_class, &handler_suffix);
+				PHALCON_CONCAT_VV(&handler_class, &camelized_class, &handler_suffix);
 			}
-			zval_ptr_dtor(&camelized_namespace);
-		} else {
-			PHALCON_CONCAT_VV(&handler_class, &camelized_class, &handler_suffix);
+			zval_ptr_dtor(&camelized_class);
 		}
-		zval_ptr_dtor(&camelized_class);
 
 		/**
 		 * Handlers are retrieved as shared instances from the Service Container
@@ -840,8 +871,16 @@ PHP_METHOD(Phalcon_Dispatcher, dispatch){
 			 * DI doesn't have a service with that name, try to load it using an autoloader
 			 */
 			assert(Z_TYPE(handler_class) == IS_STRING);
-			ZVAL_BOOL(&has_service, (phalcon_class_exists(&handler_class, 1) != NULL) ? 1 : 0);
-
+			if (handler_entry) {
+				ZVAL_TRUE(&has_service);
+			} else {
+				zend_class_entry *ce = phalcon_class_exists(&handler_class, 1);
+				/* Only the names of existing classes are kept, the others could grow the cache without bound */
+				if (ce && handler_cacheable) {
+					handler_entry = phalcon_dispatcher_add_handler(Z_STR(handler_name), handler_namespace, Z_TYPE(handler_suffix) == IS_STRING ? Z_STR(handler_suffix) : NULL, handler_flags, Z_STR(handler_class), ce);
+				}
+				ZVAL_BOOL(&has_service, ce != NULL ? 1 : 0);
+			}
 		}
 
 		/**
@@ -904,8 +943,19 @@ PHP_METHOD(Phalcon_Dispatcher, dispatch){
 		/**
 		 * Check if the method exists in the handler
 		 */
-		PHALCON_CONCAT_VV(&action_method, &action_name, &action_suffix);
-		if (phalcon_method_exists(&handler, &action_method) == FAILURE) {
+		action_entry = NULL;
+		if (handler_entry && handler_entry->ce == Z_OBJCE(handler) && Z_TYPE(action_name) == IS_STRING && Z_TYPE(action_suffix) == IS_STRING) {
+			if ((action_entry = phalcon_dispatcher_find_action(handler_entry, Z_STR(action_name), Z_STR(action_suffix))) != NULL) {
+				ZVAL_STR_COPY(&action_method, action_entry->method);
+			} else {
+				PHALCON_CONCAT_VV(&action_method, &action_name, &action_suffix);
+				action_entry = phalcon_dispatcher_add_action(handler_entry, Z_STR(action_name), Z_STR(action_suffix), Z_STR(action_method));
+			}
+		} else {
+			PHALCON_CONCAT_VV(&action_method, &action_name, &action_suffix);
+		}
+
+		if (!action_entry && phalcon_method_exists(&handler, &action_method) == FAILURE) {
 			/**
 			 * Call beforeNotFoundAction
 			 */
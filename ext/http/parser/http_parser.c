@@ -443,6 +443,214 @@ enum http_host_state
 #define IS_HEADER_CHAR(ch)                                                     \
   (ch == CR || ch == LF || ch == 9 || ((unsigned char)ch > 31 && ch != 127))
 
+/* Runs of bytes that can not move the state machine are skipped in bulk:
+ * header names up to the first byte that is not a token, header values up to
+ * a CR, a LF or a byte refused by IS_HEADER_CHAR, URLs up to a '?', a '#' or a
+ * byte refused by IS_URL_CHAR. The byte returned, or end, still goes through
+ * the state machine, so the vector classes may be narrower than the scalar
+ * ones but never wider. The vector paths follow the target of the build
+ * (-msse4.2, -mavx2 or -march=native), the scalar path reads 8 bytes at once.
+ */
+#if defined(__GNUC__) && (defined(__AVX2__) || defined(__SSE4_2__))
+# define HTTP_PARSER_SIMD 1
+# ifdef __AVX2__
+#  include <immintrin.h>
+# else
+#  include <nmmintrin.h>
+# endif
+#endif
+
+#define SCAN_ONES           0x0101010101010101ULL
+#define SCAN_HIGHS          0x8080808080808080ULL
+
+/* Non zero when a byte of the word is below n, which is at most 128 */
+#define SCAN_LESS(w, n)     (((w) - SCAN_ONES * (n)) & ~(w) & SCAN_HIGHS)
+#define SCAN_HAS(w, n)      SCAN_LESS((w) ^ (SCAN_ONES * (n)), 1)
+
+#define IS_HEADER_VALUE_CHAR(ch)                                               \
+  (ch == 9 || ((unsigned char)ch > 31 && ch != 127))
+
+#ifdef HTTP_PARSER_SIMD
+/* Bit h of entry l is set when the byte 0xhl is a token, see tokens[] */
+static const unsigned char token_nibbles[16] = {
+  0xe8, 0xfc, 0xf8, 0xfc, 0xfc, 0xfc, 0xfc, 0xfc,
+  0xf8, 0xf8, 0xf4, 0x54, 0xd0, 0x54, 0xf4, 0x70 };
+
+static const unsigned char nibble_bits[16] = {
+  1, 2, 4, 8, 16, 32, 64, 128, 0, 0, 0, 0, 0, 0, 0, 0 };
+#endif
+
+static const char *
+scan_header_field(const char *p, const char *end)
+{
+#if defined(HTTP_PARSER_SIMD) && defined(__AVX2__)
+  const __m256i lut = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) token_nibbles));
+  const __m256i bits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) nibble_bits));
+  const __m256i low = _mm256_set1_epi8(0x0f);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i row = _mm256_shuffle_epi8(lut, _mm256_and_si256(v, low));
+    __m256i bit = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+    unsigned int mask = (unsigned int) _mm256_movemask_epi8(
+      _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), _mm256_setzero_si256()));
+
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#elif defined(HTTP_PARSER_SIMD)
+  const __m128i lut = _mm_loadu_si128((const __m128i *) token_nibbles);
+  const __m128i bits = _mm_loadu_si128((const __m128i *) nibble_bits);
+  const __m128i low = _mm_set1_epi8(0x0f);
+
+  for (; end - p >= 16; p += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) p);
+    __m128i row = _mm_shuffle_epi8(lut, _mm_and_si128(v, low));
+    __m128i bit = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(v, 4), low));
+    unsigned int mask = (unsigned int) _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_and_si128(row, bit), _mm_setzero_si128()));
+
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#endif
+
+  /* Names are short and the token class has no cheap word test */
+  while (p != end && TOKEN(*p)) {
+    p++;
+  }
+
+  return p;
+}
+
+static const char *
+scan_header_value(const char *p, const char *end)
+{
+  uint64_t w;
+  int i;
+
+#if defined(HTTP_PARSER_SIMD) && defined(__AVX2__)
+  const __m256i ctl = _mm256_set1_epi8(0x1f);
+  const __m256i tab = _mm256_set1_epi8(9);
+  const __m256i del = _mm256_set1_epi8(127);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i stop = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctl), ctl);
+    unsigned int mask;
+
+    stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, tab), stop);
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, del));
+    mask = (unsigned int) _mm256_movemask_epi8(stop);
+
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#elif defined(HTTP_PARSER_SIMD)
+  static const char ranges[16] = "\000\010\012\037\177\177";
+  const __m128i r = _mm_loadu_si128((const __m128i *) ranges);
+
+  for (; end - p >= 16; p += 16) {
+    int n = _mm_cmpestri(r, 6, _mm_loadu_si128((const __m128i *) p), 16,
+      _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+
+    if (n != 16) {
+      return p + n;
+    }
+  }
+#endif
+
+  for (; end - p >= 8; p += 8) {
+    memcpy(&w, p, 8);
+    /* A tab trips the word test as well, the bytes tell */
+    if (SCAN_LESS(w, 0x20) | SCAN_HAS(w, 0x7f)) {
+      for (i = 0; i < 8; i++) {
+        if (!IS_HEADER_VALUE_CHAR(p[i])) {
+          return p + i;
+        }
+      }
+    }
+  }
+
+  while (p != end && IS_HEADER_VALUE_CHAR(*p)) {
+    p++;
+  }
+
+  return p;
+}
+
+static const char *
+scan_url(const char *p, const char *end)
+{
+  uint64_t w;
+  int i;
+
+#if defined(HTTP_PARSER_SIMD) && defined(__AVX2__)
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i hash = _mm256_set1_epi8('#');
+  const __m256i question = _mm256_set1_epi8('?');
+  const __m256i del = _mm256_set1_epi8(127);
+
+  for (; end - p >= 32; p += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) p);
+    __m256i stop = _mm256_cmpeq_epi8(_mm256_max_epu8(v, space), space);
+    unsigned int mask;
+
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, hash));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, question));
+    stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(v, del));
+#if HTTP_PARSER_STRICT
+    stop = _mm256_or_si256(stop, v);
+#endif
+    mask = (unsigned int) _mm256_movemask_epi8(stop);
+
+    if (mask) {
+      return p + __builtin_ctz(mask);
+    }
+  }
+#elif defined(HTTP_PARSER_SIMD)
+#if HTTP_PARSER_STRICT
+  static const char ranges[16] = "\000\040##??\177\377";
+#else
+  static const char ranges[16] = "\000\040##??\177\177";
+#endif
+  const __m128i r = _mm_loadu_si128((const __m128i *) ranges);
+
+  for (; end - p >= 16; p += 16) {
+    int n = _mm_cmpestri(r, 8, _mm_loadu_si128((const __m128i *) p), 16,
+      _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+
+    if (n != 16) {
+      return p + n;
+    }
+  }
+#endif
+
+  for (; end - p >= 8; p += 8) {
+    memcpy(&w, p, 8);
+#if HTTP_PARSER_STRICT
+    if (SCAN_LESS(w, 0x21) | SCAN_HAS(w, '#') | SCAN_HAS(w, '?') | SCAN_HAS(w, 0x7f) | (w & SCAN_HIGHS)) {
+#else
+    if (SCAN_LESS(w, 0x21) | SCAN_HAS(w, '#') | SCAN_HAS(w, '?') | SCAN_HAS(w, 0x7f)) {
+#endif
+      for (i = 0; i < 8; i++) {
+        if (!IS_URL_CHAR(p[i])) {
+          return p + i;
+        }
+      }
+    }
+  }
+
+  while (p != end && IS_URL_CHAR(*p)) {
+    p++;
+  }
+
+  return p;
+}
+
 #define start_state (parser->type == HTTP_REQUEST ? s_start_req : s_start_res)
 
 
@@ -1120,6 +1328,16 @@ reexecute:
               SET_ERRNO(HPE_INVALID_URL);
               goto error;
             }
+
+            /* The plain bytes of a path, query or fragment keep the state */
+            if (CURRENT_STATE() == s_req_path ||
+                CURRENT_STATE() == s_req_query_string ||
+                CURRENT_STATE() == s_req_fragment) {
+              const char* start = p;
+
+              p = scan_url(p + 1, data + len) - 1;
+              COUNT_HEADER_SIZE(p - start);
+            }
         }
         break;
       }
@@ -1308,6 +1526,7 @@ reexecute:
 
           switch (parser->header_state) {
             case h_general:
+              p = scan_header_field(p + 1, data + len) - 1;
               break;
 
             case h_C:
@@ -1535,25 +1754,12 @@ reexecute:
           switch (h_state) {
             case h_general:
             {
-              const char* p_cr;
-              const char* p_lf;
               size_t limit = data + len - p;
 
               limit = MIN(limit, HTTP_MAX_HEADER_SIZE);
 
-              p_cr = (const char*) memchr(p, CR, limit);
-              p_lf = (const char*) memchr(p, LF, limit);
-              if (p_cr != NULL) {
-                if (p_lf != NULL && p_cr >= p_lf)
-                  p = p_lf;
-                else
-                  p = p_cr;
-              } else if (UNLIKELY(p_lf != NULL)) {
-                p = p_lf;
-              } else {
-                p = data + len;
-              }
-              --p;
+              /* Stops on CR, LF and on the bytes checked above */
+              p = scan_header_value(p + 1, p + limit) - 1;
 
               break;
             }
@@ -64,6 +64,25 @@
  */
 zend_class_entry *phalcon_http_request_ce;
 
+/**
+ * Returns the request data injected by the owner of the request (e.g. Phalcon\Server\Http),
+ * falling back to the superglobal when nothing was injected
+ */
+static zval* phalcon_http_request_get_global(zval *object, const char *property, uint32_t property_length, const char *global, uint32_t global_length)
+{
+	zval *data = zend_read_property(phalcon_http_request_ce, object, property, property_length, 1, NULL);
+
+	if (data && Z_TYPE_P(data) == IS_ARRAY) {
+		return data;
+	}
+
+	if (!global) {
+		return NULL;
+	}
+
+	return phalcon_get_global_str(global, global_length);
+}
+
 PHP_METHOD(Phalcon_Http_Request, __construct);
 PHP_METHOD(Phalcon_Http_Request, _get);
 PHP_METHOD(Phalcon_Http_Request, get);
@@ -194,6 +213,12 @@ PHALCON_INIT_CLASS(Phalcon_Http_Request){
 	zend_declare_property_null(phalcon_http_request_ce, SL("_rawBody"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_http_request_ce, SL("_put"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_http_request_ce, SL("_data"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_http_request_ce, SL("_server"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_http_request_ce, SL("_get"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_http_request_ce, SL("_post"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_http_request_ce, SL("_request"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_http_request_ce, SL("_files"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_http_request_ce, SL("_rawBodyFile"), ZEND_ACC_PROTECTED);
 
 	zend_class_implements(phalcon_http_request_ce, 1, phalcon_http_requestinterface_ce);
 
@@ -315,7 +340,7 @@ PHP_METHOD(Phalcon_Http_Request, get)
 		}
 	}
 
-	request = phalcon_get_global_str(SL("_REQUEST"));
+	request = phalcon_http_request_get_global(getThis(), SL("_request"), SL("_REQUEST"));
 
 	PHALCON_CALL_METHOD(&put, getThis(), "getput");
 
@@ -380,7 +405,7 @@ PHP_METHOD(Phalcon_Http_Request, getPost)
 		}
 	}
 
-	post = phalcon_get_global_str(SL("_POST"));
+	post = phalcon_http_request_get_global(getThis(), SL("_post"), SL("_POST"));
 	PHALCON_RETURN_CALL_SELF("_get", post, name, filters, default_value, not_allow_empty, norecursive);
 }
 
@@ -511,7 +536,7 @@ PHP_METHOD(Phalcon_Http_Request, getQuery){
 		}
 	}
 
-	get = phalcon_get_global_str(SL("_GET"));
+	get = phalcon_http_request_get_global(getThis(), SL("_get"), SL("_GET"));
 
 	PHALCON_RETURN_CALL_SELF("_get", get, name, filters, default_value, not_allow_empty, norecursive);
 }
@@ -528,7 +553,7 @@ PHP_METHOD(Phalcon_Http_Request, getServer){
 
 	phalcon_fetch_params(0, 1, 0, &name);
 
-	_SERVER = phalcon_get_global_str(SL("_SERVER"));
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (!phalcon_array_isset_fetch(return_value, _SERVER, name, PH_COPY)) {
 		RETURN_NULL();
 	}
@@ -596,7 +621,7 @@ PHP_METHOD(Phalcon_Http_Request, has){
 
 	phalcon_fetch_params(0, 1, 0, &name);
 
-	_REQUEST = phalcon_get_global_str(SL("_REQUEST"));
+	_REQUEST = phalcon_http_request_get_global(getThis(), SL("_request"), SL("_REQUEST"));
 	RETURN_BOOL(phalcon_array_isset(_REQUEST, name));
 }
 
@@ -612,7 +637,7 @@ PHP_METHOD(Phalcon_Http_Request, hasPost){
 
 	phalcon_fetch_params(0, 1, 0, &name);
 
-	_POST = phalcon_get_global_str(SL("_POST"));
+	_POST = phalcon_http_request_get_global(getThis(), SL("_post"), SL("_POST"));
 	RETURN_BOOL(phalcon_array_isset(_POST, name));
 }
 
@@ -665,7 +690,7 @@ PHP_METHOD(Phalcon_Http_Request, hasQuery){
 
 	phalcon_fetch_params(0, 1, 0, &name);
 
-	_GET = phalcon_get_global_str(SL("_GET"));
+	_GET = phalcon_http_request_get_global(getThis(), SL("_get"), SL("_GET"));
 	RETURN_BOOL(phalcon_array_isset(_GET, name));
 }
 
@@ -681,7 +706,7 @@ PHP_METHOD(Phalcon_Http_Request, hasServer){
 
 	phalcon_fetch_params(0, 1, 0, &name);
 
-	_SERVER = phalcon_get_global_str(SL("_SERVER"));
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	RETURN_BOOL(phalcon_array_isset(_SERVER, name));
 }
 
@@ -697,7 +722,7 @@ PHP_METHOD(Phalcon_Http_Request, hasHeader){
 
 	phalcon_fetch_params(0, 1, 0, &header);
 
-	_SERVER = phalcon_get_global_str(SS("_SERVER") TSRMLS_CC);
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (phalcon_array_isset(_SERVER, header)) {
 		RETURN_TRUE;
 	}
@@ -722,7 +747,7 @@ PHP_METHOD(Phalcon_Http_Request, getHeader)
 
 	phalcon_fetch_params(0, 1, 0, &header);
 
-	_SERVER = phalcon_get_global_str(SL("_SERVER"));
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (!phalcon_array_isset_fetch(return_value, _SERVER, header, PH_COPY)) {
 		PHALCON_CONCAT_SV(&key, "HTTP_", header);
 		if (phalcon_array_isset_fetch(return_value, _SERVER, &key, PH_COPY)) {
@@ -785,7 +810,7 @@ PHP_METHOD(Phalcon_Http_Request, isSoapRequested)
 {
 	zval *server, content_type = {};
 
-	server = phalcon_get_global_str(SL("_SERVER"));
+	server = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (phalcon_array_isset_str(server, SL("HTTP_SOAPACTION"))) {
 		RETURN_TRUE;
 	}
@@ -832,8 +857,11 @@ PHP_METHOD(Phalcon_Http_Request, getRawBody)
 		RETURN_CTOR(&raw);
 	}
 
+	/* A large body Phalcon\Server\Http has kept in a temporary file */
+	phalcon_read_property(&raw, getThis(), SL("_rawBodyFile"), PH_NOISY|PH_READONLY);
+
 	context = php_stream_context_from_zval(zcontext, 0);
-	stream = php_stream_open_wrapper_ex("php://input", "rb", REPORT_ERRORS, NULL, context);
+	stream = php_stream_open_wrapper_ex(Z_TYPE(raw) == IS_STRING ? Z_STRVAL(raw) : "php://input", "rb", REPORT_ERRORS, NULL, context);
 	maxlen    = PHP_STREAM_COPY_ALL;
 
 	if (!stream) {
@@ -899,7 +927,7 @@ PHP_METHOD(Phalcon_Http_Request, getServerAddress){
 
 	zval *server, server_addr = {};
 
-	server = phalcon_get_global_str(SL("_SERVER"));
+	server = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (phalcon_array_isset_fetch_str(&server_addr, server, SL("SERVER_ADDR"), PH_READONLY)) {
 		RETURN_CTOR(&server_addr);
 	}
@@ -916,7 +944,7 @@ PHP_METHOD(Phalcon_Http_Request, getServerName){
 
 	zval *server, server_name = {};
 
-	server = phalcon_get_global_str(SL("_SERVER"));
+	server = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (phalcon_array_isset_fetch_str(&server_name, server, SL("SERVER_NAME"), PH_READONLY)) {
 		RETURN_CTOR(&server_name);
 	}
@@ -1044,7 +1072,7 @@ PHP_METHOD(Phalcon_Http_Request, getClientAddress){
 		trust_forwarded_header = &PHALCON_GLOBAL(z_false);
 	}
 
-	_SERVER = phalcon_get_global_str(SL("_SERVER"));
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 
 	/**
 	 * Proxies use this IP
@@ -1078,15 +1106,23 @@ PHP_METHOD(Phalcon_Http_Request, getClientAddress){
 	RETURN_NULL();
 }
 
-static const char* phalcon_http_request_getmethod_helper()
+static const char* phalcon_http_request_getmethod_helper(zval *object)
 {
 	zval *value, *_SERVER, key = {};
-	const char *method = SG(request_info).request_method;
+	const char *method = NULL;
+
+	/* Data injected by the server takes precedence over the SAPI request info */
+	_SERVER = phalcon_http_request_get_global(object, SL("_server"), NULL, 0);
+	if (!_SERVER) {
+		method = SG(request_info).request_method;
+	}
 
 	if (unlikely(!method)) {
 		ZVAL_STRING(&key, "REQUEST_METHOD");
 
-		_SERVER = phalcon_get_global_str(SL("_SERVER"));
+		if (!_SERVER) {
+			_SERVER = phalcon_get_global_str(SL("_SERVER"));
+		}
 		if (Z_TYPE_P(_SERVER) == IS_ARRAY) {
 			value = phalcon_hash_get(Z_ARRVAL_P(_SERVER), &key, BP_VAR_UNSET);
 			zval_ptr_dtor(&key);
@@ -1124,7 +1160,7 @@ PHP_METHOD(Phalcon_Http_Request, getMethod){
 		zval_ptr_dtor(&options);
 	}
 
-	const char *m = phalcon_http_request_getmethod_helper();
+	const char *m = phalcon_http_request_getmethod_helper(getThis());
 	if (m) {
 		RETURN_STRING(m);
 	}
@@ -1143,7 +1179,7 @@ PHP_METHOD(Phalcon_Http_Request, getURI){
 
 	ZVAL_STRING(&key, "REQUEST_URI");
 
-	_SERVER = phalcon_get_global_str(SL("_SERVER"));
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	value = (Z_TYPE_P(_SERVER) == IS_ARRAY) ? phalcon_hash_get(Z_ARRVAL_P(_SERVER), &key, BP_VAR_UNSET) : NULL;
 	if (value && Z_TYPE_P(value) == IS_STRING) {
 		RETURN_ZVAL(value, 1, 0);
@@ -1163,7 +1199,7 @@ PHP_METHOD(Phalcon_Http_Request, getQueryString){
 
 	ZVAL_STRING(&key, "QUERY_STRING");
 
-	_SERVER = phalcon_get_global_str(SS("_SERVER") TSRMLS_CC);
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	value = (Z_TYPE_P(_SERVER) == IS_ARRAY) ? phalcon_hash_get(Z_ARRVAL_P(_SERVER), &key, BP_VAR_UNSET) : NULL;
 	if (value && Z_TYPE_P(value) == IS_STRING) {
 		RETURN_ZVAL(value, 1, 0);
@@ -1181,7 +1217,7 @@ PHP_METHOD(Phalcon_Http_Request, getUserAgent){
 
 	zval *server, user_agent = {};
 
-	server = phalcon_get_global_str(SL("_SERVER"));
+	server = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (phalcon_array_isset_fetch_str(&user_agent, server, SL("HTTP_USER_AGENT"), PH_READONLY)) {
 		RETURN_CTOR(&user_agent);
 	}
@@ -1230,7 +1266,7 @@ PHP_METHOD(Phalcon_Http_Request, isPost){
 	zval post = {}, method = {};
 
 	if (Z_OBJCE_P(getThis()) == phalcon_http_request_ce) {
-		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(), "POST"));
+		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(getThis()), "POST"));
 	}
 
 	ZVAL_STR(&post, IS(POST));
@@ -1250,7 +1286,7 @@ PHP_METHOD(Phalcon_Http_Request, isGet){
 	zval get = {}, method = {};
 
 	if (Z_OBJCE_P(getThis()) == phalcon_http_request_ce) {
-		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(), "GET"));
+		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(getThis()), "GET"));
 	}
 
 	ZVAL_STR(&get, IS(GET));
@@ -1270,7 +1306,7 @@ PHP_METHOD(Phalcon_Http_Request, isPut){
 	zval put = {}, method = {};
 
 	if (Z_OBJCE_P(getThis()) == phalcon_http_request_ce) {
-		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(), "PUT"));
+		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(getThis()), "PUT"));
 	}
 
 	ZVAL_STR(&put, IS(PUT));
@@ -1290,7 +1326,7 @@ PHP_METHOD(Phalcon_Http_Request, isPatch){
 	zval patch = {}, method = {};
 
 	if (Z_OBJCE_P(getThis()) == phalcon_http_request_ce) {
-		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(), "PATCH"));
+		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(getThis()), "PATCH"));
 	}
 
 	ZVAL_STR(&patch, IS(PATCH));
@@ -1310,7 +1346,7 @@ PHP_METHOD(Phalcon_Http_Request, isHead){
 	zval head = {}, method = {};
 
 	if (Z_OBJCE_P(getThis()) == phalcon_http_request_ce) {
-		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(), "HEAD"));
+		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(getThis()), "HEAD"));
 	}
 
 	ZVAL_STR(&head, IS(HEAD));
@@ -1330,7 +1366,7 @@ PHP_METHOD(Phalcon_Http_Request, isDelete){
 	zval delete = {}, method = {};
 
 	if (Z_OBJCE_P(getThis()) == phalcon_http_request_ce) {
-		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(), "DELETE"));
+		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(getThis()), "DELETE"));
 	}
 
 	ZVAL_STR(&delete, IS(DELETE));
@@ -1350,7 +1386,7 @@ PHP_METHOD(Phalcon_Http_Request, isOptions){
 	zval options = {}, method = {};
 
 	if (Z_OBJCE_P(getThis()) == phalcon_http_request_ce) {
-		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(), "OPTIONS"));
+		RETURN_BOOL(!strcmp(phalcon_http_request_getmethod_helper(getThis()), "OPTIONS"));
 	}
 
 	PHALCON_CALL_METHOD(&method, getThis(), "getmethod");
@@ -1393,7 +1429,7 @@ PHP_METHOD(Phalcon_Http_Request, hasFiles){
 
 	only_successful = not_errored ? phalcon_get_intval(not_errored) : 1;
 
-	_FILES = phalcon_get_global_str(SL("_FILES"));
+	_FILES = phalcon_http_request_get_global(getThis(), SL("_files"), SL("_FILES"));
 	if (unlikely(Z_TYPE_P(_FILES) != IS_ARRAY)) {
 		RETURN_LONG(0);
 	}
@@ -1515,7 +1551,7 @@ PHP_METHOD(Phalcon_Http_Request, getUploadedFiles){
 
 	array_init(return_value);
 
-	_FILES = phalcon_get_global_str(SL("_FILES"));
+	_FILES = phalcon_http_request_get_global(getThis(), SL("_files"), SL("_FILES"));
 	if (Z_TYPE_P(_FILES) != IS_ARRAY || !zend_hash_num_elements(Z_ARRVAL_P(_FILES))) {
 		return;
 	}
@@ -1572,7 +1608,7 @@ PHP_METHOD(Phalcon_Http_Request, getHeaders){
 	zend_string *str_key;
 
 	array_init(return_value);
-	_SERVER = phalcon_get_global_str(SL("_SERVER"));
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (unlikely(Z_TYPE_P(_SERVER) != IS_ARRAY)) {
 		return;
 	}
@@ -1596,7 +1632,7 @@ PHP_METHOD(Phalcon_Http_Request, getHTTPReferer){
 
 	zval *_SERVER, http_referer = {};
 
-	_SERVER = phalcon_get_global_str(SL("_SERVER"));
+	_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 	if (phalcon_array_isset_fetch_str(&http_referer, _SERVER, SL("HTTP_REFERER"), PH_READONLY)) {
 		RETURN_CTOR(&http_referer);
 	}
@@ -1795,7 +1831,7 @@ PHP_METHOD(Phalcon_Http_Request, getBasicAuth)
 	char *auth_password = SG(request_info).auth_password;
 
 	if (unlikely(!auth_user)) {
-		_SERVER = phalcon_get_global_str(SL("_SERVER"));
+		_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 		if (Z_TYPE_P(_SERVER) == IS_ARRAY) {
 			ZVAL_STRING(&key, "PHP_AUTH_USER");
 
@@ -1839,7 +1875,7 @@ PHP_METHOD(Phalcon_Http_Request, getDigestAuth){
 	const char *auth_digest = SG(request_info).auth_digest;
 
 	if (unlikely(!auth_digest)) {
-		_SERVER = phalcon_get_global_str(SL("_SERVER"));
+		_SERVER = phalcon_http_request_get_global(getThis(), SL("_server"), SL("_SERVER"));
 		if (Z_TYPE_P(_SERVER) == IS_ARRAY) {
 			ZVAL_STRING(&key, "PHP_AUTH_DIGEST");
 
@@ -20,6 +20,7 @@
 #include "http/responseinterface.h"
 #include "http/response/exception.h"
 #include "http/response/headers.h"
+#include "http/requestinterface.h"
 #include "di.h"
 #include "diinterface.h"
 #include "di/injectable.h"
@@ -780,22 +781,47 @@ PHP_METHOD(Phalcon_Http_Response, send){
 
 		if (Z_TYPE(file) == IS_STRING && Z_STRLEN(file)) {
 			php_stream *stream;
-			zval *_SERVER, http_range = {}, filesize = {}, content_length = {};
+			zval *_SERVER, http_range = {}, filesize = {}, content_length = {}, dependency_injector = {}, service = {}, has_request = {}, request = {}, key = {};
+
+			/**
+			 * The Range header of the request service, the one Phalcon\Server\Http injects,
+			 * or of $_SERVER without it
+			 */
+			PHALCON_CALL_METHOD(&dependency_injector, getThis(), "getdi");
+			if (Z_TYPE(dependency_injector) == IS_OBJECT) {
+				ZVAL_STR(&service, IS(request));
+				PHALCON_CALL_METHOD(&has_request, &dependency_injector, "has", &service);
+				if (zend_is_true(&has_request)) {
+					PHALCON_CALL_METHOD(&request, &dependency_injector, "getshared", &service);
+				}
+			}
+			zval_ptr_dtor(&dependency_injector);
+
+			if (Z_TYPE(request) == IS_OBJECT && instanceof_function(Z_OBJCE(request), phalcon_http_requestinterface_ce)) {
+				ZVAL_STRING(&key, "HTTP_RANGE");
+				PHALCON_CALL_METHOD(&http_range, &request, "getserver", &key);
+				zval_ptr_dtor(&key);
+			} else {
+				_SERVER = phalcon_get_global_str(SL("_SERVER"));
+				phalcon_array_isset_fetch_str(&http_range, _SERVER, SL("HTTP_RANGE"), PH_COPY);
+			}
+			zval_ptr_dtor(&request);
 
 			stream = php_stream_open_wrapper(Z_STRVAL(file), "rb", REPORT_ERRORS, NULL);
 			if (stream == NULL) {
+				zval_ptr_dtor(&http_range);
 				goto gotoend;
 			}
 			PHALCON_CALL_METHOD(&headers, getThis(), "getheaders");
 			PHALCON_CALL_FUNCTION(&filesize, "filesize", &file);
-			_SERVER = phalcon_get_global_str(SL("_SERVER"));
-			if (phalcon_array_isset_fetch_str(&http_range, _SERVER, SL("HTTP_RANGE"), PH_READONLY)) {
+			if (Z_TYPE(http_range) == IS_STRING) {
 				zval pattern = {}, matched = {}, matches = {};
 				ZVAL_STRING(&pattern, "#bytes=(\\d+)-(\\d+)?#i");
 				ZVAL_MAKE_REF(&matches);
 				RETURN_ON_FAILURE(phalcon_preg_match(&matched, &pattern, &http_range, &matches));
 				ZVAL_UNREF(&matches);
 				zval_ptr_dtor(&pattern);
+				zval_ptr_dtor(&http_range);
 				if (zend_is_true(&matched)) {
 					zval match_one = {}, match_two = {}, status = {}, message = {}, content_range = {}, length = {};
 					zend_long max, start = 0, end = 0, len = 0;
@@ -864,6 +890,8 @@ PHP_METHOD(Phalcon_Http_Response, send){
 					zval_ptr_dtor(&headers);
 					goto gotoend;
 				}
+			} else {
+				zval_ptr_dtor(&http_range);
 			}
 
 			PHALCON_CONCAT_SV(&content_length, "Content-Length: ", &filesize);
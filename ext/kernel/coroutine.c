@@ -0,0 +1,153 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2015 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#include "kernel/coroutine.h"
+#include "kernel/lthread/lthread.h"
+
+static int phalcon_coroutine_running = 0;
+
+/* The state of the worker around lthread_run(), it is the live one whenever no coroutine runs */
+static phalcon_coroutine_vm phalcon_coroutine_base;
+
+static void phalcon_coroutine_vm_save(phalcon_coroutine_vm *vm)
+{
+	vm->vm_stack = EG(vm_stack);
+	vm->vm_stack_top = EG(vm_stack_top);
+	vm->vm_stack_end = EG(vm_stack_end);
+	vm->current_execute_data = EG(current_execute_data);
+	memcpy(&vm->sapi_headers, &SG(sapi_headers), sizeof(sapi_headers_struct));
+}
+
+static void phalcon_coroutine_vm_restore(phalcon_coroutine_vm *vm)
+{
+	EG(vm_stack) = vm->vm_stack;
+	EG(vm_stack_top) = vm->vm_stack_top;
+	EG(vm_stack_end) = vm->vm_stack_end;
+	EG(current_execute_data) = vm->current_execute_data;
+	memcpy(&SG(sapi_headers), &vm->sapi_headers, sizeof(sapi_headers_struct));
+}
+
+/**
+ * Called by the worker before lthread_run(), the frames of the worker are the parent of every coroutine
+ */
+void phalcon_coroutine_scheduler_begin()
+{
+	phalcon_coroutine_running = 1;
+	phalcon_coroutine_vm_save(&phalcon_coroutine_base);
+}
+
+void phalcon_coroutine_scheduler_end()
+{
+	phalcon_coroutine_vm_restore(&phalcon_coroutine_base);
+	phalcon_coroutine_running = 0;
+}
+
+int phalcon_coroutine_active()
+{
+	return phalcon_coroutine_running && lthread_current() != NULL;
+}
+
+/**
+ * Gives the running coroutine its own VM stack and response headers before it calls into PHP,
+ * a suspended coroutine keeps its frames while others run. The live state is the base one here,
+ * wait_fd() puts it back before every switch
+ */
+void phalcon_coroutine_enter(phalcon_coroutine *coroutine)
+{
+	llist_dtor_func_t dtor = phalcon_coroutine_base.sapi_headers.headers.dtor;
+
+	zend_vm_stack_init();
+	EG(current_execute_data) = phalcon_coroutine_base.current_execute_data;
+
+	memset(&SG(sapi_headers), 0, sizeof(sapi_headers_struct));
+	zend_llist_init(&SG(sapi_headers).headers, sizeof(sapi_header_struct), dtor, 0);
+
+	lthread_set_data(coroutine);
+}
+
+void phalcon_coroutine_leave(phalcon_coroutine *coroutine)
+{
+	lthread_set_data(NULL);
+
+	zend_llist_destroy(&SG(sapi_headers).headers);
+	if (SG(sapi_headers).http_status_line) {
+		efree(SG(sapi_headers).http_status_line);
+	}
+	if (SG(sapi_headers).mimetype) {
+		efree(SG(sapi_headers).mimetype);
+	}
+
+	zend_vm_stack_destroy();
+
+	phalcon_coroutine_vm_restore(&phalcon_coroutine_base);
+}
+
+/**
+ * Yields until the descriptor is ready, returns 0 outside a coroutine so the caller blocks as usual,
+ * 1 when it is ready, -1 on EOF and -2 when the timeout (milliseconds, 0 waits forever) expired
+ */
+int phalcon_coroutine_wait_fd(int fd, int write, int timeout)
+{
+	phalcon_coroutine *coroutine;
+	int ret;
+
+	if (!phalcon_coroutine_active() || fd < 0) {
+		return 0;
+	}
+
+	/* The next coroutine scheduled starts from the base state, not from the frames of this one */
+	coroutine = (phalcon_coroutine *)lthread_get_data();
+	if (coroutine) {
+		phalcon_coroutine_vm_save(&coroutine->vm);
+		phalcon_coroutine_vm_restore(&phalcon_coroutine_base);
+	}
+
+	ret = write ? lthread_wait_write(fd, timeout) : lthread_wait_read(fd, timeout);
+
+	if (coroutine) {
+		phalcon_coroutine_vm_restore(&coroutine->vm);
+		lthread_set_data(coroutine);
+		if (coroutine->resume) {
+			coroutine->resume(coroutine);
+		}
+	}
+
+	return ret < 0 ? ret : 1;
+}
+
+int phalcon_coroutine_wait_stream(php_stream *stream, int write, int timeout)
+{
+	php_socket_t fd;
+
+	if (!phalcon_coroutine_active()) {
+		return 0;
+	}
+
+	/* Buffered data is read without touching the socket */
+	if (!write && stream->writepos > stream->readpos) {
+		return 1;
+	}
+
+	if (php_stream_cast(stream, PHP_STREAM_AS_FD_FOR_SELECT | PHP_STREAM_CAST_INTERNAL, (void *)&fd, 1) != SUCCESS) {
+		return 0;
+	}
+
+	return phalcon_coroutine_wait_fd(fd, write, timeout);
+}
@@ -0,0 +1,66 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2015 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_KERNEL_COROUTINE_H
+#define PHALCON_KERNEL_COROUTINE_H
+
+#include "php_phalcon.h"
+
+#include <main/SAPI.h>
+#include <main/php_streams.h>
+
+/**
+ * The engine state a coroutine owns, it is swapped in and out around every yield
+ */
+typedef struct _phalcon_coroutine_vm {
+	zend_vm_stack vm_stack;
+	zval *vm_stack_top;
+	zval *vm_stack_end;
+	zend_execute_data *current_execute_data;
+	sapi_headers_struct sapi_headers;
+} phalcon_coroutine_vm;
+
+typedef struct _phalcon_coroutine {
+	phalcon_coroutine_vm vm;
+	void (*resume)(struct _phalcon_coroutine *coroutine);
+	void *data;
+} phalcon_coroutine;
+
+#ifdef PHALCON_USE_SERVER
+
+void phalcon_coroutine_scheduler_begin();
+void phalcon_coroutine_scheduler_end();
+int phalcon_coroutine_active();
+
+void phalcon_coroutine_enter(phalcon_coroutine *coroutine);
+void phalcon_coroutine_leave(phalcon_coroutine *coroutine);
+
+int phalcon_coroutine_wait_fd(int fd, int write, int timeout);
+int phalcon_coroutine_wait_stream(php_stream *stream, int write, int timeout);
+
+#else
+
+#define phalcon_coroutine_active() 0
+#define phalcon_coroutine_wait_fd(fd, write, timeout) 0
+#define phalcon_coroutine_wait_stream(stream, write, timeout) 0
+
+#endif
+
+#endif /* PHALCON_KERNEL_COROUTINE_H */
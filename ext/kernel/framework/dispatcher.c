@@ -0,0 +1,188 @@
+
+/*
+ +------------------------------------------------------------------------+
+ | Phalcon Framework                                                      |
+ +------------------------------------------------------------------------+
+ | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+ +------------------------------------------------------------------------+
+ | This source file is subject to the New BSD License that is bundled     |
+ | with this package in the file docs/LICENSE.txt.                        |
+ |                                                                        |
+ | If you did not receive a copy of the license and are unable to         |
+ | obtain it through the world-wide-web, please send an email             |
+ | to license@phalconphp.com so we can send you a copy immediately.       |
+ +------------------------------------------------------------------------+
+ | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+ |          Eduar Carvajal <eduar@phalconphp.com>                         |
+ +------------------------------------------------------------------------+
+*/
+
+#include "php_phalcon.h"
+
+#include "kernel/framework/dispatcher.h"
+
+/**
+ * The dispatcher resolves the same handlers and actions over and over, the class name
+ * built from the camelized names, its class entry and the method of every action
+ * found in it are kept here, under the handler and the action names whose hashes are already
+ * computed, so nothing is allocated to find them again. Only the classes found loaded
+ * are kept, they can not go away before the end of the request, on the long running
+ * servers that is the life of the process
+ */
+static int phalcon_dispatcher_string_equals(zend_string *s1, zend_string *s2)
+{
+	if (!s1 || !s2) {
+		return s1 == s2;
+	}
+
+	return zend_string_equals(s1, s2);
+}
+
+static void phalcon_dispatcher_action_dtor(zval *zv)
+{
+	phalcon_dispatcher_action *action = Z_PTR_P(zv), *next;
+
+	while (action) {
+		next = action->next;
+		zend_string_release(action->suffix);
+		zend_string_release(action->method);
+		efree(action);
+		action = next;
+	}
+}
+
+static void phalcon_dispatcher_handler_dtor(zval *zv)
+{
+	phalcon_dispatcher_handler *handler = Z_PTR_P(zv), *next;
+
+	while (handler) {
+		next = handler->next;
+		if (handler->namespace_name) {
+			zend_string_release(handler->namespace_name);
+		}
+		if (handler->suffix) {
+			zend_string_release(handler->suffix);
+		}
+		zend_string_release(handler->handler_class);
+		zend_hash_destroy(&handler->actions);
+		efree(handler);
+		handler = next;
+	}
+}
+
+/**
+ * Destroyes the resolved handlers
+ */
+void phalcon_dispatcher_destroy_cache() {
+
+	zend_phalcon_globals *phalcon_globals_ptr = PHALCON_VGLOBAL;
+
+	if (phalcon_globals_ptr->dispatcher.handler_cache != NULL) {
+		zend_hash_destroy(phalcon_globals_ptr->dispatcher.handler_cache);
+		FREE_HASHTABLE(phalcon_globals_ptr->dispatcher.handler_cache);
+		phalcon_globals_ptr->dispatcher.handler_cache = NULL;
+	}
+}
+
+phalcon_dispatcher_handler *phalcon_dispatcher_find_handler(zend_string *handler_name, zend_string *namespace_name, zend_string *suffix, int flags) {
+
+	zend_phalcon_globals *phalcon_globals_ptr = PHALCON_VGLOBAL;
+	phalcon_dispatcher_handler *handler;
+
+	if (phalcon_globals_ptr->dispatcher.handler_cache == NULL) {
+		return NULL;
+	}
+
+	handler = zend_hash_find_ptr(phalcon_globals_ptr->dispatcher.handler_cache, handler_name);
+	for (; handler; handler = handler->next) {
+		if (handler->flags == flags && phalcon_dispatcher_string_equals(handler->namespace_name, namespace_name) && phalcon_dispatcher_string_equals(handler->suffix, suffix)) {
+			return handler;
+		}
+	}
+
+	return NULL;
+}
+
+phalcon_dispatcher_handler *phalcon_dispatcher_add_handler(zend_string *handler_name, zend_string *namespace_name, zend_string *suffix, int flags, zend_string *handler_class, zend_class_entry *ce) {
+
+	zend_phalcon_globals *phalcon_globals_ptr = PHALCON_VGLOBAL;
+	phalcon_dispatcher_handler *handler;
+	zval *first;
+
+	if (phalcon_globals_ptr->dispatcher.handler_cache == NULL) {
+		ALLOC_HASHTABLE(phalcon_globals_ptr->dispatcher.handler_cache);
+		zend_hash_init(phalcon_globals_ptr->dispatcher.handler_cache, 8, NULL, phalcon_dispatcher_handler_dtor, 0);
+	}
+
+	handler = emalloc(sizeof(phalcon_dispatcher_handler));
+	handler->namespace_name = namespace_name ? zend_string_copy(namespace_name) : NULL;
+	handler->suffix = suffix ? zend_string_copy(suffix) : NULL;
+	handler->flags = flags;
+	handler->handler_class = zend_string_copy(handler_class);
+	handler->ce = ce;
+	zend_hash_init(&handler->actions, 8, NULL, phalcon_dispatcher_action_dtor, 0);
+
+	if ((first = zend_hash_find(phalcon_globals_ptr->dispatcher.handler_cache, handler_name)) != NULL) {
+		handler->next = Z_PTR_P(first);
+		Z_PTR_P(first) = handler;
+	} else {
+		handler->next = NULL;
+		zend_hash_add_new_ptr(phalcon_globals_ptr->dispatcher.handler_cache, handler_name, handler);
+	}
+
+	return handler;
+}
+
+phalcon_dispatcher_action *phalcon_dispatcher_find_action(phalcon_dispatcher_handler *handler, zend_string *action_name, zend_string *suffix) {
+
+	phalcon_dispatcher_action *action = zend_hash_find_ptr(&handler->actions, action_name);
+
+	for (; action; action = action->next) {
+		if (zend_string_equals(action->suffix, suffix)) {
+			return action;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Looks the method up in the class of the handler and its parents, as
+ * phalcon_method_exists() does, only a method found is kept
+ */
+phalcon_dispatcher_action *phalcon_dispatcher_add_action(phalcon_dispatcher_handler *handler, zend_string *action_name, zend_string *suffix, zend_string *method) {
+
+	phalcon_dispatcher_action *action;
+	zend_class_entry *ce;
+	zend_string *lcname;
+	int found = 0;
+	zval *first;
+
+	if (!handler->ce) {
+		return NULL;
+	}
+
+	lcname = zend_string_tolower(method);
+	for (ce = handler->ce; ce && !found; ce = ce->parent) {
+		found = zend_hash_exists(&ce->function_table, lcname);
+	}
+	zend_string_release(lcname);
+
+	if (!found) {
+		return NULL;
+	}
+
+	action = emalloc(sizeof(phalcon_dispatcher_action));
+	action->suffix = zend_string_copy(suffix);
+	action->method = zend_string_copy(method);
+
+	if ((first = zend_hash_find(&handler->actions, action_name)) != NULL) {
+		action->next = Z_PTR_P(first);
+		Z_PTR_P(first) = action;
+	} else {
+		action->next = NULL;
+		zend_hash_add_new_ptr(&handler->actions, action_name, action);
+	}
+
+	return action;
+}
@@ -0,0 +1,52 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_KERNEL_FRAMEWORK_DISPATCHER_H
+#define PHALCON_KERNEL_FRAMEWORK_DISPATCHER_H
+
+#include <Zend/zend.h>
+
+/* The method an action resolves to, kept once it is found in the class of its handler */
+typedef struct _phalcon_dispatcher_action {
+	zend_string *suffix;
+	zend_string *method;
+	struct _phalcon_dispatcher_action *next;
+} phalcon_dispatcher_action;
+
+/* The class a handler name resolves to, for a namespace, a suffix and the camelize flags */
+typedef struct _phalcon_dispatcher_handler {
+	zend_string *namespace_name;
+	zend_string *suffix;
+	int flags;
+	zend_string *handler_class;
+	zend_class_entry *ce;
+	HashTable actions;
+	struct _phalcon_dispatcher_handler *next;
+} phalcon_dispatcher_handler;
+
+#define PHALCON_DISPATCHER_CAMELIZE_HANDLER		1
+#define PHALCON_DISPATCHER_CAMELIZE_NAMESPACE	2
+
+void phalcon_dispatcher_destroy_cache();
+phalcon_dispatcher_handler *phalcon_dispatcher_find_handler(zend_string *handler_name, zend_string *namespace_name, zend_string *suffix, int flags);
+phalcon_dispatcher_handler *phalcon_dispatcher_add_handler(zend_string *handler_name, zend_string *namespace_name, zend_string *suffix, int flags, zend_string *handler_class, zend_class_entry *ce);
+phalcon_dispatcher_action *phalcon_dispatcher_find_action(phalcon_dispatcher_handler *handler, zend_string *action_name, zend_string *suffix);
+phalcon_dispatcher_action *phalcon_dispatcher_add_action(phalcon_dispatcher_handler *handler, zend_string *action_name, zend_string *suffix, zend_string *method);
+
+#endif /* PHALCON_KERNEL_FRAMEWORK_DISPATCHER_H */
@@ -23,107 +23,115 @@
 #include <Zend/zend_smart_str.h>
 #include <ext/standard/php_string.h>
 
-zval *phalcon_replace_marker(int named, zval *paths, zval *replacements, unsigned long *position, char *cursor, char *marker)
+/**
+ * Name of the replacement a marker of the pattern is filled with, the position moves
+ * for every valid marker as the paths count them. Returns 0 when the marker is left out
+ */
+static int phalcon_replace_marker(int named, zval *paths, zend_ulong *position, char *cursor, char *marker, const char **key, size_t *key_length)
 {
-	unsigned int length = 0, variable_length, ch, j;
-	char *item = NULL, *cursor_var, *variable = NULL;
-	int not_valid = 0;
-	zval *zv, *tmp;
+	unsigned int length = 0, variable_length = 0, ch, j;
+	char *cursor_var;
+	zval *zv;
 
 	if (named) {
 		length = cursor - marker - 1;
-		item = estrndup(marker + 1, length);
-		cursor_var = item;
-		marker = item;
+		marker++;
+		cursor_var = marker;
 		for (j = 0; j < length; j++) {
 			ch = *cursor_var;
 			if (ch == '\0') {
-				not_valid = 1;
-				break;
+				return 0;
 			}
 			if (j == 0 && !((ch >= 'a' && ch <='z') || (ch >= 'A' && ch <= 'Z'))){
-				not_valid = 1;
-				break;
+				return 0;
 			}
 			if ((ch >= 'a' && ch <='z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '-' || ch == '_' || ch ==  ':') {
 				if (ch == ':') {
 					variable_length = cursor_var - marker;
-					variable = estrndup(marker, variable_length);
 					break;
 				}
 			} else {
-				not_valid = 1;
-				break;
+				return 0;
 			}
 			cursor_var++;
 		}
 	}
 
-	if (!not_valid) {
-
-		if (zend_hash_index_exists(Z_ARRVAL_P(paths), *position)) {
-			if (named) {
-				if (variable) {
-					efree(item);
-					item = variable;
-					length = variable_length;
-				}
+	if (!zend_hash_index_exists(Z_ARRVAL_P(paths), (*position)++)) {
+		return 0;
+	}
 
-				if (zend_hash_str_exists(Z_ARRVAL_P(replacements), item, length)) {
-					if ((zv = zend_hash_str_find(Z_ARRVAL_P(replacements), item, length)) != NULL) {
-						efree(item);
-						(*position)++;
-						return zv;
-					}
-				}
-			} else {
-				if ((zv = zend_hash_index_find(Z_ARRVAL_P(paths), *position)) != NULL) {
-					if (Z_TYPE_P(zv) == IS_STRING) {
-						if (zend_hash_str_exists(Z_ARRVAL_P(replacements), Z_STRVAL_P(zv), Z_STRLEN_P(zv))) {
-							if ((tmp = zend_hash_str_find(Z_ARRVAL_P(replacements), Z_STRVAL_P(zv), Z_STRLEN_P(zv))) != NULL) {
-								(*position)++;
-								return tmp;
-							}
-						}
-					}
-				}
-			}
-		}
+	if (named) {
+		*key = marker;
+		*key_length = variable_length ? variable_length : length;
+		return 1;
+	}
 
-		(*position)++;
+	if ((zv = zend_hash_index_find(Z_ARRVAL_P(paths), *position - 1)) != NULL && Z_TYPE_P(zv) == IS_STRING) {
+		*key = Z_STRVAL_P(zv);
+		*key_length = Z_STRLEN_P(zv);
+		return 1;
 	}
 
-	if (item) {
-		efree(item);
+	return 0;
+}
+
+static void phalcon_replace_append(smart_str *route_str, zval *replacements, const char *key, size_t key_length)
+{
+	zval *replace, replace_copy = {};
+
+	if ((replace = zend_hash_str_find(Z_ARRVAL_P(replacements), key, key_length)) == NULL) {
+		return;
 	}
 
-return NULL;
+	if (Z_TYPE_P(replace) == IS_STRING) {
+		smart_str_appendl(route_str, Z_STRVAL_P(replace), Z_STRLEN_P(replace));
+	} else {
+		if (zend_make_printable_zval(replace, &replace_copy)) {
+			replace = &replace_copy;
+		}
+		smart_str_appendl(route_str, Z_STRVAL_P(replace), Z_STRLEN_P(replace));
+		if (replace == &replace_copy) {
+			zval_dtor(&replace_copy);
+		}
+	}
 }
 
 /**
- * Replaces placeholders and named variables with their corresponding values in an array
+ * A marker found in the pattern, filled from the replacements or, when a template is
+ * recorded, added to the segments after the literal text preceding it
  */
-void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval *replacements){
-
-	zval *replace, replace_copy = {};
-	char *cursor, *marker = NULL;
-	unsigned int bracket_count = 0, parentheses_count = 0, intermediate = 0;
-	unsigned char ch;
-	smart_str route_str = {0};
-	ulong position = 1;
-	int i;
-	int use_copy, looking_placeholder = 0;
+static void phalcon_replace_found(smart_str *route_str, zval *segments, zval *replacements, int named, zval *paths, zend_ulong *position, char *cursor, char *marker)
+{
+	const char *key;
+	size_t key_length;
 
-	if (Z_TYPE_P(pattern) != IS_STRING || Z_TYPE_P(replacements) != IS_ARRAY || Z_TYPE_P(paths) != IS_ARRAY) {
-		ZVAL_NULL(return_value);
-		php_error_docref(NULL, E_WARNING, "Invalid arguments supplied for phalcon_replace_paths()");
+	if (!phalcon_replace_marker(named, paths, position, cursor, marker, &key, &key_length)) {
 		return;
 	}
 
-	if (Z_STRLEN_P(pattern) <= 0) {
-		ZVAL_FALSE(return_value);
-		return;
+	if (segments) {
+		smart_str_0(route_str);
+		add_next_index_str(segments, route_str->s ? route_str->s : ZSTR_EMPTY_ALLOC());
+		route_str->s = NULL;
+		route_str->a = 0;
+		add_next_index_stringl(segments, key, key_length);
+	} else {
+		phalcon_replace_append(route_str, replacements, key, key_length);
 	}
+}
+
+/**
+ * Walks the pattern the way the router reads its markers, the pattern must not be empty
+ * and the paths not either
+ */
+static void phalcon_replace_scan(smart_str *route_str, zval *segments, zval *pattern, zval *paths, zval *replacements)
+{
+	char *cursor, *marker = NULL;
+	unsigned int bracket_count = 0, parentheses_count = 0, intermediate = 0;
+	unsigned char ch;
+	zend_ulong position = 1;
+	int i, looking_placeholder = 0;
 
 	cursor = Z_STRVAL_P(pattern);
 	if (*cursor == '/') {
@@ -134,11 +142,6 @@ void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval
 		i = 0;
 	}
 
-	if (!zend_hash_num_elements(Z_ARRVAL_P(paths))) {
-		ZVAL_STRINGL(return_value, Z_STRVAL_P(pattern)+i, Z_STRLEN_P(pattern)-i);
-		return;
-	}
-
 	for (; i < Z_STRLEN_P(pattern); ++i) {
 
 		ch = *cursor;
@@ -158,20 +161,7 @@ void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval
 					bracket_count--;
 					if (intermediate > 0) {
 						if (bracket_count == 0) {
-							replace = phalcon_replace_marker(1, paths, replacements, &position, cursor, marker);
-							if (replace) {
-								use_copy = 0;
-								if (Z_TYPE_P(replace) != IS_STRING) {
-									use_copy = zend_make_printable_zval(replace, &replace_copy);
-									if (use_copy) {
-										replace = &replace_copy;
-									}
-								}
-								smart_str_appendl(&route_str, Z_STRVAL_P(replace), Z_STRLEN_P(replace));
-								if (use_copy) {
-									zval_dtor(&replace_copy);
-								}
-							}
+							phalcon_replace_found(route_str, segments, replacements, 1, paths, &position, cursor, marker);
 							cursor++;
 							continue;
 						}
@@ -192,20 +182,7 @@ void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval
 					parentheses_count--;
 					if (intermediate > 0) {
 						if (parentheses_count == 0) {
-							replace = phalcon_replace_marker(0, paths, replacements, &position, cursor, marker);
-							if (replace) {
-								use_copy = 0;
-								if (Z_TYPE_P(replace) != IS_STRING) {
-									use_copy = zend_make_printable_zval(replace, &replace_copy);
-									if (use_copy) {
-										replace = &replace_copy;
-									}
-								}
-								smart_str_appendl(&route_str, Z_STRVAL_P(replace), Z_STRLEN_P(replace));
-								if (use_copy) {
-									zval_dtor(&replace_copy);
-								}
-							}
+							phalcon_replace_found(route_str, segments, replacements, 0, paths, &position, cursor, marker);
 							cursor++;
 							continue;
 						}
@@ -218,20 +195,7 @@ void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval
 			if (looking_placeholder) {
 				if (intermediate > 0) {
 					if (ch < 'a' || ch > 'z' || i == (Z_STRLEN_P(pattern) - 1)) {
-						replace = phalcon_replace_marker(0, paths, replacements, &position, cursor, marker);
-						if (replace) {
-							use_copy = 0;
-							if (Z_TYPE_P(replace) != IS_STRING) {
-								use_copy = zend_make_printable_zval(replace, &replace_copy);
-								if (use_copy) {
-									replace = &replace_copy;
-								}
-							}
-							smart_str_appendl(&route_str, Z_STRVAL_P(replace), Z_STRLEN_P(replace));
-							if (use_copy) {
-								zval_dtor(&replace_copy);
-							}
-						}
+						phalcon_replace_found(route_str, segments, replacements, 0, paths, &position, cursor, marker);
 						looking_placeholder = 0;
 						continue;
 					}
@@ -248,11 +212,38 @@ void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval
 		if (bracket_count > 0 || parentheses_count > 0 || looking_placeholder) {
 			intermediate++;
 		} else {
-			smart_str_appendc(&route_str, ch);
+			smart_str_appendc(route_str, ch);
 		}
 
 		cursor++;
 	}
+}
+
+/**
+ * Replaces placeholders and named variables with their corresponding values in an array
+ */
+void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval *replacements){
+
+	smart_str route_str = {0};
+
+	if (Z_TYPE_P(pattern) != IS_STRING || Z_TYPE_P(replacements) != IS_ARRAY || Z_TYPE_P(paths) != IS_ARRAY) {
+		ZVAL_NULL(return_value);
+		php_error_docref(NULL, E_WARNING, "Invalid arguments supplied for phalcon_replace_paths()");
+		return;
+	}
+
+	if (Z_STRLEN_P(pattern) <= 0) {
+		ZVAL_FALSE(return_value);
+		return;
+	}
+
+	if (!zend_hash_num_elements(Z_ARRVAL_P(paths))) {
+		int i = *Z_STRVAL_P(pattern) == '/' ? 1 : 0;
+		ZVAL_STRINGL(return_value, Z_STRVAL_P(pattern)+i, Z_STRLEN_P(pattern)-i);
+		return;
+	}
+
+	phalcon_replace_scan(&route_str, NULL, pattern, paths, replacements);
 	smart_str_0(&route_str);
 
 	if (route_str.s) {
@@ -264,6 +255,54 @@ void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval
 
 }
 
+/**
+ * Compiles what phalcon_replace_paths() does with a pattern and its paths into a
+ * template, an array alternating the literal text and the name of the replacement
+ * every marker takes, it starts and ends with literal text
+ */
+void phalcon_compile_paths(zval *return_value, zval *pattern, zval *paths){
+
+	smart_str route_str = {0};
+
+	array_init(return_value);
+
+	if (Z_TYPE_P(pattern) != IS_STRING || Z_TYPE_P(paths) != IS_ARRAY || Z_STRLEN_P(pattern) <= 0) {
+		add_next_index_str(return_value, ZSTR_EMPTY_ALLOC());
+		return;
+	}
+
+	if (!zend_hash_num_elements(Z_ARRVAL_P(paths))) {
+		int i = *Z_STRVAL_P(pattern) == '/' ? 1 : 0;
+		add_next_index_stringl(return_value, Z_STRVAL_P(pattern)+i, Z_STRLEN_P(pattern)-i);
+		return;
+	}
+
+	phalcon_replace_scan(&route_str, return_value, pattern, paths, NULL);
+	smart_str_0(&route_str);
+
+	add_next_index_str(return_value, route_str.s ? route_str.s : ZSTR_EMPTY_ALLOC());
+}
+
+/**
+ * Appends the URL a template of phalcon_compile_paths() gives for the replacements
+ */
+void phalcon_fill_paths(smart_str *buffer, zval *template, zval *replacements){
+
+	zval *segment;
+	zend_ulong idx;
+
+	ZEND_HASH_FOREACH_NUM_KEY_VAL(Z_ARRVAL_P(template), idx, segment) {
+		if (Z_TYPE_P(segment) != IS_STRING) {
+			continue;
+		}
+		if (idx & 1) {
+			phalcon_replace_append(buffer, replacements, Z_STRVAL_P(segment), Z_STRLEN_P(segment));
+		} else {
+			smart_str_appendl(buffer, Z_STRVAL_P(segment), Z_STRLEN_P(segment));
+		}
+	} ZEND_HASH_FOREACH_END();
+}
+
 /**
  * Extracts parameters from a string
  * An initialized zval array must be passed as second parameter
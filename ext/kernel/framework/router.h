@@ -21,9 +21,14 @@
 #define PHALCON_KERNEL_FRAMEWORK_ROUTER_H
 
 #include <Zend/zend.h>
+#include <Zend/zend_smart_str.h>
 
 /* Extract named parameters */
 void phalcon_extract_named_params(zval *return_value, zval *str, zval *matches);
 void phalcon_replace_paths(zval *return_value, zval *pattern, zval *paths, zval *uri);
 
+/* Reverse routing with the pattern scanned once */
+void phalcon_compile_paths(zval *return_value, zval *pattern, zval *paths);
+void phalcon_fill_paths(smart_str *buffer, zval *template, zval *replacements);
+
 #endif /* PHALCON_KERNEL_FRAMEWORK_ROUTER_H */
@@ -81,6 +81,10 @@ phalcon_io_client_info *phalcon_io_create_client (void *tpi, phalcon_io_socket_t
 	ci->use_eb = PHALCON_IO_FALSE;
 
 	ci->operation = PHALCON_IO_OP_NONE;
+	ci->task_thread = -1;
+	ci->task_ops = 0;
+	ci->task_scheduled = PHALCON_IO_FALSE;
+	ci->task_next = NULL;
 	ci->overlapped = NULL;
 	ci->callback_has_written = PHALCON_IO_FALSE;
 	ci->can_write = PHALCON_IO_TRUE;
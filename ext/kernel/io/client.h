@@ -96,6 +96,10 @@ struct _phalcon_io_client_info {
 	int read_end;				// PHALCON_IO_TRUE if no more data
 	int error;				// PHALCON_IO_TRUE if I/O error
 	int operation;			// IOCP and tasks operation
+	int task_thread;			// tasks. thread the client is scheduled on
+	int task_ops;				// tasks. bit set of the pending operations
+	int task_scheduled;		// tasks. PHALCON_IO_TRUE while queued or running
+	phalcon_io_client_info* task_next;	// tasks. inbox link
 	void *overlapped;			// IOCP overlapped buffer
 	int callback_has_written;	// I/O management. indication that data was written during callback
 	int can_write;			// I/O management. if PHALCON_IO_FALSE, indicates a write started and waiting for readiness signal
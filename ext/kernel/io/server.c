@@ -88,8 +88,8 @@ void phalcon_io_set_defaults(void* tpi, int use_write_events, int read_buffer_si
 
 int phalcon_io_enqueue_message(phalcon_io_client_info* ci, int operation)
 {
-	ci->operation = operation;
-	return phalcon_io_enqueue_task(ci);
+	// ci->operation belongs to the task thread running the client, it is set there
+	return phalcon_io_enqueue_task(ci, operation);
 }
 
 int phalcon_io_write_message(phalcon_io_client_info* ci, char* message)
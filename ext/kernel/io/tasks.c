@@ -32,45 +32,131 @@
 
 static phalcon_io_tasks_data * td;
 
+/* Chase-Lev work stealing deque, see "Correct and Efficient Work-Stealing for Weak Memory Models" */
+
+static int phalcon_io_deque_push (phalcon_io_deque *dq, phalcon_io_client_info *ci)
+{
+	int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED);
+	int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+
+	if (b - t >= PHALCON_IO_DEQUE_SIZE)
+		return PHALCON_IO_FALSE;
+
+	__atomic_store_n(&dq->items[b & (PHALCON_IO_DEQUE_SIZE - 1)], ci, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+	return PHALCON_IO_TRUE;
+}
+
+static phalcon_io_client_info *phalcon_io_deque_take (phalcon_io_deque *dq)
+{
+	phalcon_io_client_info *ci = NULL;
+	int64_t b = __atomic_load_n(&dq->bottom, __ATOMIC_RELAXED) - 1;
+	int64_t t;
+
+	__atomic_store_n(&dq->bottom, b, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	t = __atomic_load_n(&dq->top, __ATOMIC_RELAXED);
+
+	if (t <= b) {
+		ci = __atomic_load_n(&dq->items[b & (PHALCON_IO_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+		if (t == b) {
+			// last item, race against the thieves
+			if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+				ci = NULL;
+			__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+		}
+	} else {
+		__atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELAXED);
+	}
+	return ci;
+}
+
+static phalcon_io_client_info *phalcon_io_deque_steal (phalcon_io_deque *dq)
+{
+	phalcon_io_client_info *ci;
+	int64_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+	int64_t b;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+	if (t >= b)
+		return NULL;
+
+	ci = __atomic_load_n(&dq->items[t & (PHALCON_IO_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return NULL;		// lost the race, the caller tries another victim
+	return ci;
+}
+
+static int phalcon_io_default_task_threads ()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n < 1)
+		n = 1;
+	return n > PHALCON_IO_MAX_TASK_THREADS? PHALCON_IO_MAX_TASK_THREADS: (int)n;
+}
+
 void phalcon_io_init_tasks()
 {
+	int it;
 	if (td != NULL)
 		return;
 	td = (phalcon_io_tasks_data *) calloc (1, sizeof(phalcon_io_tasks_data));
 	td->threads = (phalcon_io_thread_t *) calloc(PHALCON_IO_BLOCK_SIZE, sizeof(phalcon_io_thread_t));
-	td->max_threads = 0;
+	td->max_threads = PHALCON_IO_BLOCK_SIZE;
 	td->first_free_thread = 0;
-	td->tasks = (phalcon_io_task_info *) calloc(PHALCON_IO_BLOCK_SIZE, sizeof(phalcon_io_task_info));
-	td->max_tasks = 0;
-	td->first_free_task = 0;
-	td->first_task = 0;
+	td->max_workers = phalcon_io_default_task_threads();
+	td->workers = (phalcon_io_task_worker *) calloc(td->max_workers, sizeof(phalcon_io_task_worker));
+	for (it = 0; it < td->max_workers; it++) {
+		td->workers[it].index = it;
+		pthread_mutex_init(&td->workers[it].lock, NULL);
+		pthread_cond_init(&td->workers[it].cond, NULL);
+	}
+	td->num_workers = 0;
+	td->sleeping_workers = 0;
+	td->stop_requests = 0;
 	pthread_mutex_init(&td->lock,NULL);
-	pthread_cond_init(&td->cond,NULL);
 	td->must_Exit = 0;
 }
 
 void phalcon_io_clean_tasks()
 {
 	int it;
+	if (td == NULL)
+		return;
 	td->must_Exit = 1;
-	pthread_cond_broadcast(&td->cond);
+	for (it = 0; it < td->num_workers; it++) {
+		pthread_mutex_lock(&td->workers[it].lock);
+		pthread_cond_signal(&td->workers[it].cond);
+		pthread_mutex_unlock(&td->workers[it].lock);
+	}
     for (it=0; it < td->first_free_thread; it++) {
     	if (td->threads[it]!=(phalcon_io_thread_t)0)
     		pthread_join(td->threads[it], NULL);
     	td->threads[it] = (phalcon_io_thread_t)0;
     }
-    if (td)
-    	free(td);
+	for (it = 0; it < td->max_workers; it++) {
+		pthread_mutex_destroy(&td->workers[it].lock);
+		pthread_cond_destroy(&td->workers[it].cond);
+	}
+	free(td->workers);
+	free(td->threads);
+	free(td);
     td = NULL;
 }
 
 void phalcon_io_push_thread (phalcon_io_thread_t thread)
 {
 	if (td->first_free_thread >= td->max_threads) {
-		td->max_threads += PHALCON_IO_BLOCK_SIZE;
-		if (realloc ((void *)td->threads, td->max_threads) == NULL)
+		phalcon_io_thread_t *threads = realloc ((void *)td->threads, (td->max_threads + PHALCON_IO_BLOCK_SIZE) * sizeof(phalcon_io_thread_t));
+		if (threads == NULL) {
 			phalcon_io_error_message("No memory (realloc)\n");
-
+			return;
+		}
+		td->threads = threads;
+		td->max_threads += PHALCON_IO_BLOCK_SIZE;
 	}
 	td->threads[td->first_free_thread++] = thread;
 }
@@ -79,6 +165,7 @@ void phalcon_io_push_thread (phalcon_io_thread_t thread)
 void phalcon_io_delete_thread (phalcon_io_thread_t thread)
 {
 	int it;
+	pthread_mutex_lock(&td->lock);
     for (it=0; it < td->first_free_thread; it++) {
     	if (td->threads[it]==thread) {
     		int nthreads = td->first_free_thread - it - 1;
@@ -88,6 +175,7 @@ void phalcon_io_delete_thread (phalcon_io_thread_t thread)
     		break;
     	}
      }
+	pthread_mutex_unlock(&td->lock);
 }
 
 int phalcon_io_get_running_task_threads()
@@ -97,102 +185,253 @@ int phalcon_io_get_running_task_threads()
 
 int phalcon_io_start_one_task_thread()
 {
+	phalcon_io_task_worker *worker;
+	phalcon_io_thread_t pid;
+	int ret;
+
 	if (td==NULL)
 		phalcon_io_init_tasks ();
-	phalcon_io_thread_t pid;
-	int ret = pthread_create(&pid, 0, phalcon_io_tasks_thread, td);
-	phalcon_io_push_thread(pid);
+
+	pthread_mutex_lock(&td->lock);
+	if (td->num_workers >= td->max_workers || td->workers[td->num_workers].stopping) {
+		pthread_mutex_unlock(&td->lock);
+		return PHALCON_IO_ERROR;
+	}
+	worker = &td->workers[td->num_workers];
+	ret = pthread_create(&pid, 0, phalcon_io_tasks_thread, worker);
+	if (ret == 0) {
+		worker->thread = pid;
+		phalcon_io_push_thread(pid);
+		// publish the worker once it exists, producers only pick published workers
+		__atomic_store_n(&td->num_workers, td->num_workers + 1, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&td->lock);
 	return ret;
 }
 
 void phalcon_io_stop_one_task_thread()
 {
+	int it;
 	fprintf (stderr, "phalcon_io_stop_one_task_thread\n");
-	// push an empty task to signal the end
-	if (phalcon_io_get_running_task_threads() > 0)
-		phalcon_io_enqueue_task (NULL);
+	if (phalcon_io_get_running_task_threads() > 0) {
+		__atomic_add_fetch(&td->stop_requests, 1, __ATOMIC_SEQ_CST);
+		for (it = 0; it < td->num_workers; it++) {
+			pthread_mutex_lock(&td->workers[it].lock);
+			pthread_cond_signal(&td->workers[it].cond);
+			pthread_mutex_unlock(&td->workers[it].lock);
+		}
+	}
 }
 
-// return PHALCON_IO_ERROR if error or number of tasks pushed
-int phalcon_io_push_task (phalcon_io_client_info *ci)
+// the clients are scheduled, not the messages: a client is in at most one queue at a time and
+// runs on one thread at a time, so the messages of a connection are never processed out of order
+static void phalcon_io_schedule_client (phalcon_io_client_info *ci)
 {
-	if (td->first_free_task >= td->max_tasks) {
-		td->max_tasks += PHALCON_IO_BLOCK_SIZE;
-		if (realloc ((void *)td->tasks, td->max_tasks) == NULL) {
-			phalcon_io_error_message("No memory (realloc)\n");
-			return PHALCON_IO_ERROR;
+	phalcon_io_task_worker *worker;
+	int nworkers, home;
+
+	while (1) {
+		nworkers = __atomic_load_n(&td->num_workers, __ATOMIC_ACQUIRE);
+		home = __atomic_load_n(&ci->task_thread, __ATOMIC_RELAXED);
+
+		// affinity, a connection stays on the thread that last ran it
+		if (home < 0 || home >= nworkers) {
+			home = (int)(ci->socket % nworkers);
+			__atomic_store_n(&ci->task_thread, home, __ATOMIC_RELAXED);
+		}
+		worker = &td->workers[home];
+
+		pthread_mutex_lock(&worker->lock);
+		// the worker was stopped meanwhile, pick another home
+		if (home >= td->num_workers) {
+			pthread_mutex_unlock(&worker->lock);
+			__atomic_store_n(&ci->task_thread, -1, __ATOMIC_RELAXED);
+			continue;
 		}
+		ci->task_next = NULL;
+		if (worker->inbox_last)
+			worker->inbox_last->task_next = ci;
+		else
+			worker->inbox_first = ci;
+		worker->inbox_last = ci;
+		if (worker->sleeping)
+			pthread_cond_signal(&worker->cond);
+		pthread_mutex_unlock(&worker->lock);
+		break;
 	}
-	td->tasks[td->first_free_task++].ci = ci;
-	return td->first_free_task - td->first_task;
 }
 
-phalcon_io_client_info *phalcon_io_pop_task ()
+// wakes a sleeping worker other than self, it steals what self queued
+static void phalcon_io_wake_idle_worker (phalcon_io_task_worker *self)
 {
-	phalcon_io_client_info *ci = NULL;
-	if (td->first_task >= 0)
-		ci = td->tasks[td->first_task++].ci;
-
-	if (td->first_task >= td->first_free_task)
-		td->first_task = td->first_free_task = 0;		// queue empty; reset pointers
-	else if (td->first_task >= td->max_tasks/2) {		// half empty; shift data at the beginning
-		int ntasks = td->first_free_task-td->first_task;
-		memmove (&td->tasks[0], &td->tasks[td->first_task], ntasks*sizeof(phalcon_io_task_info));
-		td->first_free_task -= td->first_task;
-		td->first_task = 0;
+	int nworkers = __atomic_load_n(&td->num_workers, __ATOMIC_ACQUIRE);
+	int it;
+	phalcon_io_task_worker *worker;
+
+	if (__atomic_load_n(&td->sleeping_workers, __ATOMIC_SEQ_CST) == 0)
+		return;
+
+	for (it = 1; it < nworkers; it++) {
+		worker = &td->workers[(self->index + it) % nworkers];
+		pthread_mutex_lock(&worker->lock);
+		if (worker->sleeping) {
+			pthread_cond_signal(&worker->cond);
+			pthread_mutex_unlock(&worker->lock);
+			return;
+		}
+		pthread_mutex_unlock(&worker->lock);
 	}
-	return ci;
 }
 
-// return PHALCON_IO_ERROR if error or number of tasks enqueued
-int phalcon_io_enqueue_task (phalcon_io_client_info *ci)
+// return PHALCON_IO_ERROR if error or number of task threads
+int phalcon_io_enqueue_task (phalcon_io_client_info *ci, int operation)
 {
-	int ntasks;
 	phalcon_io_threads_info *ti = (phalcon_io_threads_info *)ci->tpi;
+	int expected = PHALCON_IO_FALSE;
+
 	if (!ti->allow_tasks)
 		return PHALCON_IO_ERROR;
 	phalcon_io_debug_message(PHALCON_IO_DEBUG_CLIENT, "Task push\n");
 
-	if (phalcon_io_get_running_task_threads() < 1)
+	if (td == NULL)
+		phalcon_io_init_tasks ();
+
+	// the pool grows with the load, a thread is added only when none of them is idle
+	if (__atomic_load_n(&td->num_workers, __ATOMIC_ACQUIRE) < 1
+		|| (__atomic_load_n(&td->sleeping_workers, __ATOMIC_SEQ_CST) == 0 && td->num_workers < td->max_workers))
 		phalcon_io_start_one_task_thread();
-	pthread_mutex_lock(&td->lock);
-	ntasks = phalcon_io_push_task(ci);
-	pthread_mutex_unlock(&td->lock);
-	if (ntasks < 0)
+	if (td->num_workers < 1)
 		return PHALCON_IO_ERROR;
-	pthread_cond_signal(&td->cond);
-	return ntasks;
+
+	__atomic_or_fetch(&ci->task_ops, 1 << operation, __ATOMIC_SEQ_CST);
+
+	// already queued or running, the running thread picks the new operation up
+	if (__atomic_compare_exchange_n(&ci->task_scheduled, &expected, PHALCON_IO_TRUE, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		phalcon_io_schedule_client(ci);
+
+	return td->num_workers;
 }
 
-phalcon_io_callback_t phalcon_io_tasks_thread(void *data)
+static void phalcon_io_run_client (phalcon_io_task_worker *worker, phalcon_io_client_info *ci)
 {
+	int ops, expected;
+
+	__atomic_store_n(&ci->task_thread, worker->index, __ATOMIC_RELAXED);
+
+	while (1) {
+		while ((ops = __atomic_exchange_n(&ci->task_ops, 0, __ATOMIC_SEQ_CST)) != 0) {
+			phalcon_io_debug_message(PHALCON_IO_DEBUG_CLIENT, "Task pop\n");
+			if (ops & (1 << PHALCON_IO_OP_READ)) {
+				ci->operation = PHALCON_IO_OP_READ;
+				phalcon_io_do_callback(ci, PHALCON_IO_CLIENT_DEFFERED_READ);
+			}
+			if (ops & (1 << PHALCON_IO_OP_WRITE)) {
+				ci->operation = PHALCON_IO_OP_WRITE;
+				phalcon_io_do_callback(ci, PHALCON_IO_CLIENT_DEFFERED_WRITE);
+			}
+		}
+
+		__atomic_store_n(&ci->task_scheduled, PHALCON_IO_FALSE, __ATOMIC_SEQ_CST);
+
+		// an operation enqueued before the flag was cleared would otherwise be lost
+		expected = PHALCON_IO_FALSE;
+		if (__atomic_load_n(&ci->task_ops, __ATOMIC_SEQ_CST) == 0
+			|| !__atomic_compare_exchange_n(&ci->task_scheduled, &expected, PHALCON_IO_TRUE, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+			break;
+	}
+}
+
+static phalcon_io_client_info *phalcon_io_steal_client (phalcon_io_task_worker *worker)
+{
+	int nworkers = __atomic_load_n(&td->num_workers, __ATOMIC_ACQUIRE);
+	int it, victim;
 	phalcon_io_client_info *ci;
 
+	for (it = 1; it < nworkers; it++) {
+		victim = (worker->index + it) % nworkers;
+		if ((ci = phalcon_io_deque_steal(&td->workers[victim].deque)) != NULL)
+			return ci;
+	}
+	return NULL;
+}
+
+phalcon_io_callback_t phalcon_io_tasks_thread(void *data)
+{
+	phalcon_io_task_worker *worker = (phalcon_io_task_worker *)data;
+	phalcon_io_client_info *ci, *inbox;
+	int stops, pushed;
+
 	while (!td->must_Exit) {
-		pthread_mutex_lock(&td->lock);
-		if (td->first_free_task <= 0) {
-			while (td->first_free_task==0 && !td->must_Exit)
-				pthread_cond_wait(&td->cond, &td->lock);
-			if (td->must_Exit) {
-				pthread_mutex_unlock(&td->lock);
-				break;
-			}
+		// move the inbox to the deque where the idle threads can steal from
+		pthread_mutex_lock(&worker->lock);
+		inbox = worker->inbox_first;
+		worker->inbox_first = worker->inbox_last = NULL;
+		pthread_mutex_unlock(&worker->lock);
+
+		pushed = 0;
+		while (inbox) {
+			ci = inbox;
+			inbox = ci->task_next;
+			if (phalcon_io_deque_push(&worker->deque, ci))
+				pushed++;
+			else
+				phalcon_io_run_client(worker, ci);		// deque full, run it now
 		}
-		ci = phalcon_io_pop_task();
-		if (ci == NULL)					// request to stop thread
-			phalcon_io_delete_thread (pthread_self());
-		pthread_mutex_unlock(&td->lock);
-		if (ci == NULL) {				// request to stop thread
+
+		// this thread runs one of them, an idle one can steal the others
+		if (pushed > 1)
+			phalcon_io_wake_idle_worker(worker);
+
+		if ((ci = phalcon_io_deque_take(&worker->deque)) != NULL || (ci = phalcon_io_steal_client(worker)) != NULL) {
+			phalcon_io_run_client(worker, ci);
+			continue;
+		}
+
+		// only the last worker stops so the published workers stay contiguous
+		stops = __atomic_load_n(&td->stop_requests, __ATOMIC_SEQ_CST);
+		if (stops > 0 && worker->index > 0 && worker->index == td->num_workers - 1
+			&& __atomic_compare_exchange_n(&td->stop_requests, &stops, stops - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&td->lock);
+			pthread_mutex_lock(&worker->lock);
+			worker->stopping = 1;
+			__atomic_store_n(&td->num_workers, worker->index, __ATOMIC_RELEASE);
+			inbox = worker->inbox_first;
+			worker->inbox_first = worker->inbox_last = NULL;
+			pthread_mutex_unlock(&worker->lock);
+			pthread_mutex_unlock(&td->lock);
+
+			// hand over what was scheduled here since the inbox was drained
+			while (inbox) {
+				ci = inbox;
+				inbox = ci->task_next;
+				__atomic_store_n(&ci->task_thread, -1, __ATOMIC_RELAXED);
+				phalcon_io_schedule_client(ci);
+			}
+			while ((ci = phalcon_io_deque_take(&worker->deque)) != NULL)
+				phalcon_io_run_client(worker, ci);
+
+			// the deque is empty, a new thread can take the slot over
+			pthread_mutex_lock(&td->lock);
+			worker->stopping = 0;
+			pthread_mutex_unlock(&td->lock);
+
 			phalcon_io_delete_thread (pthread_self());
 			pthread_detach(pthread_self());
 			break;
 		}
 
-		phalcon_io_debug_message(PHALCON_IO_DEBUG_CLIENT, "Task pop\n");
-		if (ci->operation == PHALCON_IO_OP_READ)
-			phalcon_io_do_callback(ci, PHALCON_IO_CLIENT_DEFFERED_READ);
-		else if (ci->operation == PHALCON_IO_OP_WRITE)
-			phalcon_io_do_callback(ci, PHALCON_IO_CLIENT_DEFFERED_WRITE);
+		// idle, sleep until a client is scheduled here, another thread has work to steal or a stop is requested
+		pthread_mutex_lock(&worker->lock);
+		// the stop request is read under the lock it is signaled with, the last worker can not miss it
+		if (worker->inbox_first == NULL && !td->must_Exit
+			&& !(__atomic_load_n(&td->stop_requests, __ATOMIC_SEQ_CST) > 0 && worker->index > 0 && worker->index == td->num_workers - 1)) {
+			worker->sleeping = 1;
+			__atomic_add_fetch(&td->sleeping_workers, 1, __ATOMIC_SEQ_CST);
+			pthread_cond_wait(&worker->cond, &worker->lock);
+			__atomic_sub_fetch(&td->sleeping_workers, 1, __ATOMIC_SEQ_CST);
+			worker->sleeping = 0;
+		}
+		pthread_mutex_unlock(&worker->lock);
 	}
 	return (phalcon_io_callback_t) 0;
 }
@@ -25,23 +25,42 @@
 #include "kernel/io/sockets.h"
 #include "kernel/io/client.h"
 
+#include <stdint.h>
+
 #define PHALCON_IO_BLOCK_SIZE 128
+#define PHALCON_IO_MAX_TASK_THREADS 64
+#define PHALCON_IO_DEQUE_SIZE 1024			// power of two
+
+// Chase-Lev deque, only the owner pushes and takes at the bottom, any thread steals at the top
+typedef struct {
+	volatile int64_t top;
+	volatile int64_t bottom;
+	phalcon_io_client_info *volatile items[PHALCON_IO_DEQUE_SIZE];
+} phalcon_io_deque;
 
 typedef struct {
-	phalcon_io_client_info *ci;
-} phalcon_io_task_info;
+	int index;
+	phalcon_io_thread_t thread;
+	phalcon_io_deque deque;
+	pthread_mutex_t lock;			// protects the inbox only, producers of different threads never meet
+	pthread_cond_t cond;
+	phalcon_io_client_info *inbox_first;
+	phalcon_io_client_info *inbox_last;
+	int sleeping;					// waiting on cond, only signaled work wakes it up
+	int stopping;					// unpublished but still draining its deque, the slot can not be reused yet
+} phalcon_io_task_worker;
 
 typedef struct {
-	pthread_mutex_t lock;
-	pthread_cond_t	cond;
+	pthread_mutex_t lock;			// protects the threads list
 	int must_Exit;
+	volatile int stop_requests;
 	phalcon_io_thread_t *threads;
 	int max_threads;
 	int first_free_thread;
-	phalcon_io_task_info *tasks;
-	int max_tasks;
-	int first_free_task;
-	int first_task;
+	phalcon_io_task_worker *workers;
+	int max_workers;
+	volatile int num_workers;
+	volatile int sleeping_workers;
 } phalcon_io_tasks_data;
 
 void phalcon_io_init_tasks ();
@@ -51,9 +70,7 @@ void phalcon_io_delete_thread (phalcon_io_thread_t thread);
 int  phalcon_io_get_running_task_threads ();
 int  phalcon_io_start_one_task_thread ();
 void phalcon_io_stop_one_task_thread ();
-int  phalcon_io_push_task (phalcon_io_client_info *ci);
-phalcon_io_client_info *phalcon_io_pop_task ();
-int	 phalcon_io_enqueue_task (phalcon_io_client_info *ci);
+int	 phalcon_io_enqueue_task (phalcon_io_client_info *ci, int operation);
 phalcon_io_callback_t phalcon_io_tasks_thread (void *data);
 
 #endif /* PHALCON_KERNEL_IO_TASKS_H */
@@ -54,6 +54,9 @@ void php_phalcon_init_globals(zend_phalcon_globals *phalcon_globals) {
 	phalcon_globals->orm.allow_update_primary = 0;
 	phalcon_globals->orm.enable_strict = 0;
 
+	/* Dispatcher options */
+	phalcon_globals->dispatcher.handler_cache = NULL;
+
 	/* Security options */
 	phalcon_globals->security.crypt_std_des_supported  = zend_hash_str_exists(constants, SL("CRYPT_STD_DES"));
 	phalcon_globals->security.crypt_ext_des_supported  = zend_hash_str_exists(constants, SL("CRYPT_EXT_DES"));
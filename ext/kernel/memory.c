@@ -25,6 +25,7 @@
 #include "kernel/fcall.h"
 #include "kernel/backtrace.h"
 #include "kernel/framework/orm.h"
+#include "kernel/framework/dispatcher.h"
 
 /*
  * Memory Frames/Virtual Symbol Scopes
@@ -66,6 +67,7 @@ void phalcon_deinitialize_memory()
 	}
 
 	phalcon_orm_destroy_cache();
+	phalcon_dispatcher_destroy_cache();
 
 	phalcon_globals_ptr->initialized = 0;
 }
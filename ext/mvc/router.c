@@ -27,9 +27,18 @@
 #include "diinterface.h"
 #include "di/injectable.h"
 #include "http/requestinterface.h"
+#include "http/request.h"
 #include "debug.h"
 
 #include <main/SAPI.h>
+#include <Zend/zend_smart_str.h>
+#include <ext/standard/php_var.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "kernel/main.h"
 #include "kernel/memory.h"
@@ -103,6 +112,10 @@ PHP_METHOD(Phalcon_Mvc_Router, setDefaultController);
 PHP_METHOD(Phalcon_Mvc_Router, getDefaultController);
 PHP_METHOD(Phalcon_Mvc_Router, setControllerName);
 PHP_METHOD(Phalcon_Mvc_Router, getControllerName);
+PHP_METHOD(Phalcon_Mvc_Router, export);
+PHP_METHOD(Phalcon_Mvc_Router, import);
+PHP_METHOD(Phalcon_Mvc_Router, save);
+PHP_METHOD(Phalcon_Mvc_Router, load);
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_router___construct, 0, 0, 0)
 	ZEND_ARG_TYPE_INFO(0, defaultRoutes, _IS_BOOL, 1)
@@ -154,6 +167,10 @@ static const zend_function_entry phalcon_mvc_router_method_entry[] = {
 	PHP_ME(Phalcon_Mvc_Router, getDefaultController, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router, setControllerName, arginfo_phalcon_routerinterface_sethandlername, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router, getControllerName, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router, export, arginfo_phalcon_mvc_router_export, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router, import, arginfo_phalcon_mvc_router_import, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router, save, arginfo_phalcon_mvc_router_save, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router, load, arginfo_phalcon_mvc_router_load, ZEND_ACC_PUBLIC)
 	PHP_FE_END
 };
 
@@ -173,6 +190,9 @@ PHALCON_INIT_CLASS(Phalcon_Mvc_Router){
 	zend_declare_property_null(phalcon_mvc_router_ce, SL("_removeExtraSlashes"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_ce, SL("_notFoundPaths"), ZEND_ACC_PROTECTED);
 	zend_declare_property_bool(phalcon_mvc_router_ce, SL("_isExactControllerName"), 0, ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_mvc_router_ce, SL("_compiledRoutes"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_mvc_router_ce, SL("_compiledStatic"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_mvc_router_ce, SL("_compiledVersion"), ZEND_ACC_PROTECTED);
 
 	zend_declare_class_constant_long(phalcon_mvc_router_ce, SL("URI_SOURCE_GET_URL"), 0);
 	zend_declare_class_constant_long(phalcon_mvc_router_ce, SL("URI_SOURCE_SERVER_REQUEST_URI"), 1);
@@ -419,9 +439,495 @@ PHP_METHOD(Phalcon_Mvc_Router, getDefaults){
 	phalcon_array_update_string(return_value, IS(params),     &params,          PH_COPY);
 }
 
+/**
+ * Tells if a compiled pattern can be compiled: the "#^...$#" and "#^...$#u" expressions
+ * without back references, recursion, named groups, verbs or alternatives at the top
+ * level, which would not survive the merge, and the static patterns made of ASCII
+ * bytes, regex is 0 for those
+ */
+static int phalcon_mvc_router_mergeable(zval *pattern, const char **body, size_t *body_len, int *regex, int *utf8)
+{
+	const char *p, *end;
+	size_t len;
+	int depth = 0;
+
+	if (Z_TYPE_P(pattern) != IS_STRING || !Z_STRLEN_P(pattern)) {
+		return 0;
+	}
+
+	p = Z_STRVAL_P(pattern);
+	len = Z_STRLEN_P(pattern);
+
+	/* The same test as handle() */
+	if (len > 3 && p[1] == '^') {
+		if (p[0] != '#') {
+			return 0;
+		}
+
+		if (len >= 5 && !memcmp(p + len - 3, "$#u", 3)) {
+			*utf8 = 1;
+			end = p + len - 3;
+		} else if (!memcmp(p + len - 2, "$#", 2)) {
+			*utf8 = 0;
+			end = p + len - 2;
+		} else {
+			return 0;
+		}
+
+		*regex = 1;
+		*body = p + 2;
+		*body_len = end - *body;
+
+		for (p = *body; p < end; p++) {
+			if (*p == '\\') {
+				/* A trailing backslash would escape the closing parenthesis */
+				if (++p == end || (*p >= '0' && *p <= '9') || *p == 'g' || *p == 'k' || *p == 'Q') {
+					return 0;
+				}
+			} else if (*p == '[') {
+				/* A class may hold parentheses and bars, a leading ']' is literal */
+				if (++p < end && *p == '^') {
+					p++;
+				}
+				if (p < end && *p == ']') {
+					p++;
+				}
+				for (; p < end && *p != ']'; p++) {
+					if (*p == '\\' && ++p == end) {
+						return 0;
+					}
+				}
+				if (p == end) {
+					return 0;
+				}
+			} else if (*p == '(') {
+				depth++;
+				if (p + 2 < end) {
+					if (p[1] == '*') {
+						return 0;
+					}
+					if (p[1] == '?' && (memchr("PR0123456789+-&'C", p[2], sizeof("PR0123456789+-&'C") - 1) || (p[2] == '<' && p + 3 < end && p[3] != '=' && p[3] != '!'))) {
+						return 0;
+					}
+				}
+			} else if (*p == ')') {
+				if (!depth--) {
+					return 0;
+				}
+			} else if (*p == '|' && !depth) {
+				/* "^a|b$" would become "^(?:a|b)$" once wrapped */
+				return 0;
+			}
+		}
+
+		if (depth) {
+			return 0;
+		}
+
+		return 1;
+	}
+
+	*regex = 0;
+	*utf8 = -1;
+	*body = p;
+	*body_len = len;
+
+	for (end = p + len; p < end; p++) {
+		if (!*p || (unsigned char)*p >= 0x80) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Appends a chunk, a pattern merging count routes, one route checked as usual or,
+ * without pattern, count static routes
+ */
+static void phalcon_mvc_router_chunk(zval *chunks, smart_str *pattern, int count, int utf8)
+{
+	zval chunk = {};
+
+	array_init_size(&chunk, 2);
+
+	if (!pattern) {
+		add_next_index_bool(&chunk, 0);
+	} else if (count > 1) {
+		smart_str_appendl(pattern, ")#", 2);
+		if (utf8 == 1) {
+			smart_str_appendc(pattern, 'u');
+		}
+		smart_str_0(pattern);
+		add_next_index_str(&chunk, pattern->s);
+		pattern->s = NULL;
+	} else {
+		smart_str_free(pattern);
+		add_next_index_null(&chunk);
+	}
+
+	add_next_index_long(&chunk, count);
+	add_next_index_zval(chunks, &chunk);
+}
+
+static void phalcon_mvc_router_static_add(zval *buckets, zend_string *method, zend_long position)
+{
+	zval *bucket, tmp = {};
+
+	if ((bucket = zend_hash_find(Z_ARRVAL_P(buckets), method)) == NULL) {
+		array_init(&tmp);
+		bucket = zend_hash_add_new(Z_ARRVAL_P(buckets), method, &tmp);
+	}
+
+	zend_hash_index_add_empty_element(Z_ARRVAL_P(bucket), position);
+}
+
+/**
+ * Files the position of a static route under its URI, in a bucket for each of its
+ * HTTP methods, the routes without constraint go to the "" bucket
+ */
+static void phalcon_mvc_router_static(zval *table, zend_string *uri, zval *methods, zend_long position)
+{
+	zval *buckets, *method, tmp = {};
+
+	if ((buckets = zend_hash_find(Z_ARRVAL_P(table), uri)) == NULL) {
+		array_init(&tmp);
+		buckets = zend_hash_add_new(Z_ARRVAL_P(table), uri, &tmp);
+	}
+
+	if (Z_TYPE_P(methods) == IS_STRING) {
+		phalcon_mvc_router_static_add(buckets, Z_STR_P(methods), position);
+	} else if (Z_TYPE_P(methods) == IS_ARRAY) {
+		ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(methods), method) {
+			if (Z_TYPE_P(method) == IS_STRING) {
+				phalcon_mvc_router_static_add(buckets, Z_STR_P(method), position);
+			} else {
+				phalcon_mvc_router_static_add(buckets, ZSTR_EMPTY_ALLOC(), position);
+			}
+		} ZEND_HASH_FOREACH_END();
+	} else {
+		phalcon_mvc_router_static_add(buckets, ZSTR_EMPTY_ALLOC(), position);
+	}
+}
+
+/**
+ * Splits the routes, in the order handle() checks them, into chunks. The routes of a
+ * regular expression chunk are merged into one pattern where every alternative ends
+ * with (*MARK:n), n being its position in the chunk, so one preg_match() gives the
+ * first route worth checking. The static routes are filed in statics, under their
+ * URI or under the lowercase URI for the case insensitive ones, and their chunks are
+ * only checked for the positions the URI of the request finds there. A chunk is
+ * [pattern, number of routes], the pattern is false for the static routes and null
+ * for the routes that can not be merged.
+ */
+static int phalcon_mvc_router_compile(zval *chunks, zval *statics, zval *routes, zval *all_case_sensitive)
+{
+	zval *route, exact = {}, folded = {};
+	smart_str pattern = {0};
+	zend_long position = 0;
+	int count = 0, static_count = 0, utf8 = -1;
+
+	array_init(chunks);
+	array_init(&exact);
+	array_init(&folded);
+
+	ZEND_HASH_REVERSE_FOREACH_VAL(Z_ARRVAL_P(routes), route) {
+		zval compiled_pattern = {}, case_sensitive = {}, methods = {};
+		const char *body = NULL;
+		size_t body_len = 0;
+		int mergeable, regex = 0, route_utf8 = -1;
+
+		if (FAILURE == phalcon_call_method(&compiled_pattern, route, "getcompiledpattern", 0, NULL)
+			|| FAILURE == phalcon_call_method(&case_sensitive, route, "getcasesensitive", 0, NULL)) {
+			zval_ptr_dtor(&compiled_pattern);
+			zval_ptr_dtor(&exact);
+			zval_ptr_dtor(&folded);
+			smart_str_free(&pattern);
+			return FAILURE;
+		}
+
+		if (Z_TYPE(case_sensitive) == IS_NULL) {
+			ZVAL_COPY(&case_sensitive, all_case_sensitive);
+		}
+
+		mergeable = phalcon_mvc_router_mergeable(&compiled_pattern, &body, &body_len, &regex, &route_utf8);
+
+		if (count && (!mergeable || !regex || count == PHALCON_MVC_ROUTER_CHUNK_ROUTES
+			|| ZSTR_LEN(pattern.s) + body_len > PHALCON_MVC_ROUTER_CHUNK_SIZE
+			|| (route_utf8 >= 0 && utf8 >= 0 && route_utf8 != utf8))) {
+			phalcon_mvc_router_chunk(chunks, &pattern, count, utf8);
+			count = 0;
+			utf8 = -1;
+		}
+
+		if (static_count && (!mergeable || regex)) {
+			phalcon_mvc_router_chunk(chunks, NULL, static_count, -1);
+			static_count = 0;
+		}
+
+		if (mergeable && !regex) {
+			if (FAILURE == phalcon_call_method(&methods, route, "gethttpmethods", 0, NULL)) {
+				zval_ptr_dtor(&compiled_pattern);
+				zval_ptr_dtor(&case_sensitive);
+				zval_ptr_dtor(&exact);
+				zval_ptr_dtor(&folded);
+				return FAILURE;
+			}
+
+			/* strcasecmp() folds ASCII only, as zend_string_tolower() does */
+			if (zend_is_true(&case_sensitive)) {
+				zend_string *lower = zend_string_tolower(Z_STR(compiled_pattern));
+				phalcon_mvc_router_static(&folded, lower, &methods, position);
+				zend_string_release(lower);
+			} else {
+				phalcon_mvc_router_static(&exact, Z_STR(compiled_pattern), &methods, position);
+			}
+			zval_ptr_dtor(&methods);
+
+			static_count++;
+		} else if (!mergeable) {
+			phalcon_mvc_router_chunk(chunks, &pattern, 1, utf8);
+		} else {
+			smart_str_appendl(&pattern, count ? "|" : "#^(?:", count ? 1 : 5);
+
+			/* The "i" flag handle() adds, for the merged routes only */
+			if (zend_is_true(&case_sensitive)) {
+				smart_str_appendl(&pattern, "(?i:", 4);
+			} else {
+				smart_str_appendl(&pattern, "(?:", 3);
+			}
+
+			smart_str_appendl(&pattern, body, body_len);
+			smart_str_appendl(&pattern, ")$(*MARK:", 9);
+			smart_str_append_long(&pattern, count);
+			smart_str_appendc(&pattern, ')');
+
+			count++;
+			if (route_utf8 >= 0) {
+				utf8 = route_utf8;
+			}
+		}
+
+		position++;
+		zval_ptr_dtor(&compiled_pattern);
+		zval_ptr_dtor(&case_sensitive);
+	} ZEND_HASH_FOREACH_END();
+
+	if (count) {
+		phalcon_mvc_router_chunk(chunks, &pattern, count, utf8);
+	} else if (static_count) {
+		phalcon_mvc_router_chunk(chunks, NULL, static_count, -1);
+	}
+
+	array_init_size(statics, 2);
+	add_next_index_zval(statics, &exact);
+	add_next_index_zval(statics, &folded);
+
+	return SUCCESS;
+}
+
+/**
+ * Collects the positions of the static routes filed under the URI, from the bucket
+ * of the HTTP method and from the one of the routes without constraint
+ */
+static void phalcon_mvc_router_candidates(zval *candidates, zval *statics, zval *uri, zval *http_method, int all_methods)
+{
+	zval *table, *buckets, *bucket;
+	zend_string *key, *method;
+	int i;
+
+	array_init(candidates);
+
+	if (Z_TYPE_P(uri) != IS_STRING || Z_TYPE_P(statics) != IS_ARRAY) {
+		return;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if ((table = zend_hash_index_find(Z_ARRVAL_P(statics), i)) == NULL) {
+			continue;
+		}
+
+		key = i ? zend_string_tolower(Z_STR_P(uri)) : zend_string_copy(Z_STR_P(uri));
+		if ((buckets = zend_hash_find(Z_ARRVAL_P(table), key)) != NULL) {
+			ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL_P(buckets), method, bucket) {
+				if (all_methods || !ZSTR_LEN(method) || (Z_TYPE_P(http_method) == IS_STRING && zend_string_equals(method, Z_STR_P(http_method)))) {
+					zend_hash_merge(Z_ARRVAL_P(candidates), Z_ARRVAL_P(bucket), NULL, 0);
+				}
+			} ZEND_HASH_FOREACH_END();
+		}
+		zend_string_release(key);
+	}
+}
+
+/**
+ * Returns the chunks and the static routes of the compiled matcher, built again when
+ * a route was added or changed, or nulls when the events of the routes have to be
+ * fired for every one of them
+ */
+static int phalcon_mvc_router_compiled(zval *chunks, zval *statics, zval *router, zval *routes, zval *all_case_sensitive)
+{
+	zval events_manager = {}, route_version = {}, version = {}, compiled_version = {};
+
+	ZVAL_NULL(chunks);
+	ZVAL_NULL(statics);
+
+	phalcon_read_property(&events_manager, router, SL("_eventsManager"), PH_READONLY);
+	if (Z_TYPE(events_manager) != IS_NULL
+		|| phalcon_method_exists_ex(router, SL("beforecheckroute")) == SUCCESS
+		|| phalcon_method_exists_ex(router, SL("notmatchedroute")) == SUCCESS) {
+		return SUCCESS;
+	}
+
+	phalcon_read_static_property_ce(&route_version, phalcon_mvc_router_route_ce, SL("_version"), PH_READONLY);
+
+	array_init_size(&version, 3);
+	phalcon_array_append_long(&version, Z_TYPE(route_version) == IS_LONG ? Z_LVAL(route_version) : 0, 0);
+	phalcon_array_append_long(&version, zend_hash_num_elements(Z_ARRVAL_P(routes)), 0);
+	phalcon_array_append_long(&version, zend_is_true(all_case_sensitive), 0);
+
+	phalcon_read_property(&compiled_version, router, SL("_compiledVersion"), PH_READONLY);
+	if (Z_TYPE(compiled_version) == IS_ARRAY && PHALCON_IS_IDENTICAL(&version, &compiled_version)) {
+		phalcon_read_property(chunks, router, SL("_compiledRoutes"), PH_COPY);
+		phalcon_read_property(statics, router, SL("_compiledStatic"), PH_COPY);
+		zval_ptr_dtor(&version);
+		return SUCCESS;
+	}
+
+	if (FAILURE == phalcon_mvc_router_compile(chunks, statics, routes, all_case_sensitive)) {
+		zval_ptr_dtor(chunks);
+		ZVAL_NULL(chunks);
+		zval_ptr_dtor(&version);
+		return FAILURE;
+	}
+
+	phalcon_update_property(router, SL("_compiledRoutes"), chunks);
+	phalcon_update_property(router, SL("_compiledStatic"), statics);
+	phalcon_update_property(router, SL("_compiledVersion"), &version);
+	zval_ptr_dtor(&version);
+
+	return SUCCESS;
+}
+
+/**
+ * The blobs start with the format, the version of Phalcon and the hash of the caller
+ * on their own line, they are compared before anything is unserialized
+ */
+static zend_string *phalcon_mvc_router_export_header(zval *hash)
+{
+	zend_string *header, *str = zval_get_string(hash);
+
+	header = strpprintf(0, "phalcon-router/%d %s %s\n", PHALCON_MVC_ROUTER_EXPORT_FORMAT, PHP_PHALCON_VERSION, ZSTR_VAL(str));
+	zend_string_release(str);
+
+	return header;
+}
+
+/**
+ * Replaces the routes of the router with those of a blob written by export(), the
+ * compiled matcher comes with them and is used as long as the routes do not change
+ */
+static int phalcon_mvc_router_import(zval *router, const char *data, size_t length, zval *hash)
+{
+	zval payload = {}, routes = {}, names = {}, not_found = {}, chunks = {}, statics = {}, case_sensitive = {};
+	zval route_version = {}, unique_id = {}, version = {}, *route;
+	php_unserialize_data_t var_hash;
+	HashTable classes;
+	const unsigned char *p, *end = (const unsigned char *)data + length;
+	zend_string *header;
+	zend_long next_id = 0;
+	int valid;
+
+	header = phalcon_mvc_router_export_header(hash);
+	valid = length > ZSTR_LEN(header) && !memcmp(data, ZSTR_VAL(header), ZSTR_LEN(header));
+	p = (const unsigned char *)data + ZSTR_LEN(header);
+	zend_string_release(header);
+
+	if (!valid) {
+		return FAILURE;
+	}
+
+	/**
+	 * Any other class is restored as __PHP_Incomplete_Class, a tampered blob can not
+	 * run the __wakeup() or __destruct() of the classes it names
+	 */
+	zend_hash_init(&classes, 2, NULL, NULL, 0);
+	zend_hash_str_add_empty_element(&classes, SL("phalcon\\mvc\\router\\route"));
+	zend_hash_str_add_empty_element(&classes, SL("phalcon\\mvc\\router\\group"));
+
+	PHP_VAR_UNSERIALIZE_INIT(var_hash);
+#if PHP_VERSION_ID >= 70100
+	php_var_unserialize_set_allowed_classes(var_hash, &classes);
+	valid = php_var_unserialize(&payload, &p, end, &var_hash);
+#else
+	valid = php_var_unserialize_ex(&payload, &p, end, &var_hash, &classes);
+#endif
+	PHP_VAR_UNSERIALIZE_DESTROY(var_hash);
+	zend_hash_destroy(&classes);
+
+	if (!valid || Z_TYPE(payload) != IS_ARRAY
+		|| !phalcon_array_isset_fetch_str(&routes, &payload, SL("routes"), PH_READONLY) || Z_TYPE(routes) != IS_ARRAY
+		|| !phalcon_array_isset_fetch_str(&names, &payload, SL("names"), PH_READONLY) || Z_TYPE(names) != IS_ARRAY
+		|| !phalcon_array_isset_fetch_str(&not_found, &payload, SL("notFound"), PH_READONLY)
+		|| !phalcon_array_isset_fetch_str(&chunks, &payload, SL("chunks"), PH_READONLY) || Z_TYPE(chunks) != IS_ARRAY
+		|| !phalcon_array_isset_fetch_str(&statics, &payload, SL("statics"), PH_READONLY) || Z_TYPE(statics) != IS_ARRAY
+		|| !phalcon_array_isset_fetch_str(&case_sensitive, &payload, SL("caseSensitive"), PH_READONLY)) {
+		zval_ptr_dtor(&payload);
+		return FAILURE;
+	}
+
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL(routes), route) {
+		zval route_id = {};
+
+		if (Z_TYPE_P(route) != IS_OBJECT || !instanceof_function(Z_OBJCE_P(route), phalcon_mvc_router_route_ce)) {
+			zval_ptr_dtor(&payload);
+			return FAILURE;
+		}
+
+		phalcon_read_property(&route_id, route, SL("_id"), PH_READONLY);
+		if (Z_TYPE(route_id) == IS_LONG && Z_LVAL(route_id) >= next_id) {
+			next_id = Z_LVAL(route_id) + 1;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	/* The routes added later must not take the ids of the imported ones */
+	phalcon_read_static_property_ce(&unique_id, phalcon_mvc_router_route_ce, SL("_uniqueId"), PH_READONLY);
+	if (Z_TYPE(unique_id) != IS_LONG || Z_LVAL(unique_id) < next_id) {
+		zend_update_static_property_long(phalcon_mvc_router_route_ce, SL("_uniqueId"), next_id);
+	}
+
+	phalcon_update_property(router, SL("_routes"), &routes);
+	phalcon_update_property(router, SL("_routesNameLookup"), &names);
+	phalcon_update_property(router, SL("_notFoundPaths"), &not_found);
+
+	/**
+	 * The matcher was compiled for this case sensitivity, phalcon_mvc_router_compiled()
+	 * builds it again when the router uses another one
+	 */
+	phalcon_read_static_property_ce(&route_version, phalcon_mvc_router_route_ce, SL("_version"), PH_READONLY);
+
+	array_init_size(&version, 3);
+	phalcon_array_append_long(&version, Z_TYPE(route_version) == IS_LONG ? Z_LVAL(route_version) : 0, 0);
+	phalcon_array_append_long(&version, zend_hash_num_elements(Z_ARRVAL(routes)), 0);
+	phalcon_array_append_long(&version, zend_is_true(&case_sensitive), 0);
+
+	phalcon_update_property(router, SL("_compiledRoutes"), &chunks);
+	phalcon_update_property(router, SL("_compiledStatic"), &statics);
+	phalcon_update_property(router, SL("_compiledVersion"), &version);
+
+	zval_ptr_dtor(&version);
+	zval_ptr_dtor(&payload);
+
+	return SUCCESS;
+}
+
 /**
  * Handles routing information received from the rewrite engine
  *
+ * Without an events manager the patterns of the routes are merged into a few regular
+ * expressions and the static ones are looked up by URI and HTTP method, both built
+ * again when the routes change, only the routes they select have their HTTP method,
+ * hostname and beforeMatch checked.
+ *
  *<code>
  * //Read the info from the rewrite engine
  * $router->handle();
@@ -437,8 +943,12 @@ PHP_METHOD(Phalcon_Mvc_Router, handle){
 	zval *uri = NULL, real_uri = {}, removeextraslashes = {}, handled_uri = {}, route_found = {}, params = {}, service = {}, dependency_injector = {}, request = {}, debug_message = {}, event_name = {};
 	zval all_case_sensitive = {}, current_host_name = {}, routes = {}, *route, matches = {}, parts = {}, namespace_name = {}, default_namespace = {}, module = {}, default_module = {}, exact = {};
 	zval controller = {}, default_handler = {}, action = {}, default_action = {}, mode = {}, http_method = {}, action_name = {}, params_str = {}, str_params = {}, params_merge = {}, default_params = {};
+	zval chunks = {}, statics = {}, candidates = {};
 	zend_string *str_key;
 	ulong idx;
+	zend_long remaining = 0, skip = 0, route_position = 0;
+	uint32_t chunk_index = 0;
+	int static_chunk = 0;
 
 	phalcon_fetch_params(0, 0, 1, &uri);
 
@@ -499,11 +1009,67 @@ PHP_METHOD(Phalcon_Mvc_Router, handle){
 
 	PHALCON_CALL_METHOD(&all_case_sensitive, getThis(), "getcasesensitive");
 
+	/**
+	 * The compiled matcher tells which routes can not match, they are skipped
+	 */
+	RETURN_ON_FAILURE(phalcon_mvc_router_compiled(&chunks, &statics, getThis(), &routes, &all_case_sensitive));
+
+	/**
+	 * The static routes are looked up by URI, a custom request may compare the methods its own way
+	 */
+	if (Z_TYPE(chunks) == IS_ARRAY) {
+		phalcon_mvc_router_candidates(&candidates, &statics, &handled_uri, &http_method, Z_OBJCE(request) != phalcon_http_request_ce);
+	}
+
 	ZEND_HASH_REVERSE_FOREACH_VAL(Z_ARRVAL(routes), route) {
 		zval case_sensitive = {}, methods = {}, match_method = {}, hostname = {}, prefix = {}, regex_host_name = {}, matched = {};
 		zval pattern = {}, case_pattern = {}, before_match = {}, before_match_params = {}, paths = {};
 		zval converters = {}, *position;
 
+		if (Z_TYPE(chunks) == IS_ARRAY) {
+			zend_long current = route_position++;
+
+			if (!remaining) {
+				zval *chunk = zend_hash_index_find(Z_ARRVAL(chunks), chunk_index++), chunk_pattern = {}, chunk_count = {}, chunk_found = {}, chunk_matches = {}, mark = {};
+
+				skip = 0;
+				remaining = 1;
+				static_chunk = 0;
+				if (chunk) {
+					phalcon_array_fetch_long(&chunk_pattern, chunk, 0, PH_NOISY|PH_READONLY);
+					phalcon_array_fetch_long(&chunk_count, chunk, 1, PH_NOISY|PH_READONLY);
+					remaining = Z_LVAL(chunk_count);
+
+					if (Z_TYPE(chunk_pattern) == IS_FALSE) {
+						static_chunk = 1;
+					} else if (Z_TYPE(chunk_pattern) == IS_STRING) {
+						ZVAL_NULL(&chunk_matches);
+						ZVAL_MAKE_REF(&chunk_matches);
+						RETURN_ON_FAILURE(phalcon_preg_match(&chunk_found, &chunk_pattern, &handled_uri, &chunk_matches));
+						ZVAL_UNREF(&chunk_matches);
+
+						/* On a PCRE error every route of the chunk is checked */
+						if (Z_TYPE(chunk_found) != IS_FALSE && !zend_is_true(&chunk_found)) {
+							skip = remaining;
+						} else if (phalcon_array_isset_fetch_str(&mark, &chunk_matches, SL("MARK"), PH_READONLY)) {
+							skip = zval_get_long(&mark);
+						}
+						zval_ptr_dtor(&chunk_matches);
+					}
+				}
+			}
+
+			remaining--;
+			if (static_chunk) {
+				if (!zend_hash_index_exists(Z_ARRVAL(candidates), current)) {
+					continue;
+				}
+			} else if (skip) {
+				skip--;
+				continue;
+			}
+		}
+
 		PHALCON_CALL_METHOD(&case_sensitive, route, "getcasesensitive");
 		if (Z_TYPE(case_sensitive) == IS_NULL) {
 			ZVAL_COPY(&case_sensitive, &all_case_sensitive);
@@ -763,6 +1329,9 @@ PHP_METHOD(Phalcon_Mvc_Router, handle){
 			zval_ptr_dtor(&event_name);
 		}
 	} ZEND_HASH_FOREACH_END();
+	zval_ptr_dtor(&chunks);
+	zval_ptr_dtor(&statics);
+	zval_ptr_dtor(&candidates);
 	zval_ptr_dtor(&current_host_name);
 	zval_ptr_dtor(&handled_uri);
 	zval_ptr_dtor(&request);
@@ -1411,3 +1980,248 @@ PHP_METHOD(Phalcon_Mvc_Router, getControllerName){
 
 	RETURN_MEMBER(getThis(), "_handler");
 }
+
+/**
+ * Exports the routes, their names, the not found paths and the compiled matcher to a
+ * string, import() restores them without adding or compiling a route. The hash is
+ * any string the application changes with its routes, the modification time of the
+ * file defining them for instance, a blob is only imported with the same hash and
+ * the same version of Phalcon
+ *
+ * The routes are serialized, a route or a group with closures can not be exported,
+ * import() restores no other class than Route and Group
+ *
+ *<code>
+ * $router = new Phalcon\Mvc\Router\Annotations(false);
+ * $cache = new Phalcon\Cache\Yac('router_');
+ * $hash = filemtime('routes.php');
+ *
+ * if (!$router->import($cache->get('routes'), $hash)) {
+ *     require 'routes.php';
+ *     $cache->set('routes', $router->export($hash));
+ * }
+ *</code>
+ *
+ * @param string $hash
+ * @return string
+ */
+PHP_METHOD(Phalcon_Mvc_Router, export){
+
+	zval *hash = NULL, routes = {}, *route, names = {}, not_found = {}, all_case_sensitive = {}, chunks = {}, statics = {}, payload = {};
+	php_serialize_data_t var_hash;
+	smart_str buffer = {0};
+	zend_string *header;
+
+	phalcon_fetch_params(0, 0, 1, &hash);
+
+	if (!hash) {
+		hash = &PHALCON_GLOBAL(z_null);
+	}
+
+	phalcon_read_property(&routes, getThis(), SL("_routes"), PH_NOISY|PH_READONLY);
+	if (Z_TYPE(routes) != IS_ARRAY) {
+		PHALCON_THROW_EXCEPTION_STR(phalcon_mvc_router_exception_ce, "There are no routes to export");
+		return;
+	}
+
+	PHALCON_CALL_METHOD(&all_case_sensitive, getThis(), "getcasesensitive");
+
+	/**
+	 * All the named routes, getRouteByName() only fills the lookup with those it looked for
+	 */
+	array_init(&names);
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL(routes), route) {
+		zval route_name = {};
+
+		if (FAILURE == phalcon_call_method(&route_name, route, "getname", 0, NULL)) {
+			zval_ptr_dtor(&names);
+			zval_ptr_dtor(&all_case_sensitive);
+			return;
+		}
+		if (Z_TYPE(route_name) == IS_STRING && Z_STRLEN(route_name) && !phalcon_array_isset(&names, &route_name)) {
+			phalcon_array_update(&names, &route_name, route, PH_COPY);
+		}
+		zval_ptr_dtor(&route_name);
+	} ZEND_HASH_FOREACH_END();
+
+	if (FAILURE == phalcon_mvc_router_compile(&chunks, &statics, &routes, &all_case_sensitive)) {
+		zval_ptr_dtor(&chunks);
+		zval_ptr_dtor(&names);
+		zval_ptr_dtor(&all_case_sensitive);
+		return;
+	}
+
+	phalcon_read_property(&not_found, getThis(), SL("_notFoundPaths"), PH_READONLY);
+
+	array_init_size(&payload, 6);
+	phalcon_array_update_str(&payload, SL("routes"), &routes, PH_COPY);
+	phalcon_array_update_str(&payload, SL("names"), &names, 0);
+	phalcon_array_update_str(&payload, SL("notFound"), &not_found, PH_COPY);
+	phalcon_array_update_str(&payload, SL("chunks"), &chunks, 0);
+	phalcon_array_update_str(&payload, SL("statics"), &statics, 0);
+	phalcon_array_update_str_bool(&payload, SL("caseSensitive"), zend_is_true(&all_case_sensitive), 0);
+	zval_ptr_dtor(&all_case_sensitive);
+
+	header = phalcon_mvc_router_export_header(hash);
+	smart_str_append(&buffer, header);
+	zend_string_release(header);
+
+	PHP_VAR_SERIALIZE_INIT(var_hash);
+	php_var_serialize(&buffer, &payload, &var_hash);
+	PHP_VAR_SERIALIZE_DESTROY(var_hash);
+	zval_ptr_dtor(&payload);
+
+	if (EG(exception)) {
+		smart_str_free(&buffer);
+		return;
+	}
+
+	smart_str_0(&buffer);
+	RETURN_NEW_STR(buffer.s);
+}
+
+/**
+ * Replaces the routes with those exported by export() with the same hash, returns
+ * false and keeps the routes when the data is not such a blob. Only the routes and
+ * the groups are restored as objects, the subclasses of Route can not be imported
+ *
+ * @param string $data
+ * @param string $hash
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Mvc_Router, import){
+
+	zval *data, *hash = NULL;
+
+	phalcon_fetch_params(0, 1, 1, &data, &hash);
+
+	if (!hash) {
+		hash = &PHALCON_GLOBAL(z_null);
+	}
+
+	if (Z_TYPE_P(data) != IS_STRING) {
+		RETURN_FALSE;
+	}
+
+	RETURN_BOOL(SUCCESS == phalcon_mvc_router_import(getThis(), Z_STRVAL_P(data), Z_STRLEN_P(data), hash));
+}
+
+/**
+ * Writes the routes exported by export() to a file load() maps, the file is replaced
+ * at once so the processes loading it never read half of it
+ *
+ * @param string $path
+ * @param string $hash
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Mvc_Router, save){
+
+	zval *path, *hash = NULL, data = {};
+	zend_string *tmp;
+	const char *p;
+	size_t left;
+	ssize_t n;
+	int fd;
+
+	phalcon_fetch_params(0, 1, 1, &path, &hash);
+
+	if (!hash) {
+		hash = &PHALCON_GLOBAL(z_null);
+	}
+
+	if (php_check_open_basedir(Z_STRVAL_P(path))) {
+		RETURN_FALSE;
+	}
+
+	PHALCON_CALL_METHOD(&data, getThis(), "export", hash);
+	if (Z_TYPE(data) != IS_STRING) {
+		zval_ptr_dtor(&data);
+		RETURN_FALSE;
+	}
+
+	tmp = strpprintf(0, "%s.%d.tmp", Z_STRVAL_P(path), (int)getpid());
+	if ((fd = open(ZSTR_VAL(tmp), O_WRONLY|O_CREAT|O_TRUNC, 0644)) < 0) {
+		php_error_docref(NULL, E_WARNING, "Unable to open %s: %s", ZSTR_VAL(tmp), strerror(errno));
+		zend_string_release(tmp);
+		zval_ptr_dtor(&data);
+		RETURN_FALSE;
+	}
+
+	/* The terminating NUL goes with the data, load() gives the unserializer a terminated buffer */
+	p = Z_STRVAL(data);
+	left = Z_STRLEN(data) + 1;
+	while (left) {
+		n = write(fd, p, left);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		p += n;
+		left -= n;
+	}
+	close(fd);
+	zval_ptr_dtor(&data);
+
+	if (left || rename(ZSTR_VAL(tmp), Z_STRVAL_P(path))) {
+		php_error_docref(NULL, E_WARNING, "Unable to write %s: %s", Z_STRVAL_P(path), strerror(errno));
+		unlink(ZSTR_VAL(tmp));
+		zend_string_release(tmp);
+		RETURN_FALSE;
+	}
+
+	zend_string_release(tmp);
+	RETURN_TRUE;
+}
+
+/**
+ * Imports the routes from a file written by save(), the file is mapped and unserialized
+ * from the mapping without being copied into a string first, the routes are still
+ * built in the memory of every process loading it
+ *
+ *<code>
+ * if (!$router->load('/var/cache/routes.bin', $hash)) {
+ *     require 'routes.php';
+ *     $router->save('/var/cache/routes.bin', $hash);
+ * }
+ *</code>
+ *
+ * @param string $path
+ * @param string $hash
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Mvc_Router, load){
+
+	zval *path, *hash = NULL;
+	struct stat st;
+	char *data;
+	int fd, status = FAILURE;
+
+	phalcon_fetch_params(0, 1, 1, &path, &hash);
+
+	if (!hash) {
+		hash = &PHALCON_GLOBAL(z_null);
+	}
+
+	if (php_check_open_basedir_ex(Z_STRVAL_P(path), 0)) {
+		RETURN_FALSE;
+	}
+
+	if ((fd = open(Z_STRVAL_P(path), O_RDONLY)) < 0) {
+		RETURN_FALSE;
+	}
+
+	if (fstat(fd, &st) == 0 && st.st_size > 1) {
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (data != MAP_FAILED) {
+			if (data[st.st_size - 1] == '\0') {
+				status = phalcon_mvc_router_import(getThis(), data, st.st_size - 1, hash);
+			}
+			munmap(data, st.st_size);
+		}
+	}
+	close(fd);
+
+	RETURN_BOOL(SUCCESS == status);
+}
@@ -22,8 +22,34 @@
 
 #include "php_phalcon.h"
 
+/* Limits of the regular expressions merging the routes, the compiled form has to fit PCRE */
+#define PHALCON_MVC_ROUTER_CHUNK_ROUTES		64
+#define PHALCON_MVC_ROUTER_CHUNK_SIZE		8192
+
+/* Bumped when the layout of the exported routes changes, the blobs of another format are refused */
+#define PHALCON_MVC_ROUTER_EXPORT_FORMAT	1
+
 extern zend_class_entry *phalcon_mvc_router_ce;
 
 PHALCON_INIT_CLASS(Phalcon_Mvc_Router);
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_router_export, 0, 0, 0)
+	ZEND_ARG_INFO(0, hash)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_router_import, 0, 0, 1)
+	ZEND_ARG_INFO(0, data)
+	ZEND_ARG_INFO(0, hash)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_router_save, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, path, IS_STRING, 0)
+	ZEND_ARG_INFO(0, hash)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_router_load, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, path, IS_STRING, 0)
+	ZEND_ARG_INFO(0, hash)
+ZEND_END_ARG_INFO()
+
 #endif /* PHALCON_MVC_ROUTER_H */
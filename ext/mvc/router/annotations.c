@@ -59,6 +59,9 @@ zend_class_entry *phalcon_mvc_router_annotations_ce;
 PHP_METHOD(Phalcon_Mvc_Router_Annotations, addResource);
 PHP_METHOD(Phalcon_Mvc_Router_Annotations, addModuleResource);
 PHP_METHOD(Phalcon_Mvc_Router_Annotations, handle);
+PHP_METHOD(Phalcon_Mvc_Router_Annotations, export);
+PHP_METHOD(Phalcon_Mvc_Router_Annotations, import);
+PHP_METHOD(Phalcon_Mvc_Router_Annotations, load);
 PHP_METHOD(Phalcon_Mvc_Router_Annotations, processControllerAnnotation);
 PHP_METHOD(Phalcon_Mvc_Router_Annotations, processActionAnnotation);
 PHP_METHOD(Phalcon_Mvc_Router_Annotations, setControllerSuffix);
@@ -105,6 +108,9 @@ static const zend_function_entry phalcon_mvc_router_annotations_method_entry[] =
 	PHP_ME(Phalcon_Mvc_Router_Annotations, addResource, arginfo_phalcon_mvc_router_annotations_addresource, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Annotations, addModuleResource, arginfo_phalcon_mvc_router_annotations_addmoduleresource, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Annotations, handle, arginfo_phalcon_mvc_router_annotations_handle, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router_Annotations, export, arginfo_phalcon_mvc_router_export, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router_Annotations, import, arginfo_phalcon_mvc_router_import, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router_Annotations, load, arginfo_phalcon_mvc_router_load, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Annotations, processControllerAnnotation, arginfo_phalcon_mvc_router_annotations_processcontrollerannotation, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Annotations, processActionAnnotation, arginfo_phalcon_mvc_router_annotations_processactionannotation, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Annotations, setControllerSuffix, arginfo_phalcon_mvc_router_annotations_setcontrollersuffix, ZEND_ACC_PUBLIC)
@@ -202,126 +208,140 @@ PHP_METHOD(Phalcon_Mvc_Router_Annotations, addModuleResource){
 }
 
 /**
- * Produce the routing parameters from the rewrite information
- *
- * @param string $uri
+ * Adds the routes of the annotated resources, only those whose prefix starts the URI
+ * when one is given
  */
-PHP_METHOD(Phalcon_Mvc_Router_Annotations, handle){
-
-	zval *uri = NULL, real_uri = {}, service = {}, annotations_service = {}, processed = {}, handlers = {}, controller_suffix = {}, *scope;
+static void phalcon_mvc_router_annotations_process(zval *router, zval *uri)
+{
+	zval service = {}, annotations_service = {}, handlers = {}, controller_suffix = {}, *scope;
 	zend_string *str_key;
 	ulong idx;
 
-	phalcon_fetch_params(0, 0, 1, &uri);
-
-	if (!uri || Z_TYPE_P(uri) == IS_NULL) {
-		PHALCON_CALL_METHOD(&real_uri, getThis(), "getrewriteuri");
-	} else {
-		ZVAL_COPY_VALUE(&real_uri, uri);
-	}
-
 	ZVAL_STR(&service, IS(annotations));
 
-	PHALCON_CALL_METHOD(&annotations_service, getThis(), "getresolveservice", &service);
+	PHALCON_CALL_METHOD(&annotations_service, router, "getresolveservice", &service);
 	PHALCON_VERIFY_INTERFACE(&annotations_service, phalcon_annotations_adapterinterface_ce);
 
-	phalcon_read_property(&processed, getThis(), SL("_processed"), PH_READONLY);
-	if (!zend_is_true(&processed)) {
-		phalcon_read_property(&handlers, getThis(), SL("_handlers"), PH_READONLY);
-		if (Z_TYPE(handlers) == IS_ARRAY) {
-			phalcon_read_property(&controller_suffix, getThis(), SL("_controllerSuffix"), PH_READONLY);
-
-			ZEND_HASH_FOREACH_VAL(Z_ARRVAL(handlers), scope) {
-				zval prefix = {}, handler = {}, controller_name = {}, namespace_name = {}, module_name = {}, suffixed = {};
-				zval handler_annotations = {}, class_annotations = {}, annotations = {}, *annotation, method_annotations = {}, *collection;
-				if (Z_TYPE_P(scope) == IS_ARRAY) {
-					/**
-					 * A prefix (if any) must be in position 0
-					 */
-					phalcon_array_fetch_long(&prefix, scope, 0, PH_NOISY|PH_READONLY);
-					if (Z_TYPE(prefix) == IS_STRING) {
-						if (!phalcon_start_with(&real_uri, &prefix, NULL)) {
-							continue;
-						}
+	phalcon_read_property(&handlers, router, SL("_handlers"), PH_READONLY);
+	if (Z_TYPE(handlers) == IS_ARRAY) {
+		phalcon_read_property(&controller_suffix, router, SL("_controllerSuffix"), PH_READONLY);
+
+		ZEND_HASH_FOREACH_VAL(Z_ARRVAL(handlers), scope) {
+			zval prefix = {}, handler = {}, controller_name = {}, namespace_name = {}, module_name = {}, suffixed = {};
+			zval handler_annotations = {}, class_annotations = {}, annotations = {}, *annotation, method_annotations = {}, *collection;
+			if (Z_TYPE_P(scope) == IS_ARRAY) {
+				/**
+				 * A prefix (if any) must be in position 0
+				 */
+				phalcon_array_fetch_long(&prefix, scope, 0, PH_NOISY|PH_READONLY);
+				if (uri && Z_TYPE(prefix) == IS_STRING) {
+					if (!phalcon_start_with(uri, &prefix, NULL)) {
+						continue;
 					}
+				}
 
+				/**
+				 * The controller must be in position 1
+				 */
+				phalcon_array_fetch_long(&handler, scope, 1, PH_NOISY|PH_READONLY);
+				if (phalcon_memnstr_str(&handler, SL("\\"))) {
 					/**
-					 * The controller must be in position 1
+					 * Extract the real class name from the namespaced class
 					 */
-					phalcon_array_fetch_long(&handler, scope, 1, PH_NOISY|PH_READONLY);
-					if (phalcon_memnstr_str(&handler, SL("\\"))) {
-						/**
-						 * Extract the real class name from the namespaced class
-						 */
-						phalcon_get_class_ns(&controller_name, &handler, 0);
-
-						/**
-						 * Extract the namespace from the namespaced class
-						 */
-						phalcon_get_ns_class(&namespace_name, &handler, 0);
-					} else {
-						ZVAL_COPY_VALUE(&controller_name, &handler);
-					}
-
-					phalcon_update_property_null(getThis(), SL("_routePrefix"));
+					phalcon_get_class_ns(&controller_name, &handler, 0);
 
 					/**
-					 * Check if the scope has a module associated
+					 * Extract the namespace from the namespaced class
 					 */
-					if (phalcon_array_isset_long(scope, 2)) {
-						phalcon_array_fetch_long(&module_name, scope, 2, PH_NOISY|PH_READONLY);
-					}
+					phalcon_get_ns_class(&namespace_name, &handler, 0);
+				} else {
+					ZVAL_COPY_VALUE(&controller_name, &handler);
+				}
 
-					PHALCON_CONCAT_VV(&suffixed, &handler, &controller_suffix);
+				phalcon_update_property_null(router, SL("_routePrefix"));
 
-					/**
-					 * Get the annotations from the class
-					 */
-					PHALCON_CALL_METHOD(&handler_annotations, &annotations_service, "get", &suffixed);
+				/**
+				 * Check if the scope has a module associated
+				 */
+				if (phalcon_array_isset_long(scope, 2)) {
+					phalcon_array_fetch_long(&module_name, scope, 2, PH_NOISY|PH_READONLY);
+				}
 
+				PHALCON_CONCAT_VV(&suffixed, &handler, &controller_suffix);
+
+				/**
+				 * Get the annotations from the class
+				 */
+				PHALCON_CALL_METHOD(&handler_annotations, &annotations_service, "get", &suffixed);
+
+				/**
+				 * Process class annotations
+				 */
+				PHALCON_CALL_METHOD(&class_annotations, &handler_annotations, "getclassannotations");
+				if (Z_TYPE(class_annotations) == IS_OBJECT) {
 					/**
 					 * Process class annotations
 					 */
-					PHALCON_CALL_METHOD(&class_annotations, &handler_annotations, "getclassannotations");
-					if (Z_TYPE(class_annotations) == IS_OBJECT) {
-						/**
-						 * Process class annotations
-						 */
-						PHALCON_CALL_METHOD(&annotations, &class_annotations, "getannotations");
-						if (Z_TYPE(annotations) == IS_ARRAY) {
+					PHALCON_CALL_METHOD(&annotations, &class_annotations, "getannotations");
+					if (Z_TYPE(annotations) == IS_ARRAY) {
+						ZEND_HASH_FOREACH_VAL(Z_ARRVAL(annotations), annotation) {
+							PHALCON_CALL_METHOD(NULL, router, "processcontrollerannotation", &controller_name, annotation);
+						} ZEND_HASH_FOREACH_END();
+
+					}
+				}
+
+				/**
+				 * Process method annotations
+				 */
+				PHALCON_CALL_METHOD(&method_annotations, &handler_annotations, "getmethodsannotations");
+				if (Z_TYPE(method_annotations) == IS_ARRAY) {
+					ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL(method_annotations), idx, str_key, collection) {
+						zval method = {};
+						if (str_key) {
+							ZVAL_STR(&method, str_key);
+						} else {
+							ZVAL_LONG(&method, idx);
+						}
+						if (Z_TYPE_P(collection) == IS_OBJECT) {
+							PHALCON_CALL_METHOD(&annotations, collection, "getannotations");
 							ZEND_HASH_FOREACH_VAL(Z_ARRVAL(annotations), annotation) {
-								PHALCON_CALL_METHOD(NULL, getThis(), "processcontrollerannotation", &controller_name, annotation);
+								PHALCON_CALL_METHOD(NULL, router, "processactionannotation", &module_name, &namespace_name, &controller_name, &method, annotation);
 							} ZEND_HASH_FOREACH_END();
 
 						}
-					}
-
-					/**
-					 * Process method annotations
-					 */
-					PHALCON_CALL_METHOD(&method_annotations, &handler_annotations, "getmethodsannotations");
-					if (Z_TYPE(method_annotations) == IS_ARRAY) {
-						ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL(method_annotations), idx, str_key, collection) {
-							zval method = {};
-							if (str_key) {
-								ZVAL_STR(&method, str_key);
-							} else {
-								ZVAL_LONG(&method, idx);
-							}
-							if (Z_TYPE_P(collection) == IS_OBJECT) {
-								PHALCON_CALL_METHOD(&annotations, collection, "getannotations");
-								ZEND_HASH_FOREACH_VAL(Z_ARRVAL(annotations), annotation) {
-									PHALCON_CALL_METHOD(NULL, getThis(), "processactionannotation", &module_name, &namespace_name, &controller_name, &method, annotation);
-								} ZEND_HASH_FOREACH_END();
-
-							}
-						} ZEND_HASH_FOREACH_END();
-					}
+					} ZEND_HASH_FOREACH_END();
 				}
-			} ZEND_HASH_FOREACH_END();
-		}
+			}
+		} ZEND_HASH_FOREACH_END();
+	}
 
-		phalcon_update_property_bool(getThis(), SL("_processed"), 1);
+	phalcon_update_property_bool(router, SL("_processed"), 1);
+}
+
+/**
+ * Produce the routing parameters from the rewrite information
+ *
+ * @param string $uri
+ */
+PHP_METHOD(Phalcon_Mvc_Router_Annotations, handle){
+
+	zval *uri = NULL, real_uri = {}, processed = {};
+
+	phalcon_fetch_params(0, 0, 1, &uri);
+
+	if (!uri || Z_TYPE_P(uri) == IS_NULL) {
+		PHALCON_CALL_METHOD(&real_uri, getThis(), "getrewriteuri");
+	} else {
+		ZVAL_COPY_VALUE(&real_uri, uri);
+	}
+
+	phalcon_read_property(&processed, getThis(), SL("_processed"), PH_READONLY);
+	if (!zend_is_true(&processed)) {
+		phalcon_mvc_router_annotations_process(getThis(), &real_uri);
+		if (EG(exception)) {
+			return;
+		}
 	}
 
 	/**
@@ -330,6 +350,81 @@ PHP_METHOD(Phalcon_Mvc_Router_Annotations, handle){
 	PHALCON_CALL_PARENT(NULL, phalcon_mvc_router_annotations_ce, getThis(), "handle", &real_uri);
 }
 
+/**
+ * Exports the routes of every resource, see Phalcon\Mvc\Router::export(). The resources
+ * are read here when handle() did not read them yet, export before handling a URI, the
+ * resources whose prefix does not start it are skipped there
+ *
+ * @param string $hash
+ * @return string
+ */
+PHP_METHOD(Phalcon_Mvc_Router_Annotations, export){
+
+	zval *hash = NULL, processed = {};
+
+	phalcon_fetch_params(0, 0, 1, &hash);
+
+	if (!hash) {
+		hash = &PHALCON_GLOBAL(z_null);
+	}
+
+	phalcon_read_property(&processed, getThis(), SL("_processed"), PH_READONLY);
+	if (!zend_is_true(&processed)) {
+		phalcon_mvc_router_annotations_process(getThis(), NULL);
+		if (EG(exception)) {
+			return;
+		}
+	}
+
+	PHALCON_CALL_PARENT(return_value, phalcon_mvc_router_annotations_ce, getThis(), "export", hash);
+}
+
+/**
+ * Imports the routes exported by export(), the resources are not read again
+ *
+ * @param string $data
+ * @param string $hash
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Mvc_Router_Annotations, import){
+
+	zval *data, *hash = NULL;
+
+	phalcon_fetch_params(0, 1, 1, &data, &hash);
+
+	if (!hash) {
+		hash = &PHALCON_GLOBAL(z_null);
+	}
+
+	PHALCON_CALL_PARENT(return_value, phalcon_mvc_router_annotations_ce, getThis(), "import", data, hash);
+	if (zend_is_true(return_value)) {
+		phalcon_update_property_bool(getThis(), SL("_processed"), 1);
+	}
+}
+
+/**
+ * Imports the routes from a file written by save(), the resources are not read again
+ *
+ * @param string $path
+ * @param string $hash
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Mvc_Router_Annotations, load){
+
+	zval *path, *hash = NULL;
+
+	phalcon_fetch_params(0, 1, 1, &path, &hash);
+
+	if (!hash) {
+		hash = &PHALCON_GLOBAL(z_null);
+	}
+
+	PHALCON_CALL_PARENT(return_value, phalcon_mvc_router_annotations_ce, getThis(), "load", path, hash);
+	if (zend_is_true(return_value)) {
+		phalcon_update_property_bool(getThis(), SL("_processed"), 1);
+	}
+}
+
 /**
  * Checks for annotations in the controller docblock
  *
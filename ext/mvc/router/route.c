@@ -61,6 +61,7 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, getPattern);
 PHP_METHOD(Phalcon_Mvc_Router_Route, getCompiledPattern);
 PHP_METHOD(Phalcon_Mvc_Router_Route, getPaths);
 PHP_METHOD(Phalcon_Mvc_Router_Route, getReversedPaths);
+PHP_METHOD(Phalcon_Mvc_Router_Route, getReverseTemplate);
 PHP_METHOD(Phalcon_Mvc_Router_Route, setHttpMethods);
 PHP_METHOD(Phalcon_Mvc_Router_Route, getHttpMethods);
 PHP_METHOD(Phalcon_Mvc_Router_Route, setPrefix);
@@ -136,6 +137,7 @@ static const zend_function_entry phalcon_mvc_router_route_method_entry[] = {
 	PHP_ME(Phalcon_Mvc_Router_Route, getCompiledPattern, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Route, getPaths, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Route, getReversedPaths, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Router_Route, getReverseTemplate, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Route, setHttpMethods, arginfo_phalcon_mvc_router_routeinterface_sethttpmethods, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Route, getHttpMethods, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Router_Route, setPrefix, arginfo_phalcon_mvc_router_route_setprefix, ZEND_ACC_PUBLIC)
@@ -173,6 +175,7 @@ PHALCON_INIT_CLASS(Phalcon_Mvc_Router_Route){
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_pattern"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_compiledPattern"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_paths"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_reverseTemplate"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_methods"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_prefix"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_hostname"), ZEND_ACC_PROTECTED);
@@ -182,6 +185,7 @@ PHALCON_INIT_CLASS(Phalcon_Mvc_Router_Route){
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_beforeMatch"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_group"), ZEND_ACC_PROTECTED);
 	zend_declare_property_long(phalcon_mvc_router_route_ce, SL("_uniqueId"), 0, ZEND_ACC_STATIC|ZEND_ACC_PROTECTED);
+	zend_declare_property_long(phalcon_mvc_router_route_ce, SL("_version"), 0, ZEND_ACC_STATIC|ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_defaultNamespace"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_defaultModule"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_router_route_ce, SL("_defaultController"), ZEND_ACC_PROTECTED);
@@ -196,6 +200,20 @@ PHALCON_INIT_CLASS(Phalcon_Mvc_Router_Route){
 	return SUCCESS;
 }
 
+/**
+ * Every change of a compiled pattern, of the HTTP methods, of a case sensitivity, of a
+ * name, of a hostname or of a url generator moves _version, the routers compare it to
+ * know when their compiled matcher is stale and Phalcon\Mvc\Url when its URLs are
+ */
+static void phalcon_mvc_router_route_changed()
+{
+	zval version = {};
+
+	phalcon_read_static_property_ce(&version, phalcon_mvc_router_route_ce, SL("_version"), PH_READONLY);
+	ZVAL_LONG(&version, Z_TYPE(version) == IS_LONG ? Z_LVAL(version) + 1 : 1);
+	phalcon_update_static_property_ce(phalcon_mvc_router_route_ce, SL("_version"), &version);
+}
+
 /**
  * Phalcon\Mvc\Router\Route constructor
  *
@@ -432,6 +450,8 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, via){
 	phalcon_fetch_params(0, 1, 0, &http_methods);
 
 	phalcon_update_property(getThis(), SL("_methods"), http_methods);
+	phalcon_mvc_router_route_changed();
+
 	RETURN_THIS();
 }
 
@@ -599,11 +619,13 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, reConfigure){
 	 */
 	phalcon_update_property(getThis(), SL("_compiledPattern"), &compiled_pattern);
 	zval_ptr_dtor(&compiled_pattern);
+	phalcon_mvc_router_route_changed();
 
 	/**
 	 * Update the route's paths
 	 */
 	phalcon_update_property(getThis(), SL("_paths"), &route_paths);
+	phalcon_update_property_null(getThis(), SL("_reverseTemplate"));
 	if (unlikely(PHALCON_GLOBAL(debug).enable_debug)) {
 		ZVAL_STRING(&debug_message, "Update Route paths: ");
 		PHALCON_DEBUG_LOG(&debug_message);
@@ -643,6 +665,8 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, setName){
 	phalcon_fetch_params(0, 1, 0, &name);
 
 	phalcon_update_property(getThis(), SL("_name"), name);
+	phalcon_mvc_router_route_changed();
+
 	RETURN_THIS();
 }
 
@@ -745,6 +769,32 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, getReversedPaths){
 	} ZEND_HASH_FOREACH_END();
 }
 
+/**
+ * Returns the template Phalcon\Mvc\Url fills to build the URLs of the route, the
+ * literal text of the pattern alternating with the names of the replacements. The
+ * pattern is only scanned the first time
+ *
+ * @return array
+ */
+PHP_METHOD(Phalcon_Mvc_Router_Route, getReverseTemplate){
+
+	zval pattern = {}, paths = {};
+
+	phalcon_read_property(return_value, getThis(), SL("_reverseTemplate"), PH_COPY);
+	if (Z_TYPE_P(return_value) == IS_ARRAY) {
+		return;
+	}
+
+	PHALCON_CALL_METHOD(&pattern, getThis(), "getpattern");
+	PHALCON_CALL_METHOD(&paths, getThis(), "getreversedpaths");
+
+	phalcon_compile_paths(return_value, &pattern, &paths);
+	zval_ptr_dtor(&pattern);
+	zval_ptr_dtor(&paths);
+
+	phalcon_update_property(getThis(), SL("_reverseTemplate"), return_value);
+}
+
 /**
  * Sets a set of HTTP methods that constraint the matching of the route (alias of via)
  *
@@ -763,6 +813,8 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, setHttpMethods){
 	phalcon_fetch_params(0, 1, 0, &http_methods);
 
 	phalcon_update_property(getThis(), SL("_methods"), http_methods);
+	phalcon_mvc_router_route_changed();
+
 	RETURN_THIS();
 }
 
@@ -821,6 +873,8 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, setHostname){
 	phalcon_fetch_params(0, 1, 0, &hostname);
 
 	phalcon_update_property(getThis(), SL("_hostname"), hostname);
+	phalcon_mvc_router_route_changed();
+
 	RETURN_THIS();
 }
 
@@ -1047,6 +1101,7 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, setUrlGenerator){
 
 	PHALCON_CALL_CE_STATIC(&callback, zend_ce_closure, "bind", generator, getThis());
 	phalcon_update_property(getThis(), SL("_urlGenerator"), &callback);
+	phalcon_mvc_router_route_changed();
 
 	RETURN_THIS();
 }
@@ -1073,6 +1128,7 @@ PHP_METHOD(Phalcon_Mvc_Router_Route, setCaseSensitive){
 	phalcon_fetch_params(0, 1, 0, &case_sensitive);
 
 	phalcon_update_property_bool(getThis(), SL("_caseSensitive"), zend_is_true(case_sensitive));
+	phalcon_mvc_router_route_changed();
 
 	RETURN_THIS();
 }
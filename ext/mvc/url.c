@@ -22,10 +22,12 @@
 #include "mvc/urlinterface.h"
 #include "mvc/url/exception.h"
 #include "mvc/routerinterface.h"
+#include "mvc/router/route.h"
 #include "diinterface.h"
 #include "di/injectable.h"
 
 #include <Zend/zend_closures.h>
+#include <Zend/zend_smart_str.h>
 
 #include "kernel/main.h"
 #include "kernel/memory.h"
@@ -37,6 +39,7 @@
 #include "kernel/concat.h"
 #include "kernel/string.h"
 #include "kernel/framework/router.h"
+#include "kernel/operators.h"
 
 #include "interned-strings.h"
 
@@ -67,6 +70,7 @@ PHP_METHOD(Phalcon_Mvc_Url, get);
 PHP_METHOD(Phalcon_Mvc_Url, getStatic);
 PHP_METHOD(Phalcon_Mvc_Url, path);
 PHP_METHOD(Phalcon_Mvc_Url, isLocal);
+PHP_METHOD(Phalcon_Mvc_Url, setCacheSize);
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_url_setstaticbaseuri, 0, 0, 1)
 	ZEND_ARG_INFO(0, staticBaseUri)
@@ -80,6 +84,10 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_url_islocal, 0, 0, 1)
 	ZEND_ARG_TYPE_INFO(0, uri, IS_STRING, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_mvc_url_setcachesize, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, size, IS_LONG, 0)
+ZEND_END_ARG_INFO()
+
 static const zend_function_entry phalcon_mvc_url_method_entry[] = {
 	PHP_ME(Phalcon_Mvc_Url, setBaseUri, arginfo_phalcon_mvc_urlinterface_setbaseuri, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Url, setStaticBaseUri, arginfo_phalcon_mvc_url_setstaticbaseuri, ZEND_ACC_PUBLIC)
@@ -91,6 +99,7 @@ static const zend_function_entry phalcon_mvc_url_method_entry[] = {
 	PHP_ME(Phalcon_Mvc_Url, getStatic, arginfo_phalcon_mvc_url_getstatic, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Url, path, arginfo_phalcon_mvc_urlinterface_path, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Mvc_Url, isLocal, arginfo_phalcon_mvc_url_islocal, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Mvc_Url, setCacheSize, arginfo_phalcon_mvc_url_setcachesize, ZEND_ACC_PUBLIC)
 	PHP_FE_END
 };
 
@@ -105,6 +114,9 @@ PHALCON_INIT_CLASS(Phalcon_Mvc_Url){
 	zend_declare_property_null(phalcon_mvc_url_ce, SL("_staticBaseUri"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_url_ce, SL("_basePath"), ZEND_ACC_PROTECTED);
 	zend_declare_property_null(phalcon_mvc_url_ce, SL("_router"), ZEND_ACC_PROTECTED);
+	zend_declare_property_long(phalcon_mvc_url_ce, SL("_cacheSize"), 0, ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_mvc_url_ce, SL("_cache"), ZEND_ACC_PROTECTED);
+	zend_declare_property_null(phalcon_mvc_url_ce, SL("_cacheVersion"), ZEND_ACC_PROTECTED);
 
 	zend_class_implements(phalcon_mvc_url_ce, 1, phalcon_mvc_urlinterface_ce);
 
@@ -135,6 +147,7 @@ PHP_METHOD(Phalcon_Mvc_Url, setBaseUri){
 	}
 
 	phalcon_update_property(getThis(), SL("_baseUri"), &trimmed);
+	phalcon_update_property_null(getThis(), SL("_cache"));
 
 	phalcon_read_property(&static_base_uri, getThis(), SL("_staticBaseUri"), PH_NOISY|PH_READONLY);
 	if (Z_TYPE(static_base_uri) == IS_NULL) {
@@ -251,6 +264,175 @@ PHP_METHOD(Phalcon_Mvc_Url, getBasePath){
 	RETURN_MEMBER(getThis(), "_basePath");
 }
 
+/**
+ * Key of the URL cache for the arguments of get(), only built from scalar values
+ */
+static int phalcon_mvc_url_cache_key(smart_str *key, zval *uri)
+{
+	zend_string *str_key;
+	zend_ulong idx;
+	zval *value;
+
+	ZEND_HASH_FOREACH_KEY_VAL_IND(Z_ARRVAL_P(uri), idx, str_key, value) {
+		ZVAL_DEREF(value);
+
+		if (str_key) {
+			smart_str_append_long(key, ZSTR_LEN(str_key));
+			smart_str_appendc(key, ':');
+			smart_str_append(key, str_key);
+		} else {
+			smart_str_appendc(key, '#');
+			smart_str_append_long(key, idx);
+		}
+
+		switch (Z_TYPE_P(value)) {
+			case IS_STRING:
+				smart_str_appendc(key, '=');
+				smart_str_append_long(key, Z_STRLEN_P(value));
+				smart_str_appendc(key, ':');
+				smart_str_append(key, Z_STR_P(value));
+				break;
+			case IS_LONG:
+				smart_str_appendc(key, 'i');
+				smart_str_append_long(key, Z_LVAL_P(value));
+				break;
+			case IS_TRUE:
+				smart_str_appendc(key, 't');
+				break;
+			case IS_FALSE:
+				smart_str_appendc(key, 'f');
+				break;
+			case IS_NULL:
+				smart_str_appendc(key, 'n');
+				break;
+			default:
+				smart_str_free(key);
+				return 0;
+		}
+		smart_str_appendc(key, ';');
+	} ZEND_HASH_FOREACH_END();
+
+	smart_str_0(key);
+	return key->s != NULL;
+}
+
+/**
+ * Returns the router of the named routes, taken from the services container the first time
+ */
+static void phalcon_mvc_url_router(zval *router, zval *url)
+{
+	zval dependency_injector = {}, service = {};
+
+	phalcon_read_property(router, url, SL("_router"), PH_COPY);
+
+	/**
+	 * Check if the router has not previously set
+	 */
+	if (Z_TYPE_P(router) != IS_OBJECT) {
+		PHALCON_CALL_METHOD(&dependency_injector, url, "getdi");
+		if (!zend_is_true(&dependency_injector)) {
+			PHALCON_THROW_EXCEPTION_STR(phalcon_mvc_url_exception_ce, "A dependency injector container is required to obtain the \"url\" service");
+			return;
+		}
+
+		ZVAL_STR(&service, IS(router));
+
+		PHALCON_CALL_METHOD(router, &dependency_injector, "getshared", &service);
+		zval_ptr_dtor(&dependency_injector);
+		PHALCON_VERIFY_INTERFACE(router, phalcon_mvc_routerinterface_ce);
+		phalcon_update_property(url, SL("_router"), router);
+	}
+}
+
+/**
+ * Builds the URL of a named route, the template of a Phalcon\Mvc\Router\Route is filled
+ * in one pass. The URLs of the url generators are not cacheable
+ */
+static void phalcon_mvc_url_route(zval *return_value, zval *router, zval *uri, zval *route_name, zval *base_uri, int *cacheable)
+{
+	zval route = {}, exception_message = {}, generator = {};
+
+	*cacheable = 0;
+
+	/**
+	 * Every route is uniquely identified by a name
+	 */
+	PHALCON_CALL_METHOD(&route, router, "getroutebyname", route_name);
+	if (Z_TYPE(route) != IS_OBJECT) {
+		PHALCON_CONCAT_SVS(&exception_message, "Cannot obtain a route using the name \"", route_name, "\"");
+		PHALCON_THROW_EXCEPTION_ZVAL(phalcon_mvc_url_exception_ce, &exception_message);
+		zval_ptr_dtor(&route);
+		return;
+	}
+
+	/**
+	 * Return the Url Generator
+	 */
+	PHALCON_CALL_METHOD(&generator, &route, "geturlgenerator");
+
+	if (phalcon_is_callable(&generator) || (Z_TYPE(generator) == IS_OBJECT && instanceof_function(Z_OBJCE(generator), zend_ce_closure))) {
+		zval paths = {}, arguments = {};
+
+		PHALCON_CALL_METHOD(&paths, &route, "getreversedpaths");
+
+		array_init_size(&arguments, 3);
+		phalcon_array_append(&arguments, base_uri, PH_COPY);
+		phalcon_array_append(&arguments, &paths, 0);
+		phalcon_array_append(&arguments, uri, PH_COPY);
+		PHALCON_CALL_USER_FUNC_ARRAY(return_value, &generator, &arguments);
+		zval_ptr_dtor(&arguments);
+	} else {
+		zval has_hostname = {}, hostname = {}, template = {};
+		smart_str url_str = {0};
+
+		if (phalcon_array_isset_fetch_str(&has_hostname, uri, SL("hostname"), PH_READONLY) && zend_is_true(&has_hostname)) {
+			PHALCON_CALL_METHOD(&hostname, &route, "gethostname");
+			if (Z_TYPE(hostname) == IS_STRING) {
+				smart_str_append(&url_str, Z_STR(hostname));
+			}
+			zval_ptr_dtor(&hostname);
+		}
+
+		if (Z_TYPE_P(base_uri) == IS_STRING) {
+			smart_str_append(&url_str, Z_STR_P(base_uri));
+		}
+
+		/**
+		 * Replace the patterns by its variables
+		 */
+		if (instanceof_function(Z_OBJCE(route), phalcon_mvc_router_route_ce)) {
+			PHALCON_CALL_METHOD(&template, &route, "getreversetemplate");
+			if (Z_TYPE(template) == IS_ARRAY) {
+				phalcon_fill_paths(&url_str, &template, uri);
+			}
+			zval_ptr_dtor(&template);
+		} else {
+			zval pattern = {}, paths = {}, processed_uri = {};
+
+			PHALCON_CALL_METHOD(&pattern, &route, "getpattern");
+			PHALCON_CALL_METHOD(&paths, &route, "getreversedpaths");
+
+			phalcon_replace_paths(&processed_uri, &pattern, &paths, uri);
+			if (Z_TYPE(processed_uri) == IS_STRING) {
+				smart_str_append(&url_str, Z_STR(processed_uri));
+			}
+			zval_ptr_dtor(&pattern);
+			zval_ptr_dtor(&paths);
+			zval_ptr_dtor(&processed_uri);
+		}
+
+		smart_str_0(&url_str);
+		if (url_str.s) {
+			RETVAL_STR(url_str.s);
+		} else {
+			RETVAL_EMPTY_STRING();
+		}
+		*cacheable = 1;
+	}
+	zval_ptr_dtor(&route);
+	zval_ptr_dtor(&generator);
+}
+
 /**
  * Generates a URL
  *
@@ -272,9 +454,7 @@ PHP_METHOD(Phalcon_Mvc_Url, getBasePath){
  */
 PHP_METHOD(Phalcon_Mvc_Url, get){
 
-	zval *uri = NULL, *args = NULL, *_local = NULL, local = {}, base_uri = {}, dependency_injector = {};
-	zval service = {}, route_name = {}, exception_message = {};
-	zval paths = {}, matched = {}, regexp = {}, generator = {}, arguments = {};
+	zval *uri = NULL, *args = NULL, *_local = NULL, local = {}, base_uri = {}, route_name = {}, matched = {}, regexp = {};
 
 	phalcon_fetch_params(0, 0, 3, &uri, &args, &local);
 
@@ -317,7 +497,9 @@ PHP_METHOD(Phalcon_Mvc_Url, get){
 			ZVAL_ZVAL(return_value, uri, 1, 0);
 		}
 	} else if (Z_TYPE_P(uri) == IS_ARRAY) {
-		zval router = {}, route = {};
+		zval router = {}, cache_size = {}, cache = {}, route_version = {}, version = {}, cache_version = {}, *cached;
+		smart_str cache_key = {0};
+		int cacheable = 0;
 
 		if (!phalcon_array_isset_fetch_str(&route_name, uri, SL("for"), PH_READONLY)) {
 			PHALCON_THROW_EXCEPTION_STR(phalcon_mvc_url_exception_ce, "It's necessary to define the route name with the parameter \"for\"");
@@ -325,80 +507,73 @@ PHP_METHOD(Phalcon_Mvc_Url, get){
 			return;
 		}
 
-		phalcon_read_property(&router, getThis(), SL("_router"), PH_COPY);
+		phalcon_mvc_url_router(&router, getThis());
+		if (EG(exception)) {
+			zval_ptr_dtor(&router);
+			zval_ptr_dtor(&base_uri);
+			return;
+		}
 
 		/**
-		 * Check if the router has not previously set
+		 * The URLs already built for the same arguments, forgotten when a route or the
+		 * router changes
 		 */
-		if (Z_TYPE(router) != IS_OBJECT) {
-			PHALCON_CALL_METHOD(&dependency_injector, getThis(), "getdi");
-			if (!zend_is_true(&dependency_injector)) {
-				PHALCON_THROW_EXCEPTION_STR(phalcon_mvc_url_exception_ce, "A dependency injector container is required to obtain the \"url\" service");
-				return;
+		phalcon_read_property(&cache_size, getThis(), SL("_cacheSize"), PH_READONLY);
+		if (Z_TYPE(cache_size) == IS_LONG && Z_LVAL(cache_size) > 0 && phalcon_mvc_url_cache_key(&cache_key, uri)) {
+			phalcon_read_static_property_ce(&route_version, phalcon_mvc_router_route_ce, SL("_version"), PH_READONLY);
+
+			array_init_size(&version, 2);
+			phalcon_array_append(&version, &route_version, PH_COPY);
+			phalcon_array_append(&version, &router, PH_COPY);
+
+			phalcon_read_property(&cache_version, getThis(), SL("_cacheVersion"), PH_READONLY);
+			phalcon_read_property(&cache, getThis(), SL("_cache"), PH_READONLY);
+
+			if (Z_TYPE(cache) != IS_ARRAY || Z_TYPE(cache_version) != IS_ARRAY || !PHALCON_IS_IDENTICAL(&version, &cache_version)) {
+				phalcon_update_property_empty_array(getThis(), SL("_cache"));
+				phalcon_update_property(getThis(), SL("_cacheVersion"), &version);
+			} else if ((cached = zend_hash_find(Z_ARRVAL(cache), cache_key.s)) != NULL) {
+				ZVAL_COPY(return_value, cached);
+				smart_str_free(&cache_key);
+				zval_ptr_dtor(&version);
+				zval_ptr_dtor(&router);
+				goto query;
 			}
-
-			ZVAL_STR(&service, IS(router));
-
-			PHALCON_CALL_METHOD(&router, &dependency_injector, "getshared", &service);
-			PHALCON_VERIFY_INTERFACE(&router, phalcon_mvc_routerinterface_ce);
-			phalcon_update_property(getThis(), SL("_router"), &router);
+			zval_ptr_dtor(&version);
 		}
 
-		/**
-		 * Every route is uniquely identified by a name
-		 */
-		PHALCON_CALL_METHOD(&route, &router, "getroutebyname", &route_name);
-		if (Z_TYPE(route) != IS_OBJECT) {
-			PHALCON_CONCAT_SVS(&exception_message, "Cannot obtain a route using the name \"", &route_name, "\"");
-			PHALCON_THROW_EXCEPTION_ZVAL(phalcon_mvc_url_exception_ce, &exception_message);
+		phalcon_mvc_url_route(return_value, &router, uri, &route_name, &base_uri, &cacheable);
+		zval_ptr_dtor(&router);
+		if (EG(exception)) {
+			smart_str_free(&cache_key);
 			zval_ptr_dtor(&base_uri);
-			zval_ptr_dtor(&router);
 			return;
 		}
-		zval_ptr_dtor(&router);
-
-		/**
-		 * Return the reversed paths
-		 */
-		PHALCON_CALL_METHOD(&paths, &route, "getreversedpaths");
 
-		/**
-		 * Return the Url Generator
-		 */
-		PHALCON_CALL_METHOD(&generator, &route, "geturlgenerator");
-
-		if (phalcon_is_callable(&generator) || (Z_TYPE(generator) == IS_OBJECT && instanceof_function(Z_OBJCE(generator), zend_ce_closure))) {
-			array_init_size(&arguments, 3);
-			phalcon_array_append(&arguments, &base_uri, PH_COPY);
-			phalcon_array_append(&arguments, &paths, PH_COPY);
-			phalcon_array_append(&arguments, uri, PH_COPY);
-			PHALCON_CALL_USER_FUNC_ARRAY(return_value, &generator, &arguments);
-			zval_ptr_dtor(&arguments);
-		} else {
-			zval pattern = {}, processed_uri = {}, has_hostname = {};
-			PHALCON_CALL_METHOD(&pattern, &route, "getpattern");
-
-			/**
-			 * Replace the patterns by its variables
-			 */
-			phalcon_replace_paths(&processed_uri, &pattern, &paths, uri);
-
-			if (phalcon_array_isset_fetch_str(&has_hostname, uri, SL("hostname"), PH_READONLY) && zend_is_true(&has_hostname)) {
-				zval hostname = {};
-				PHALCON_CALL_METHOD(&hostname, &route, "gethostname");
-				PHALCON_CONCAT_VVV(return_value, &hostname, &base_uri, &processed_uri);
-				zval_ptr_dtor(&pattern);
-				zval_ptr_dtor(&hostname);
-			} else {
-				PHALCON_CONCAT_VV(return_value, &base_uri, &processed_uri);
+		if (cache_key.s && cacheable) {
+			phalcon_read_property(&cache, getThis(), SL("_cache"), PH_READONLY);
+			if (Z_TYPE(cache) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL(cache)) >= Z_LVAL(cache_size)) {
+				zend_string *str_key, *oldest = NULL;
+				zval index = {};
+
+				/* The oldest URL makes room */
+				ZEND_HASH_FOREACH_STR_KEY(Z_ARRVAL(cache), str_key) {
+					oldest = str_key;
+					break;
+				} ZEND_HASH_FOREACH_END();
+
+				if (oldest) {
+					ZVAL_STR_COPY(&index, oldest);
+					phalcon_unset_property_array(getThis(), SL("_cache"), &index);
+					zval_ptr_dtor(&index);
+				}
 			}
-			zval_ptr_dtor(&pattern);
-			zval_ptr_dtor(&processed_uri);
+			phalcon_update_property_array_string(getThis(), SL("_cache"), cache_key.s, return_value);
 		}
-		zval_ptr_dtor(&route);
-		zval_ptr_dtor(&generator);
-		zval_ptr_dtor(&paths);
+		smart_str_free(&cache_key);
 	}
+
+query:
 	zval_ptr_dtor(&base_uri);
 
 	if (zend_is_true(args)) {
@@ -523,3 +698,28 @@ PHP_METHOD(Phalcon_Mvc_Url, isLocal){
 		}
 	}
 }
+
+/**
+ * Keeps up to this number of the URLs get() builds for the named routes, the next
+ * calls with the same arguments return them. The arguments must be scalars, the URLs
+ * are forgotten when the base URI, a route or the router changes. 0, the default,
+ * disables it
+ *
+ *<code>
+ *	$url->setCacheSize(1024);
+ *</code>
+ *
+ * @param int $size
+ * @return Phalcon\Mvc\Url
+ */
+PHP_METHOD(Phalcon_Mvc_Url, setCacheSize){
+
+	zval *size;
+
+	phalcon_fetch_params(0, 1, 0, &size);
+
+	phalcon_update_property_long(getThis(), SL("_cacheSize"), phalcon_get_intval(size));
+	phalcon_update_property_null(getThis(), SL("_cache"));
+
+	RETURN_THIS();
+}
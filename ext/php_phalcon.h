@@ -64,6 +64,11 @@ typedef struct _phalcon_orm_options {
 	zend_bool enable_strict;
 } phalcon_orm_options;
 
+/** Dispatcher options */
+typedef struct _phalcon_dispatcher_options {
+	HashTable *handler_cache;
+} phalcon_dispatcher_options;
+
 /** Validation options */
 typedef struct _phalcon_validation_options {
 	zend_bool allow_empty;
@@ -120,6 +125,9 @@ ZEND_BEGIN_MODULE_GLOBALS(phalcon)
 	/** ORM */
 	phalcon_orm_options orm;
 
+	/** Dispatcher */
+	phalcon_dispatcher_options dispatcher;
+
 	/** Validation */
 	phalcon_validation_options validation;
 
@@ -33,6 +33,7 @@
 #include "kernel/string.h"
 #include "kernel/concat.h"
 #include "kernel/operators.h"
+#include "kernel/coroutine.h"
 
 /**
  * Phalcon\Queue\Beanstalk
@@ -614,6 +615,9 @@ PHP_METHOD(Phalcon_Queue_Beanstalk, read){
 		RETURN_FALSE;
 	}
 
+	/* Inside a server coroutine the other requests run while the reply is pending */
+	phalcon_coroutine_wait_stream(stream, 0, 0);
+
 	if (zend_is_true(length)) {
 		if (php_stream_eof(stream)) {
 			RETURN_FALSE;
@@ -693,6 +697,7 @@ PHP_METHOD(Phalcon_Queue_Beanstalk, write){
 
 	PHALCON_CONCAT_VS(&packet, data, "\r\n");
 
+	phalcon_coroutine_wait_stream(stream, 1, 0);
 	php_stream_write(stream, Z_STRVAL(packet), Z_STRLEN(packet));
 	zval_ptr_dtor(&packet);
 }
@@ -0,0 +1,309 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#include "server/compress.h"
+
+#ifdef PHALCON_USE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <ctype.h>
+#include <stdlib.h>
+
+static const char *phalcon_server_compress_default_types[] = {
+	"text/", "application/json", "application/javascript", "application/xml", "image/svg+xml", NULL
+};
+
+static inline void phalcon_server_compress_lru_unlink(struct phalcon_server_compress_entry *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static inline void phalcon_server_compress_lru_push(struct phalcon_server_compress *compress, struct phalcon_server_compress_entry *entry)
+{
+	entry->next = compress->lru.next;
+	entry->prev = &compress->lru;
+	compress->lru.next->prev = entry;
+	compress->lru.next = entry;
+}
+
+struct phalcon_server_compress *phalcon_server_compress_new(int level, size_t min_length, size_t max_bytes)
+{
+	struct phalcon_server_compress *compress = calloc(1, sizeof(struct phalcon_server_compress));
+
+	compress->level = level >= 1 && level <= 9 ? level : PHALCON_SERVER_COMPRESS_LEVEL;
+	compress->min_length = min_length;
+	compress->max_bytes = max_bytes;
+	compress->num_buckets = 1024;
+	compress->buckets = calloc(compress->num_buckets, sizeof(struct phalcon_server_compress_entry *));
+	compress->lru.next = compress->lru.prev = &compress->lru;
+	pthread_mutex_init(&compress->lock, NULL);
+
+	return compress;
+}
+
+/**
+ * Adds a media type to the allowlist, a type ending with '/' allows every subtype
+ */
+void phalcon_server_compress_add_type(struct phalcon_server_compress *compress, const char *type, size_t type_len)
+{
+	compress->types = realloc(compress->types, (compress->num_types + 1) * sizeof(char *));
+	compress->types[compress->num_types++] = strndup(type, type_len);
+}
+
+static void phalcon_server_compress_evict(struct phalcon_server_compress *compress, struct phalcon_server_compress_entry *entry)
+{
+	struct phalcon_server_compress_entry **slot = &compress->buckets[entry->hash & (compress->num_buckets - 1)];
+
+	while (*slot != entry) {
+		slot = &(*slot)->hash_next;
+	}
+	*slot = entry->hash_next;
+
+	phalcon_server_compress_lru_unlink(entry);
+	compress->bytes -= entry->body_len;
+	free(entry->body);
+	free(entry);
+}
+
+void phalcon_server_compress_free(struct phalcon_server_compress *compress)
+{
+	int i;
+
+	while (compress->lru.next != &compress->lru) {
+		phalcon_server_compress_evict(compress, compress->lru.next);
+	}
+
+	for (i = 0; i < compress->num_types; i++) {
+		free(compress->types[i]);
+	}
+	free(compress->types);
+	free(compress->buckets);
+	pthread_mutex_destroy(&compress->lock);
+	free(compress);
+}
+
+/**
+ * Picks the encoding from an Accept-Encoding value, gzip is preferred over deflate
+ */
+int phalcon_server_compress_negotiate(struct phalcon_server_compress *compress, const char *accept_encoding)
+{
+	const char *p = accept_encoding, *token, *q;
+	size_t token_len;
+	int gzip = 0, deflate = 0, any = 0, *target;
+
+	if (!compress || !accept_encoding) {
+		return PHALCON_SERVER_ENCODING_IDENTITY;
+	}
+
+	while (*p) {
+		while (*p == ' ' || *p == '\t' || *p == ',') {
+			p++;
+		}
+		token = p;
+		while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') {
+			p++;
+		}
+		token_len = p - token;
+		if (!token_len) {
+			break;
+		}
+
+		if (token_len == 4 && !strncasecmp(token, "gzip", 4)) {
+			target = &gzip;
+		} else if (token_len == 7 && !strncasecmp(token, "deflate", 7)) {
+			target = &deflate;
+		} else if (token_len == 1 && *token == '*') {
+			target = &any;
+		} else {
+			target = NULL;
+		}
+
+		/* q=0 refuses the coding */
+		while (*p && *p != ',') {
+			if (*p == ';') {
+				q = p + 1;
+				while (*q == ' ') {
+					q++;
+				}
+				if ((q[0] == 'q' || q[0] == 'Q') && q[1] == '=' && target && strtod(q + 2, NULL) <= 0) {
+					target = NULL;
+				}
+			}
+			p++;
+		}
+
+		if (target) {
+			*target = 1;
+		}
+	}
+
+	if (gzip || any) {
+		return PHALCON_SERVER_ENCODING_GZIP;
+	}
+	if (deflate) {
+		return PHALCON_SERVER_ENCODING_DEFLATE;
+	}
+
+	return PHALCON_SERVER_ENCODING_IDENTITY;
+}
+
+/**
+ * Small bodies and media types that are already compressed are sent as they are
+ */
+int phalcon_server_compress_acceptable(struct phalcon_server_compress *compress, const char *content_type, size_t length)
+{
+	const char *type;
+	size_t type_len, content_type_len;
+	int i;
+
+	if (!compress || length < compress->min_length || !content_type) {
+		return 0;
+	}
+
+	while (*content_type == ' ') {
+		content_type++;
+	}
+	content_type_len = strcspn(content_type, "; \t");
+
+	for (i = 0; compress->num_types ? i < compress->num_types : phalcon_server_compress_default_types[i] != NULL; i++) {
+		type = compress->num_types ? compress->types[i] : phalcon_server_compress_default_types[i];
+		type_len = strlen(type);
+		if (type_len && type[type_len - 1] == '/') {
+			if (content_type_len > type_len && !strncasecmp(content_type, type, type_len)) {
+				return 1;
+			}
+		} else if (content_type_len == type_len && !strncasecmp(content_type, type, type_len)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+const char *phalcon_server_compress_name(int encoding)
+{
+	return encoding == PHALCON_SERVER_ENCODING_GZIP ? "gzip" : (encoding == PHALCON_SERVER_ENCODING_DEFLATE ? "deflate" : "identity");
+}
+
+/**
+ * Returns NULL when the body does not get smaller
+ */
+zend_string *phalcon_server_compress_data(struct phalcon_server_compress *compress, int encoding, const char *data, size_t length)
+{
+#ifdef PHALCON_USE_ZLIB
+	z_stream stream;
+	zend_string *body;
+
+	memset(&stream, 0, sizeof(z_stream));
+
+	/* 31 writes the gzip wrapper, 15 the zlib one HTTP calls deflate */
+	if (deflateInit2(&stream, compress->level, Z_DEFLATED, encoding == PHALCON_SERVER_ENCODING_GZIP ? 31 : 15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return NULL;
+	}
+
+	body = zend_string_alloc(deflateBound(&stream, length), 0);
+
+	stream.next_in = (Bytef *)data;
+	stream.avail_in = length;
+	stream.next_out = (Bytef *)ZSTR_VAL(body);
+	stream.avail_out = ZSTR_LEN(body);
+
+	if (deflate(&stream, Z_FINISH) != Z_STREAM_END || stream.total_out >= length) {
+		deflateEnd(&stream);
+		zend_string_free(body);
+		return NULL;
+	}
+	deflateEnd(&stream);
+
+	ZSTR_LEN(body) = stream.total_out;
+	ZSTR_VAL(body)[ZSTR_LEN(body)] = '\0';
+
+	return body;
+#else
+	return NULL;
+#endif
+}
+
+/**
+ * A hit costs a copy, the threads of the worker never share a zend_string
+ */
+zend_string *phalcon_server_compress_lookup(struct phalcon_server_compress *compress, int encoding, const char *key, size_t key_len)
+{
+	struct phalcon_server_compress_entry *entry;
+	zend_string *body = NULL;
+	zend_ulong hash = zend_inline_hash_func(key, key_len);
+
+	pthread_mutex_lock(&compress->lock);
+	for (entry = compress->buckets[hash & (compress->num_buckets - 1)]; entry; entry = entry->hash_next) {
+		if (entry->hash == hash && entry->encoding == encoding && entry->key_len == key_len && !memcmp(entry->key, key, key_len)) {
+			phalcon_server_compress_lru_unlink(entry);
+			phalcon_server_compress_lru_push(compress, entry);
+			body = zend_string_init(entry->body, entry->body_len, 0);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&compress->lock);
+
+	return body;
+}
+
+void phalcon_server_compress_store(struct phalcon_server_compress *compress, int encoding, const char *key, size_t key_len, zend_string *body)
+{
+	struct phalcon_server_compress_entry *entry;
+	zend_ulong hash = zend_inline_hash_func(key, key_len);
+	size_t index = hash & (compress->num_buckets - 1);
+
+	if (ZSTR_LEN(body) > compress->max_bytes / 4) {
+		return;
+	}
+
+	pthread_mutex_lock(&compress->lock);
+
+	/* Another thread compressed the same body meanwhile */
+	for (entry = compress->buckets[index]; entry; entry = entry->hash_next) {
+		if (entry->hash == hash && entry->encoding == encoding && entry->key_len == key_len && !memcmp(entry->key, key, key_len)) {
+			pthread_mutex_unlock(&compress->lock);
+			return;
+		}
+	}
+
+	while (compress->bytes + ZSTR_LEN(body) > compress->max_bytes && compress->lru.prev != &compress->lru) {
+		phalcon_server_compress_evict(compress, compress->lru.prev);
+	}
+
+	entry = malloc(sizeof(struct phalcon_server_compress_entry) + key_len);
+	memcpy(entry->key, key, key_len);
+	entry->key[key_len] = '\0';
+	entry->key_len = key_len;
+	entry->hash = hash;
+	entry->encoding = encoding;
+	entry->body = malloc(ZSTR_LEN(body));
+	memcpy(entry->body, ZSTR_VAL(body), ZSTR_LEN(body));
+	entry->body_len = ZSTR_LEN(body);
+
+	entry->hash_next = compress->buckets[index];
+	compress->buckets[index] = entry;
+	phalcon_server_compress_lru_push(compress, entry);
+	compress->bytes += entry->body_len;
+
+	pthread_mutex_unlock(&compress->lock);
+}
@@ -0,0 +1,81 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_SERVER_COMPRESS_H
+#define PHALCON_SERVER_COMPRESS_H
+
+#include "php_phalcon.h"
+
+#include "server/utils.h"
+
+#include <pthread.h>
+
+#define PHALCON_SERVER_COMPRESS_LEVEL			6
+#define PHALCON_SERVER_COMPRESS_MIN_LENGTH		1024
+#define PHALCON_SERVER_COMPRESS_CACHE_BYTES		(16 * 1024 * 1024)
+/* Bigger static files are sent as they are with sendfile */
+#define PHALCON_SERVER_COMPRESS_MAX_FILE		(8 * 1024 * 1024)
+
+enum {
+	PHALCON_SERVER_ENCODING_IDENTITY,
+	PHALCON_SERVER_ENCODING_GZIP,
+	PHALCON_SERVER_ENCODING_DEFLATE
+};
+
+/* A compressed variant, the key is the validator of the original */
+struct phalcon_server_compress_entry {
+	struct phalcon_server_compress_entry *prev;
+	struct phalcon_server_compress_entry *next;
+	struct phalcon_server_compress_entry *hash_next;
+	zend_ulong hash;
+	int encoding;
+	char *body;
+	size_t body_len;
+	size_t key_len;
+	char key[1];
+};
+
+/* Process local, the entries are plain memory shared by the threads of a worker */
+struct phalcon_server_compress {
+	int level;
+	size_t min_length;
+	char **types;
+	int num_types;
+	struct phalcon_server_compress_entry **buckets;
+	size_t num_buckets;
+	struct phalcon_server_compress_entry lru;
+	size_t bytes;
+	size_t max_bytes;
+	pthread_mutex_t lock;
+};
+
+struct phalcon_server_compress *phalcon_server_compress_new(int level, size_t min_length, size_t max_bytes);
+void phalcon_server_compress_add_type(struct phalcon_server_compress *compress, const char *type, size_t type_len);
+void phalcon_server_compress_free(struct phalcon_server_compress *compress);
+
+int phalcon_server_compress_negotiate(struct phalcon_server_compress *compress, const char *accept_encoding);
+int phalcon_server_compress_acceptable(struct phalcon_server_compress *compress, const char *content_type, size_t length);
+const char *phalcon_server_compress_name(int encoding);
+
+zend_string *phalcon_server_compress_data(struct phalcon_server_compress *compress, int encoding, const char *data, size_t length);
+zend_string *phalcon_server_compress_lookup(struct phalcon_server_compress *compress, int encoding, const char *key, size_t key_len);
+void phalcon_server_compress_store(struct phalcon_server_compress *compress, int encoding, const char *key, size_t key_len, zend_string *body);
+
+#endif /* PHALCON_SERVER_COMPRESS_H */
@@ -19,6 +19,7 @@
 */
 
 #include "server/core.h"
+#include "server/limiter.h"
 
 #include <sys/select.h>
 
@@ -83,6 +84,11 @@ void phalcon_server_init_signal(struct phalcon_server_context *ctx)
 		phalcon_server_exit_cleanup(ctx);
 	}
 
+	if(sigaddset(&siglist, SIGHUP) == -1) {
+		perror("Unable to add SIGHUP signal to signal list");
+		phalcon_server_exit_cleanup(ctx);
+	}
+
 	if(pthread_sigmask(SIG_BLOCK, &siglist, NULL) != 0) {
 		perror("Unable to change signal mask");
 		phalcon_server_exit_cleanup(ctx);
@@ -152,6 +158,9 @@ struct phalcon_server_conn_context *phalcon_server_alloc_context(struct phalcon_
 	ret->fd = 0;
 	ret->fd_added = 0;
 	ret->next_idx = -1;
+	ret->timer.prev = ret->timer.next = NULL;
+	ret->timer.type = PHALCON_SERVER_TIMEOUT_NONE;
+	ret->accepted_at = ret->message_at = ret->write_at = 0;
 
 	ret->pool = pool;
 
@@ -185,7 +194,511 @@ struct phalcon_server_conn_context *phalcon_server_get_context(struct phalcon_se
 	return ret;
 }
 
-int phalcon_server_init_single_server(struct phalcon_server_context *ctx, struct in_addr ip, uint16_t port)
+void phalcon_server_slab_init(struct phalcon_server_slab *slab, size_t item_size)
+{
+	memset(slab, 0, sizeof(struct phalcon_server_slab));
+
+	/* Freed items keep the free list link in their first bytes */
+	slab->item_size = item_size < sizeof(void *) ? sizeof(void *) : item_size;
+	pthread_mutex_init(&slab->lock, NULL);
+}
+
+static inline void phalcon_server_slab_link(struct phalcon_server_slab *slab, struct phalcon_server_slab_page *page)
+{
+	page->prev = NULL;
+	page->next = slab->partial;
+	if (slab->partial) {
+		slab->partial->prev = page;
+	}
+	slab->partial = page;
+}
+
+static inline void phalcon_server_slab_unlink(struct phalcon_server_slab *slab, struct phalcon_server_slab_page *page)
+{
+	if (page->prev) {
+		page->prev->next = page->next;
+	} else {
+		slab->partial = page->next;
+	}
+	if (page->next) {
+		page->next->prev = page->prev;
+	}
+	page->prev = page->next = NULL;
+}
+
+static inline int phalcon_server_slab_full(struct phalcon_server_slab_page *page)
+{
+	return !page->free_list && page->carved == PHALCON_SERVER_SLAB_ITEMS;
+}
+
+/**
+ * Items are carved out of mmap'd memory pool pages and recycled through the free list of
+ * their page, every item is preceded by a pointer to its page. Pages with a free item are
+ * kept in the partial list, a page is unmapped as soon as its last item is freed unless
+ * it is the only one left
+ */
+void *phalcon_server_slab_alloc(struct phalcon_server_slab *slab)
+{
+	struct phalcon_server_slab_page *page;
+	void **item;
+
+	pthread_mutex_lock(&slab->lock);
+
+	page = slab->partial;
+	if (!page) {
+		size_t size = phalcon_memory_pool_size_hint(MAX(slab->item_size + sizeof(void *), sizeof(struct phalcon_server_slab_page)), PHALCON_SERVER_SLAB_ITEMS + 1);
+		void *mem = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+		phalcon_memory_pool *pool;
+
+		if (mem == MAP_FAILED) {
+			pthread_mutex_unlock(&slab->lock);
+			perror("Unable to mmap slab page");
+			return NULL;
+		}
+
+		pool = phalcon_memory_pool_format(mem, size);
+		page = phalcon_memory_pool_zalloc(pool, sizeof(struct phalcon_server_slab_page));
+		page->pool = pool;
+
+		phalcon_server_slab_link(slab, page);
+		slab->pages++;
+	}
+
+	if (page->free_list) {
+		item = (void **)page->free_list - 1;
+		page->free_list = *(void **)page->free_list;
+	} else {
+		item = phalcon_memory_pool_alloc(page->pool, slab->item_size + sizeof(void *));
+		item[0] = page;
+		page->carved++;
+	}
+
+	page->used++;
+	if (phalcon_server_slab_full(page)) {
+		phalcon_server_slab_unlink(slab, page);
+	}
+
+	slab->allocated++;
+
+	pthread_mutex_unlock(&slab->lock);
+
+	return item + 1;
+}
+
+void phalcon_server_slab_free(struct phalcon_server_slab *slab, void *ptr)
+{
+	struct phalcon_server_slab_page *page;
+	int full;
+
+	if (!ptr) {
+		return;
+	}
+
+	page = ((void **)ptr)[-1];
+
+	pthread_mutex_lock(&slab->lock);
+
+	full = phalcon_server_slab_full(page);
+
+	*(void **)ptr = page->free_list;
+	page->free_list = ptr;
+	page->used--;
+	slab->allocated--;
+
+	if (!page->used && slab->pages > 1) {
+		/* An idle burst must give its memory back, only the last page stays mapped */
+		if (!full) {
+			phalcon_server_slab_unlink(slab, page);
+		}
+		slab->pages--;
+		munmap(page->pool, phalcon_memory_pool_memory_size(page->pool));
+	} else if (full) {
+		phalcon_server_slab_link(slab, page);
+	}
+
+	pthread_mutex_unlock(&slab->lock);
+}
+
+static uint64_t phalcon_server_timer_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000) / PHALCON_SERVER_TIMER_TICK;
+}
+
+void phalcon_server_timer_wheel_init(struct phalcon_server_timer_wheel *wheel)
+{
+	int i;
+
+	for (i = 0; i < PHALCON_SERVER_TIMER_SLOTS; i++) {
+		wheel->slots[i].prev = wheel->slots[i].next = &wheel->slots[i];
+	}
+
+	wheel->current = phalcon_server_timer_now();
+	wheel->count = 0;
+	pthread_mutex_init(&wheel->lock, NULL);
+}
+
+static inline void phalcon_server_timer_unlink(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->prev = timer->next = NULL;
+	wheel->count--;
+}
+
+static inline void phalcon_server_timer_link(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer)
+{
+	struct phalcon_server_timer *slot;
+
+	slot = &wheel->slots[timer->expires % PHALCON_SERVER_TIMER_SLOTS];
+	timer->next = slot;
+	timer->prev = slot->prev;
+	slot->prev->next = timer;
+	slot->prev = timer;
+	wheel->count++;
+}
+
+/**
+ * Arms the timer, the slot is the expiry tick modulo the wheel size so arming and canceling are O(1)
+ */
+void phalcon_server_timer_add(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer, int msec)
+{
+	uint64_t ticks = msec / PHALCON_SERVER_TIMER_TICK;
+
+	pthread_mutex_lock(&wheel->lock);
+
+	if (timer->prev) {
+		phalcon_server_timer_unlink(wheel, timer);
+	}
+
+	timer->expires = phalcon_server_timer_now() + (ticks ? ticks : 1);
+	phalcon_server_timer_link(wheel, timer);
+
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+/**
+ * Takes the timer out of the wheel keeping its type and expiry, it can not fire until it is resumed
+ */
+void phalcon_server_timer_suspend(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer)
+{
+	pthread_mutex_lock(&wheel->lock);
+
+	if (timer->prev) {
+		phalcon_server_timer_unlink(wheel, timer);
+	}
+
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+/**
+ * Puts a suspended timer back at its expiry, one already past fires on the next tick
+ */
+void phalcon_server_timer_resume(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer)
+{
+	uint64_t now;
+
+	pthread_mutex_lock(&wheel->lock);
+
+	if (!timer->prev) {
+		now = phalcon_server_timer_now();
+		if (timer->expires <= now) {
+			timer->expires = now + 1;
+		}
+		phalcon_server_timer_link(wheel, timer);
+	}
+
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+void phalcon_server_timer_cancel(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer)
+{
+	pthread_mutex_lock(&wheel->lock);
+
+	if (timer->prev) {
+		phalcon_server_timer_unlink(wheel, timer);
+	}
+	timer->type = PHALCON_SERVER_TIMEOUT_NONE;
+
+	pthread_mutex_unlock(&wheel->lock);
+}
+
+/**
+ * Runs the callback of every timer due, the slots elapsed since the last call are visited once
+ */
+void phalcon_server_timer_expire(struct phalcon_server_timer_wheel *wheel, void (*callback)(struct phalcon_server_timer *, void *), void *arg)
+{
+	struct phalcon_server_timer *slot, *timer, *next, *expired = NULL;
+	uint64_t now = phalcon_server_timer_now();
+	int scanned = 0;
+
+	pthread_mutex_lock(&wheel->lock);
+
+	while (wheel->count && wheel->current <= now && scanned++ < PHALCON_SERVER_TIMER_SLOTS) {
+		slot = &wheel->slots[wheel->current % PHALCON_SERVER_TIMER_SLOTS];
+		for (timer = slot->next; timer != slot; timer = next) {
+			next = timer->next;
+			if (timer->expires <= now) {
+				phalcon_server_timer_unlink(wheel, timer);
+				timer->next = expired;
+				expired = timer;
+			}
+		}
+		wheel->current++;
+	}
+	wheel->current = now + 1;
+
+	pthread_mutex_unlock(&wheel->lock);
+
+	/* The callbacks may arm or cancel timers */
+	while (expired) {
+		timer = expired;
+		expired = timer->next;
+		timer->next = NULL;
+		callback(timer, arg);
+	}
+}
+
+/**
+ * Runs the callback of every timer of the given type at once, whatever its expiry
+ */
+void phalcon_server_timer_expire_type(struct phalcon_server_timer_wheel *wheel, int type, void (*callback)(struct phalcon_server_timer *, void *), void *arg)
+{
+	struct phalcon_server_timer *slot, *timer, *next, *expired = NULL;
+	int i;
+
+	pthread_mutex_lock(&wheel->lock);
+
+	for (i = 0; wheel->count && i < PHALCON_SERVER_TIMER_SLOTS; i++) {
+		slot = &wheel->slots[i];
+		for (timer = slot->next; timer != slot; timer = next) {
+			next = timer->next;
+			if (timer->type == type) {
+				phalcon_server_timer_unlink(wheel, timer);
+				timer->next = expired;
+				expired = timer;
+			}
+		}
+	}
+
+	pthread_mutex_unlock(&wheel->lock);
+
+	while (expired) {
+		timer = expired;
+		expired = timer->next;
+		timer->next = NULL;
+		callback(timer, arg);
+	}
+}
+
+/**
+ * Arms the connection timer for the given phase, the header timeout is absolute so it is
+ * not pushed back by clients that trickle bytes
+ */
+void phalcon_server_set_timeout(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, int type)
+{
+	if (type == PHALCON_SERVER_TIMEOUT_HEADER && client_ctx->timer.type == type) {
+		if (client_ctx->timer.prev) {
+			return;
+		}
+		if (client_ctx->flags & PHALCON_SERVER_CONN_BUSY) {
+			phalcon_server_timer_resume(&ctx->wheel, &client_ctx->timer);
+			return;
+		}
+	}
+
+	if (type == PHALCON_SERVER_TIMEOUT_NONE || ctx->timeouts[type] <= 0) {
+		phalcon_server_timer_cancel(&ctx->wheel, &client_ctx->timer);
+		return;
+	}
+
+	client_ctx->timer.type = type;
+	phalcon_server_timer_add(&ctx->wheel, &client_ctx->timer, ctx->timeouts[type]);
+}
+
+static void phalcon_server_process_timeout(struct phalcon_server_timer *timer, void *arg)
+{
+	struct phalcon_server_context *ctx = (struct phalcon_server_context *)arg;
+	struct phalcon_server_conn_context *client_ctx;
+
+	client_ctx = (struct phalcon_server_conn_context *)((char *)timer - XtOffsetOf(struct phalcon_server_conn_context, timer));
+
+	phalcon_server_log_printf(ctx, "Timeout %d on socket %d\n", timer->type, client_ctx->fd);
+
+	if (ctx->timeout) {
+		ctx->timeout(ctx, client_ctx);
+	} else {
+		phalcon_server_client_close(client_ctx);
+		phalcon_server_free_context(client_ctx);
+	}
+}
+
+static struct phalcon_server_output_chunk *phalcon_server_output_push(struct phalcon_server_context *ctx, struct phalcon_server_output *output)
+{
+	if (output->tail == output->size) {
+		if (output->head > 0) {
+			memmove(output->chunks, output->chunks + output->head, (output->tail - output->head) * sizeof(struct phalcon_server_output_chunk));
+			output->tail -= output->head;
+			output->head = 0;
+		} else if (!output->size) {
+			output->chunks = phalcon_server_slab_alloc(&ctx->chunks);
+			assert(output->chunks);
+			output->size = PHALCON_SERVER_OUTPUT_CHUNKS;
+		} else {
+			/* Only deep pipelines outgrow the slab item */
+			struct phalcon_server_output_chunk *chunks = malloc(output->size * 2 * sizeof(struct phalcon_server_output_chunk));
+			assert(chunks);
+			memcpy(chunks, output->chunks, output->size * sizeof(struct phalcon_server_output_chunk));
+			if (output->size == PHALCON_SERVER_OUTPUT_CHUNKS) {
+				phalcon_server_slab_free(&ctx->chunks, output->chunks);
+			} else {
+				free(output->chunks);
+			}
+			output->chunks = chunks;
+			output->size *= 2;
+		}
+	}
+
+	return &output->chunks[output->tail++];
+}
+
+static void phalcon_server_output_release(struct phalcon_server_context *ctx, struct phalcon_server_output *output)
+{
+	if (output->size == PHALCON_SERVER_OUTPUT_CHUNKS) {
+		phalcon_server_slab_free(&ctx->chunks, output->chunks);
+	} else if (output->chunks) {
+		free(output->chunks);
+	}
+
+	memset(output, 0, sizeof(struct phalcon_server_output));
+}
+
+void phalcon_server_output_append_string(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, zend_string *str)
+{
+	struct phalcon_server_output_chunk *chunk;
+
+	if (!ZSTR_LEN(str)) {
+		return;
+	}
+
+	chunk = phalcon_server_output_push(ctx, &client_ctx->output);
+	chunk->str = zend_string_copy(str);
+	chunk->file_fd = -1;
+	chunk->offset = 0;
+	chunk->length = ZSTR_LEN(str);
+	client_ctx->output.length += ZSTR_LEN(str);
+}
+
+void phalcon_server_output_append_file(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, int file_fd, off_t offset, size_t length)
+{
+	struct phalcon_server_output_chunk *chunk;
+
+	if (!length) {
+		close(file_fd);
+		return;
+	}
+
+	chunk = phalcon_server_output_push(ctx, &client_ctx->output);
+	chunk->str = NULL;
+	chunk->file_fd = file_fd;
+	chunk->offset = offset;
+	chunk->length = length;
+	client_ctx->output.length += length;
+}
+
+/**
+ * Writes the queued chunks, strings are gathered with writev and files are sent with sendfile,
+ * returns 1 when everything was written, 0 when the socket would block and -1 on error
+ */
+int phalcon_server_output_flush(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+	struct phalcon_server_output *output = &client_ctx->output;
+	struct phalcon_server_output_chunk *chunk;
+	struct iovec iov[PHALCON_SERVER_MAX_IOVECS];
+	ssize_t ret;
+	int i, n;
+
+	while (output->head < output->tail) {
+		chunk = &output->chunks[output->head];
+
+		if (!chunk->str) {
+			ret = sendfile(client_ctx->fd, chunk->file_fd, &chunk->offset, chunk->length);
+			if (ret < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return errno == EAGAIN ? 0 : -1;
+			}
+			if (ret == 0) {
+				/* The file was truncated */
+				return -1;
+			}
+			phalcon_server_metrics_add(&ctx->wdata[client_ctx->cpu_id].metrics.bytes_out, ret);
+			output->length -= ret;
+			chunk->length -= ret;
+			if (!chunk->length) {
+				close(chunk->file_fd);
+				output->head++;
+			}
+			continue;
+		}
+
+		for (n = 0, i = output->head; i < output->tail && n < PHALCON_SERVER_MAX_IOVECS && output->chunks[i].str; i++, n++) {
+			iov[n].iov_base = ZSTR_VAL(output->chunks[i].str) + output->chunks[i].offset;
+			iov[n].iov_len = output->chunks[i].length;
+		}
+
+		ret = writev(client_ctx->fd, iov, n);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN ? 0 : -1;
+		}
+		phalcon_server_metrics_add(&ctx->wdata[client_ctx->cpu_id].metrics.bytes_out, ret);
+		output->length -= ret;
+
+		/* Partial writes keep their position in the chunk */
+		while (ret > 0) {
+			chunk = &output->chunks[output->head];
+			if ((size_t)ret >= chunk->length) {
+				ret -= chunk->length;
+				zend_string_release(chunk->str);
+				output->head++;
+			} else {
+				chunk->offset += ret;
+				chunk->length -= ret;
+				ret = 0;
+			}
+		}
+	}
+
+	/* Nothing is kept for idle keep-alive connections */
+	phalcon_server_output_release(ctx, output);
+
+	return 1;
+}
+
+void phalcon_server_output_free(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+	struct phalcon_server_output *output = &client_ctx->output;
+	int i;
+
+	for (i = output->head; i < output->tail; i++) {
+		if (output->chunks[i].str) {
+			zend_string_release(output->chunks[i].str);
+		} else {
+			close(output->chunks[i].file_fd);
+		}
+	}
+
+	phalcon_server_output_release(ctx, output);
+}
+
+int phalcon_server_init_single_server(struct phalcon_server_context *ctx, struct in_addr ip, uint16_t port, int reuseport)
 {
 	struct sockaddr_in addr;
 	socklen_t addrlen = sizeof(addr);
@@ -206,6 +719,13 @@ int phalcon_server_init_single_server(struct phalcon_server_context *ctx, struct
 		phalcon_server_exit_cleanup(ctx);
 	}
 
+#ifdef SO_REUSEPORT
+	if (reuseport && setsockopt(serverfd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value)) == -1) {
+		perror("Unable to set socket reuseport option");
+		phalcon_server_exit_cleanup(ctx);
+	}
+#endif
+
 	memset(&addr, 0, addrlen);
 	addr.sin_family = AF_INET;
 	addr.sin_port = htons(port);
@@ -224,6 +744,24 @@ int phalcon_server_init_single_server(struct phalcon_server_context *ctx, struct
 	return serverfd;
 }
 
+static int phalcon_server_reuseport_supported()
+{
+#ifdef SO_REUSEPORT
+	int fd, value = 1, ret;
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
+		return 0;
+	}
+
+	ret = setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &value, sizeof(value));
+	close(fd);
+
+	return ret == 0;
+#else
+	return 0;
+#endif
+}
+
 void phalcon_server_init_server(struct phalcon_server_context *ctx)
 {
 	int ret, i;
@@ -233,14 +771,25 @@ void phalcon_server_init_server(struct phalcon_server_context *ctx)
 	assert(ctx->start_cpu >= 0 && ctx->start_cpu < phalcon_server_get_cpu_num());
 	assert(ctx->start_cpu <= phalcon_server_get_cpu_num() - ctx->start_cpu);
 
+	if (ctx->enable_reuseport && !phalcon_server_reuseport_supported()) {
+		phalcon_server_log_printf(ctx, "SO_REUSEPORT unsupported, sharing listen sockets\n");
+		ctx->enable_reuseport = 0;
+	}
+
 	for (i = 0; i < ctx->la_num; i++){
 		struct in_addr ip;
 		uint16_t port;
 
+		/* Every worker opens its own listen sockets */
+		if (ctx->enable_reuseport) {
+			ctx->la[i].listen_fd = -1;
+			continue;
+		}
+
 		ip = ctx->la[i].listenip;
 		port = ctx->la[i].param_port;
 
-		ctx->la[i].listen_fd = phalcon_server_init_single_server(ctx, ip, port);
+		ctx->la[i].listen_fd = phalcon_server_init_single_server(ctx, ip, port, 0);
 	}
 
 	limits.rlim_cur = RLIM_INFINITY;
@@ -271,31 +820,31 @@ void phalcon_server_init_server(struct phalcon_server_context *ctx)
 #if PHALCON_USE_THREADPOOL
 /* Thread start */
 static void phalcon_server_worker_thread_process(void *arg) {
-	struct phalcon_server_worker_data *data = (struct phalcon_server_worker_data *)arg;
+	struct phalcon_server_context *ctx = (struct phalcon_server_context *)arg;
 
-	while(likely(!data->shutdown)) {
-		struct phalcon_server_worker_queue_op *op = phalcon_message_queue_read(&data->worker_queue);
+	while(1) {
+		struct phalcon_server_worker_queue_op *op = phalcon_message_queue_read(&ctx->worker_queue);
 
-		phalcon_server_log_printf(op->ctx, "Thread op %d, cpu %d\n", op->type, op->client_ctx->cpu_id);
+		phalcon_server_log_printf(op->ctx, "Thread op %d, cpu %d\n", op->type, ctx->cpu_id);
 		switch(op->type) {
 		case OP_EXIT:
-			phalcon_message_queue_message_free(&data->worker_queue, op);
+			phalcon_message_queue_message_free(&ctx->worker_queue, op);
 			return;
 		default:
 			op->handler(op->ctx, op->client_ctx);
 			break;
 		}
-		phalcon_message_queue_message_free(&data->worker_queue, op);
+		phalcon_message_queue_message_free(&ctx->worker_queue, op);
 	}
 }
 
 static void phalcon_server_worker_threadpool_init(struct phalcon_server_context *ctx, struct phalcon_server_worker_data *data) {
 	int i;
-	data->main_thread = pthread_self();
-	phalcon_message_queue_init(&data->worker_queue, sizeof(struct phalcon_server_worker_queue_op), 512);
+	ctx->main_thread = pthread_self();
+	phalcon_message_queue_init(&ctx->worker_queue, sizeof(struct phalcon_server_worker_queue_op), 512);
 	for(i=0;i<PHALCON_SERVER_MAX_WORKER_THREADS;++i) {
 		phalcon_server_log_printf(ctx, "Thread create %d, cpu %d\n", i, data->cpu_id);
-		pthread_create(&data->worker_threads[i], NULL, (void *)&phalcon_server_worker_thread_process, (void *)data);
+		pthread_create(&ctx->worker_threads[i], NULL, (void *)&phalcon_server_worker_thread_process, (void *)ctx);
 	}
 }
 
@@ -303,18 +852,222 @@ static void phalcon_server_worker_threadpool_destroy(struct phalcon_server_conte
 	int i;
 	for(i=0;i<PHALCON_SERVER_MAX_WORKER_THREADS;++i) {
 		phalcon_server_log_printf(ctx, "Thread destroy %d, cpu %d\n", i, data->cpu_id);
-		struct phalcon_server_worker_queue_op *op = phalcon_message_queue_message_alloc_blocking(&data->worker_queue);
+		struct phalcon_server_worker_queue_op *op = phalcon_message_queue_message_alloc_blocking(&ctx->worker_queue);
 		phalcon_server_log_printf(ctx, "Thread destroy %d, cpu %d\n", i, data->cpu_id);
 		op->type = OP_EXIT;
-		phalcon_message_queue_write(&data->worker_queue, op);
+		phalcon_message_queue_write(&ctx->worker_queue, op);
 		phalcon_server_log_printf(ctx, "Thread destroy %d, cpu %d\n", i, data->cpu_id);
 	}
-
+	for(i=0;i<PHALCON_SERVER_MAX_WORKER_THREADS;++i) {
+		pthread_join(ctx->worker_threads[i], NULL);
+	}
 }
 #endif
 
 /* Thread end */
 
+static volatile sig_atomic_t phalcon_server_drain_requested = 0;
+
+static void phalcon_server_drain_handler(int signum)
+{
+	phalcon_server_drain_requested = 1;
+}
+
+/**
+ * Stops accepting, the connections already accepted are served until they are closed
+ */
+static void phalcon_server_begin_drain(struct phalcon_server_context *ctx, struct phalcon_server_conn_context **listen_ctxs)
+{
+	struct epoll_event evt;
+	uint64_t accept_failures;
+	int i;
+
+	ctx->draining = 1;
+
+	for (i = 0; i < ctx->la_num; i++) {
+		if (ctx->enable_reuseport) {
+			/* Closing a SO_REUSEPORT socket resets its backlog, take what is queued first,
+			 * a pass takes a batch and stops at the first failed accept(), EAGAIN included */
+			do {
+				accept_failures = ctx->wdata[listen_ctxs[i]->cpu_id].accept_cnt;
+				listen_ctxs[i]->events = EPOLLIN;
+				listen_ctxs[i]->handler(ctx, listen_ctxs[i]);
+			} while (ctx->wdata[listen_ctxs[i]->cpu_id].accept_cnt == accept_failures);
+		}
+
+		evt.events = 0;
+		evt.data.ptr = listen_ctxs[i];
+		epoll_ctl(listen_ctxs[i]->ep_fd, EPOLL_CTL_DEL, listen_ctxs[i]->fd, &evt);
+
+		/* The shared listen socket stays open, it belongs to the master */
+		if (ctx->enable_reuseport) {
+			close(listen_ctxs[i]->fd);
+		}
+		phalcon_server_free_context(listen_ctxs[i]);
+	}
+
+	/* The idle keep-alive connections have nothing to finish, the busy ones keep their timer out of the wheel */
+	phalcon_server_timer_expire_type(&ctx->wheel, PHALCON_SERVER_TIMEOUT_KEEPALIVE, phalcon_server_process_timeout, ctx);
+
+	phalcon_server_log_printf(ctx, "cpu[%d] draining %d connections\n", ctx->cpu_id, ctx->pool->allocated);
+}
+
+/**
+ * Runs the read handler of the connection, on a pool thread when there is a pool
+ */
+void phalcon_server_dispatch_read(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+#if PHALCON_USE_THREADPOOL
+	struct phalcon_server_worker_queue_op *op;
+
+	phalcon_server_log_printf(ctx, "Message queue write cpu %d\n", ctx->cpu_id);
+
+	/* The wheel expires on this thread, the timer stays out of it until the pool thread is done */
+	__sync_fetch_and_or(&client_ctx->flags, PHALCON_SERVER_CONN_BUSY);
+	phalcon_server_timer_suspend(&ctx->wheel, &client_ctx->timer);
+
+	op = phalcon_message_queue_message_alloc_blocking(&ctx->worker_queue);
+	op->type = OP_READ;
+	op->ctx = ctx;
+	op->client_ctx = client_ctx;
+	op->handler = client_ctx->handler;
+	phalcon_message_queue_write(&ctx->worker_queue, op);
+#else
+	client_ctx->handler(ctx, client_ctx);
+#endif
+}
+
+static struct phalcon_server_context *phalcon_server_coroutine_ctx = NULL;
+
+static void phalcon_server_coroutine_connection(void *arg)
+{
+	struct phalcon_server_conn_context *client_ctx = (struct phalcon_server_conn_context *)arg;
+	struct phalcon_server_context *ctx = phalcon_server_coroutine_ctx;
+
+	lthread_detach();
+
+	ctx->coroutine(ctx, client_ctx);
+
+	lthread_close(client_ctx->fd);
+	phalcon_server_free_context(client_ctx);
+}
+
+/**
+ * One acceptor coroutine per listen socket, it checks for a drain request every second
+ */
+static void phalcon_server_coroutine_accept(void *arg)
+{
+	struct phalcon_server_conn_context *listen_ctx = (struct phalcon_server_conn_context *)arg;
+	struct phalcon_server_context *ctx = phalcon_server_coroutine_ctx;
+	struct phalcon_server_conn_context *client_ctx;
+	struct pahlcon_server_socket_address client_addr;
+	socklen_t client_addrlen;
+	lthread_t *lt;
+	int client_fd, draining;
+
+	lthread_detach();
+
+	while (!ctx->wdata[listen_ctx->cpu_id].shutdown) {
+		/* Closing a SO_REUSEPORT socket resets its backlog, a last pass takes what is queued */
+		draining = phalcon_server_drain_requested;
+		if (draining && !ctx->enable_reuseport) {
+			break;
+		}
+		if (!draining && lthread_wait_read(listen_ctx->fd, 1000) < 0) {
+			continue;
+		}
+
+		while (ctx->pool->allocated < ctx->pool->total) {
+			client_addrlen = sizeof(client_addr);
+#ifdef HAVE_ACCEPT4
+			client_fd = accept4(listen_ctx->fd, (struct sockaddr *) &client_addr, &client_addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+			client_fd = accept(listen_ctx->fd, (struct sockaddr *) &client_addr, &client_addrlen);
+#endif
+			if (client_fd < 0) {
+				if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					ctx->wdata[listen_ctx->cpu_id].accept_cnt++;
+				}
+				break;
+			}
+#ifndef HAVE_ACCEPT4
+			fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+			if (ctx->limiter && phalcon_server_limiter_blocked(ctx->limiter, &client_addr)) {
+				phalcon_server_metrics_add(&ctx->wdata[listen_ctx->cpu_id].metrics.rate_limited, 1);
+				close(client_fd);
+				continue;
+			}
+
+			client_ctx = phalcon_server_alloc_context(ctx->pool);
+			client_ctx->fd = client_fd;
+			client_ctx->accepted_at = phalcon_server_metrics_now();
+			memcpy(&client_ctx->addr, &client_addr, sizeof(client_addr));
+			client_ctx->addr.len = client_addrlen;
+			client_ctx->cpu_id = listen_ctx->cpu_id;
+			client_ctx->ep_fd = -1;
+			ctx->wdata[listen_ctx->cpu_id].acceptcnt++;
+
+			if (lthread_create(&lt, phalcon_server_coroutine_connection, client_ctx) != 0) {
+				close(client_fd);
+				phalcon_server_free_context(client_ctx);
+			}
+		}
+
+		if (draining) {
+			break;
+		}
+	}
+
+	/* Draining, the connection coroutines finish and lthread_run() returns */
+	ctx->draining = 1;
+	if (ctx->enable_reuseport) {
+		lthread_close(listen_ctx->fd);
+	}
+	phalcon_server_free_context(listen_ctx);
+}
+
+/**
+ * Coroutine mode, a blocking call of a request yields to the other requests of the worker
+ */
+static void phalcon_server_process_clients_coroutine(struct phalcon_server_context *ctx, struct phalcon_server_worker_data *mydata)
+{
+	struct phalcon_server_conn_context *listen_ctx;
+	struct sigaction sa;
+	lthread_t *lt;
+	int i;
+
+	phalcon_server_coroutine_ctx = ctx;
+
+	for (i = 0; i < ctx->la_num; i++) {
+		if (ctx->enable_reuseport) {
+			ctx->la[i].listen_fd = phalcon_server_init_single_server(ctx, ctx->la[i].listenip, ctx->la[i].param_port, 1);
+		}
+
+		listen_ctx = phalcon_server_alloc_context(ctx->pool);
+		listen_ctx->fd = ctx->la[i].listen_fd;
+		listen_ctx->cpu_id = mydata->cpu_id;
+		listen_ctx->ep_fd = -1;
+
+		if (lthread_create(&lt, phalcon_server_coroutine_accept, listen_ctx) != 0) {
+			perror("Unable to create accept coroutine");
+			phalcon_server_exit_cleanup(ctx);
+		}
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = phalcon_server_drain_handler;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGQUIT, &sa, NULL);
+
+	mydata->ready = getpid();
+
+	phalcon_coroutine_scheduler_begin();
+	lthread_run();
+	phalcon_coroutine_scheduler_end();
+}
+
 void phalcon_server_process_clients(struct phalcon_server_context *ctx, void *arg)
 {
 	struct phalcon_server_worker_data *mydata = (struct phalcon_server_worker_data *)arg;
@@ -327,10 +1080,14 @@ void phalcon_server_process_clients(struct phalcon_server_context *ctx, void *ar
 	int ret;
 
 	int cpu_id = mydata->cpu_id;;
-	int ep_fd;
+	int ep_fd, signal_fd;
 	int i;
+	time_t drain_deadline = 0;
+	struct signalfd_siginfo siginfo;
+	sigset_t sigquit;
 
 	struct phalcon_server_conn_context *listen_ctx;
+	struct phalcon_server_conn_context *listen_ctxs[32];
 
 	ret = phalcon_server_bind_process_cpu(cpu_id);
 	if (ret < 0) {
@@ -340,13 +1097,33 @@ void phalcon_server_process_clients(struct phalcon_server_context *ctx, void *ar
 
 	ctx->pool = phalcon_server_init_pool(PHALCON_SERVER_MAX_CONNS_PER_WORKER);
 
+	/* Idle connections own no buffers, they are borrowed from the worker slabs while in use */
+	phalcon_server_slab_init(&ctx->buffers, PHALCON_SERVER_MAX_BUFSIZE);
+	phalcon_server_slab_init(&ctx->chunks, PHALCON_SERVER_OUTPUT_CHUNKS * sizeof(struct phalcon_server_output_chunk));
+
+	phalcon_server_timer_wheel_init(&ctx->wheel);
+
+	if (ctx->coroutine) {
+		phalcon_server_process_clients_coroutine(ctx, mydata);
+		return;
+	}
+
 	if ((ep_fd = epoll_create(PHALCON_SERVER_MAX_CONNS_PER_WORKER)) < 0) {
 		perror("Unable to create epoll FD");
 		phalcon_server_exit_cleanup(ctx);
 	}
 
+#if PHALCON_USE_THREADPOOL
+	FD_ZERO(&listen_fds);
+#endif
 	for (i = 0; i < ctx->la_num; i++) {
 		listen_ctx = phalcon_server_alloc_context(ctx->pool);
+		listen_ctxs[i] = listen_ctx;
+
+		if (ctx->enable_reuseport) {
+			/* The kernel balances the connections between the sockets of the workers */
+			ctx->la[i].listen_fd = phalcon_server_init_single_server(ctx, ctx->la[i].listenip, ctx->la[i].param_port, 1);
+		}
 
 		listen_ctx->fd = ctx->la[i].listen_fd;
 		listen_ctx->handler = ctx->accept ? ctx->accept : phalcon_server_builtin_process_accept;
@@ -354,6 +1131,12 @@ void phalcon_server_process_clients(struct phalcon_server_context *ctx, void *ar
 		listen_ctx->ep_fd = ep_fd;
 
 		evt.events = EPOLLIN | EPOLLHUP | EPOLLERR;
+#ifdef EPOLLEXCLUSIVE
+		/* A shared listen socket only wakes up one of the workers */
+		if (!ctx->enable_reuseport) {
+			evt.events |= EPOLLEXCLUSIVE;
+		}
+#endif
 		evt.data.ptr = listen_ctx;
 
 		if (epoll_ctl(listen_ctx->ep_fd, EPOLL_CTL_ADD, listen_ctx->fd, &evt) < 0) {
@@ -364,17 +1147,50 @@ void phalcon_server_process_clients(struct phalcon_server_context *ctx, void *ar
 		FD_SET(listen_ctx->fd, &listen_fds);
 #endif
 	}
+
+	/**
+	 * SIGQUIT asks the worker to drain, it is sent once its replacement accepts. It is blocked
+	 * before the pool threads inherit the mask and read from the epoll set, a handler could run
+	 * on a pool thread while this one sleeps in epoll_wait()
+	 */
+	sigemptyset(&sigquit);
+	sigaddset(&sigquit, SIGQUIT);
+	if (pthread_sigmask(SIG_BLOCK, &sigquit, NULL) != 0 || (signal_fd = signalfd(-1, &sigquit, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+		perror("Unable to create the drain signal FD");
+		phalcon_server_exit_cleanup(ctx);
+	}
+
+	evt.events = EPOLLIN;
+	evt.data.ptr = &phalcon_server_drain_requested;
+	if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, signal_fd, &evt) < 0) {
+		perror("Unable to add the drain signal FD to epoll");
+		phalcon_server_exit_cleanup(ctx);
+	}
+
 #if PHALCON_USE_THREADPOOL
 	phalcon_server_worker_threadpool_init(ctx, mydata);
 #endif
 	mydata->polls_min = PHALCON_SERVER_EVENTS_PER_BATCH;
 
+	mydata->ready = getpid();
+
 	while (likely(!mydata->shutdown)) {
 		int num_events;
 		int i;
 		int events;
 
-		num_events = epoll_wait(ep_fd, evts, PHALCON_SERVER_EVENTS_PER_BATCH, -1);
+		if (unlikely(phalcon_server_drain_requested)) {
+			if (!ctx->draining) {
+				phalcon_server_begin_drain(ctx, listen_ctxs);
+				drain_deadline = time(NULL) + PHALCON_SERVER_DRAIN_TIMEOUT;
+			}
+			if (!ctx->pool->allocated || time(NULL) >= drain_deadline) {
+				break;
+			}
+		}
+
+		/* Wake up every tick while connection timers are armed */
+		num_events = epoll_wait(ep_fd, evts, PHALCON_SERVER_EVENTS_PER_BATCH, ctx->wheel.count || ctx->draining ? PHALCON_SERVER_TIMER_TICK : -1);
 		if (num_events < 0) {
 			if (errno == EINTR)
 				continue;
@@ -395,6 +1211,13 @@ void phalcon_server_process_clients(struct phalcon_server_context *ctx, void *ar
 		for (i = 0 ; i < num_events; i++) {
 			int active_fd;
 
+			if (unlikely(evts[i].data.ptr == &phalcon_server_drain_requested)) {
+				while (read(signal_fd, &siginfo, sizeof(siginfo)) == sizeof(siginfo)) {
+					phalcon_server_drain_requested = 1;
+				}
+				continue;
+			}
+
 			events = evts[i].events;
 			listen_ctx = evts[i].data.ptr;
 			listen_ctx->events = events;
@@ -406,52 +1229,122 @@ void phalcon_server_process_clients(struct phalcon_server_context *ctx, void *ar
 			if(events & EPOLLOUT || FD_ISSET(active_fd, &listen_fds)) {
 				listen_ctx->handler(ctx, listen_ctx);
 			} else {
-				phalcon_server_log_printf(ctx, "Message queue write cpu %d\n", cpu_id);
-				struct phalcon_server_worker_queue_op *op = phalcon_message_queue_message_alloc_blocking(&mydata->worker_queue);
-				op->type = OP_READ;
-				op->ctx = ctx;
-				op->client_ctx = listen_ctx;
-				op->handler = listen_ctx->handler;
-				phalcon_message_queue_write(&mydata->worker_queue, op);
+				phalcon_server_dispatch_read(ctx, listen_ctx);
 			}
 #else
 			listen_ctx->handler(ctx, listen_ctx);
 #endif
 		}
+
+		if (ctx->wheel.count) {
+			phalcon_server_timer_expire(&ctx->wheel, phalcon_server_process_timeout, ctx);
+		}
 	}
 #if PHALCON_USE_THREADPOOL
 	phalcon_server_worker_threadpool_destroy(ctx, mydata);
 #endif
+	close(signal_fd);
+}
+
+static pid_t phalcon_server_fork_worker(struct phalcon_server_context *ctx, int i)
+{
+	pid_t pid;
+
+	if ( (pid = fork()) < 0) {
+		perror("Unable to fork child process");
+		return pid;
+	} else if( pid == 0) {
+		ctx->wdata[i].process = getpid();
+		ctx->cpu_id = ctx->wdata[i].cpu_id ;
+		phalcon_server_process_clients(ctx, (void *)&(ctx->wdata[i]));
+		exit(0);
+	}
+
+	ctx->wdata[i].process = pid;
+
+	return pid;
 }
 
 void phalcon_server_init_workers(struct phalcon_server_context *ctx)
 {
-	int i, pid;
+	int i;
+
+	size_t size = ctx->num_workers * sizeof(struct phalcon_server_worker_data);
 
-	ctx->wdata = mmap(NULL, ctx->num_workers * sizeof(struct phalcon_server_worker_data),
+	if (ctx->limiter) {
+		size = ZEND_MM_ALIGNED_SIZE_EX(size, 64) + phalcon_server_limiter_size(ctx->limiter);
+	}
+
+	ctx->wdata = mmap(NULL, size,
 		     PROT_READ|PROT_WRITE,
 		     MAP_ANON|MAP_SHARED,
 		     -1, 0);
 
-	memset(ctx->wdata, 0, ctx->num_workers * sizeof(struct phalcon_server_worker_data));
-
-	if (ctx->wdata == NULL) {
+	if (ctx->wdata == MAP_FAILED) {
 		perror("Unable to mmap shared global wdata");
 		phalcon_server_exit_cleanup(ctx);
 	}
 
+	memset(ctx->wdata, 0, size);
+
+	if (ctx->limiter) {
+		ctx->limiter->slots = (struct phalcon_server_limiter_slot *)((char *)ctx->wdata + ZEND_MM_ALIGNED_SIZE_EX(ctx->num_workers * sizeof(struct phalcon_server_worker_data), 64));
+	}
+
 	for(i = 0; i < ctx->num_workers; i++) {
 		ctx->wdata[i].trancnt = 0;
 		ctx->wdata[i].cpu_id = i + ctx->start_cpu;
 
-		if ( (pid = fork()) < 0) {
-			perror("Unable to fork child process");
+		if (phalcon_server_fork_worker(ctx, i) < 0) {
 			phalcon_server_exit_cleanup(ctx);
-		} else if( pid == 0) {
-			ctx->wdata[i].process = getpid();
-			ctx->cpu_id = ctx->wdata[i].cpu_id ;
-			phalcon_server_process_clients(ctx, (void *)&(ctx->wdata[i]));
-			exit(0);
+		}
+	}
+}
+
+/**
+ * Rolling reload, one CPU at a time a new worker is forked and the old one drains once
+ * the new one accepts, the listen sockets of the master are never closed
+ */
+void phalcon_server_reload_workers(struct phalcon_server_context *ctx)
+{
+	pid_t old;
+	int i, waited;
+
+	for(i = 0; i < ctx->num_workers; i++) {
+		old = ctx->wdata[i].process;
+
+		/* A worker still draining from the previous reload is stopped now */
+		if (ctx->wdata[i].retired) {
+			kill(ctx->wdata[i].retired, SIGTERM);
+		}
+		ctx->wdata[i].retired = old;
+
+		if (phalcon_server_fork_worker(ctx, i) < 0) {
+			ctx->wdata[i].retired = 0;
+			continue;
+		}
+
+		for (waited = 0; ctx->wdata[i].ready != ctx->wdata[i].process && waited < PHALCON_SERVER_READY_TIMEOUT; waited += 10) {
+			usleep(10 * 1000);
+		}
+
+		if (old) {
+			phalcon_server_log_printf(ctx, "drain process %d\n", old);
+			kill(old, SIGQUIT);
+		}
+	}
+}
+
+static void phalcon_server_reap_workers(struct phalcon_server_context *ctx)
+{
+	pid_t pid;
+	int i;
+
+	while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+		for(i = 0; i < ctx->num_workers; i++) {
+			if (ctx->wdata[i].retired == pid) {
+				ctx->wdata[i].retired = 0;
+			}
 		}
 	}
 }
@@ -514,12 +1407,22 @@ void phalcon_server_builtin_process_accept(struct phalcon_server_context *ctx, s
 		fcntl(client_fd, F_SETFL, flags);
 #endif
 
+		/* A client over its rate is dropped before its request is read */
+		if (ctx->limiter && phalcon_server_limiter_blocked(ctx->limiter, &client_addr)) {
+			phalcon_server_metrics_add(&ctx->wdata[cpu_id].metrics.rate_limited, 1);
+			close(client_fd);
+			continue;
+		}
+
 		phalcon_server_log_printf(ctx, "Accept socket %d from %d\n", client_fd, listen_fd);
 
 		client_ctx = phalcon_server_alloc_context(listen_ctx->pool);
 		assert(client_ctx);
 
 		client_ctx->fd = client_fd;
+		client_ctx->accepted_at = phalcon_server_metrics_now();
+		memcpy(&client_ctx->addr, &client_addr, sizeof(client_addr));
+		client_ctx->addr.len = client_addrlen;
 
 		client_ctx->handler = ctx->read;
 
@@ -537,6 +1440,8 @@ void phalcon_server_builtin_process_accept(struct phalcon_server_context *ctx, s
 
 		client_ctx->fd_added = 1;
 		ctx->wdata[cpu_id].acceptcnt++;
+
+		phalcon_server_set_timeout(ctx, client_ctx, PHALCON_SERVER_TIMEOUT_HEADER);
 	}
 
 	goto back;
@@ -573,6 +1478,11 @@ void phalcon_server_do_stats(struct phalcon_server_context *ctx)
 		phalcon_server_exit_cleanup(ctx);
 	}
 
+	if(sigaddset(&siglist, SIGHUP) == -1) {
+		perror("Unable to add SIGHUP signal to stats signal list");
+		phalcon_server_exit_cleanup(ctx);
+	}
+
 	FILE *p = fdopen(ctx->pfd, "w");
 
 	while(1) {
@@ -583,6 +1493,9 @@ void phalcon_server_do_stats(struct phalcon_server_context *ctx)
 
 		if(signum == SIGALRM) {
 			uint64_t acceptcnt = 0, trancnt = 0;
+			struct phalcon_server_histogram handle = {0};
+
+			phalcon_server_reap_workers(ctx);
 
 			for(i = 0; i < ctx->num_workers; i++)
 			{
@@ -594,12 +1507,17 @@ void phalcon_server_do_stats(struct phalcon_server_context *ctx)
 						ctx->wdata[i].polls_lst, ctx->wdata[i].polls_min, ctx->wdata[i].polls_max,
 						ctx->wdata[i].polls_avg, ctx->wdata[i].accept_cnt, ctx->wdata[i].read_cnt,
 						ctx->wdata[i].write_cnt);
+				phalcon_server_histogram_merge(&handle, &ctx->wdata[i].metrics.histograms[PHALCON_SERVER_METRIC_HANDLE]);
 				ctx->wdata[i].acceptcnt_prev = ctx->wdata[i].acceptcnt;
 				ctx->wdata[i].trancnt_prev = ctx->wdata[i].trancnt;
 			}
 
-			fprintf(p, "\tRequest/s %8"PRIu64",%8"PRIu64"\n", acceptcnt, trancnt);
+			fprintf(p, "\tRequest/s %8"PRIu64",%8"PRIu64"\tp99 %8"PRIu64"us\n", acceptcnt, trancnt,
+				phalcon_server_histogram_percentile(&handle, 0.99));
 
+		} else if(signum == SIGHUP) {
+			fprintf(p, "Reloading workers\n");
+			phalcon_server_reload_workers(ctx);
 		} else if(signum == SIGINT) {
 			phalcon_server_stop_workers(ctx);
 			break;
@@ -624,6 +1542,9 @@ void phalcon_server_stop_workers(struct phalcon_server_context *ctx)
 				phalcon_server_log_printf(ctx, "kill process %d\n", ctx->wdata[i].process);
 				kill(ctx->wdata[i].process, SIGTERM);
 			}
+			if (ctx->wdata[i].retired) {
+				kill(ctx->wdata[i].retired, SIGTERM);
+			}
 		}
 	}
 }
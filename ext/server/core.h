@@ -26,6 +26,10 @@
 #include <Zend/zend_smart_str.h>
 
 #include "kernel/message/queue.h"
+#include "kernel/mpool.h"
+#include "server/metrics.h"
+#include "kernel/coroutine.h"
+#include "kernel/lthread/lthread.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -37,21 +41,27 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sched.h>
 #include <sys/syscall.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/resource.h>
+#include <sys/wait.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <pthread.h>
 
 #if HAVE_EPOLL
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
 #endif
 
 #ifndef PHALCON_USE_THREADPOOL
@@ -61,6 +71,31 @@
 #define PHALCON_SERVER_MAX_CONNS_PER_WORKER		8192
 #define PHALCON_SERVER_MAX_BUFSIZE				2048
 
+#define PHALCON_SERVER_CONN_CLOSE				0x01
+/* Handed to a pool thread, its timer is suspended */
+#define PHALCON_SERVER_CONN_BUSY				0x02
+
+#define PHALCON_SERVER_OUTPUT_CHUNKS			8
+/* Bytes queued for a connection above which its pipelined messages are not parsed */
+#define PHALCON_SERVER_OUTPUT_MAX				(256 * 1024)
+#define PHALCON_SERVER_SLAB_ITEMS				256
+
+#define PHALCON_SERVER_DRAIN_TIMEOUT			30
+#define PHALCON_SERVER_READY_TIMEOUT			5000
+
+#define PHALCON_SERVER_TIMER_SLOTS				512
+#define PHALCON_SERVER_TIMER_TICK				100
+
+enum {
+	PHALCON_SERVER_TIMEOUT_NONE,
+	PHALCON_SERVER_TIMEOUT_HEADER,
+	PHALCON_SERVER_TIMEOUT_BODY,
+	PHALCON_SERVER_TIMEOUT_KEEPALIVE,
+	PHALCON_SERVER_TIMEOUT_WRITE,
+	PHALCON_SERVER_TIMEOUT_MAX
+};
+#define PHALCON_SERVER_MAX_IOVECS				64
+
 #define PHALCON_SERVER_EVENTS_PER_BATCH			64
 #define PHALCON_SERVER_ACCEPT_PER_LISTEN_EVENT	1
 #define PHALCON_SERVER_MAX_WORKER_THREADS		4
@@ -69,6 +104,8 @@ typedef struct phalcon_server_conn_context phalcon_server_conn_context_t;
 typedef struct phalcon_server_context phalcon_server_context_t;
 typedef struct phalcon_server_context_pool phalcon_server_context_pool_t;
 
+struct phalcon_server_limiter;
+
 struct pahlcon_server_socket_address {
     union {
         struct sockaddr_in inet_v4;
@@ -78,6 +115,52 @@ struct pahlcon_server_socket_address {
     socklen_t len;
 };
 
+struct phalcon_server_slab_page {
+	struct phalcon_server_slab_page *prev;
+	struct phalcon_server_slab_page *next;
+	phalcon_memory_pool *pool;
+	void *free_list;
+	size_t carved;
+	size_t used;
+};
+
+struct phalcon_server_slab {
+	size_t item_size;
+	struct phalcon_server_slab_page *partial;
+	size_t pages;
+	size_t allocated;
+	pthread_mutex_t lock;
+};
+
+struct phalcon_server_timer {
+	struct phalcon_server_timer *prev;
+	struct phalcon_server_timer *next;
+	uint64_t expires;
+	int type;
+};
+
+struct phalcon_server_timer_wheel {
+	uint64_t current;
+	size_t count;
+	struct phalcon_server_timer slots[PHALCON_SERVER_TIMER_SLOTS];
+	pthread_mutex_t lock;
+};
+
+struct phalcon_server_output_chunk {
+	zend_string *str;
+	int file_fd;
+	off_t offset;
+	size_t length;
+};
+
+struct phalcon_server_output {
+	struct phalcon_server_output_chunk *chunks;
+	int head;
+	int tail;
+	int size;
+	size_t length;
+};
+
 struct phalcon_server_conn_context {
 	int fd;
 	int fd_added;
@@ -88,9 +171,13 @@ struct phalcon_server_conn_context {
 	int events;
 	int data_len;
 	int next_idx;
-	char buf[PHALCON_SERVER_MAX_BUFSIZE];
 	void *user_data;
-	zend_string *response;
+	struct phalcon_server_output output;
+	struct phalcon_server_timer timer;
+	uint64_t accepted_at;
+	uint64_t message_at;
+	uint64_t write_at;
+	struct pahlcon_server_socket_address addr;
 	phalcon_server_context_pool_t *pool;
 } *arr;
 
@@ -119,6 +206,8 @@ struct phalcon_server_worker_queue_op {
 
 struct phalcon_server_worker_data {
 	pid_t process;
+	pid_t ready;
+	pid_t retired;
 	uint64_t trancnt;
 	uint64_t trancnt_prev;
 	uint64_t acceptcnt;
@@ -134,16 +223,13 @@ struct phalcon_server_worker_data {
 	uint64_t accept_cnt;
 	uint64_t read_cnt;
 	uint64_t write_cnt;
+	struct phalcon_server_metrics metrics;
 	int shutdown;
-#if PHALCON_USE_THREADPOOL
-	pthread_t main_thread;
-	pthread_t worker_threads[PHALCON_SERVER_MAX_WORKER_THREADS];
-	struct phalcon_message_queue worker_queue;
-#endif
 };
 
 struct phalcon_server_context {
 	int enable_verbose;
+	int enable_reuseport;
 	int num_workers;
 	int start_cpu;
 	int la_num;
@@ -151,12 +237,28 @@ struct phalcon_server_context {
 	FILE *log_file;
 	zend_string *log_path;
 	int cpu_id;
+	int draining;
 	phalcon_server_context_pool_t *pool;
+	struct phalcon_server_slab buffers;
+	struct phalcon_server_slab chunks;
+	struct phalcon_server_timer_wheel wheel;
+	int timeouts[PHALCON_SERVER_TIMEOUT_MAX];
 	struct phalcon_server_worker_data *wdata;
+	/* Token buckets shared by the workers, their slots follow wdata in the same mapping */
+	struct phalcon_server_limiter *limiter;
 	struct phalcon_server_listen_addr la[32];
+#if PHALCON_USE_THREADPOOL
+	/* Process local, an old and a new worker share the worker data of a CPU during a reload */
+	pthread_t main_thread;
+	pthread_t worker_threads[PHALCON_SERVER_MAX_WORKER_THREADS];
+	struct phalcon_message_queue worker_queue;
+#endif
 	void (*accept)(phalcon_server_context_t *, phalcon_server_conn_context_t *);
 	void (*read)(phalcon_server_context_t *, phalcon_server_conn_context_t *);
 	void (*write)(phalcon_server_context_t *, phalcon_server_conn_context_t *);
+	void (*timeout)(phalcon_server_context_t *, phalcon_server_conn_context_t *);
+	/* When set each connection runs in an lthread coroutine instead of the epoll handlers */
+	void (*coroutine)(phalcon_server_context_t *, phalcon_server_conn_context_t *);
 };
 
 void phalcon_server_init_log(struct phalcon_server_context *ctx);
@@ -165,6 +267,7 @@ void phalcon_server_init_signal(struct phalcon_server_context *ctx);
 void phalcon_server_init_timer(struct phalcon_server_context *ctx);
 void phalcon_server_init_workers(struct phalcon_server_context *ctx);
 void phalcon_server_do_stats(struct phalcon_server_context *ctx);
+void phalcon_server_reload_workers(struct phalcon_server_context *ctx);
 void phalcon_server_exit_cleanup(struct phalcon_server_context *ctx);
 void phalcon_server_stop_workers(struct phalcon_server_context *ctx);
 
@@ -173,6 +276,29 @@ struct phalcon_server_conn_context *phalcon_server_alloc_context(struct phalcon_
 void phalcon_server_free_context(struct phalcon_server_conn_context *client_ctx);
 struct phalcon_server_conn_context *phalcon_server_get_context(struct phalcon_server_context_pool *pool, int fd);
 
+void phalcon_server_slab_init(struct phalcon_server_slab *slab, size_t item_size);
+void *phalcon_server_slab_alloc(struct phalcon_server_slab *slab);
+void phalcon_server_slab_free(struct phalcon_server_slab *slab, void *ptr);
+
+void phalcon_server_timer_wheel_init(struct phalcon_server_timer_wheel *wheel);
+void phalcon_server_timer_add(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer, int msec);
+void phalcon_server_timer_suspend(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer);
+void phalcon_server_timer_resume(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer);
+void phalcon_server_timer_cancel(struct phalcon_server_timer_wheel *wheel, struct phalcon_server_timer *timer);
+void phalcon_server_timer_expire(struct phalcon_server_timer_wheel *wheel, void (*callback)(struct phalcon_server_timer *, void *), void *arg);
+void phalcon_server_timer_expire_type(struct phalcon_server_timer_wheel *wheel, int type, void (*callback)(struct phalcon_server_timer *, void *), void *arg);
+void phalcon_server_set_timeout(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, int type);
+
+void phalcon_server_output_append_string(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, zend_string *str);
+void phalcon_server_output_append_file(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, int file_fd, off_t offset, size_t length);
+int phalcon_server_output_flush(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx);
+void phalcon_server_output_free(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx);
+
+static inline int phalcon_server_output_pending(struct phalcon_server_conn_context *client_ctx){
+	return client_ctx->output.head < client_ctx->output.tail;
+}
+
+void phalcon_server_dispatch_read(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx);
 void phalcon_server_builtin_process_accept(struct phalcon_server_context *ctx, struct phalcon_server_conn_context * listen_ctx);
 
 static inline int phalcon_server_get_cpu_num(){
@@ -189,13 +315,4 @@ static inline int phalcon_server_get_cpu_num(){
     	memcpy(a, b, sizeof(zval)); \
 	}
 
-#define PHALCON_SERVER_STRING_APPEND(dest, str) \
-	{ \
-		int old_len, len; \
-		old_len = ZSTR_LEN(dest); len = ZSTR_LEN(str); \
-		dest = zend_string_extend(dest, old_len + len + 1, 0); \
-		memcpy(&(ZSTR_VAL(dest)[old_len]), ZSTR_VAL(str), len); \
-		ZSTR_VAL(dest)[old_len + len] = '\0'; \
-	}
-
 #endif /* PHALCON_SERVER_CORE_H */
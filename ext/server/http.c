@@ -22,6 +22,11 @@
 #include "server/core.h"
 #include "server/exception.h"
 #include "server/utils.h"
+#include "server/limiter.h"
+#include "http/request.h"
+#include "http/response.h"
+#include "di.h"
+#include "di/service.h"
 
 #include "kernel/main.h"
 #include "kernel/memory.h"
@@ -33,12 +38,52 @@
 #include "kernel/object.h"
 #include "kernel/exception.h"
 
+#include "interned-strings.h"
+
+#include <main/SAPI.h>
+#include <main/php_variables.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
 /**
  * Phalcon\Server\Http
  *
+ * Every parsed request is exposed to the application as its "request" service,
+ * method, headers, query and body are read from it instead of the superglobals.
+ *
+ * With 'keepalive' => true, the default, a connection is kept open after its response
+ * and the pipelined requests are answered in order, 'timeout' => ['keepalive' => seconds]
+ * closes it once it stays idle.
+ *
+ * With 'reuseport' => true every worker binds its own listener and the kernel spreads the
+ * connections over them.
+ *
+ * Sending SIGHUP to the master replaces the workers one CPU at a time, the old ones stop
+ * accepting and finish their connections before exiting.
+ *
+ * With 'coroutine' => true every connection runs in a coroutine, the blocking calls of
+ * Phalcon\Socket\Client and Phalcon\Queue\Beanstalk yield to the other requests of the worker.
+ * Each request is handled by its own clone of the application and of its container, the
+ * shared services are resolved again for it and Di::getDefault() returns its container.
+ *
+ * The 'static' mounts map url prefixes to directories, their files are answered by the
+ * workers with sendfile and only the urls without a file reach the application.
+ *
+ * With 'compress' the text responses are sent with gzip or deflate, the variants of the
+ * static files and of the responses with an ETag are kept compressed by each worker.
+ *
+ * The bodies bigger than 'body' => ['buffer' => bytes] are written to a temporary file and
+ * the files of a multipart/form-data upload go to their own ones while they arrive,
+ * 'max' answers 413 to bigger bodies before they are read.
+ *
+ * The 'limit' token buckets are shared by all the workers, a client over its rate gets 429
+ * without reaching the application and its new connections are closed on accept.
+ *
  *<code>
  *
- *	$server = new Phalcon\Server\Http('127.0.0.1', 8989);
+ *	$server = new Phalcon\Server\Http(['host' => '127.0.0.1', 'port' => 8989, 'timeout' => ['header' => 10, 'keepalive' => 15], 'metrics' => '/server-metrics', 'static' => ['/' => __DIR__ . '/public'], 'compress' => ['min_length' => 1024], 'body' => ['buffer' => 1048576, 'max' => 67108864], 'limit' => ['rate' => 100, 'burst' => 200, 'routes' => ['/login' => ['rate' => 1, 'burst' => 5]]]]);
  *  $server->start($application);
  *
  *</code>
@@ -83,6 +128,22 @@ void phalcon_server_http_object_free_handler(zend_object *object)
 {
 	phalcon_server_http_object *intern = phalcon_server_http_object_from_obj(object);
 
+	if (intern->metrics_path) {
+		zend_string_release(intern->metrics_path);
+	}
+
+	if (intern->statics) {
+		phalcon_server_static_free(intern->statics);
+	}
+
+	if (intern->compress) {
+		phalcon_server_compress_free(intern->compress);
+	}
+
+	if (intern->ctx.limiter) {
+		phalcon_server_limiter_free(intern->ctx.limiter);
+	}
+
 	if (intern->ctx.log_path) {
 		zend_string_release(intern->ctx.log_path);
 	}
@@ -106,8 +167,9 @@ PHALCON_INIT_CLASS(Phalcon_Server_Http){
  */
 PHP_METHOD(Phalcon_Server_Http, __construct){
 
-	zval *config, verbose = {}, worker = {}, log_path = {}, host = {}, port = {};
+	zval *config, verbose = {}, worker = {}, keepalive = {}, reuseport = {}, coroutine = {}, timeout = {}, metrics = {}, statics = {}, static_cache = {}, compress = {}, body = {}, limit = {}, option = {}, log_path = {}, host = {}, port = {}, seconds = {}, *root;
 	phalcon_server_http_object *intern;
+	zend_string *prefix;
 	int num_workers = 2;
 
 	phalcon_fetch_params(0, 1, 0, &config);
@@ -126,6 +188,134 @@ PHP_METHOD(Phalcon_Server_Http, __construct){
 
 	intern->ctx.num_workers = num_workers > phalcon_server_get_cpu_num() ? phalcon_server_get_cpu_num() : num_workers;
 
+	if (phalcon_array_isset_fetch_str(&keepalive, config, SL("keepalive"), PH_READONLY)) {
+		intern->enable_keepalive = zend_is_true(&keepalive);
+	} else {
+		intern->enable_keepalive = 1;
+	}
+
+	if (phalcon_array_isset_fetch_str(&reuseport, config, SL("reuseport"), PH_READONLY)) {
+		intern->ctx.enable_reuseport = zend_is_true(&reuseport);
+	}
+
+	if (phalcon_array_isset_fetch_str(&coroutine, config, SL("coroutine"), PH_READONLY)) {
+		intern->enable_coroutine = zend_is_true(&coroutine);
+	}
+
+	/* The latency histograms of every worker are served on this path */
+	if (phalcon_array_isset_fetch_str(&metrics, config, SL("metrics"), PH_READONLY) && Z_TYPE(metrics) == IS_STRING && Z_STRLEN(metrics)) {
+		intern->metrics_path = zend_string_copy(Z_STR(metrics));
+	}
+
+	/* Url prefix => directory, each worker caches the open files, 'static_cache' entries at most */
+	if (phalcon_array_isset_fetch_str(&statics, config, SL("static"), PH_READONLY) && Z_TYPE(statics) == IS_ARRAY) {
+		if (phalcon_array_isset_fetch_str(&static_cache, config, SL("static_cache"), PH_READONLY) && Z_TYPE(static_cache) == IS_LONG && Z_LVAL(static_cache) > 0) {
+			intern->statics = phalcon_server_static_new(Z_LVAL(static_cache));
+		} else {
+			intern->statics = phalcon_server_static_new(PHALCON_SERVER_STATIC_CACHE_SIZE);
+		}
+
+		ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL(statics), prefix, root) {
+			if (!prefix || Z_TYPE_P(root) != IS_STRING) {
+				PHALCON_THROW_EXCEPTION_STR(phalcon_server_exception_ce, "The static mounts must be url prefix => directory");
+				return;
+			}
+			phalcon_server_static_add_mount(intern->statics, ZSTR_VAL(prefix), ZSTR_LEN(prefix), Z_STRVAL_P(root), Z_STRLEN_P(root));
+		} ZEND_HASH_FOREACH_END();
+	}
+
+	/* gzip/deflate negotiated on Accept-Encoding, true or ['level', 'min_length', 'types', 'cache' => bytes] */
+#ifdef PHALCON_USE_ZLIB
+	if (phalcon_array_isset_fetch_str(&compress, config, SL("compress"), PH_READONLY) && zend_is_true(&compress)) {
+		int level = PHALCON_SERVER_COMPRESS_LEVEL;
+		size_t min_length = PHALCON_SERVER_COMPRESS_MIN_LENGTH, cache_bytes = PHALCON_SERVER_COMPRESS_CACHE_BYTES;
+
+		if (Z_TYPE(compress) == IS_ARRAY) {
+			if (phalcon_array_isset_fetch_str(&option, &compress, SL("level"), PH_READONLY) && Z_TYPE(option) == IS_LONG) {
+				level = Z_LVAL(option);
+			}
+			if (phalcon_array_isset_fetch_str(&option, &compress, SL("min_length"), PH_READONLY) && Z_TYPE(option) == IS_LONG && Z_LVAL(option) >= 0) {
+				min_length = Z_LVAL(option);
+			}
+			if (phalcon_array_isset_fetch_str(&option, &compress, SL("cache"), PH_READONLY) && Z_TYPE(option) == IS_LONG && Z_LVAL(option) >= 0) {
+				cache_bytes = Z_LVAL(option);
+			}
+		}
+
+		intern->compress = phalcon_server_compress_new(level, min_length, cache_bytes);
+
+		if (Z_TYPE(compress) == IS_ARRAY && phalcon_array_isset_fetch_str(&option, &compress, SL("types"), PH_READONLY) && Z_TYPE(option) == IS_ARRAY) {
+			ZEND_HASH_FOREACH_VAL(Z_ARRVAL(option), root) {
+				if (Z_TYPE_P(root) == IS_STRING) {
+					phalcon_server_compress_add_type(intern->compress, Z_STRVAL_P(root), Z_STRLEN_P(root));
+				}
+			} ZEND_HASH_FOREACH_END();
+		}
+	}
+#endif
+
+	/* Bytes of a body kept in memory and bytes accepted at all, 0 for no limit */
+	intern->body_buffer = PHALCON_HTTP_PARSER_BODY_BUFFER;
+	if (phalcon_array_isset_fetch_str(&body, config, SL("body"), PH_READONLY) && Z_TYPE(body) == IS_ARRAY) {
+		if (phalcon_array_isset_fetch_str(&option, &body, SL("buffer"), PH_READONLY) && Z_TYPE(option) == IS_LONG && Z_LVAL(option) >= 0) {
+			intern->body_buffer = Z_LVAL(option);
+		}
+		if (phalcon_array_isset_fetch_str(&option, &body, SL("max"), PH_READONLY) && Z_TYPE(option) == IS_LONG && Z_LVAL(option) >= 0) {
+			intern->body_max = Z_LVAL(option);
+		}
+	}
+
+	/* Requests per second and burst of a client address, 'routes' => [url prefix => ['rate', 'burst']] adds a bucket per prefix */
+	if (phalcon_array_isset_fetch_str(&limit, config, SL("limit"), PH_READONLY) && Z_TYPE(limit) == IS_ARRAY) {
+		zval burst = {};
+
+		if (phalcon_array_isset_fetch_str(&option, &limit, SL("slots"), PH_READONLY) && Z_TYPE(option) == IS_LONG && Z_LVAL(option) > 0) {
+			intern->ctx.limiter = phalcon_server_limiter_new(Z_LVAL(option));
+		} else {
+			intern->ctx.limiter = phalcon_server_limiter_new(PHALCON_SERVER_LIMITER_SLOTS);
+		}
+
+		if (phalcon_array_isset_fetch_str(&option, &limit, SL("rate"), PH_READONLY)) {
+			phalcon_array_isset_fetch_str(&burst, &limit, SL("burst"), PH_READONLY);
+			phalcon_server_limiter_add_rule(intern->ctx.limiter, NULL, 0, zval_get_long(&option), Z_TYPE(burst) != IS_UNDEF ? zval_get_long(&burst) : 0);
+		}
+
+		if (phalcon_array_isset_fetch_str(&option, &limit, SL("routes"), PH_READONLY) && Z_TYPE(option) == IS_ARRAY) {
+			ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL(option), prefix, root) {
+				zval rate = {};
+
+				if (!prefix || Z_TYPE_P(root) != IS_ARRAY || !phalcon_array_isset_fetch_str(&rate, root, SL("rate"), PH_READONLY)) {
+					PHALCON_THROW_EXCEPTION_STR(phalcon_server_exception_ce, "The route limits must be url prefix => ['rate', 'burst']");
+					return;
+				}
+				ZVAL_UNDEF(&burst);
+				phalcon_array_isset_fetch_str(&burst, root, SL("burst"), PH_READONLY);
+				phalcon_server_limiter_add_rule(intern->ctx.limiter, ZSTR_VAL(prefix), ZSTR_LEN(prefix), zval_get_long(&rate), Z_TYPE(burst) != IS_UNDEF ? zval_get_long(&burst) : 0);
+			} ZEND_HASH_FOREACH_END();
+		}
+	}
+
+	/* Timeouts in seconds, 0 disables one */
+	intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_HEADER] = 10 * 1000;
+	intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_BODY] = 30 * 1000;
+	intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_KEEPALIVE] = 15 * 1000;
+	intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_WRITE] = 30 * 1000;
+
+	if (phalcon_array_isset_fetch_str(&timeout, config, SL("timeout"), PH_READONLY) && Z_TYPE(timeout) == IS_ARRAY) {
+		if (phalcon_array_isset_fetch_str(&seconds, &timeout, SL("header"), PH_READONLY)) {
+			intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_HEADER] = (int)(zval_get_double(&seconds) * 1000);
+		}
+		if (phalcon_array_isset_fetch_str(&seconds, &timeout, SL("body"), PH_READONLY)) {
+			intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_BODY] = (int)(zval_get_double(&seconds) * 1000);
+		}
+		if (phalcon_array_isset_fetch_str(&seconds, &timeout, SL("keepalive"), PH_READONLY)) {
+			intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_KEEPALIVE] = (int)(zval_get_double(&seconds) * 1000);
+		}
+		if (phalcon_array_isset_fetch_str(&seconds, &timeout, SL("write"), PH_READONLY)) {
+			intern->ctx.timeouts[PHALCON_SERVER_TIMEOUT_WRITE] = (int)(zval_get_double(&seconds) * 1000);
+		}
+	}
+
 	if (phalcon_array_isset_fetch_str(&log_path, config, SL("log"), PH_READONLY) && Z_TYPE(log_path) == IS_STRING) {
 		intern->ctx.log_path = zend_string_copy(Z_STR(log_path));
 	}
@@ -158,21 +348,83 @@ struct http_parser_settings http_parser_request_settings = {
     .on_chunk_complete = phalcon_http_parser_on_chunk_complete
 };
 
-char *http_200="HTTP/1.0 200 OK\r\n"
-	"Cache-Control: no-cache\r\n"
+char *http_400="HTTP/1.1 400 Bad Request\r\n"
 	"Connection: close\r\n"
-	"Content-Type: text/html\r\n"
-	"\r\n"
-	"<html><body><h1>200 OK</h1>\nEverything is fine.\n</body></html>\n";
+	"Content-Length: 0\r\n"
+	"\r\n";
+
+static phalcon_http_parser_data *phalcon_server_http_parser_data(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+	phalcon_server_http_object *intern;
+	phalcon_http_parser_data *parser_data;
+
+	if (!client_ctx->user_data) {
+		intern = phalcon_server_http_object_from_ctx(ctx);
+		parser_data = phalcon_server_slab_alloc(&intern->parsers);
+		assert(parser_data);
+		phalcon_http_parser_data_init(parser_data, (struct http_parser *)(parser_data + 1), &http_parser_request_settings);
+		parser_data->body_buffer = intern->body_buffer;
+		parser_data->body_max = intern->body_max;
+		parser_data->pause_headers = ctx->limiter != NULL;
+		client_ctx->user_data = parser_data;
+	}
+
+	return (phalcon_http_parser_data *)client_ctx->user_data;
+}
+
+static void phalcon_server_http_release_parser_data(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+	phalcon_server_http_object *intern;
+
+	if (client_ctx->user_data) {
+		intern = phalcon_server_http_object_from_ctx(ctx);
+		phalcon_http_parser_data_destroy((phalcon_http_parser_data *)client_ctx->user_data);
+		phalcon_server_slab_free(&intern->parsers, client_ctx->user_data);
+		client_ctx->user_data = NULL;
+	}
+}
+
+/**
+ * Arms the timeout of the phase the connection is waiting in
+ */
+static void phalcon_server_http_update_timeout(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+	phalcon_http_parser_data *parser_data = (phalcon_http_parser_data *)client_ctx->user_data;
+
+	if (phalcon_server_output_pending(client_ctx)) {
+		phalcon_server_set_timeout(ctx, client_ctx, PHALCON_SERVER_TIMEOUT_WRITE);
+	} else if (!parser_data || parser_data->state == HTTP_PARSER_STATE_NONE) {
+		phalcon_server_set_timeout(ctx, client_ctx, PHALCON_SERVER_TIMEOUT_KEEPALIVE);
+	} else if (parser_data->state < HTTP_PARSER_STATE_HEADER_END) {
+		phalcon_server_set_timeout(ctx, client_ctx, PHALCON_SERVER_TIMEOUT_HEADER);
+	} else {
+		phalcon_server_set_timeout(ctx, client_ctx, PHALCON_SERVER_TIMEOUT_BODY);
+	}
+}
+
+static void phalcon_server_http_close(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+	phalcon_server_timer_cancel(&ctx->wheel, &client_ctx->timer);
+	phalcon_server_http_release_parser_data(ctx, client_ctx);
+	phalcon_server_output_free(ctx, client_ctx);
+
+	client_ctx->flags = 0;
+
+	// __sync_synchronize();
+	phalcon_server_client_close(client_ctx);
+	// __sync_synchronize();
+	phalcon_server_free_context(client_ctx);
+}
 
 void phalcon_server_http_process_write(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
 {
 	int ep_fd, fd;
 	int events = client_ctx->events;
 	int cpu_id = client_ctx->cpu_id;
-	int old_len, ret;
+	int ret;
 	struct epoll_event evt;
 	phalcon_server_http_object *intern;
+	phalcon_http_parser_data *parser_data;
 
 	ep_fd = client_ctx->ep_fd;
 	fd = client_ctx->fd;
@@ -184,50 +436,45 @@ void phalcon_server_http_process_write(struct phalcon_server_context *ctx, struc
 		goto free_back;
 	}
 
-	old_len = ZSTR_LEN(client_ctx->response);
-	if (ZSTR_LEN(client_ctx->response)) {
-		ret = write(fd, ZSTR_VAL(client_ctx->response), old_len);
-		if (ret < 0) {
-			ctx->wdata[cpu_id].write_cnt++;
-			perror("process_write() can't write client socket");
-			goto free_back;
-		}
-		if (ret < old_len) {
-			zend_string *new_response = zend_string_alloc(old_len - ret, 0);
-			memcpy(ZSTR_VAL(new_response), ZSTR_VAL(client_ctx->response) + ret, old_len - ret);
-			zend_string_release(client_ctx->response);
-			client_ctx->response = new_response;
-			evt.events = EPOLLOUT | EPOLLHUP | EPOLLERR;
-			evt.data.ptr = client_ctx;
-			ret = epoll_ctl(ep_fd, EPOLL_CTL_MOD, fd, &evt);
-			if (ret < 0) {
-				perror("Unable to add client socket read event to epoll");
-				goto free_back;
-			}
-			goto back;
-		} else {
-			zend_string_release(client_ctx->response);
-			client_ctx->response = NULL;
-		}
-	} else {
-		ret = write(fd, http_200, strlen(http_200));
-		if (ret < 0) {
-			ctx->wdata[cpu_id].write_cnt++;
-			perror("process_write() can't write client socket");
-			goto free_back;
-		}
+	ret = phalcon_server_output_flush(ctx, client_ctx);
+	if (ret < 0) {
+		ctx->wdata[cpu_id].write_cnt++;
+		perror("process_write() can't write client socket");
+		goto free_back;
+	} else if (ret == 0) {
+		/* The socket buffer is full, wait for the next EPOLLOUT */
+		phalcon_server_set_timeout(ctx, client_ctx, PHALCON_SERVER_TIMEOUT_WRITE);
+		goto back;
 	}
 
-	phalcon_server_log_printf(ctx, "Write %d to socket %d\n", ret, fd);
+	phalcon_server_log_printf(ctx, "Write done to socket %d\n", fd);
 
-	ctx->wdata[cpu_id].trancnt++;
+	if (client_ctx->write_at) {
+		phalcon_server_histogram_record(&ctx->wdata[cpu_id].metrics.histograms[PHALCON_SERVER_METRIC_WRITE], phalcon_server_metrics_now() - client_ctx->write_at);
+		client_ctx->write_at = 0;
+	}
 
 	intern = phalcon_server_http_object_from_ctx(ctx);
-	if (!intern->enable_keepalive)
+	if (!intern->enable_keepalive || ctx->draining || (client_ctx->flags & PHALCON_SERVER_CONN_CLOSE))
 		goto free_back;
 
 	client_ctx->handler = ctx->read;
 
+	/* The parser was paused on a full output, the read handler parses the rest and registers again */
+	parser_data = (phalcon_http_parser_data *)client_ctx->user_data;
+	if (parser_data && parser_data->pipelined.s) {
+		evt.events = EPOLLHUP | EPOLLERR;
+		evt.data.ptr = client_ctx;
+		if (epoll_ctl(ep_fd, EPOLL_CTL_MOD, fd, &evt) < 0) {
+			perror("Unable to remove client socket write event from epoll");
+			goto free_back;
+		}
+		client_ctx->events = EPOLLIN;
+		phalcon_server_dispatch_read(ctx, client_ctx);
+		goto back;
+	}
+
+	/* Modifying the registration reports data pipelined while the responses were written */
 	evt.events = EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLET;
 	evt.data.ptr = client_ctx;
 
@@ -237,26 +484,833 @@ void phalcon_server_http_process_write(struct phalcon_server_context *ctx, struc
 		goto free_back;
 	}
 
+	phalcon_server_http_update_timeout(ctx, client_ctx);
+
 	goto back;
 
 free_back:
-	// __sync_synchronize();
-	phalcon_server_client_close(client_ctx);
-	// __sync_synchronize();
-	phalcon_server_free_context(client_ctx);
+	phalcon_server_http_close(ctx, client_ctx);
 
 back:
 	return;
 }
 
+/**
+ * Reads a spilled body back, only done for the forms the application expects in getPost()
+ */
+static zend_string *phalcon_server_http_read_file(const char *path, size_t length)
+{
+	zend_string *content;
+	size_t offset = 0;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return NULL;
+	}
+
+	content = zend_string_alloc(length, 0);
+	while (offset < length) {
+		n = read(fd, ZSTR_VAL(content) + offset, length - offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		offset += n;
+	}
+	close(fd);
+
+	ZSTR_LEN(content) = offset;
+	ZSTR_VAL(content)[offset] = '\0';
+
+	return content;
+}
+
+/* Same as the one of rfc1867.c, the entries are removed when the message is reset */
+static void phalcon_server_http_free_filename(zval *el)
+{
+	zend_string_release((zend_string *)Z_PTR_P(el));
+}
+
+static void phalcon_server_http_append_file(zval *entry, const char *key, size_t key_len, zval *value)
+{
+	zval *list = zend_hash_str_find(Z_ARRVAL_P(entry), key, key_len);
+
+	if (!list) {
+		zval tmp = {};
+		array_init(&tmp);
+		list = zend_hash_str_update(Z_ARRVAL_P(entry), key, key_len, &tmp);
+	}
+	add_next_index_zval(list, value);
+}
+
+/**
+ * The fields of a multipart/form-data body go to the post data, its files are laid out like $_FILES,
+ * "name[]" fields are grouped, and their temporary names are made valid for move_uploaded_file()
+ */
+static void phalcon_server_http_build_multipart(zval *post, zval *files, phalcon_server_multipart *multipart)
+{
+	phalcon_server_multipart_part *part;
+	zval file = {}, *entry;
+	size_t name_len;
+	int i;
+
+	array_init(files);
+
+	for (i = 0; i < multipart->num_parts; i++) {
+		part = &multipart->parts[i];
+		if (!part->name || !ZSTR_LEN(part->name)) {
+			continue;
+		}
+
+		if (!part->filename) {
+			php_register_variable_safe(ZSTR_VAL(part->name), part->value.s ? ZSTR_VAL(part->value.s) : "", part->value.s ? ZSTR_LEN(part->value.s) : 0, post);
+			continue;
+		}
+
+		if (part->tmp_name) {
+			if (!SG(rfc1867_uploaded_files)) {
+				ALLOC_HASHTABLE(SG(rfc1867_uploaded_files));
+				zend_hash_init(SG(rfc1867_uploaded_files), 8, NULL, phalcon_server_http_free_filename, 0);
+			}
+			zend_hash_add_ptr(SG(rfc1867_uploaded_files), part->tmp_name, zend_string_copy(part->tmp_name));
+		}
+
+		name_len = ZSTR_LEN(part->name);
+		if (name_len > 2 && !memcmp(ZSTR_VAL(part->name) + name_len - 2, "[]", 2)) {
+			if ((entry = zend_symtable_str_find(Z_ARRVAL_P(files), ZSTR_VAL(part->name), name_len - 2)) == NULL) {
+				array_init(&file);
+				entry = zend_symtable_str_update(Z_ARRVAL_P(files), ZSTR_VAL(part->name), name_len - 2, &file);
+			}
+
+			ZVAL_STR_COPY(&file, part->filename);
+			phalcon_server_http_append_file(entry, SL("name"), &file);
+			if (part->type) {
+				ZVAL_STR_COPY(&file, part->type);
+			} else {
+				ZVAL_EMPTY_STRING(&file);
+			}
+			phalcon_server_http_append_file(entry, SL("type"), &file);
+			if (part->tmp_name) {
+				ZVAL_STR_COPY(&file, part->tmp_name);
+			} else {
+				ZVAL_EMPTY_STRING(&file);
+			}
+			phalcon_server_http_append_file(entry, SL("tmp_name"), &file);
+			ZVAL_LONG(&file, part->error);
+			phalcon_server_http_append_file(entry, SL("error"), &file);
+			ZVAL_LONG(&file, part->error ? 0 : part->size);
+			phalcon_server_http_append_file(entry, SL("size"), &file);
+			continue;
+		}
+
+		array_init(&file);
+		add_assoc_str(&file, "name", zend_string_copy(part->filename));
+		if (part->type) {
+			add_assoc_str(&file, "type", zend_string_copy(part->type));
+		} else {
+			add_assoc_stringl(&file, "type", "", 0);
+		}
+		if (part->tmp_name) {
+			add_assoc_str(&file, "tmp_name", zend_string_copy(part->tmp_name));
+		} else {
+			add_assoc_stringl(&file, "tmp_name", "", 0);
+		}
+		add_assoc_long(&file, "error", part->error);
+		add_assoc_long(&file, "size", part->error ? 0 : part->size);
+		zend_symtable_update(Z_ARRVAL_P(files), part->name, &file);
+	}
+}
+
+/**
+ * Builds the Phalcon\Http\Request of the parsed message, the superglobals are left untouched
+ */
+static void phalcon_server_http_build_request(zval *request, zval *path, struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, phalcon_http_parser_data *parser_data)
+{
+	zval server = {}, get = {}, post = {}, merged = {}, raw_body = {}, files = {}, raw_body_file = {}, *value;
+	zend_string *str_key;
+	int form;
+	const char *url, *query;
+	char remote_ip[INET6_ADDRSTRLEN] = {0};
+	size_t url_len;
+	struct timeval tv = {0};
+
+	object_init_ex(request, phalcon_http_request_ce);
+	PHALCON_CALL_METHOD(NULL, request, "__construct");
+
+	array_init(&server);
+	array_init(&get);
+	array_init(&post);
+
+	url = parser_data->url.s ? ZSTR_VAL(parser_data->url.s) : "/";
+	url_len = parser_data->url.s ? ZSTR_LEN(parser_data->url.s) : 1;
+
+	phalcon_array_update_str_str(&server, SL("REQUEST_METHOD"), (char *)http_method_str(parser_data->parser->method), strlen(http_method_str(parser_data->parser->method)), 0);
+	phalcon_array_update_str_str(&server, SL("REQUEST_URI"), (char *)url, url_len, 0);
+
+	query = memchr(url, '?', url_len);
+	if (query) {
+		ZVAL_STRINGL(path, url, query - url);
+		query++;
+		phalcon_array_update_str_str(&server, SL("QUERY_STRING"), (char *)query, url_len - (query - url), 0);
+		/* treat_data takes ownership of the buffer */
+		sapi_module.treat_data(PARSE_STRING, estrndup(query, url_len - (query - url)), &get);
+	} else {
+		ZVAL_STRINGL(path, url, url_len);
+		phalcon_array_update_str_str(&server, SL("QUERY_STRING"), "", 0, 0);
+	}
+
+	phalcon_array_update_str_str(&server, SL("SERVER_PROTOCOL"), (char *)(parser_data->parser->http_minor ? "HTTP/1.1" : "HTTP/1.0"), sizeof("HTTP/1.1") - 1, 0);
+	phalcon_array_update_str_str(&server, SL("SERVER_ADDR"), ctx->la[0].param_ip, strlen(ctx->la[0].param_ip), 0);
+	phalcon_array_update_str_long(&server, SL("SERVER_PORT"), ctx->la[0].param_port, 0);
+	phalcon_array_update_str_str(&server, SL("SERVER_SOFTWARE"), SL("Phalcon Server"), 0);
+
+	if (client_ctx->addr.addr.inet_v4.sin_family == AF_INET) {
+		inet_ntop(AF_INET, &client_ctx->addr.addr.inet_v4.sin_addr, remote_ip, sizeof(remote_ip));
+		phalcon_array_update_str_str(&server, SL("REMOTE_ADDR"), remote_ip, strlen(remote_ip), 0);
+		phalcon_array_update_str_long(&server, SL("REMOTE_PORT"), ntohs(client_ctx->addr.addr.inet_v4.sin_port), 0);
+	} else if (client_ctx->addr.addr.inet_v6.sin6_family == AF_INET6) {
+		inet_ntop(AF_INET6, &client_ctx->addr.addr.inet_v6.sin6_addr, remote_ip, sizeof(remote_ip));
+		phalcon_array_update_str_str(&server, SL("REMOTE_ADDR"), remote_ip, strlen(remote_ip), 0);
+		phalcon_array_update_str_long(&server, SL("REMOTE_PORT"), ntohs(client_ctx->addr.addr.inet_v6.sin6_port), 0);
+	}
+
+	if (!gettimeofday(&tv, NULL)) {
+		phalcon_array_update_str_long(&server, SL("REQUEST_TIME"), tv.tv_sec, 0);
+		phalcon_array_update_str_double(&server, SL("REQUEST_TIME_FLOAT"), tv.tv_sec + tv.tv_usec / 1000000.0, 0);
+	}
+
+	/* Headers are exposed the CGI way, Content-Type and Content-Length without the HTTP_ prefix */
+	ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL(parser_data->head), str_key, value) {
+		zend_string *name;
+		size_t i, offset = 0;
+
+		if (!str_key) {
+			continue;
+		}
+
+		if (!zend_binary_strcasecmp(ZSTR_VAL(str_key), ZSTR_LEN(str_key), SL("Content-Type"))
+			|| !zend_binary_strcasecmp(ZSTR_VAL(str_key), ZSTR_LEN(str_key), SL("Content-Length"))) {
+			name = zend_string_alloc(ZSTR_LEN(str_key), 0);
+		} else {
+			name = zend_string_alloc(ZSTR_LEN(str_key) + 5, 0);
+			memcpy(ZSTR_VAL(name), "HTTP_", 5);
+			offset = 5;
+		}
+
+		for (i = 0; i < ZSTR_LEN(str_key); i++) {
+			char c = ZSTR_VAL(str_key)[i];
+			ZSTR_VAL(name)[offset + i] = c == '-' ? '_' : toupper(c);
+		}
+		ZSTR_VAL(name)[ZSTR_LEN(name)] = '\0';
+
+		phalcon_array_update_string(&server, name, value, PH_COPY);
+		zend_string_release(name);
+	} ZEND_HASH_FOREACH_END();
+
+	form = (value = zend_hash_str_find(Z_ARRVAL(server), SL("CONTENT_TYPE"))) != NULL && Z_TYPE_P(value) == IS_STRING
+		&& !strncasecmp(Z_STRVAL_P(value), SL("application/x-www-form-urlencoded"));
+
+	if (parser_data->multipart) {
+		/* Like PHP the raw body of an upload is not kept */
+		phalcon_server_http_build_multipart(&post, &files, parser_data->multipart);
+		ZVAL_EMPTY_STRING(&raw_body);
+	} else if (parser_data->body_file) {
+		/* Read from the file by getRawBody() only when asked for */
+		ZVAL_STR_COPY(&raw_body_file, parser_data->body_file);
+		ZVAL_NULL(&raw_body);
+
+		if (form) {
+			zend_string *content = phalcon_server_http_read_file(ZSTR_VAL(parser_data->body_file), parser_data->body_length);
+			if (content) {
+				sapi_module.treat_data(PARSE_STRING, estrndup(ZSTR_VAL(content), ZSTR_LEN(content)), &post);
+				zend_string_release(content);
+			}
+		}
+	} else if (parser_data->body.s) {
+		ZVAL_STR_COPY(&raw_body, parser_data->body.s);
+
+		if (form) {
+			sapi_module.treat_data(PARSE_STRING, estrndup(Z_STRVAL(raw_body), Z_STRLEN(raw_body)), &post);
+		}
+	} else {
+		ZVAL_EMPTY_STRING(&raw_body);
+	}
+
+	phalcon_fast_array_merge(&merged, &get, &post);
+
+	phalcon_update_property(request, SL("_server"), &server);
+	phalcon_update_property(request, SL("_get"), &get);
+	phalcon_update_property(request, SL("_post"), &post);
+	phalcon_update_property(request, SL("_request"), &merged);
+	phalcon_update_property(request, SL("_rawBody"), &raw_body);
+	if (Z_TYPE(files) == IS_ARRAY) {
+		phalcon_update_property(request, SL("_files"), &files);
+	}
+	if (Z_TYPE(raw_body_file) == IS_STRING) {
+		phalcon_update_property(request, SL("_rawBodyFile"), &raw_body_file);
+	}
+
+	zval_ptr_dtor(&server);
+	zval_ptr_dtor(&get);
+	zval_ptr_dtor(&post);
+	zval_ptr_dtor(&merged);
+	zval_ptr_dtor(&raw_body);
+	zval_ptr_dtor(&files);
+	zval_ptr_dtor(&raw_body_file);
+}
+
+static sapi_header_struct *phalcon_server_http_find_header(const char *name, size_t name_len)
+{
+	zend_llist_position pos;
+	sapi_header_struct *h;
+
+	h = (sapi_header_struct*)zend_llist_get_first_ex(&SG(sapi_headers).headers, &pos);
+	while (h) {
+		if (h->header_len > name_len && h->header[name_len] == ':' && !strncasecmp(h->header, name, name_len)) {
+			return h;
+		}
+		h = (sapi_header_struct*)zend_llist_get_next_ex(&SG(sapi_headers).headers, &pos);
+	}
+
+	return NULL;
+}
+
+static void phalcon_server_http_add_header(const char *value, size_t value_len)
+{
+	sapi_header_struct header;
+
+	header.header = estrndup(value, value_len);
+	header.header_len = value_len;
+	zend_llist_add_element(&SG(sapi_headers).headers, &header);
+}
+
+/**
+ * Brings the Content-Length of the application up to date once the server changed the body
+ */
+static void phalcon_server_http_update_content_length(size_t length)
+{
+	sapi_header_struct *h;
+	char value[64];
+	int len;
+
+	if ((h = phalcon_server_http_find_header(SL("Content-Length"))) == NULL) {
+		return;
+	}
+
+	len = snprintf(value, sizeof(value), "Content-Length: %zu", length);
+	efree(h->header);
+	h->header = estrndup(value, len);
+	h->header_len = len;
+}
+
+/**
+ * Answers the metrics path with the counters of every worker, they live in the shared worker data
+ */
+static int phalcon_server_http_metrics(struct phalcon_server_context *ctx, phalcon_http_parser_data *parser_data, zval *content)
+{
+	phalcon_server_http_object *intern = phalcon_server_http_object_from_ctx(ctx);
+	struct phalcon_server_metrics *total;
+	const struct phalcon_server_metrics **metrics;
+	const char **workers;
+	smart_str buffer = {0};
+	const char *url;
+	size_t url_len;
+	char *labels;
+	int i;
+
+	if (!intern->metrics_path || !parser_data->url.s) {
+		return 0;
+	}
+
+	url = ZSTR_VAL(parser_data->url.s);
+	url_len = ZSTR_LEN(parser_data->url.s);
+	if (memchr(url, '?', url_len)) {
+		url_len = (const char *)memchr(url, '?', url_len) - url;
+	}
+	if (url_len != ZSTR_LEN(intern->metrics_path) || memcmp(url, ZSTR_VAL(intern->metrics_path), url_len)) {
+		return 0;
+	}
+
+	total = ecalloc(1, sizeof(struct phalcon_server_metrics));
+	metrics = safe_emalloc(ctx->num_workers + 1, sizeof(*metrics), 0);
+	workers = safe_emalloc(ctx->num_workers + 1, sizeof(*workers), 0);
+	labels = safe_emalloc(ctx->num_workers, 12, 0);
+
+	for (i = 0; i < ctx->num_workers; i++) {
+		snprintf(labels + i * 12, 12, "%d", i);
+		metrics[i] = &ctx->wdata[i].metrics;
+		workers[i] = labels + i * 12;
+		phalcon_server_metrics_merge(total, &ctx->wdata[i].metrics);
+	}
+	metrics[i] = total;
+	workers[i] = "all";
+
+	phalcon_server_metrics_render(&buffer, metrics, workers, ctx->num_workers + 1);
+	smart_str_0(&buffer);
+	efree(labels);
+	efree(workers);
+	efree(metrics);
+	efree(total);
+
+	ZVAL_STR(content, buffer.s);
+
+	phalcon_server_http_add_header(SL("Content-Type: text/plain; version=0.0.4"));
+
+	return 1;
+}
+
+/**
+ * Compresses the body the application answered, bodies with an ETag are compressed once per worker
+ */
+static void phalcon_server_http_compress(struct phalcon_server_context *ctx, phalcon_http_parser_data *parser_data, zval *content)
+{
+	phalcon_server_http_object *intern = phalcon_server_http_object_from_ctx(ctx);
+	sapi_header_struct *content_type, *etag;
+	zval *accept_encoding;
+	const char *value;
+	zend_string *body = NULL;
+	smart_str key = {0}, header = {0};
+	int encoding;
+
+	if (!intern->compress || Z_TYPE_P(content) != IS_STRING || (SG(sapi_headers).http_response_code && SG(sapi_headers).http_response_code != 200)) {
+		return;
+	}
+
+	if (phalcon_server_http_find_header(SL("Content-Encoding"))) {
+		return;
+	}
+
+	/* PHP answers text/html unless told otherwise */
+	content_type = phalcon_server_http_find_header(SL("Content-Type"));
+	value = content_type ? content_type->header + sizeof("Content-Type:") - 1 : "text/html";
+	if (!phalcon_server_compress_acceptable(intern->compress, value, Z_STRLEN_P(content))) {
+		return;
+	}
+
+	phalcon_server_http_add_header(SL("Vary: Accept-Encoding"));
+
+	accept_encoding = phalcon_http_parser_data_header(parser_data, SL("Accept-Encoding"));
+	encoding = phalcon_server_compress_negotiate(intern->compress, accept_encoding ? Z_STRVAL_P(accept_encoding) : NULL);
+	if (encoding == PHALCON_SERVER_ENCODING_IDENTITY) {
+		return;
+	}
+
+	etag = phalcon_server_http_find_header(SL("ETag"));
+	if (etag && parser_data->url.s) {
+		smart_str_append(&key, parser_data->url.s);
+		smart_str_appendl(&key, etag->header, etag->header_len);
+		smart_str_0(&key);
+		body = phalcon_server_compress_lookup(intern->compress, encoding, ZSTR_VAL(key.s), ZSTR_LEN(key.s));
+	}
+
+	if (!body) {
+		body = phalcon_server_compress_data(intern->compress, encoding, Z_STRVAL_P(content), Z_STRLEN_P(content));
+		if (body && key.s) {
+			phalcon_server_compress_store(intern->compress, encoding, ZSTR_VAL(key.s), ZSTR_LEN(key.s), body);
+		}
+	}
+	smart_str_free(&key);
+
+	if (!body) {
+		return;
+	}
+
+	zval_ptr_dtor(content);
+	ZVAL_STR(content, body);
+	phalcon_server_http_update_content_length(ZSTR_LEN(body));
+
+	/* Another representation, a strong validator becomes weak like nginx does */
+	if (etag) {
+		value = etag->header + sizeof("ETag:") - 1;
+		while (*value == ' ') {
+			value++;
+		}
+		if (*value == '"') {
+			smart_str_appends(&header, "ETag: W/");
+			smart_str_appends(&header, value);
+			smart_str_0(&header);
+			efree(etag->header);
+			etag->header = estrndup(ZSTR_VAL(header.s), ZSTR_LEN(header.s));
+			etag->header_len = ZSTR_LEN(header.s);
+			smart_str_free(&header);
+		}
+	}
+
+	smart_str_appends(&header, "Content-Encoding: ");
+	smart_str_appends(&header, phalcon_server_compress_name(encoding));
+	smart_str_0(&header);
+	phalcon_server_http_add_header(ZSTR_VAL(header.s), ZSTR_LEN(header.s));
+	smart_str_free(&header);
+}
+
+typedef struct {
+	phalcon_coroutine coroutine;
+	zval application;
+	zval dependency_injector;
+} phalcon_server_http_coroutine;
+
+/**
+ * A resumed coroutine makes its own container the default one again
+ */
+static void phalcon_server_http_coroutine_resume(phalcon_coroutine *coroutine)
+{
+	phalcon_server_http_coroutine *http_coroutine = (phalcon_server_http_coroutine *)coroutine;
+
+	if (Z_TYPE(http_coroutine->dependency_injector) == IS_OBJECT) {
+		phalcon_update_static_property_ce(phalcon_di_ce, SL("_default"), &http_coroutine->dependency_injector);
+	}
+}
+
+/**
+ * Gives the coroutine its own copy of the application and of its container, the shared
+ * services are resolved again for its request and never seen by the others of the worker
+ */
+static void phalcon_server_http_coroutine_isolate(phalcon_server_http_coroutine *http_coroutine, zval *application)
+{
+	zval dependency_injector = {}, services = {}, copy = {}, *service;
+	zend_string *name;
+	zend_ulong idx;
+	int flag = 0;
+
+	PHALCON_CALL_METHOD_FLAG(flag, &dependency_injector, application, "getdi");
+	if (flag == FAILURE || Z_TYPE(dependency_injector) != IS_OBJECT
+		|| phalcon_clone(&http_coroutine->dependency_injector, &dependency_injector) == FAILURE) {
+		zval_ptr_dtor(&dependency_injector);
+		ZVAL_UNDEF(&http_coroutine->dependency_injector);
+		ZVAL_COPY(&http_coroutine->application, application);
+		return;
+	}
+	zval_ptr_dtor(&dependency_injector);
+
+	/* Di::__clone() forgets the shared instances, the services keep their own */
+	phalcon_read_property(&services, &http_coroutine->dependency_injector, SL("_services"), PH_READONLY);
+	if (Z_TYPE(services) == IS_ARRAY) {
+		array_init_size(&copy, zend_hash_num_elements(Z_ARRVAL(services)));
+		ZEND_HASH_FOREACH_KEY_VAL(Z_ARRVAL(services), idx, name, service) {
+			zval tmp = {};
+			if (Z_TYPE_P(service) == IS_OBJECT && instanceof_function(Z_OBJCE_P(service), phalcon_di_service_ce) && phalcon_clone(&tmp, service) == SUCCESS) {
+				phalcon_update_property_null(&tmp, SL("_sharedInstance"));
+				phalcon_update_property_bool(&tmp, SL("_resolved"), 0);
+			} else {
+				ZVAL_COPY(&tmp, service);
+			}
+			if (name) {
+				zend_hash_update(Z_ARRVAL(copy), name, &tmp);
+			} else {
+				zend_hash_index_update(Z_ARRVAL(copy), idx, &tmp);
+			}
+		} ZEND_HASH_FOREACH_END();
+		phalcon_update_property(&http_coroutine->dependency_injector, SL("_services"), &copy);
+		zval_ptr_dtor(&copy);
+	}
+
+	if (phalcon_clone(&http_coroutine->application, application) == FAILURE) {
+		ZVAL_COPY(&http_coroutine->application, application);
+	}
+	PHALCON_CALL_METHOD_FLAG(flag, NULL, &http_coroutine->application, "setdi", &http_coroutine->dependency_injector);
+
+	phalcon_server_http_coroutine_resume(&http_coroutine->coroutine);
+}
+
+/**
+ * Drops the copies of a finished coroutine, the container of the application is the default again
+ */
+static void phalcon_server_http_coroutine_release(phalcon_server_http_coroutine *http_coroutine, zval *application)
+{
+	zval dependency_injector = {};
+	int flag = 0;
+
+	if (Z_TYPE(http_coroutine->dependency_injector) == IS_OBJECT) {
+		PHALCON_CALL_METHOD_FLAG(flag, &dependency_injector, application, "getdi");
+		if (flag == SUCCESS && Z_TYPE(dependency_injector) == IS_OBJECT) {
+			phalcon_update_static_property_ce(phalcon_di_ce, SL("_default"), &dependency_injector);
+		}
+		zval_ptr_dtor(&dependency_injector);
+	}
+
+	zval_ptr_dtor(&http_coroutine->dependency_injector);
+	zval_ptr_dtor(&http_coroutine->application);
+}
+
+/**
+ * Applies the Range of the message to a file of Response::setFileToSend(), returns the length to send
+ */
+static size_t phalcon_server_http_file_range(phalcon_http_parser_data *parser_data, struct stat *st, off_t *offset)
+{
+	zval *range, *if_range;
+	char etag[PHALCON_SERVER_STATIC_ETAG_SIZE], last_modified[PHALCON_SERVER_STATIC_DATE_SIZE], header[128];
+	off_t length = st->st_size;
+	int len;
+
+	*offset = 0;
+
+	/* A status or a Content-Range set by the application is kept */
+	if ((SG(sapi_headers).http_response_code && SG(sapi_headers).http_response_code != 200)
+		|| (range = phalcon_http_parser_data_header(parser_data, SL("Range"))) == NULL) {
+		return (size_t)length;
+	}
+
+	/* Validators like the mounted directories send, a stale If-Range gets the whole file */
+	if ((if_range = phalcon_http_parser_data_header(parser_data, SL("If-Range"))) != NULL) {
+		phalcon_server_static_validators(st->st_mtime, st->st_size, etag, last_modified);
+		if (strcmp(Z_STRVAL_P(if_range), etag) && strcmp(Z_STRVAL_P(if_range), last_modified)) {
+			return (size_t)length;
+		}
+	}
+
+	switch (phalcon_server_static_range(Z_STRVAL_P(range), st->st_size, offset, &length)) {
+		case 1:
+			SG(sapi_headers).http_response_code = 206;
+			len = snprintf(header, sizeof(header), "Content-Range: bytes %llu-%llu/%llu",
+				(unsigned long long)*offset, (unsigned long long)(*offset + length - 1), (unsigned long long)st->st_size);
+			break;
+		case -1:
+			SG(sapi_headers).http_response_code = 416;
+			len = snprintf(header, sizeof(header), "Content-Range: bytes */%llu", (unsigned long long)st->st_size);
+			*offset = 0;
+			length = 0;
+			break;
+		default:
+			return (size_t)length;
+	}
+
+	/* The status line Response::sendHeaders() left would hide the new code */
+	if (SG(sapi_headers).http_status_line) {
+		efree(SG(sapi_headers).http_status_line);
+		SG(sapi_headers).http_status_line = NULL;
+	}
+	sapi_add_header_ex(header, len, 1, 1);
+	phalcon_server_http_update_content_length((size_t)length);
+
+	return (size_t)length;
+}
+
+/**
+ * Runs the application for one complete message and appends its response to the connection
+ */
+static void phalcon_server_http_handle_request(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, phalcon_http_parser_data *parser_data, int keepalive)
+{
+	zval url = {}, request = {}, dependency_injector = {}, service = {}, response = {}, content = {}, file = {}, *application;
+	phalcon_server_http_object *intern;
+	phalcon_server_http_coroutine coroutine = {0};
+	zend_string *headers;
+	struct stat st;
+	off_t file_offset = 0;
+	int flag = 0, file_fd = -1;
+	size_t content_length = 0;
+
+	intern = phalcon_server_http_object_from_ctx(ctx);
+	application = &intern->application;
+
+	if (ctx->coroutine) {
+		coroutine.coroutine.resume = phalcon_server_http_coroutine_resume;
+		phalcon_coroutine_enter(&coroutine.coroutine);
+	}
+
+	if (phalcon_server_http_metrics(ctx, parser_data, &content)) {
+		goto output;
+	}
+
+	/* The requests of the other coroutines run while this one waits, none of them shares its services */
+	if (ctx->coroutine) {
+		phalcon_server_http_coroutine_isolate(&coroutine, &intern->application);
+		application = &coroutine.application;
+	}
+
+	phalcon_server_http_build_request(&request, &url, ctx, client_ctx, parser_data);
+
+	PHALCON_CALL_METHOD_FLAG(flag, &dependency_injector, application, "getdi");
+	if (flag == SUCCESS && Z_TYPE(dependency_injector) == IS_OBJECT) {
+		ZVAL_STR(&service, IS(request));
+		PHALCON_CALL_METHOD_FLAG(flag, NULL, &dependency_injector, "set", &service, &request);
+	}
+	zval_ptr_dtor(&dependency_injector);
+
+	if (flag == SUCCESS) {
+		PHALCON_CALL_METHOD_FLAG(flag, &response, application, "handle", &url);
+	}
+	zval_ptr_dtor(&request);
+	ZVAL_UNDEF(&request);
+	zval_ptr_dtor(&url);
+
+	if (flag == FAILURE) {
+		if (EG(exception)) {
+			zval ex = {};
+			ZVAL_OBJ(&ex, EG(exception));
+			phalcon_read_property(&content, &ex, SL("message"), PH_NOISY|PH_COPY);
+			zend_clear_exception();
+		}
+		SG(sapi_headers).http_response_code = 500;
+		phalcon_server_metrics_add(&ctx->wdata[client_ctx->cpu_id].metrics.application_errors, 1);
+	} else {
+		if (Z_TYPE(response) == IS_OBJECT) {
+			PHALCON_CALL_METHOD_FLAG(flag, &content, &response, "getcontent");
+
+			/* Response::setFileToSend(), the file is streamed with sendfile */
+			if (Z_TYPE(content) == IS_NULL && instanceof_function(Z_OBJCE(response), phalcon_http_response_ce)) {
+				phalcon_read_property(&file, &response, SL("_file"), PH_READONLY);
+				if (Z_TYPE(file) == IS_STRING && Z_STRLEN(file)) {
+					file_fd = open(Z_STRVAL(file), O_RDONLY | O_CLOEXEC);
+					if (file_fd >= 0 && (fstat(file_fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+						close(file_fd);
+						file_fd = -1;
+					}
+					if (file_fd < 0) {
+						SG(sapi_headers).http_response_code = 404;
+					}
+				}
+			}
+		}
+		zval_ptr_dtor(&response);
+	}
+
+output:
+	if (file_fd < 0) {
+		phalcon_server_http_compress(ctx, parser_data, &content);
+	}
+
+	if (file_fd >= 0) {
+		content_length = phalcon_server_http_file_range(parser_data, &st, &file_offset);
+	} else if (Z_TYPE(content) == IS_STRING) {
+		content_length = Z_STRLEN(content);
+	}
+
+	headers = phalcon_server_http_get_headers(parser_data->parser->http_major * 100 + parser_data->parser->http_minor, keepalive, content_length);
+	phalcon_server_http_reset_headers();
+
+	if (ctx->coroutine) {
+		phalcon_server_http_coroutine_release(&coroutine, &intern->application);
+		phalcon_coroutine_leave(&coroutine.coroutine);
+	}
+
+	/* Headers and body stay separate buffers, they are gathered by writev */
+	phalcon_server_output_append_string(ctx, client_ctx, headers);
+	zend_string_release(headers);
+
+	if (parser_data->parser->method != HTTP_HEAD) {
+		if (file_fd >= 0) {
+			phalcon_server_output_append_file(ctx, client_ctx, file_fd, file_offset, content_length);
+			file_fd = -1;
+		} else if (Z_TYPE(content) == IS_STRING) {
+			phalcon_server_output_append_string(ctx, client_ctx, Z_STR(content));
+		}
+	}
+	if (file_fd >= 0) {
+		close(file_fd);
+	}
+	zval_ptr_dtor(&content);
+
+	ctx->wdata[client_ctx->cpu_id].trancnt++;
+}
+
+/**
+ * Feeds the bytes read to the parser and answers every complete message in order
+ */
+static void phalcon_server_http_execute(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, phalcon_http_parser_data *parser_data, const char *buf, size_t len)
+{
+	phalcon_server_http_object *intern = phalcon_server_http_object_from_ctx(ctx);
+	int cpu_id = client_ctx->cpu_id;
+	size_t offset = 0, nparsed;
+
+	phalcon_server_log_printf(ctx, "Read %d from socket %d\n", (int)len, client_ctx->fd);
+	client_ctx->data_len = len;
+
+	if (client_ctx->accepted_at) {
+		phalcon_server_histogram_record(&ctx->wdata[cpu_id].metrics.histograms[PHALCON_SERVER_METRIC_ACCEPT], phalcon_server_metrics_now() - client_ctx->accepted_at);
+		client_ctx->accepted_at = 0;
+	}
+
+	while (offset < len) {
+		if (parser_data->state == HTTP_PARSER_STATE_NONE) {
+			client_ctx->message_at = phalcon_server_metrics_now();
+		}
+
+		nparsed = http_parser_execute(parser_data->parser, parser_data->settings, buf + offset, len - offset);
+		offset += nparsed;
+
+		if (HTTP_PARSER_ERRNO(parser_data->parser) == HPE_PAUSED && parser_data->state == HTTP_PARSER_STATE_HEADER_END) {
+			/* Checked before the body is read, the application is never bootstrapped for it */
+			if (!phalcon_server_limiter_allow(ctx->limiter, &client_ctx->addr,
+				parser_data->url.s ? ZSTR_VAL(parser_data->url.s) : "/", parser_data->url.s ? ZSTR_LEN(parser_data->url.s) : 1)) {
+				/* The body is left unread, the connection can not be kept alive */
+				zend_string *too_many = phalcon_server_http_build_headers(parser_data->parser->http_major * 100 + parser_data->parser->http_minor, 429, 0, 0, SL("Retry-After: 1\r\n"));
+
+				phalcon_server_output_append_string(ctx, client_ctx, too_many);
+				zend_string_release(too_many);
+				phalcon_server_metrics_add(&ctx->wdata[cpu_id].metrics.rate_limited, 1);
+				client_ctx->flags |= PHALCON_SERVER_CONN_CLOSE;
+				break;
+			}
+			http_parser_pause(parser_data->parser, 0);
+		} else if (HTTP_PARSER_ERRNO(parser_data->parser) == HPE_PAUSED) {
+			int keepalive = intern->enable_keepalive && !ctx->draining && http_should_keep_alive(parser_data->parser);
+			uint64_t handle_at = phalcon_server_metrics_now();
+
+			phalcon_server_histogram_record(&ctx->wdata[cpu_id].metrics.histograms[PHALCON_SERVER_METRIC_PARSE], handle_at - client_ctx->message_at);
+			if (phalcon_server_static_handle(intern->statics, intern->compress, ctx, client_ctx, parser_data, keepalive)) {
+				ctx->wdata[cpu_id].trancnt++;
+			} else {
+				phalcon_server_http_handle_request(ctx, client_ctx, parser_data, keepalive);
+			}
+			phalcon_server_histogram_record(&ctx->wdata[cpu_id].metrics.histograms[PHALCON_SERVER_METRIC_HANDLE], phalcon_server_metrics_now() - handle_at);
+			if (!keepalive) {
+				client_ctx->flags |= PHALCON_SERVER_CONN_CLOSE;
+				break;
+			}
+
+			/* The leftover bytes belong to the next pipelined message */
+			phalcon_http_parser_data_reset(parser_data);
+			if (client_ctx->output.length > PHALCON_SERVER_OUTPUT_MAX && offset < len) {
+				/* The parser stays paused, the rest is parsed once the queued responses are written */
+				smart_str_appendl(&parser_data->pipelined, buf + offset, len - offset);
+				break;
+			}
+			http_parser_pause(parser_data->parser, 0);
+		} else if (HTTP_PARSER_ERRNO(parser_data->parser) != HPE_OK) {
+			zend_string *bad_request;
+
+			/* A refused body is answered with its own status, 413 for a too large one */
+			if (parser_data->body_error) {
+				bad_request = phalcon_server_http_build_headers(parser_data->parser->http_major * 100 + parser_data->parser->http_minor, parser_data->body_error, 0, 0, NULL, 0);
+			} else {
+				bad_request = zend_string_init(http_400, strlen(http_400), 0);
+			}
+
+			phalcon_server_log_printf(ctx, "Parser error %s on socket %d\n", http_errno_name(HTTP_PARSER_ERRNO(parser_data->parser)), client_ctx->fd);
+			phalcon_server_output_append_string(ctx, client_ctx, bad_request);
+			zend_string_release(bad_request);
+			phalcon_server_metrics_add(&ctx->wdata[cpu_id].metrics.parse_errors, 1);
+			client_ctx->flags |= PHALCON_SERVER_CONN_CLOSE;
+			break;
+		}
+	}
+}
+
+/**
+ * Parses the pipelined bytes kept while the output was over PHALCON_SERVER_OUTPUT_MAX
+ */
+static void phalcon_server_http_resume(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, phalcon_http_parser_data *parser_data)
+{
+	zend_string *pipelined = parser_data->pipelined.s;
+
+	memset(&parser_data->pipelined, 0, sizeof(smart_str));
+	http_parser_pause(parser_data->parser, 0);
+	phalcon_server_http_execute(ctx, client_ctx, parser_data, ZSTR_VAL(pipelined), ZSTR_LEN(pipelined));
+	zend_string_release(pipelined);
+}
+
 static void phalcon_server_http_process_read(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
 {
 	int ep_fd, fd;
 	int events = client_ctx->events;
 	struct epoll_event evt;
-	int ret;
-	char *buf = client_ctx->buf;
+	int ret, rearm = 0;
+	char *buf = NULL;
 	int cpu_id = client_ctx->cpu_id;
+	phalcon_http_parser_data *parser_data;
 
 	ep_fd = client_ctx->ep_fd;
 	fd = client_ctx->fd;
@@ -273,91 +1327,176 @@ static void phalcon_server_http_process_read(struct phalcon_server_context *ctx,
 
 	phalcon_server_log_printf(ctx, "Process read event[%02x] on socket %d\n", events, fd);
 
-    ret = read(fd, buf, PHALCON_SERVER_MAX_BUFSIZE);
-	client_ctx->data_len = ret;
-	if (ret < 0) {
-		ctx->wdata[cpu_id].read_cnt++;
-		perror("process_read() can't read client socket");
-		goto free_back;
-	} else if (ret == 0) {
-		phalcon_server_log_printf(ctx, "Socket %d is closed\n", fd);
+	parser_data = phalcon_server_http_parser_data(ctx, client_ctx);
+
+	/* The read buffer is only borrowed while the socket is drained */
+	buf = phalcon_server_slab_alloc(&ctx->buffers);
+	if (!buf) {
 		goto free_back;
-	} else {
-		phalcon_http_parser_data *parser_data;
-		if (!client_ctx->user_data) {
-			client_ctx->user_data = phalcon_http_parser_data_new(&http_parser_request_settings);
-		}
-		parser_data = (phalcon_http_parser_data *)client_ctx->user_data;
-
-		http_parser_execute(parser_data->parser, parser_data->settings, buf, ret);
-
-		phalcon_server_log_printf(ctx, "Parser state %d, request from socket %d\n", parser_data->parser->state, fd);
-        if (parser_data->parser->state >= HTTP_PARSER_STATE_END || ret < PHALCON_SERVER_MAX_BUFSIZE) {
-			zval url = {}, response = {}, content = {};
-			phalcon_server_http_object *intern;
-			int flag = 0;
-
-			ZVAL_STR(&url, parser_data->url.s);
-			intern = phalcon_server_http_object_from_ctx(ctx);
-
-			PHALCON_CALL_METHOD_FLAG(flag, &response, &intern->application, "handle", &url);
-			phalcon_http_parser_data_free(parser_data);
-			client_ctx->user_data = NULL;
-			client_ctx->response = phalcon_server_http_get_headers();
-			if (flag == FAILURE) {
-				if (EG(exception)) {
-					zval ex, msg;
-					ZVAL_OBJ(&ex, EG(exception));
-					phalcon_read_property(&msg, &ex, SL("message"), PH_NOISY|PH_READONLY);
-					if (Z_TYPE(msg) == IS_STRING) {
-						PHALCON_SERVER_STRING_APPEND(client_ctx->response, Z_STR(msg));
-					}
-					zend_clear_exception();
-				}
-			} else {
-				PHALCON_CALL_METHOD_FLAG(flag, &content, &response, "getcontent");
-				if (Z_TYPE(content) == IS_STRING) {
-					PHALCON_SERVER_STRING_APPEND(client_ctx->response, Z_STR(content));
-				}
-				zval_ptr_dtor(&content);
-				zval_ptr_dtor(&response);
+	}
+
+	/* Dispatched by process_write() once the output went out, the registration was dropped meanwhile */
+	if (parser_data->pipelined.s) {
+		phalcon_server_http_resume(ctx, client_ctx, parser_data);
+		rearm = 1;
+	}
+
+	/* Edge triggered, drain the socket and answer every complete message in order, a paused parser stops reading */
+	while (!(client_ctx->flags & PHALCON_SERVER_CONN_CLOSE) && !parser_data->pipelined.s) {
+		ret = read(fd, buf, PHALCON_SERVER_MAX_BUFSIZE);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
-			client_ctx->handler = ctx->write;
-			evt.events = EPOLLOUT | EPOLLHUP | EPOLLERR;
-			evt.data.ptr = client_ctx;
-			ret = epoll_ctl(ep_fd, EPOLL_CTL_MOD, fd, &evt);
-			if (ret < 0) {
-				perror("Unable to add client socket write event to epoll");
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			ctx->wdata[cpu_id].read_cnt++;
+			perror("process_read() can't read client socket");
+			goto free_back;
+		} else if (ret == 0) {
+			phalcon_server_log_printf(ctx, "Socket %d is closed\n", fd);
+			if (!phalcon_server_output_pending(client_ctx)) {
 				goto free_back;
 			}
-			goto back;
-        }
+			/* Half closed, the pending responses are still written */
+			client_ctx->flags |= PHALCON_SERVER_CONN_CLOSE;
+			break;
+		}
 
-		phalcon_server_log_printf(ctx, "Read %d from socket %d\n", ret, fd);
-		client_ctx->handler = ctx->read;
-		evt.events = EPOLLIN | EPOLLERR | EPOLLET;
-		evt.data.ptr = client_ctx;
+		phalcon_server_metrics_add(&ctx->wdata[cpu_id].metrics.bytes_in, ret);
+		phalcon_server_http_execute(ctx, client_ctx, parser_data, buf, ret);
+	}
 
+	if (phalcon_server_output_pending(client_ctx)) {
+		/* All responses of the pipelined messages go out in one write */
+		if (!client_ctx->write_at) {
+			client_ctx->write_at = phalcon_server_metrics_now();
+		}
+		client_ctx->handler = ctx->write;
+		evt.events = EPOLLOUT | EPOLLHUP | EPOLLERR;
+		evt.data.ptr = client_ctx;
 		ret = epoll_ctl(ep_fd, EPOLL_CTL_MOD, fd, &evt);
 		if (ret < 0) {
+			perror("Unable to add client socket write event to epoll");
+			goto free_back;
+		}
+	} else if (client_ctx->flags & PHALCON_SERVER_CONN_CLOSE) {
+		goto free_back;
+	} else if (rearm) {
+		/* Modifying the registration reports data that arrived while it was dropped */
+		evt.events = EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLET;
+		evt.data.ptr = client_ctx;
+		if (epoll_ctl(ep_fd, EPOLL_CTL_MOD, fd, &evt) < 0) {
 			perror("Unable to add client socket read event to epoll");
 			goto free_back;
 		}
 	}
 
+	/* Between two messages the parser holds no state, idle connections give it back */
+	if (client_ctx->user_data && parser_data->state == HTTP_PARSER_STATE_NONE && !parser_data->pipelined.s) {
+		phalcon_server_http_release_parser_data(ctx, client_ctx);
+	}
+
+	phalcon_server_http_update_timeout(ctx, client_ctx);
+	__sync_fetch_and_and(&client_ctx->flags, ~PHALCON_SERVER_CONN_BUSY);
+
 	goto back;
 
 free_back:
 	phalcon_server_log_printf(ctx, "cpu[%d] close socket %d\n", cpu_id, client_ctx->fd);
-	//__sync_synchronize();
-	phalcon_server_client_close(client_ctx);
-	//__sync_synchronize();
-	phalcon_server_free_context(client_ctx);
+	phalcon_server_http_close(ctx, client_ctx);
 
 back:
+	phalcon_server_slab_free(&ctx->buffers, buf);
 	return;
 }
 
+/**
+ * Coroutine mode, the connection is served with blocking style calls that yield to the scheduler
+ */
+static void phalcon_server_http_process_coroutine(struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx)
+{
+	phalcon_http_parser_data *parser_data;
+	char *buf;
+	ssize_t ret;
+	int timeout, waited, cpu_id = client_ctx->cpu_id;
+
+	parser_data = phalcon_server_http_parser_data(ctx, client_ctx);
+
+	buf = phalcon_server_slab_alloc(&ctx->buffers);
+	if (!buf) {
+		goto back;
+	}
+
+	while (!(client_ctx->flags & PHALCON_SERVER_CONN_CLOSE)) {
+		if (parser_data->pipelined.s) {
+			/* The responses queued before are written, the rest of the pipeline is parsed */
+			phalcon_server_http_resume(ctx, client_ctx, parser_data);
+		} else {
+			if (parser_data->state == HTTP_PARSER_STATE_NONE) {
+				timeout = ctx->timeouts[client_ctx->accepted_at ? PHALCON_SERVER_TIMEOUT_HEADER : PHALCON_SERVER_TIMEOUT_KEEPALIVE];
+			} else if (parser_data->state < HTTP_PARSER_STATE_HEADER_END) {
+				timeout = ctx->timeouts[PHALCON_SERVER_TIMEOUT_HEADER];
+			} else {
+				timeout = ctx->timeouts[PHALCON_SERVER_TIMEOUT_BODY];
+			}
+
+			/* An idle keep-alive connection waits in steps of a second, it is closed as soon as the worker drains */
+			if (parser_data->state == HTTP_PARSER_STATE_NONE && !client_ctx->accepted_at) {
+				waited = 0;
+				while (!ctx->draining && (ret = lthread_wait_read(client_ctx->fd, 1000)) == -2) {
+					waited += 1000;
+					if (timeout > 0 && waited >= timeout) {
+						break;
+					}
+				}
+				/* -1 is the peer closing the connection */
+				if (ctx->draining || ret == -1 || (timeout > 0 && waited >= timeout)) {
+					break;
+				}
+			}
+
+			ret = lthread_recv(client_ctx->fd, buf, PHALCON_SERVER_MAX_BUFSIZE, 0, timeout > 0 ? timeout : 0);
+			if (ret <= 0) {
+				if (ret == -1) {
+					ctx->wdata[cpu_id].read_cnt++;
+				}
+				break;
+			}
+
+			phalcon_server_metrics_add(&ctx->wdata[cpu_id].metrics.bytes_in, ret);
+			phalcon_server_http_execute(ctx, client_ctx, parser_data, buf, ret);
+		}
+
+		if (phalcon_server_output_pending(client_ctx)) {
+			client_ctx->write_at = phalcon_server_metrics_now();
+
+			while ((ret = phalcon_server_output_flush(ctx, client_ctx)) == 0) {
+				timeout = ctx->timeouts[PHALCON_SERVER_TIMEOUT_WRITE];
+				if (lthread_wait_write(client_ctx->fd, timeout > 0 ? timeout : 0) < 0) {
+					ret = -1;
+					break;
+				}
+			}
+			if (ret < 0) {
+				ctx->wdata[cpu_id].write_cnt++;
+				break;
+			}
+
+			phalcon_server_histogram_record(&ctx->wdata[cpu_id].metrics.histograms[PHALCON_SERVER_METRIC_WRITE], phalcon_server_metrics_now() - client_ctx->write_at);
+			client_ctx->write_at = 0;
+		}
+	}
+
+	phalcon_server_slab_free(&ctx->buffers, buf);
+
+back:
+	phalcon_server_http_release_parser_data(ctx, client_ctx);
+	phalcon_server_output_free(ctx, client_ctx);
+	client_ctx->flags = 0;
+}
+
 /**
  * Run the Server
  *
@@ -373,8 +1512,14 @@ PHP_METHOD(Phalcon_Server_Http, start){
 
 	intern = phalcon_server_http_object_from_obj(Z_OBJ_P(getThis()));
 	PHALCON_SERVER_COPY_TO_STACK(&intern->application, application);
+	phalcon_server_slab_init(&intern->parsers, sizeof(phalcon_http_parser_data) + sizeof(struct http_parser));
+
 	intern->ctx.read = phalcon_server_http_process_read;
 	intern->ctx.write = phalcon_server_http_process_write;
+	intern->ctx.timeout = phalcon_server_http_close;
+	if (intern->enable_coroutine) {
+		intern->ctx.coroutine = phalcon_server_http_process_coroutine;
+	}
 	printf("Listen address:\n\t%s:%d\n", intern->ctx.la[0].param_ip, intern->ctx.la[0].param_port);
 
 	phalcon_server_init_log(&intern->ctx);
@@ -24,10 +24,19 @@
 #include "php_phalcon.h"
 
 #include "server/core.h"
+#include "server/static.h"
+#include "server/compress.h"
 
 typedef struct _phalcon_server_http_object {
 	struct phalcon_server_context ctx;
 	int enable_keepalive;
+	int enable_coroutine;
+	zend_string *metrics_path;
+	struct phalcon_server_static *statics;
+	struct phalcon_server_compress *compress;
+	size_t body_buffer;
+	size_t body_max;
+	struct phalcon_server_slab parsers;
 	zval application;
 	zend_object std;
 } phalcon_server_http_object;
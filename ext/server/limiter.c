@@ -0,0 +1,259 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#include "server/limiter.h"
+
+#include <stdlib.h>
+
+struct phalcon_server_limiter *phalcon_server_limiter_new(size_t num_slots)
+{
+	struct phalcon_server_limiter *limiter = calloc(1, sizeof(struct phalcon_server_limiter));
+
+	/* A power of two, the home slot is taken from the low bits of the key */
+	limiter->num_slots = PHALCON_SERVER_LIMITER_PROBES;
+	while (limiter->num_slots < num_slots) {
+		limiter->num_slots <<= 1;
+	}
+
+	return limiter;
+}
+
+void phalcon_server_limiter_add_rule(struct phalcon_server_limiter *limiter, const char *prefix, size_t prefix_len, long rate, long burst)
+{
+	struct phalcon_server_limiter_rule *rule;
+
+	limiter->rules = realloc(limiter->rules, (limiter->num_rules + 1) * sizeof(struct phalcon_server_limiter_rule));
+	rule = &limiter->rules[limiter->num_rules++];
+
+	rule->prefix = prefix ? strndup(prefix, prefix_len) : NULL;
+	rule->prefix_len = prefix ? prefix_len : 0;
+	rule->rate = rate > 0 ? (rate < PHALCON_SERVER_LIMITER_MAX_BURST ? rate : PHALCON_SERVER_LIMITER_MAX_BURST) : 1;
+	if (burst < 1) {
+		burst = rule->rate;
+	}
+	rule->capacity = (burst < PHALCON_SERVER_LIMITER_MAX_BURST ? burst : PHALCON_SERVER_LIMITER_MAX_BURST) * PHALCON_SERVER_LIMITER_TOKEN;
+}
+
+void phalcon_server_limiter_free(struct phalcon_server_limiter *limiter)
+{
+	int i;
+
+	for (i = 0; i < limiter->num_rules; i++) {
+		free(limiter->rules[i].prefix);
+	}
+	free(limiter->rules);
+	free(limiter);
+}
+
+/**
+ * Bytes of the slots, mapped after the worker data by phalcon_server_init_workers()
+ */
+size_t phalcon_server_limiter_size(struct phalcon_server_limiter *limiter)
+{
+	return limiter->num_slots * sizeof(struct phalcon_server_limiter_slot);
+}
+
+static inline uint32_t phalcon_server_limiter_now()
+{
+	uint32_t now = (uint32_t)(phalcon_server_metrics_now() / 1000);
+
+	/* 0 would read as a full bucket */
+	return now ? now : 1;
+}
+
+static uint64_t phalcon_server_limiter_key(int rule, const struct pahlcon_server_socket_address *addr)
+{
+	unsigned char buf[sizeof(int) + 16];
+	size_t len = sizeof(int);
+
+	memcpy(buf, &rule, sizeof(int));
+	if (addr->addr.inet_v4.sin_family == AF_INET) {
+		memcpy(buf + len, &addr->addr.inet_v4.sin_addr, 4);
+		len += 4;
+	} else if (addr->addr.inet_v6.sin6_family == AF_INET6) {
+		memcpy(buf + len, &addr->addr.inet_v6.sin6_addr, 16);
+		len += 16;
+	}
+
+	return zend_inline_hash_func((const char *)buf, len);
+}
+
+static uint64_t phalcon_server_limiter_tokens(uint64_t state, uint32_t now, const struct phalcon_server_limiter_rule *rule)
+{
+	uint64_t tokens;
+
+	if (!state) {
+		return rule->capacity;
+	}
+
+	/* The unsigned difference survives the wrap of the millisecond counter */
+	tokens = (state & 0xffffffff) + (uint64_t)(uint32_t)(now - (uint32_t)(state >> 32)) * rule->rate;
+
+	return tokens < rule->capacity ? tokens : rule->capacity;
+}
+
+/**
+ * Open addressing over a short window, a key is never moved once it owns a slot.
+ * With create the slot of the client idle for longest is taken when the window is full,
+ * NULL lets the request through rather than sharing the bucket of another client
+ */
+static struct phalcon_server_limiter_slot *phalcon_server_limiter_find(struct phalcon_server_limiter *limiter, uint64_t key, uint32_t now, int create)
+{
+	struct phalcon_server_limiter_slot *slot, *victim = NULL;
+	uint64_t current, state;
+	uint32_t idle, victim_idle = PHALCON_SERVER_LIMITER_IDLE;
+	size_t i, mask = limiter->num_slots - 1;
+
+	for (i = 0; i < PHALCON_SERVER_LIMITER_PROBES; i++) {
+		slot = &limiter->slots[(key + i) & mask];
+		current = *(volatile uint64_t *)&slot->key;
+
+		if (current == key) {
+			return slot;
+		}
+
+		if (!current) {
+			if (!create) {
+				return NULL;
+			}
+			current = __sync_val_compare_and_swap(&slot->key, 0, key);
+			if (!current || current == key) {
+				return slot;
+			}
+			continue;
+		}
+
+		state = *(volatile uint64_t *)&slot->state;
+		idle = state ? now - (uint32_t)(state >> 32) : 0;
+		if (idle >= victim_idle) {
+			victim = slot;
+			victim_idle = idle;
+		}
+	}
+
+	if (!create || !victim) {
+		return NULL;
+	}
+
+	current = *(volatile uint64_t *)&victim->key;
+	if (!__sync_bool_compare_and_swap(&victim->key, current, key)) {
+		return NULL;
+	}
+	victim->state = 0;
+
+	return victim;
+}
+
+/**
+ * Checked on accept, a client whose bucket is empty is dropped before a byte is read,
+ * no token is taken so a kept alive connection pays once per request
+ */
+int phalcon_server_limiter_blocked(struct phalcon_server_limiter *limiter, const struct pahlcon_server_socket_address *addr)
+{
+	struct phalcon_server_limiter_slot *slot;
+	uint32_t now;
+	int i;
+
+	for (i = 0; i < limiter->num_rules; i++) {
+		if (limiter->rules[i].prefix) {
+			continue;
+		}
+
+		now = phalcon_server_limiter_now();
+		slot = phalcon_server_limiter_find(limiter, phalcon_server_limiter_key(i, addr), now, 0);
+
+		return slot && phalcon_server_limiter_tokens(*(volatile uint64_t *)&slot->state, now, &limiter->rules[i]) < PHALCON_SERVER_LIMITER_TOKEN;
+	}
+
+	return 0;
+}
+
+static inline int phalcon_server_limiter_match(const struct phalcon_server_limiter_rule *rule, const char *url, size_t url_len)
+{
+	return !rule->prefix || (url_len >= rule->prefix_len && !memcmp(url, rule->prefix, rule->prefix_len));
+}
+
+/**
+ * Gives back the tokens taken from the rules before the one that refused the request
+ */
+static void phalcon_server_limiter_refund(struct phalcon_server_limiter *limiter, const struct pahlcon_server_socket_address *addr, const char *url, size_t url_len, int count, uint32_t now)
+{
+	struct phalcon_server_limiter_rule *rule;
+	struct phalcon_server_limiter_slot *slot;
+	uint64_t state, tokens;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		rule = &limiter->rules[i];
+		if (!phalcon_server_limiter_match(rule, url, url_len)) {
+			continue;
+		}
+
+		slot = phalcon_server_limiter_find(limiter, phalcon_server_limiter_key(i, addr), now, 0);
+		if (!slot) {
+			continue;
+		}
+
+		do {
+			state = *(volatile uint64_t *)&slot->state;
+			tokens = phalcon_server_limiter_tokens(state, now, rule) + PHALCON_SERVER_LIMITER_TOKEN;
+			if (tokens > rule->capacity) {
+				tokens = rule->capacity;
+			}
+		} while (!__sync_bool_compare_and_swap(&slot->state, state, ((uint64_t)now << 32) | tokens));
+	}
+}
+
+/**
+ * Takes a token from every rule matching the client and the url, 0 when one of them is empty,
+ * the request then costs nothing to the other rules
+ */
+int phalcon_server_limiter_allow(struct phalcon_server_limiter *limiter, const struct pahlcon_server_socket_address *addr, const char *url, size_t url_len)
+{
+	struct phalcon_server_limiter_rule *rule;
+	struct phalcon_server_limiter_slot *slot;
+	uint64_t state, tokens;
+	uint32_t now = phalcon_server_limiter_now();
+	int i;
+
+	for (i = 0; i < limiter->num_rules; i++) {
+		rule = &limiter->rules[i];
+		if (!phalcon_server_limiter_match(rule, url, url_len)) {
+			continue;
+		}
+
+		slot = phalcon_server_limiter_find(limiter, phalcon_server_limiter_key(i, addr), now, 1);
+		if (!slot) {
+			continue;
+		}
+
+		/* Every worker updates the same word, the refill and the take are one compare and swap */
+		do {
+			state = *(volatile uint64_t *)&slot->state;
+			tokens = phalcon_server_limiter_tokens(state, now, rule);
+			if (tokens < PHALCON_SERVER_LIMITER_TOKEN) {
+				phalcon_server_limiter_refund(limiter, addr, url, url_len, i, now);
+				return 0;
+			}
+		} while (!__sync_bool_compare_and_swap(&slot->state, state, ((uint64_t)now << 32) | (tokens - PHALCON_SERVER_LIMITER_TOKEN)));
+	}
+
+	return 1;
+}
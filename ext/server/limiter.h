@@ -0,0 +1,69 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_SERVER_LIMITER_H
+#define PHALCON_SERVER_LIMITER_H
+
+#include "php_phalcon.h"
+
+#include "server/core.h"
+
+#include <stdint.h>
+
+#define PHALCON_SERVER_LIMITER_SLOTS			65536
+/* Slots looked at from the home one before the request is let through */
+#define PHALCON_SERVER_LIMITER_PROBES			8
+/* Milliseconds without a request before the slot of a client can be taken by another one */
+#define PHALCON_SERVER_LIMITER_IDLE				60000
+/* Tokens are counted in thousandths, a rate of N per second refills N of them every millisecond */
+#define PHALCON_SERVER_LIMITER_TOKEN			1000
+#define PHALCON_SERVER_LIMITER_MAX_BURST		4000000
+
+/* The state packs the millisecond of the last refill and the tokens left, 0 is a full bucket */
+struct phalcon_server_limiter_slot {
+	uint64_t key;
+	uint64_t state;
+};
+
+/* Without a prefix the rule applies to every request of a client address */
+struct phalcon_server_limiter_rule {
+	char *prefix;
+	size_t prefix_len;
+	uint32_t rate;
+	uint32_t capacity;
+};
+
+/* The rules are process local, the slots live in the shared mapping of the worker data */
+struct phalcon_server_limiter {
+	struct phalcon_server_limiter_rule *rules;
+	int num_rules;
+	struct phalcon_server_limiter_slot *slots;
+	size_t num_slots;
+};
+
+struct phalcon_server_limiter *phalcon_server_limiter_new(size_t num_slots);
+void phalcon_server_limiter_add_rule(struct phalcon_server_limiter *limiter, const char *prefix, size_t prefix_len, long rate, long burst);
+void phalcon_server_limiter_free(struct phalcon_server_limiter *limiter);
+size_t phalcon_server_limiter_size(struct phalcon_server_limiter *limiter);
+
+int phalcon_server_limiter_blocked(struct phalcon_server_limiter *limiter, const struct pahlcon_server_socket_address *addr);
+int phalcon_server_limiter_allow(struct phalcon_server_limiter *limiter, const struct pahlcon_server_socket_address *addr, const char *url, size_t url_len);
+
+#endif /* PHALCON_SERVER_LIMITER_H */
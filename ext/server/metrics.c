@@ -0,0 +1,210 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#include "server/metrics.h"
+
+static const char *phalcon_server_metric_names[PHALCON_SERVER_METRIC_MAX] = {
+	"accept", "parse", "handle", "write"
+};
+
+static const char *phalcon_server_metric_quantiles[] = {
+	"0.5", "0.9", "0.99", "0.999", NULL
+};
+
+static const double phalcon_server_metric_percentiles[] = {
+	0.5, 0.9, 0.99, 0.999
+};
+
+static inline int phalcon_server_histogram_index(uint64_t value)
+{
+	int exponent, index;
+
+	if (value < PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS) {
+		return (int)value;
+	}
+
+	exponent = 63 - __builtin_clzll(value);
+	index = (exponent - PHALCON_SERVER_HISTOGRAM_SUB_BITS + 1) * PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS
+		+ (int)((value >> (exponent - PHALCON_SERVER_HISTOGRAM_SUB_BITS)) & (PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS - 1));
+
+	return index < PHALCON_SERVER_HISTOGRAM_BUCKETS ? index : PHALCON_SERVER_HISTOGRAM_BUCKETS - 1;
+}
+
+/**
+ * Returns the highest value counted by the bucket
+ */
+static inline uint64_t phalcon_server_histogram_value(int index)
+{
+	int shift;
+
+	if (index < PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS) {
+		return (uint64_t)index;
+	}
+
+	shift = index / PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS - 1;
+
+	return ((uint64_t)(PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS + index % PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+/**
+ * Counts one value, every field is updated with an atomic add so worker threads never lock
+ */
+void phalcon_server_histogram_record(struct phalcon_server_histogram *histogram, uint64_t value)
+{
+	uint64_t max = histogram->max;
+
+	__sync_fetch_and_add(&histogram->buckets[phalcon_server_histogram_index(value)], 1);
+	__sync_fetch_and_add(&histogram->sum, value);
+	__sync_fetch_and_add(&histogram->count, 1);
+
+	while (value > max && !__sync_bool_compare_and_swap(&histogram->max, max, value)) {
+		max = histogram->max;
+	}
+}
+
+void phalcon_server_histogram_merge(struct phalcon_server_histogram *dst, const struct phalcon_server_histogram *src)
+{
+	int i;
+
+	for (i = 0; i < PHALCON_SERVER_HISTOGRAM_BUCKETS; i++) {
+		dst->buckets[i] += src->buckets[i];
+	}
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max) {
+		dst->max = src->max;
+	}
+}
+
+uint64_t phalcon_server_histogram_percentile(const struct phalcon_server_histogram *histogram, double percentile)
+{
+	uint64_t total = 0, rank, seen = 0;
+	int i;
+
+	/* The buckets are read while workers write them, count what is actually there */
+	for (i = 0; i < PHALCON_SERVER_HISTOGRAM_BUCKETS; i++) {
+		total += histogram->buckets[i];
+	}
+	if (!total) {
+		return 0;
+	}
+
+	rank = (uint64_t)(percentile * total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+
+	for (i = 0; i < PHALCON_SERVER_HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen >= rank) {
+			uint64_t value = phalcon_server_histogram_value(i);
+			return value < histogram->max ? value : histogram->max;
+		}
+	}
+
+	return histogram->max;
+}
+
+void phalcon_server_metrics_merge(struct phalcon_server_metrics *dst, const struct phalcon_server_metrics *src)
+{
+	int i;
+
+	for (i = 0; i < PHALCON_SERVER_METRIC_MAX; i++) {
+		phalcon_server_histogram_merge(&dst->histograms[i], &src->histograms[i]);
+	}
+	dst->bytes_in += src->bytes_in;
+	dst->bytes_out += src->bytes_out;
+	dst->parse_errors += src->parse_errors;
+	dst->application_errors += src->application_errors;
+	dst->rate_limited += src->rate_limited;
+}
+
+static void phalcon_server_metrics_render_family(smart_str *buffer, const char *name, const char *type, const char *help)
+{
+	smart_str_appendl(buffer, "# HELP ", sizeof("# HELP ") - 1);
+	smart_str_appends(buffer, name);
+	smart_str_appendc(buffer, ' ');
+	smart_str_appends(buffer, help);
+	smart_str_appendl(buffer, "\n# TYPE ", sizeof("\n# TYPE ") - 1);
+	smart_str_appends(buffer, name);
+	smart_str_appendc(buffer, ' ');
+	smart_str_appends(buffer, type);
+	smart_str_appendc(buffer, '\n');
+}
+
+static void phalcon_server_metrics_render_sample(smart_str *buffer, const char *name, const char *phase, const char *worker, const char *quantile, uint64_t value)
+{
+	smart_str_appends(buffer, name);
+	smart_str_appendc(buffer, '{');
+	if (phase) {
+		smart_str_appendl(buffer, "phase=\"", sizeof("phase=\"") - 1);
+		smart_str_appends(buffer, phase);
+		smart_str_appendl(buffer, "\",", 2);
+	}
+	smart_str_appendl(buffer, "worker=\"", sizeof("worker=\"") - 1);
+	smart_str_appends(buffer, worker);
+	if (quantile) {
+		smart_str_appendl(buffer, "\",quantile=\"", sizeof("\",quantile=\"") - 1);
+		smart_str_appends(buffer, quantile);
+	}
+	smart_str_appendl(buffer, "\"} ", 3);
+	smart_str_append_unsigned(buffer, value);
+	smart_str_appendc(buffer, '\n');
+}
+
+static void phalcon_server_metrics_render_counter(smart_str *buffer, const char *name, const char *help, const struct phalcon_server_metrics **metrics, const char **workers, int count, size_t offset)
+{
+	int i;
+
+	phalcon_server_metrics_render_family(buffer, name, "counter", help);
+	for (i = 0; i < count; i++) {
+		phalcon_server_metrics_render_sample(buffer, name, NULL, workers[i], NULL, *(const uint64_t *)((const char *)metrics[i] + offset));
+	}
+}
+
+/**
+ * Appends the metrics of every worker in the Prometheus text exposition format,
+ * the samples of a family are contiguous and follow its HELP and TYPE lines
+ */
+void phalcon_server_metrics_render(smart_str *buffer, const struct phalcon_server_metrics **metrics, const char **workers, int count)
+{
+	const struct phalcon_server_histogram *histogram;
+	int i, j, k;
+
+	phalcon_server_metrics_render_family(buffer, "phalcon_server_latency_microseconds", "summary", "Latency of the request phases");
+	for (k = 0; k < count; k++) {
+		for (i = 0; i < PHALCON_SERVER_METRIC_MAX; i++) {
+			histogram = &metrics[k]->histograms[i];
+
+			for (j = 0; phalcon_server_metric_quantiles[j]; j++) {
+				phalcon_server_metrics_render_sample(buffer, "phalcon_server_latency_microseconds", phalcon_server_metric_names[i], workers[k],
+					phalcon_server_metric_quantiles[j], phalcon_server_histogram_percentile(histogram, phalcon_server_metric_percentiles[j]));
+			}
+			phalcon_server_metrics_render_sample(buffer, "phalcon_server_latency_microseconds_sum", phalcon_server_metric_names[i], workers[k], NULL, histogram->sum);
+			phalcon_server_metrics_render_sample(buffer, "phalcon_server_latency_microseconds_count", phalcon_server_metric_names[i], workers[k], NULL, histogram->count);
+		}
+	}
+
+	phalcon_server_metrics_render_counter(buffer, "phalcon_server_received_bytes_total", "Bytes read from the clients", metrics, workers, count, XtOffsetOf(struct phalcon_server_metrics, bytes_in));
+	phalcon_server_metrics_render_counter(buffer, "phalcon_server_sent_bytes_total", "Bytes written to the clients", metrics, workers, count, XtOffsetOf(struct phalcon_server_metrics, bytes_out));
+	phalcon_server_metrics_render_counter(buffer, "phalcon_server_parse_errors_total", "Messages the parser rejected", metrics, workers, count, XtOffsetOf(struct phalcon_server_metrics, parse_errors));
+	phalcon_server_metrics_render_counter(buffer, "phalcon_server_application_errors_total", "Requests the application failed", metrics, workers, count, XtOffsetOf(struct phalcon_server_metrics, application_errors));
+	phalcon_server_metrics_render_counter(buffer, "phalcon_server_rate_limited_total", "Clients dropped by the rate limiter", metrics, workers, count, XtOffsetOf(struct phalcon_server_metrics, rate_limited));
+}
@@ -0,0 +1,82 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_SERVER_METRICS_H
+#define PHALCON_SERVER_METRICS_H
+
+#include "php_phalcon.h"
+
+#include <Zend/zend_smart_str.h>
+
+#include <stdint.h>
+#include <time.h>
+
+/* Log-linear buckets, 8 per power of two keep the error of a percentile under 12.5% */
+#define PHALCON_SERVER_HISTOGRAM_SUB_BITS		3
+#define PHALCON_SERVER_HISTOGRAM_SUB_BUCKETS	(1 << PHALCON_SERVER_HISTOGRAM_SUB_BITS)
+#define PHALCON_SERVER_HISTOGRAM_BUCKETS		256
+
+enum {
+	PHALCON_SERVER_METRIC_ACCEPT,
+	PHALCON_SERVER_METRIC_PARSE,
+	PHALCON_SERVER_METRIC_HANDLE,
+	PHALCON_SERVER_METRIC_WRITE,
+	PHALCON_SERVER_METRIC_MAX
+};
+
+/* Latencies in microseconds */
+struct phalcon_server_histogram {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t buckets[PHALCON_SERVER_HISTOGRAM_BUCKETS];
+};
+
+struct phalcon_server_metrics {
+	struct phalcon_server_histogram histograms[PHALCON_SERVER_METRIC_MAX];
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t parse_errors;
+	uint64_t application_errors;
+	uint64_t rate_limited;
+};
+
+static inline uint64_t phalcon_server_metrics_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline void phalcon_server_metrics_add(uint64_t *counter, uint64_t value)
+{
+	__sync_fetch_and_add(counter, value);
+}
+
+void phalcon_server_histogram_record(struct phalcon_server_histogram *histogram, uint64_t value);
+void phalcon_server_histogram_merge(struct phalcon_server_histogram *dst, const struct phalcon_server_histogram *src);
+uint64_t phalcon_server_histogram_percentile(const struct phalcon_server_histogram *histogram, double percentile);
+
+void phalcon_server_metrics_merge(struct phalcon_server_metrics *dst, const struct phalcon_server_metrics *src);
+void phalcon_server_metrics_render(smart_str *buffer, const struct phalcon_server_metrics **metrics, const char **workers, int count);
+
+#endif /* PHALCON_SERVER_METRICS_H */
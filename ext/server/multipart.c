@@ -0,0 +1,370 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#include "server/multipart.h"
+
+#include <main/SAPI.h>
+#include <main/php_open_temporary_file.h>
+#include <main/rfc1867.h>
+
+#include <unistd.h>
+#include <errno.h>
+
+/**
+ * Value of a parameter of a header like Content-Disposition, quoted or not
+ */
+static zend_string *phalcon_server_multipart_param(const char *value, size_t length, const char *name, size_t name_len)
+{
+	const char *p = value, *end = value + length, *start;
+	smart_str buffer = {0};
+
+	while (p < end) {
+		while (p < end && (*p == ';' || *p == ' ' || *p == '\t')) {
+			p++;
+		}
+		start = p;
+		while (p < end && *p != '=' && *p != ';') {
+			p++;
+		}
+
+		if (p < end && *p == '=' && (size_t)(p - start) == name_len && !strncasecmp(start, name, name_len)) {
+			p++;
+			if (p < end && *p == '"') {
+				for (p++; p < end && *p != '"'; p++) {
+					if (*p == '\\' && p + 1 < end) {
+						p++;
+					}
+					smart_str_appendc(&buffer, *p);
+				}
+			} else {
+				while (p < end && *p != ';' && *p != ' ' && *p != '\t') {
+					smart_str_appendc(&buffer, *p++);
+				}
+			}
+			smart_str_0(&buffer);
+			return buffer.s ? buffer.s : ZSTR_EMPTY_ALLOC();
+		}
+
+		/* Skip the value, it may hold a quoted ';' */
+		if (p < end && *p == '=') {
+			p++;
+			if (p < end && *p == '"') {
+				for (p++; p < end && *p != '"'; p++) {
+					if (*p == '\\') {
+						p++;
+					}
+				}
+			}
+			while (p < end && *p != ';') {
+				p++;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+phalcon_server_multipart *phalcon_server_multipart_new(const char *content_type)
+{
+	phalcon_server_multipart *multipart;
+	zend_string *boundary;
+	const char *params;
+
+	if (strncasecmp(content_type, SL("multipart/form-data")) || !(params = strchr(content_type, ';'))) {
+		return NULL;
+	}
+
+	boundary = phalcon_server_multipart_param(params, strlen(params), SL("boundary"));
+	if (!boundary) {
+		return NULL;
+	}
+	if (!ZSTR_LEN(boundary) || ZSTR_LEN(boundary) > 70) {
+		zend_string_release(boundary);
+		return NULL;
+	}
+
+	multipart = ecalloc(1, sizeof(phalcon_server_multipart));
+	multipart->delimiter = strpprintf(0, "\r\n--%s", ZSTR_VAL(boundary));
+	zend_string_release(boundary);
+
+	/* The first delimiter has no line break before it */
+	smart_str_appendl(&multipart->tail, "\r\n", 2);
+	multipart->state = PHALCON_SERVER_MULTIPART_PREAMBLE;
+
+	return multipart;
+}
+
+static void phalcon_server_multipart_close_part(phalcon_server_multipart_part *part)
+{
+	if (part->fd >= 0) {
+		close(part->fd);
+		part->fd = -1;
+	}
+	smart_str_0(&part->value);
+}
+
+static void phalcon_server_multipart_headers(phalcon_server_multipart_part *part, const char *headers, size_t length)
+{
+	const char *line = headers, *end = headers + length, *eol, *value;
+	size_t line_len;
+
+	while (line < end) {
+		eol = memchr(line, '\r', end - line);
+		line_len = eol ? (size_t)(eol - line) : (size_t)(end - line);
+
+		if ((value = memchr(line, ':', line_len)) != NULL) {
+			size_t name_len = value - line;
+			for (value++; value < line + line_len && (*value == ' ' || *value == '\t'); value++);
+
+			if (name_len == sizeof("Content-Disposition") - 1 && !strncasecmp(line, SL("Content-Disposition"))) {
+				part->name = phalcon_server_multipart_param(value, line + line_len - value, SL("name"));
+				part->filename = phalcon_server_multipart_param(value, line + line_len - value, SL("filename"));
+			} else if (name_len == sizeof("Content-Type") - 1 && !strncasecmp(line, SL("Content-Type"))) {
+				part->type = zend_string_init(value, line + line_len - value, 0);
+			}
+		}
+
+		line += line_len + 2;
+	}
+
+	if (part->filename) {
+		/* Only the base name, some browsers send the full client path */
+		const char *base = ZSTR_VAL(part->filename) + ZSTR_LEN(part->filename);
+		while (base > ZSTR_VAL(part->filename) && base[-1] != '/' && base[-1] != '\\') {
+			base--;
+		}
+		if (base != ZSTR_VAL(part->filename)) {
+			zend_string *filename = zend_string_init(base, ZSTR_VAL(part->filename) + ZSTR_LEN(part->filename) - base, 0);
+			zend_string_release(part->filename);
+			part->filename = filename;
+		}
+
+		if (!ZSTR_LEN(part->filename)) {
+			part->error = UPLOAD_ERR_NO_FILE;
+		} else if ((part->fd = php_open_temporary_fd(php_get_temporary_directory(), "php", &part->tmp_name)) < 0) {
+			part->error = UPLOAD_ERR_NO_TMP_DIR;
+		}
+	}
+}
+
+static int phalcon_server_multipart_data(phalcon_server_multipart_part *part, const char *data, size_t length)
+{
+	ssize_t n;
+
+	if (!length) {
+		return 0;
+	}
+
+	if (!part->filename) {
+		if ((part->value.s ? ZSTR_LEN(part->value.s) : 0) + length > PHALCON_SERVER_MULTIPART_MAX_FIELD) {
+			return -1;
+		}
+		smart_str_appendl(&part->value, data, length);
+		return 0;
+	}
+
+	part->size += length;
+
+	while (part->fd >= 0 && length) {
+		n = write(part->fd, data, length);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			part->error = UPLOAD_ERR_CANT_WRITE;
+			close(part->fd);
+			part->fd = -1;
+			break;
+		}
+		data += n;
+		length -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Consumes a chunk of the body, the bytes that may start a delimiter wait for the next one
+ */
+int phalcon_server_multipart_feed(phalcon_server_multipart *multipart, const char *data, size_t length)
+{
+	const char *buf, *found, *delimiter = ZSTR_VAL(multipart->delimiter);
+	size_t n, pos = 0, delimiter_len = ZSTR_LEN(multipart->delimiter), keep;
+	phalcon_server_multipart_part *part = multipart->num_parts ? &multipart->parts[multipart->num_parts - 1] : NULL;
+
+	if (multipart->error) {
+		return -1;
+	}
+
+	if (multipart->state == PHALCON_SERVER_MULTIPART_DONE) {
+		return 0;
+	}
+
+	smart_str_appendl(&multipart->tail, data, length);
+	buf = ZSTR_VAL(multipart->tail.s);
+	n = ZSTR_LEN(multipart->tail.s);
+
+	while (pos < n && multipart->state != PHALCON_SERVER_MULTIPART_DONE) {
+		switch (multipart->state) {
+			case PHALCON_SERVER_MULTIPART_PREAMBLE:
+			case PHALCON_SERVER_MULTIPART_DATA:
+				found = zend_memnstr(buf + pos, delimiter, delimiter_len, buf + n);
+				if (found) {
+					if (multipart->state == PHALCON_SERVER_MULTIPART_DATA && phalcon_server_multipart_data(part, buf + pos, found - buf - pos) < 0) {
+						goto error;
+					}
+					pos = found - buf + delimiter_len;
+					multipart->state = PHALCON_SERVER_MULTIPART_DELIMITER;
+					break;
+				}
+
+				keep = delimiter_len - 1;
+				if (n - pos > keep) {
+					if (multipart->state == PHALCON_SERVER_MULTIPART_DATA && phalcon_server_multipart_data(part, buf + pos, n - pos - keep) < 0) {
+						goto error;
+					}
+					pos = n - keep;
+				}
+				goto done;
+
+			case PHALCON_SERVER_MULTIPART_DELIMITER:
+				if (n - pos < 2) {
+					goto done;
+				}
+
+				if (part) {
+					phalcon_server_multipart_close_part(part);
+				}
+
+				if (buf[pos] == '-' && buf[pos + 1] == '-') {
+					multipart->state = PHALCON_SERVER_MULTIPART_DONE;
+					pos = n;
+					break;
+				}
+
+				/* Transport padding may follow the boundary */
+				found = zend_memnstr(buf + pos, "\r\n", 2, buf + n);
+				if (!found) {
+					if (n - pos > 256) {
+						goto error;
+					}
+					goto done;
+				}
+				pos = found - buf + 2;
+
+				if (multipart->num_parts >= PHALCON_SERVER_MULTIPART_MAX_PARTS) {
+					goto error;
+				}
+				if (multipart->num_parts == multipart->size_parts) {
+					multipart->size_parts = multipart->size_parts ? multipart->size_parts * 2 : 8;
+					multipart->parts = erealloc(multipart->parts, multipart->size_parts * sizeof(phalcon_server_multipart_part));
+				}
+				part = &multipart->parts[multipart->num_parts++];
+				memset(part, 0, sizeof(phalcon_server_multipart_part));
+				part->fd = -1;
+				multipart->state = PHALCON_SERVER_MULTIPART_HEADERS;
+				break;
+
+			case PHALCON_SERVER_MULTIPART_HEADERS:
+				if (n - pos >= 2 && buf[pos] == '\r' && buf[pos + 1] == '\n') {
+					/* A part without headers */
+					pos += 2;
+				} else {
+					found = zend_memnstr(buf + pos, "\r\n\r\n", 4, buf + n);
+					if (!found) {
+						if (n - pos > PHALCON_SERVER_MULTIPART_MAX_HEADER) {
+							goto error;
+						}
+						goto done;
+					}
+					phalcon_server_multipart_headers(part, buf + pos, found - buf - pos);
+					pos = found - buf + 4;
+				}
+				multipart->state = PHALCON_SERVER_MULTIPART_DATA;
+				break;
+		}
+	}
+
+done:
+	/* Only the unresolved bytes are kept */
+	if (pos) {
+		memmove(ZSTR_VAL(multipart->tail.s), buf + pos, n - pos);
+		ZSTR_LEN(multipart->tail.s) = n - pos;
+	}
+	return 0;
+
+error:
+	multipart->error = 1;
+	return -1;
+}
+
+/**
+ * Returns -1 when the body ended before the closing delimiter
+ */
+int phalcon_server_multipart_finish(phalcon_server_multipart *multipart)
+{
+	int i;
+
+	for (i = 0; i < multipart->num_parts; i++) {
+		phalcon_server_multipart_close_part(&multipart->parts[i]);
+	}
+
+	return !multipart->error && multipart->state == PHALCON_SERVER_MULTIPART_DONE ? 0 : -1;
+}
+
+/**
+ * The temporary files the application did not move are removed
+ */
+void phalcon_server_multipart_free(phalcon_server_multipart *multipart)
+{
+	phalcon_server_multipart_part *part;
+	int i;
+
+	for (i = 0; i < multipart->num_parts; i++) {
+		part = &multipart->parts[i];
+		if (part->fd >= 0) {
+			close(part->fd);
+		}
+		if (part->tmp_name) {
+			if (SG(rfc1867_uploaded_files)) {
+				zend_hash_del(SG(rfc1867_uploaded_files), part->tmp_name);
+			}
+			unlink(ZSTR_VAL(part->tmp_name));
+			zend_string_release(part->tmp_name);
+		}
+		if (part->name) {
+			zend_string_release(part->name);
+		}
+		if (part->filename) {
+			zend_string_release(part->filename);
+		}
+		if (part->type) {
+			zend_string_release(part->type);
+		}
+		smart_str_free(&part->value);
+	}
+
+	if (multipart->parts) {
+		efree(multipart->parts);
+	}
+	smart_str_free(&multipart->tail);
+	zend_string_release(multipart->delimiter);
+	efree(multipart);
+}
@@ -0,0 +1,68 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_SERVER_MULTIPART_H
+#define PHALCON_SERVER_MULTIPART_H
+
+#include "php_phalcon.h"
+
+#include <Zend/zend_smart_str.h>
+
+/* Part headers and form fields are kept in memory, file parts never are */
+#define PHALCON_SERVER_MULTIPART_MAX_HEADER		8192
+#define PHALCON_SERVER_MULTIPART_MAX_FIELD		(1024 * 1024)
+#define PHALCON_SERVER_MULTIPART_MAX_PARTS		1000
+
+enum {
+	PHALCON_SERVER_MULTIPART_PREAMBLE,
+	PHALCON_SERVER_MULTIPART_DELIMITER,
+	PHALCON_SERVER_MULTIPART_HEADERS,
+	PHALCON_SERVER_MULTIPART_DATA,
+	PHALCON_SERVER_MULTIPART_DONE
+};
+
+typedef struct {
+	zend_string *name;
+	zend_string *filename;
+	zend_string *type;
+	zend_string *tmp_name;
+	int fd;
+	size_t size;
+	int error;
+	smart_str value;
+} phalcon_server_multipart_part;
+
+/* Fed with the body as it arrives, the file parts are written to their own temporary files */
+typedef struct {
+	int state;
+	zend_string *delimiter;
+	smart_str tail;
+	phalcon_server_multipart_part *parts;
+	int num_parts;
+	int size_parts;
+	int error;
+} phalcon_server_multipart;
+
+phalcon_server_multipart *phalcon_server_multipart_new(const char *content_type);
+int phalcon_server_multipart_feed(phalcon_server_multipart *multipart, const char *data, size_t length);
+int phalcon_server_multipart_finish(phalcon_server_multipart *multipart);
+void phalcon_server_multipart_free(phalcon_server_multipart *multipart);
+
+#endif /* PHALCON_SERVER_MULTIPART_H */
@@ -0,0 +1,574 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#include "server/static.h"
+
+#include <ext/standard/url.h>
+
+#include <limits.h>
+#include <ctype.h>
+
+static const struct {
+	const char *extension;
+	const char *mime;
+} phalcon_server_static_mimes[] = {
+	{ "html", "text/html; charset=utf-8" },
+	{ "htm", "text/html; charset=utf-8" },
+	{ "css", "text/css; charset=utf-8" },
+	{ "js", "application/javascript; charset=utf-8" },
+	{ "json", "application/json" },
+	{ "map", "application/json" },
+	{ "xml", "application/xml" },
+	{ "txt", "text/plain; charset=utf-8" },
+	{ "csv", "text/csv" },
+	{ "png", "image/png" },
+	{ "jpg", "image/jpeg" },
+	{ "jpeg", "image/jpeg" },
+	{ "gif", "image/gif" },
+	{ "svg", "image/svg+xml" },
+	{ "ico", "image/x-icon" },
+	{ "webp", "image/webp" },
+	{ "woff", "font/woff" },
+	{ "woff2", "font/woff2" },
+	{ "ttf", "font/ttf" },
+	{ "otf", "font/otf" },
+	{ "pdf", "application/pdf" },
+	{ "zip", "application/zip" },
+	{ "gz", "application/gzip" },
+	{ "wasm", "application/wasm" },
+	{ "mp4", "video/mp4" },
+	{ "webm", "video/webm" },
+	{ "mp3", "audio/mpeg" },
+	{ NULL, NULL }
+};
+
+static const char *phalcon_server_static_days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+static const char *phalcon_server_static_months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+static const char *phalcon_server_static_mime(const char *path, size_t path_len)
+{
+	const char *extension = NULL;
+	size_t i;
+
+	for (i = path_len; i > 0; i--) {
+		if (path[i - 1] == '.') {
+			extension = path + i;
+			break;
+		}
+		if (path[i - 1] == '/') {
+			break;
+		}
+	}
+
+	if (extension) {
+		for (i = 0; phalcon_server_static_mimes[i].extension; i++) {
+			if (!strcasecmp(extension, phalcon_server_static_mimes[i].extension)) {
+				return phalcon_server_static_mimes[i].mime;
+			}
+		}
+	}
+
+	return "application/octet-stream";
+}
+
+static inline void phalcon_server_static_lru_unlink(struct phalcon_server_static_file *file)
+{
+	file->prev->next = file->next;
+	file->next->prev = file->prev;
+}
+
+static inline void phalcon_server_static_lru_push(struct phalcon_server_static *statics, struct phalcon_server_static_file *file)
+{
+	file->next = statics->lru.next;
+	file->prev = &statics->lru;
+	statics->lru.next->prev = file;
+	statics->lru.next = file;
+}
+
+struct phalcon_server_static *phalcon_server_static_new(size_t max)
+{
+	struct phalcon_server_static *statics = calloc(1, sizeof(struct phalcon_server_static));
+
+	statics->max = max ? max : PHALCON_SERVER_STATIC_CACHE_SIZE;
+	statics->num_buckets = 16;
+	while (statics->num_buckets < statics->max * 2) {
+		statics->num_buckets <<= 1;
+	}
+	statics->buckets = calloc(statics->num_buckets, sizeof(struct phalcon_server_static_file *));
+	statics->lru.next = statics->lru.prev = &statics->lru;
+	pthread_mutex_init(&statics->lock, NULL);
+
+	return statics;
+}
+
+/**
+ * Maps the urls under the prefix to the files under the root, the first matching mount wins
+ */
+void phalcon_server_static_add_mount(struct phalcon_server_static *statics, const char *prefix, size_t prefix_len, const char *root, size_t root_len)
+{
+	struct phalcon_server_static_mount *mount;
+
+	while (prefix_len && prefix[prefix_len - 1] == '/') {
+		prefix_len--;
+	}
+	while (root_len > 1 && root[root_len - 1] == '/') {
+		root_len--;
+	}
+
+	statics->mounts = realloc(statics->mounts, (statics->num_mounts + 1) * sizeof(struct phalcon_server_static_mount));
+	mount = &statics->mounts[statics->num_mounts++];
+	mount->prefix = strndup(prefix, prefix_len);
+	mount->prefix_len = prefix_len;
+	mount->root = strndup(root, root_len);
+	mount->root_len = root_len;
+}
+
+static void phalcon_server_static_close(struct phalcon_server_static_file *file)
+{
+	if (file->fd >= 0) {
+		close(file->fd);
+		file->fd = -1;
+	}
+}
+
+static void phalcon_server_static_evict(struct phalcon_server_static *statics, struct phalcon_server_static_file *file)
+{
+	struct phalcon_server_static_file **slot = &statics->buckets[file->hash & (statics->num_buckets - 1)];
+
+	while (*slot != file) {
+		slot = &(*slot)->hash_next;
+	}
+	*slot = file->hash_next;
+
+	phalcon_server_static_lru_unlink(file);
+	phalcon_server_static_close(file);
+	statics->count--;
+	free(file);
+}
+
+void phalcon_server_static_free(struct phalcon_server_static *statics)
+{
+	int i;
+
+	while (statics->lru.next != &statics->lru) {
+		phalcon_server_static_evict(statics, statics->lru.next);
+	}
+
+	for (i = 0; i < statics->num_mounts; i++) {
+		free(statics->mounts[i].prefix);
+		free(statics->mounts[i].root);
+	}
+	free(statics->mounts);
+	free(statics->buckets);
+	pthread_mutex_destroy(&statics->lock);
+	free(statics);
+}
+
+/**
+ * Formats the ETag and the Last-Modified date of a file, the buffers are those of phalcon_server_static_file
+ */
+void phalcon_server_static_validators(time_t mtime, off_t size, char *etag, char *last_modified)
+{
+	struct tm tm;
+
+	snprintf(etag, PHALCON_SERVER_STATIC_ETAG_SIZE, "\"%lx-%llx\"", (unsigned long)mtime, (unsigned long long)size);
+
+	/* Not strftime(), the application may have changed the locale */
+	gmtime_r(&mtime, &tm);
+	snprintf(last_modified, PHALCON_SERVER_STATIC_DATE_SIZE, "%s, %02d %s %04d %02d:%02d:%02d GMT",
+		phalcon_server_static_days[tm.tm_wday], tm.tm_mday, phalcon_server_static_months[tm.tm_mon],
+		tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
+}
+
+/**
+ * Opens the file and precomputes the validators sent with every response
+ */
+static void phalcon_server_static_open(struct phalcon_server_static_file *file)
+{
+	struct stat st;
+
+	phalcon_server_static_close(file);
+
+	file->fd = open(file->path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+	if (file->fd < 0) {
+		return;
+	}
+
+	/* Directories and devices are left to the application */
+	if (fstat(file->fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		phalcon_server_static_close(file);
+		return;
+	}
+
+	file->dev = st.st_dev;
+	file->ino = st.st_ino;
+	file->size = st.st_size;
+	file->mtime = st.st_mtime;
+	file->mime = phalcon_server_static_mime(file->path, file->path_len);
+
+	phalcon_server_static_validators(file->mtime, file->size, file->etag, file->last_modified);
+}
+
+/**
+ * Finds the entry of the path, called with the lock held
+ */
+static struct phalcon_server_static_file *phalcon_server_static_lookup(struct phalcon_server_static *statics, const char *path, size_t path_len, time_t now)
+{
+	struct phalcon_server_static_file *file;
+	struct stat st;
+	zend_ulong hash = zend_inline_hash_func(path, path_len);
+	size_t index = hash & (statics->num_buckets - 1);
+
+	for (file = statics->buckets[index]; file; file = file->hash_next) {
+		if (file->hash == hash && file->path_len == path_len && !memcmp(file->path, path, path_len)) {
+			break;
+		}
+	}
+
+	if (file) {
+		phalcon_server_static_lru_unlink(file);
+		phalcon_server_static_lru_push(statics, file);
+
+		if (now - file->checked >= PHALCON_SERVER_STATIC_CACHE_VALID) {
+			file->checked = now;
+			/* Deployments replace the files, the cached descriptor would keep serving the old inode */
+			if (stat(file->path, &st) < 0) {
+				phalcon_server_static_close(file);
+			} else if (file->fd < 0 || st.st_dev != file->dev || st.st_ino != file->ino || st.st_size != file->size || st.st_mtime != file->mtime) {
+				phalcon_server_static_open(file);
+			}
+		}
+
+		return file;
+	}
+
+	if (statics->count >= statics->max) {
+		phalcon_server_static_evict(statics, statics->lru.prev);
+	}
+
+	file = malloc(sizeof(struct phalcon_server_static_file) + path_len);
+	memset(file, 0, sizeof(struct phalcon_server_static_file));
+	memcpy(file->path, path, path_len);
+	file->path[path_len] = '\0';
+	file->path_len = path_len;
+	file->hash = hash;
+	file->fd = -1;
+	file->checked = now;
+	phalcon_server_static_open(file);
+
+	file->hash_next = statics->buckets[index];
+	statics->buckets[index] = file;
+	phalcon_server_static_lru_push(statics, file);
+	statics->count++;
+
+	return file;
+}
+
+/**
+ * The compressed variant of a file, read and compressed once per worker while its ETag holds
+ */
+static zend_string *phalcon_server_static_compress(struct phalcon_server_compress *compress, int encoding, int fd, off_t size, const char *path, size_t path_len, const char *etag)
+{
+	zend_string *data, *body = NULL;
+	smart_str key = {0};
+	ssize_t n;
+	off_t offset = 0;
+
+	smart_str_appendl(&key, path, path_len);
+	smart_str_appends(&key, etag);
+	smart_str_0(&key);
+
+	if ((body = phalcon_server_compress_lookup(compress, encoding, ZSTR_VAL(key.s), ZSTR_LEN(key.s))) != NULL) {
+		smart_str_free(&key);
+		return body;
+	}
+
+	data = zend_string_alloc(size, 0);
+	while (offset < size) {
+		n = pread(fd, ZSTR_VAL(data) + offset, size - offset, offset);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		offset += n;
+	}
+
+	if (offset == size) {
+		body = phalcon_server_compress_data(compress, encoding, ZSTR_VAL(data), size);
+		if (body) {
+			phalcon_server_compress_store(compress, encoding, ZSTR_VAL(key.s), ZSTR_LEN(key.s), body);
+		}
+	}
+
+	zend_string_free(data);
+	smart_str_free(&key);
+
+	return body;
+}
+
+/**
+ * Parses a single "bytes=" range, returns 1 when satisfiable, 0 when the whole file is sent and -1 when unsatisfiable
+ */
+int phalcon_server_static_range(const char *range, off_t size, off_t *offset, off_t *length)
+{
+	const char *p = range;
+	char *end;
+	unsigned long long first, last;
+
+	if (strncasecmp(p, "bytes=", sizeof("bytes=") - 1)) {
+		return 0;
+	}
+	p += sizeof("bytes=") - 1;
+
+	/* Multiple ranges would need a multipart body */
+	if (strchr(p, ',')) {
+		return 0;
+	}
+
+	while (*p == ' ') {
+		p++;
+	}
+
+	if (*p == '-') {
+		if (!isdigit((unsigned char)p[1])) {
+			return 0;
+		}
+		last = strtoull(p + 1, &end, 10);
+		if (!last || !size) {
+			return -1;
+		}
+		*length = last < (unsigned long long)size ? (off_t)last : size;
+		*offset = size - *length;
+		return 1;
+	}
+
+	if (!isdigit((unsigned char)*p)) {
+		return 0;
+	}
+	first = strtoull(p, &end, 10);
+	if (*end != '-') {
+		return 0;
+	}
+	p = end + 1;
+
+	if (isdigit((unsigned char)*p)) {
+		last = strtoull(p, &end, 10);
+		if (last < first) {
+			return 0;
+		}
+	} else {
+		last = (unsigned long long)size - 1;
+	}
+
+	if (first >= (unsigned long long)size) {
+		return -1;
+	}
+	if (last >= (unsigned long long)size) {
+		last = (unsigned long long)size - 1;
+	}
+
+	*offset = (off_t)first;
+	*length = (off_t)(last - first + 1);
+	return 1;
+}
+
+/**
+ * Answers the message from the mounted directories, returns 0 when the application has to handle it
+ */
+int phalcon_server_static_handle(struct phalcon_server_static *statics, struct phalcon_server_compress *compress, struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, phalcon_http_parser_data *parser_data, int keepalive)
+{
+	struct phalcon_server_static_mount *mount;
+	struct phalcon_server_static_file *file;
+	zval *if_none_match, *if_modified_since, *range, *if_range, *accept_encoding;
+	char path[PATH_MAX], etag[PHALCON_SERVER_STATIC_ETAG_SIZE], last_modified[PHALCON_SERVER_STATIC_DATE_SIZE];
+	const char *url, *rest, *mime, *segment;
+	size_t url_len, rest_len, path_len;
+	int i, status = 200, fd = -1, vary = 0, encoding = PHALCON_SERVER_ENCODING_IDENTITY, method = parser_data->parser->method;
+	off_t size, offset = 0, length;
+	smart_str extra = {0};
+	zend_string *headers, *body = NULL;
+
+	if (!statics || (method != HTTP_GET && method != HTTP_HEAD) || !parser_data->url.s) {
+		return 0;
+	}
+
+	url = ZSTR_VAL(parser_data->url.s);
+	url_len = strcspn(url, "?#");
+
+	for (i = 0; i < statics->num_mounts; i++) {
+		mount = &statics->mounts[i];
+		if (url_len < mount->prefix_len || memcmp(url, mount->prefix, mount->prefix_len)
+			|| (url_len > mount->prefix_len && url[mount->prefix_len] != '/')) {
+			continue;
+		}
+
+		rest = url + mount->prefix_len;
+		rest_len = url_len - mount->prefix_len;
+		if (mount->root_len + rest_len + sizeof("/index.html") > sizeof(path)) {
+			continue;
+		}
+
+		memcpy(path, mount->root, mount->root_len);
+		memcpy(path + mount->root_len, rest, rest_len);
+		path_len = mount->root_len + php_raw_url_decode(path + mount->root_len, rest_len);
+		path[path_len] = '\0';
+
+		if (memchr(path, '\0', path_len)) {
+			return 0;
+		}
+
+		/* No way out of the root */
+		for (segment = path + mount->root_len; (segment = strstr(segment, "/..")) != NULL; segment += 3) {
+			if (segment[3] == '/' || segment[3] == '\0') {
+				return 0;
+			}
+		}
+
+		if (path_len == mount->root_len || path[path_len - 1] == '/') {
+			if (path_len == mount->root_len) {
+				path[path_len++] = '/';
+			}
+			memcpy(path + path_len, "index.html", sizeof("index.html"));
+			path_len += sizeof("index.html") - 1;
+		}
+
+		pthread_mutex_lock(&statics->lock);
+		file = phalcon_server_static_lookup(statics, path, path_len, time(NULL));
+		if (file->fd >= 0) {
+			fd = dup(file->fd);
+			size = file->size;
+			mime = file->mime;
+			memcpy(etag, file->etag, sizeof(file->etag));
+			memcpy(last_modified, file->last_modified, sizeof(last_modified));
+		}
+		pthread_mutex_unlock(&statics->lock);
+
+		if (fd >= 0) {
+			break;
+		}
+	}
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	length = size;
+
+	/* Ranges are served from the identity body */
+	if (compress && size <= PHALCON_SERVER_COMPRESS_MAX_FILE && phalcon_server_compress_acceptable(compress, mime, size)) {
+		vary = 1;
+		accept_encoding = phalcon_http_parser_data_header(parser_data, SL("Accept-Encoding"));
+		if (accept_encoding && !phalcon_http_parser_data_header(parser_data, SL("Range"))) {
+			encoding = phalcon_server_compress_negotiate(compress, Z_STRVAL_P(accept_encoding));
+		}
+		if (encoding != PHALCON_SERVER_ENCODING_IDENTITY) {
+			body = phalcon_server_static_compress(compress, encoding, fd, size, path, path_len, etag);
+			if (body) {
+				/* Every variant has its own validator */
+				snprintf(etag + strlen(etag) - 1, sizeof(etag) - strlen(etag) + 1, "-%s\"", phalcon_server_compress_name(encoding));
+				length = ZSTR_LEN(body);
+			} else {
+				encoding = PHALCON_SERVER_ENCODING_IDENTITY;
+			}
+		}
+	}
+
+	/* Validators are compared as sent, like the browsers echo them */
+	if ((if_none_match = phalcon_http_parser_data_header(parser_data, SL("If-None-Match"))) != NULL) {
+		if (strstr(Z_STRVAL_P(if_none_match), etag) || !strcmp(Z_STRVAL_P(if_none_match), "*")) {
+			status = 304;
+		}
+	} else if ((if_modified_since = phalcon_http_parser_data_header(parser_data, SL("If-Modified-Since"))) != NULL) {
+		if (!strcmp(Z_STRVAL_P(if_modified_since), last_modified)) {
+			status = 304;
+		}
+	}
+
+	if (status == 200 && (range = phalcon_http_parser_data_header(parser_data, SL("Range"))) != NULL) {
+		if_range = phalcon_http_parser_data_header(parser_data, SL("If-Range"));
+		if (!if_range || !strcmp(Z_STRVAL_P(if_range), etag) || !strcmp(Z_STRVAL_P(if_range), last_modified)) {
+			switch (phalcon_server_static_range(Z_STRVAL_P(range), size, &offset, &length)) {
+				case 1:
+					status = 206;
+					break;
+				case -1:
+					status = 416;
+					length = 0;
+					break;
+			}
+		}
+	}
+
+	if (status != 416) {
+		smart_str_appends(&extra, "Content-Type: ");
+		smart_str_appends(&extra, mime);
+		smart_str_appends(&extra, "\r\nETag: ");
+		smart_str_appends(&extra, etag);
+		smart_str_appends(&extra, "\r\nLast-Modified: ");
+		smart_str_appends(&extra, last_modified);
+		smart_str_appends(&extra, "\r\n");
+	}
+	smart_str_appends(&extra, "Accept-Ranges: bytes\r\n");
+	if (vary) {
+		smart_str_appends(&extra, "Vary: Accept-Encoding\r\n");
+	}
+	if (body && status != 304) {
+		smart_str_appends(&extra, "Content-Encoding: ");
+		smart_str_appends(&extra, phalcon_server_compress_name(encoding));
+		smart_str_appends(&extra, "\r\n");
+	}
+	if (status == 206) {
+		smart_str_appends(&extra, "Content-Range: bytes ");
+		smart_str_append_unsigned(&extra, (zend_ulong)offset);
+		smart_str_appendc(&extra, '-');
+		smart_str_append_unsigned(&extra, (zend_ulong)(offset + length - 1));
+		smart_str_appendc(&extra, '/');
+		smart_str_append_unsigned(&extra, (zend_ulong)size);
+		smart_str_appends(&extra, "\r\n");
+	} else if (status == 416) {
+		smart_str_appends(&extra, "Content-Range: bytes */");
+		smart_str_append_unsigned(&extra, (zend_ulong)size);
+		smart_str_appends(&extra, "\r\n");
+	}
+	smart_str_0(&extra);
+
+	headers = phalcon_server_http_build_headers(parser_data->parser->http_major * 100 + parser_data->parser->http_minor, status, keepalive, length, ZSTR_VAL(extra.s), ZSTR_LEN(extra.s));
+	smart_str_free(&extra);
+
+	phalcon_server_output_append_string(ctx, client_ctx, headers);
+	zend_string_release(headers);
+
+	if (body) {
+		if (method != HTTP_HEAD && status == 200) {
+			phalcon_server_output_append_string(ctx, client_ctx, body);
+		}
+		zend_string_release(body);
+		close(fd);
+	} else if (method != HTTP_HEAD && (status == 200 || status == 206)) {
+		/* The duplicate is owned by the output queue, an eviction can not close it under sendfile */
+		phalcon_server_output_append_file(ctx, client_ctx, fd, offset, length);
+	} else {
+		close(fd);
+	}
+
+	return 1;
+}
@@ -0,0 +1,84 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_SERVER_STATIC_H
+#define PHALCON_SERVER_STATIC_H
+
+#include "php_phalcon.h"
+
+#include "server/core.h"
+#include "server/utils.h"
+#include "server/compress.h"
+
+#include <sys/stat.h>
+#include <pthread.h>
+
+#define PHALCON_SERVER_STATIC_CACHE_SIZE		1024
+/* Seconds a cached stat is trusted before the path is checked again */
+#define PHALCON_SERVER_STATIC_CACHE_VALID		1
+#define PHALCON_SERVER_STATIC_ETAG_SIZE			48
+#define PHALCON_SERVER_STATIC_DATE_SIZE			32
+
+/* An open file or a missing one, a negative entry saves the open() of paths left to the application */
+struct phalcon_server_static_file {
+	struct phalcon_server_static_file *prev;
+	struct phalcon_server_static_file *next;
+	struct phalcon_server_static_file *hash_next;
+	zend_ulong hash;
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	time_t checked;
+	const char *mime;
+	char etag[PHALCON_SERVER_STATIC_ETAG_SIZE];
+	char last_modified[PHALCON_SERVER_STATIC_DATE_SIZE];
+	size_t path_len;
+	char path[1];
+};
+
+struct phalcon_server_static_mount {
+	char *prefix;
+	size_t prefix_len;
+	char *root;
+	size_t root_len;
+};
+
+/* Process local, every worker keeps its own descriptors */
+struct phalcon_server_static {
+	struct phalcon_server_static_mount *mounts;
+	int num_mounts;
+	struct phalcon_server_static_file **buckets;
+	size_t num_buckets;
+	struct phalcon_server_static_file lru;
+	size_t count;
+	size_t max;
+	pthread_mutex_t lock;
+};
+
+struct phalcon_server_static *phalcon_server_static_new(size_t max);
+void phalcon_server_static_add_mount(struct phalcon_server_static *statics, const char *prefix, size_t prefix_len, const char *root, size_t root_len);
+void phalcon_server_static_free(struct phalcon_server_static *statics);
+void phalcon_server_static_validators(time_t mtime, off_t size, char *etag, char *last_modified);
+int phalcon_server_static_range(const char *range, off_t size, off_t *offset, off_t *length);
+int phalcon_server_static_handle(struct phalcon_server_static *statics, struct phalcon_server_compress *compress, struct phalcon_server_context *ctx, struct phalcon_server_conn_context *client_ctx, phalcon_http_parser_data *parser_data, int keepalive);
+
+#endif /* PHALCON_SERVER_STATIC_H */
@@ -21,13 +21,17 @@
 #include "server/utils.h"
 
 #include <main/SAPI.h>
+#include <main/php_open_temporary_file.h>
 #include <ext/date/php_date.h>
 
-phalcon_http_parser_data *phalcon_http_parser_data_new(struct http_parser_settings *request_settings)
+#include <unistd.h>
+#include <errno.h>
+
+void phalcon_http_parser_data_init(phalcon_http_parser_data *data, struct http_parser *parser, struct http_parser_settings *request_settings)
 {
-    phalcon_http_parser_data *data = ecalloc(1, sizeof(phalcon_http_parser_data));
+    memset(data, 0, sizeof(phalcon_http_parser_data));
 
-    data->parser = emalloc(sizeof(struct http_parser));
+    data->parser = parser;
     http_parser_init(data->parser, HTTP_REQUEST);
     data->parser->data = data;
 
@@ -35,6 +39,50 @@ phalcon_http_parser_data *phalcon_http_parser_data_new(struct http_parser_settin
 
     data->settings = request_settings;
     data->state = HTTP_PARSER_STATE_NONE;
+    data->body_buffer = PHALCON_HTTP_PARSER_BODY_BUFFER;
+    data->body_fd = -1;
+}
+
+/**
+ * Drops the body of the message, its temporary files included
+ */
+static void phalcon_http_parser_data_clean_body(phalcon_http_parser_data *data)
+{
+    smart_str_free(&data->body);
+    if (data->body_fd >= 0) {
+        close(data->body_fd);
+        data->body_fd = -1;
+    }
+    if (data->body_file) {
+        unlink(ZSTR_VAL(data->body_file));
+        zend_string_release(data->body_file);
+        data->body_file = NULL;
+    }
+    if (data->multipart) {
+        phalcon_server_multipart_free(data->multipart);
+        data->multipart = NULL;
+    }
+    data->body_length = 0;
+    data->body_error = 0;
+}
+
+void phalcon_http_parser_data_destroy(phalcon_http_parser_data *data)
+{
+    zval_ptr_dtor(&data->head);
+    smart_str_free(&data->url);
+    smart_str_free(&data->pipelined);
+    phalcon_http_parser_data_clean_body(data);
+    if (data->last_key) {
+        zend_string_release(data->last_key);
+        data->last_key = NULL;
+    }
+}
+
+phalcon_http_parser_data *phalcon_http_parser_data_new(struct http_parser_settings *request_settings)
+{
+    phalcon_http_parser_data *data = emalloc(sizeof(phalcon_http_parser_data));
+
+    phalcon_http_parser_data_init(data, emalloc(sizeof(struct http_parser)), request_settings);
 
     return data;
 }
@@ -42,9 +90,38 @@ phalcon_http_parser_data *phalcon_http_parser_data_new(struct http_parser_settin
 void phalcon_http_parser_data_free(phalcon_http_parser_data *data)
 {
     if (!data) return;
+    phalcon_http_parser_data_destroy(data);
     efree(data->parser);
     efree(data);
-    data = NULL;
+}
+
+/**
+ * Header of the parsed message, the names are compared case-insensitively
+ */
+zval *phalcon_http_parser_data_header(phalcon_http_parser_data *parser_data, const char *name, size_t name_len)
+{
+	zend_string *key;
+	zval *value;
+
+	ZEND_HASH_FOREACH_STR_KEY_VAL(Z_ARRVAL(parser_data->head), key, value) {
+		if (key && ZSTR_LEN(key) == name_len && !strncasecmp(ZSTR_VAL(key), name, name_len) && Z_TYPE_P(value) == IS_STRING) {
+			return value;
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	return NULL;
+}
+
+void phalcon_http_parser_data_reset(phalcon_http_parser_data *data)
+{
+    zend_hash_clean(Z_ARRVAL(data->head));
+    smart_str_free(&data->url);
+    phalcon_http_parser_data_clean_body(data);
+    if (data->last_key) {
+        zend_string_release(data->last_key);
+        data->last_key = NULL;
+    }
+    data->state = HTTP_PARSER_STATE_NONE;
 }
 
 int phalcon_http_parser_on_message_begin(http_parser *p)
@@ -109,7 +186,59 @@ int phalcon_http_parser_on_header_value(http_parser *p, const char *at, size_t l
 int phalcon_http_parser_on_headers_complete(http_parser *p)
 {
     phalcon_http_parser_data *data = (phalcon_http_parser_data *)p->data;
+    zval *content_type;
+
     data->state = HTTP_PARSER_STATE_HEADER_END;
+
+    /* Refused before a byte of the body is read */
+    if (data->body_max && (p->flags & F_CONTENTLENGTH) && p->content_length > data->body_max) {
+        data->body_error = 413;
+        return -1;
+    }
+
+    /* Form uploads are split while they arrive, the files never go through memory */
+    content_type = phalcon_http_parser_data_header(data, SL("Content-Type"));
+    if (content_type && !strncasecmp(Z_STRVAL_P(content_type), SL("multipart/form-data"))) {
+        data->multipart = phalcon_server_multipart_new(Z_STRVAL_P(content_type));
+    }
+    if (data->pause_headers) {
+        http_parser_pause(p, 1);
+    }
+    return 0;
+}
+
+/**
+ * Other bodies are buffered up to body_buffer bytes, the rest of a bigger one goes to a temporary file
+ */
+static int phalcon_http_parser_spill_body(phalcon_http_parser_data *data, const char *at, size_t length)
+{
+    ssize_t n;
+
+    if (data->body_fd < 0) {
+        data->body_fd = php_open_temporary_fd(php_get_temporary_directory(), "php", &data->body_file);
+        if (data->body_fd < 0) {
+            data->body_error = 500;
+            return -1;
+        }
+        if (data->body.s && phalcon_http_parser_spill_body(data, ZSTR_VAL(data->body.s), ZSTR_LEN(data->body.s)) < 0) {
+            return -1;
+        }
+        smart_str_free(&data->body);
+    }
+
+    while (length) {
+        n = write(data->body_fd, at, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            data->body_error = 500;
+            return -1;
+        }
+        at += n;
+        length -= n;
+    }
+
     return 0;
 }
 
@@ -117,6 +246,26 @@ int phalcon_http_parser_on_body(http_parser *p, const char *at, size_t length)
 {
     phalcon_http_parser_data *data = (phalcon_http_parser_data *)p->data;
     data->state = HTTP_PARSER_STATE_BODY;
+    data->body_length += length;
+
+    /* Chunked bodies have no Content-Length to check up front */
+    if (data->body_max && data->body_length > data->body_max) {
+        data->body_error = 413;
+        return -1;
+    }
+
+    if (data->multipart) {
+        if (phalcon_server_multipart_feed(data->multipart, at, length) < 0) {
+            data->body_error = 400;
+            return -1;
+        }
+        return 0;
+    }
+
+    if (data->body_fd >= 0 || (data->body.s ? ZSTR_LEN(data->body.s) : 0) + length > data->body_buffer) {
+        return phalcon_http_parser_spill_body(data, at, length);
+    }
+
     smart_str_appendl(&data->body, at, length);
     return 0;
 }
@@ -127,6 +276,12 @@ int phalcon_http_parser_on_message_complete(http_parser *p)
     data->state = HTTP_PARSER_STATE_END;
 	smart_str_0(&data->url);
 	smart_str_0(&data->body);
+	if (data->multipart && phalcon_server_multipart_finish(data->multipart) < 0) {
+		data->body_error = 400;
+		return -1;
+	}
+	/* Stop here so the message is answered before any pipelined one is parsed */
+	http_parser_pause(p, 1);
     return 0;
 }
 
@@ -140,7 +295,7 @@ int phalcon_http_parser_on_chunk_header(http_parser *p)
 int phalcon_http_parser_on_chunk_complete(http_parser *p)
 {
     phalcon_http_parser_data *data = (phalcon_http_parser_data *)p->data;
-    data->state = HTTP_PARSER_STATE_END;
+    data->state = HTTP_PARSER_STATE_BODY;
     return 0;
 }
 
@@ -248,7 +403,10 @@ static void append_http_status_line(smart_str *buffer, int protocol_version, int
 	smart_str_appendl_ex(buffer, "\r\n", 2, persistent);
 }
 
-static void append_essential_headers(smart_str* buffer)
+/**
+ * A negative content length is one the response already has
+ */
+static void append_essential_headers(smart_str* buffer, int keepalive, ssize_t content_length)
 {
 	struct timeval tv = {0};
 
@@ -260,16 +418,36 @@ static void append_essential_headers(smart_str* buffer)
 		zend_string_release(dt);
 	}
 
-	smart_str_appendl_ex(buffer, "Connection: close\r\n", sizeof("Connection: close\r\n") - 1, 0);
+	if (keepalive) {
+		smart_str_appendl_ex(buffer, "Connection: keep-alive\r\n", sizeof("Connection: keep-alive\r\n") - 1, 0);
+	} else {
+		smart_str_appendl_ex(buffer, "Connection: close\r\n", sizeof("Connection: close\r\n") - 1, 0);
+	}
+
+	if (content_length >= 0) {
+		smart_str_appendl_ex(buffer, "Content-Length: ", sizeof("Content-Length: ") - 1, 0);
+		smart_str_append_unsigned_ex(buffer, (size_t)content_length, 0);
+		smart_str_appendl_ex(buffer, "\r\n", 2, 0);
+	}
 }
 
-zend_string *phalcon_server_http_get_headers()
+zend_string *phalcon_server_http_get_headers(int protocol_version, int keepalive, size_t content_length)
 {
 	zend_llist *headers = &SG(sapi_headers).headers;
 	sapi_header_struct *h;
 	zend_llist_position pos;
 	smart_str buffer = {0};
-	int protocol_version = 100;
+	ssize_t length = (ssize_t)content_length;
+
+	/* Sent once, the one of the response was brought up to date by the caller */
+	h = (sapi_header_struct*)zend_llist_get_first_ex(headers, &pos);
+	while (h) {
+		if (h->header_len > sizeof("Content-Length") - 1 && h->header[sizeof("Content-Length") - 1] == ':' && !strncasecmp(h->header, SL("Content-Length"))) {
+			length = -1;
+			break;
+		}
+		h = (sapi_header_struct*)zend_llist_get_next_ex(headers, &pos);
+	}
 
 	if (SG(sapi_headers).http_status_line) {
 		smart_str_appends(&buffer, SG(sapi_headers).http_status_line);
@@ -278,7 +456,7 @@ zend_string *phalcon_server_http_get_headers()
 		append_http_status_line(&buffer, protocol_version, SG(sapi_headers).http_response_code, 0);
 	}
 
-	append_essential_headers(&buffer);
+	append_essential_headers(&buffer, keepalive, length);
 
 	h = (sapi_header_struct*)zend_llist_get_first_ex(headers, &pos);
 	while (h) {
@@ -289,6 +467,36 @@ zend_string *phalcon_server_http_get_headers()
 		h = (sapi_header_struct*)zend_llist_get_next_ex(headers, &pos);
 	}
 	smart_str_appendl(&buffer, "\r\n", 2);
+	smart_str_0(&buffer);
 
 	return buffer.s;
 }
+
+/**
+ * Headers of the responses answered without the application, the SAPI header list is not used
+ */
+zend_string *phalcon_server_http_build_headers(int protocol_version, int response_code, int keepalive, size_t content_length, const char *extra, size_t extra_len)
+{
+	smart_str buffer = {0};
+
+	append_http_status_line(&buffer, protocol_version, response_code, 0);
+	append_essential_headers(&buffer, keepalive, (ssize_t)content_length);
+
+	if (extra_len) {
+		smart_str_appendl(&buffer, extra, extra_len);
+	}
+	smart_str_appendl(&buffer, "\r\n", 2);
+	smart_str_0(&buffer);
+
+	return buffer.s;
+}
+
+void phalcon_server_http_reset_headers()
+{
+	zend_llist_clean(&SG(sapi_headers).headers);
+	if (SG(sapi_headers).http_status_line) {
+		efree(SG(sapi_headers).http_status_line);
+		SG(sapi_headers).http_status_line = NULL;
+	}
+	SG(sapi_headers).http_response_code = 0;
+}
@@ -23,9 +23,12 @@
 
 #include "php_phalcon.h"
 #include "http/parser/http_parser.h"
+#include "server/multipart.h"
 
 #include <Zend/zend_smart_str.h>
 
+#define PHALCON_HTTP_PARSER_BODY_BUFFER		(1024 * 1024)
+
 int phalcon_http_parser_on_message_begin(http_parser *);
 int phalcon_http_parser_on_url(http_parser *, const char *at, size_t length);
 int phalcon_http_parser_on_status(http_parser *, const char *at, size_t length);
@@ -49,14 +52,28 @@ typedef struct {
     smart_str url;
     smart_str body;
     zend_string *last_key;
+    size_t body_buffer;				/* bytes kept in memory before the body spills to a temporary file */
+    size_t body_max;				/* 0 for no limit */
+    size_t body_length;
+    int body_fd;
+    zend_string *body_file;
+    int body_error;					/* status answered when the body is refused */
+    int pause_headers;				/* the parser stops after the headers, the request is checked before its body is read */
+    smart_str pipelined;			/* bytes left unparsed while the responses already queued are written */
+    phalcon_server_multipart *multipart;
 } phalcon_http_parser_data;
 
-phalcon_http_parser_data *phalcon_http_parser_data_new();
+void phalcon_http_parser_data_init(phalcon_http_parser_data *hp, struct http_parser *parser, struct http_parser_settings *request_settings);
+void phalcon_http_parser_data_destroy(phalcon_http_parser_data *hp);
+phalcon_http_parser_data *phalcon_http_parser_data_new(struct http_parser_settings *request_settings);
+void phalcon_http_parser_data_reset(phalcon_http_parser_data *hp);
 void phalcon_http_parser_data_free(phalcon_http_parser_data *hp);
+zval *phalcon_http_parser_data_header(phalcon_http_parser_data *hp, const char *name, size_t name_len);
 
-extern char *http_200;
-extern char *http_200_keepalive;
+extern char *http_400;
 
-zend_string *phalcon_server_http_get_headers();
+zend_string *phalcon_server_http_get_headers(int protocol_version, int keepalive, size_t content_length);
+zend_string *phalcon_server_http_build_headers(int protocol_version, int response_code, int keepalive, size_t content_length, const char *extra, size_t extra_len);
+void phalcon_server_http_reset_headers();
 
 #endif /* PHALCON_SERVER_UTILS_H */
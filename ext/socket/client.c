@@ -31,6 +31,7 @@
 #include "kernel/concat.h"
 #include "kernel/object.h"
 #include "kernel/exception.h"
+#include "kernel/coroutine.h"
 
 /**
  * Phalcon\Socket\Client
@@ -107,6 +108,22 @@ PHALCON_INIT_CLASS(Phalcon_Socket_Client){
 	return SUCCESS;
 }
 
+/**
+ * Inside a server coroutine, yields until the socket can be read or written
+ */
+static void phalcon_socket_client_wait(zval *socket, int write)
+{
+	php_socket *php_sock;
+
+	if (!phalcon_coroutine_active()) {
+		return;
+	}
+
+	if ((php_sock = (php_socket *)zend_fetch_resource_ex(socket, php_sockets_le_socket_name, php_sockets_le_socket())) != NULL) {
+		phalcon_coroutine_wait_fd(php_sock->bsd_socket, write, 0);
+	}
+}
+
 /**
  * Phalcon\Socket\Client constructor
  */
@@ -208,6 +225,8 @@ PHP_METHOD(Phalcon_Socket_Client, read){
 
 	phalcon_read_property(&socket, getThis(), SL("_socket"), PH_NOISY|PH_READONLY);
 
+	phalcon_socket_client_wait(&socket, 0);
+
 	if (!type) {
 		PHALCON_CALL_FUNCTION(return_value, "socket_read", &socket, length);
 	} else {
@@ -244,6 +263,8 @@ PHP_METHOD(Phalcon_Socket_Client, write){
 	ZVAL_LONG(&ret, 0);
 	ZVAL_DUP(&writebuf, buffer);
 	while(1) {
+		phalcon_socket_client_wait(&socket, 1);
+
 		ZVAL_LONG(&writelen, len);
 		PHALCON_CALL_FUNCTION(&ret, "socket_write", &socket, &writebuf, &writelen);
 
@@ -276,6 +297,8 @@ PHP_METHOD(Phalcon_Socket_Client, recv){
 
 	phalcon_read_property(&socket, getThis(), SL("_socket"), PH_NOISY|PH_READONLY);
 
+	phalcon_socket_client_wait(&socket, 0);
+
 	PHALCON_CALL_FUNCTION(&ret, "socket_recv", &socket, return_value, length, flag);
 
 	if (PHALCON_IS_FALSE(&ret)) {
@@ -304,6 +327,8 @@ PHP_METHOD(Phalcon_Socket_Client, send){
 	ZVAL_DUP(&writebuf, buffer);
 
 	while(1) {
+		phalcon_socket_client_wait(&socket, 1);
+
 		ZVAL_LONG(&writelen, len);
 		PHALCON_CALL_FUNCTION(&ret, "socket_send", &socket, &writebuf, &writelen, flag);
 
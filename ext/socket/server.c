@@ -24,6 +24,7 @@
 #include "socket/exception.h"
 
 #include <Zend/zend_closures.h>
+#include <Zend/zend_smart_str.h>
 
 #if HAVE_EPOLL
 # include <sys/epoll.h>
@@ -34,8 +35,17 @@
 # include <arpa/inet.h>
 # include <signal.h>
 # define EPOLL_EVENT_SIZE 1024
+/* Bytes read at once in the event mode, and buffered at most before the frames are extracted
+ * when there is no framing, a framed input is buffered up to one frame of the largest size */
+# define PHALCON_SOCKET_SERVER_READ_SIZE 65536
+# define PHALCON_SOCKET_SERVER_READ_MAX (16 * PHALCON_SOCKET_SERVER_READ_SIZE)
+/* Bytes queued to a client at most, one that does not read is dropped instead */
+# define PHALCON_SOCKET_SERVER_WRITE_MAX (64 * PHALCON_SOCKET_SERVER_READ_SIZE)
 #endif
 
+/* The largest frame setFraming() accepts, a client may make the server buffer that much */
+#define PHALCON_SOCKET_SERVER_FRAME_MAX (64 * 1024 * 1024)
+
 #include "kernel/main.h"
 #include "kernel/memory.h"
 #include "kernel/fcall.h"
@@ -76,6 +86,20 @@
  *  );
  *
  *</code>
+ *
+ * With USE_EVENT one process serves every client through edge-triggered epoll. The reads and
+ * writes are buffered in C and the receive callback only gets complete frames:
+ *
+ *<code>
+ *
+ *	$server = new Phalcon\Socket\Server('127.0.0.1', 8989);
+ *	$server->setEvent(Phalcon\Socket\Server::USE_EVENT);
+ *	$server->setFraming(Phalcon\Socket\Server::FRAMING_LENGTH, 4);
+ *	$server->run(NULL, function(Phalcon\Socket\Client $client, $frame){
+ *		$this->send($client->getSocketId(), strrev($frame));
+ *	});
+ *
+ *</code>
  */
 zend_class_entry *phalcon_socket_server_ce;
 
@@ -90,6 +114,8 @@ PHP_METHOD(Phalcon_Socket_Server, getClients);
 PHP_METHOD(Phalcon_Socket_Server, getClient);
 PHP_METHOD(Phalcon_Socket_Server, disconnect);
 PHP_METHOD(Phalcon_Socket_Server, run);
+PHP_METHOD(Phalcon_Socket_Server, setFraming);
+PHP_METHOD(Phalcon_Socket_Server, send);
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_socket_server___construct, 0, 0, 2)
 	ZEND_ARG_TYPE_INFO(0, address, IS_STRING, 1)
@@ -128,6 +154,17 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_socket_server_disconnect, 0, 0, 1)
 	ZEND_ARG_TYPE_INFO(0, socketId, IS_LONG, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_socket_server_setframing, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, framing, IS_LONG, 0)
+	ZEND_ARG_INFO(0, option)
+	ZEND_ARG_TYPE_INFO(0, maxFrame, IS_LONG, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_socket_server_send, 0, 0, 2)
+	ZEND_ARG_TYPE_INFO(0, socketId, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, data, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_socket_server_run, 0, 0, 0)
 	ZEND_ARG_CALLABLE_INFO(0, onconnection, 1)
 	ZEND_ARG_CALLABLE_INFO(0, onrecv, 1)
@@ -151,6 +188,8 @@ static const zend_function_entry phalcon_socket_server_method_entry[] = {
 	PHP_ME(Phalcon_Socket_Server, getClient, arginfo_phalcon_socket_server_getclient, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Socket_Server, disconnect, arginfo_phalcon_socket_server_disconnect, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Socket_Server, run, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Socket_Server, setFraming, arginfo_phalcon_socket_server_setframing, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Socket_Server, send, arginfo_phalcon_socket_server_send, ZEND_ACC_PUBLIC)
 	PHP_FE_END
 };
 
@@ -168,6 +207,10 @@ PHALCON_INIT_CLASS(Phalcon_Socket_Server){
 	zend_declare_property_null(phalcon_socket_server_ce, SL("_clients"), ZEND_ACC_PROTECTED);
 	zend_declare_property_long(phalcon_socket_server_ce, SL("_event"), 1, ZEND_ACC_PROTECTED);
 	zend_declare_property_long(phalcon_socket_server_ce, SL("_backlog"), 0, ZEND_ACC_PROTECTED);
+	zend_declare_property_long(phalcon_socket_server_ce, SL("_framing"), PHALCON_SOCKET_SERVER_FRAMING_NONE, ZEND_ACC_PROTECTED);
+	zend_declare_property_long(phalcon_socket_server_ce, SL("_prefixSize"), 4, ZEND_ACC_PROTECTED);
+	zend_declare_property_string(phalcon_socket_server_ce, SL("_delimiter"), "\n", ZEND_ACC_PROTECTED);
+	zend_declare_property_long(phalcon_socket_server_ce, SL("_maxFrame"), 1024 * 1024, ZEND_ACC_PROTECTED);
 #if HAVE_EPOLL
 	zend_declare_property_long(phalcon_socket_server_ce, SL("_epollSize"), 1024, ZEND_ACC_PROTECTED);
 #endif
@@ -175,7 +218,12 @@ PHALCON_INIT_CLASS(Phalcon_Socket_Server){
 	zend_declare_class_constant_long(phalcon_socket_server_ce, SL("USE_SELECT"),	0);
 #if HAVE_EPOLL
 	zend_declare_class_constant_long(phalcon_socket_server_ce, SL("USE_EPOLL"),		1);
+	zend_declare_class_constant_long(phalcon_socket_server_ce, SL("USE_EVENT"),		2);
 #endif
+
+	zend_declare_class_constant_long(phalcon_socket_server_ce, SL("FRAMING_NONE"),		PHALCON_SOCKET_SERVER_FRAMING_NONE);
+	zend_declare_class_constant_long(phalcon_socket_server_ce, SL("FRAMING_LENGTH"),	PHALCON_SOCKET_SERVER_FRAMING_LENGTH);
+	zend_declare_class_constant_long(phalcon_socket_server_ce, SL("FRAMING_DELIMITER"),	PHALCON_SOCKET_SERVER_FRAMING_DELIMITER);
 	return SUCCESS;
 }
 
@@ -285,6 +333,7 @@ PHP_METHOD(Phalcon_Socket_Server, setEvent){
 			break;
 #if HAVE_EPOLL
 		case 1:
+		case 2:
 			phalcon_update_property(getThis(), SL("_event"), event);
 			break;
 #endif
@@ -397,6 +446,14 @@ PHP_METHOD(Phalcon_Socket_Server, disconnect){
 
 	phalcon_fetch_params(0, 1, 0, &socket_id);
 
+#if HAVE_EPOLL
+	/* The event loop closes it once what was sent to it is written */
+	if (server && server->conns && Z_TYPE_P(socket_id) == IS_LONG && zend_hash_index_exists(server->conns, Z_LVAL_P(socket_id))) {
+		zend_hash_index_add_empty_element(server->closing, Z_LVAL_P(socket_id));
+		return;
+	}
+#endif
+
 	phalcon_read_property_array(&client, getThis(), SL("_clients"), socket_id, PH_READONLY);
 	if (Z_TYPE(client) == IS_OBJECT) {
 		PHALCON_CALL_METHOD(NULL, &client, "close");
@@ -422,6 +479,17 @@ struct _phalcon_socket_server {
 	int running_children;
 	int running;
 	int timeout;
+#if HAVE_EPOLL
+	/* Event mode, clients by fd and the ones to close once their output is written */
+	int epollfd;
+	HashTable *conns;
+	HashTable *closing;
+	int framing;
+	int prefix_size;
+	zend_string *delimiter;
+	size_t max_frame;
+	size_t read_max;
+#endif
 } *server;
 
 typedef struct _phalcon_socket_server phalcon_socket_server;
@@ -443,6 +511,22 @@ void phalcon_socket_server_destroy() {
 	if (server->fd) {
 		close(server->fd);
 	}
+#if HAVE_EPOLL
+	if (server->conns) {
+		zend_hash_destroy(server->conns);
+		FREE_HASHTABLE(server->conns);
+	}
+	if (server->closing) {
+		zend_hash_destroy(server->closing);
+		FREE_HASHTABLE(server->closing);
+	}
+	if (server->delimiter) {
+		zend_string_release(server->delimiter);
+	}
+	if (server->epollfd > 0) {
+		close(server->epollfd);
+	}
+#endif
 	free(server);
 	server = NULL;
 }
@@ -528,6 +612,451 @@ static int phalcon_socket_server_startup_workers(zval *object, int max_childs) {
 	}
 }
 
+#if HAVE_EPOLL
+typedef struct {
+	zval *onconnection;
+	zval *onrecv;
+	zval *onsend;
+	zval *onclose;
+	zval *onerror;
+	zval *ontimeout;
+} phalcon_socket_server_callbacks;
+
+/* A client of the event mode, what it sent and what is sent to it stay in C */
+typedef struct {
+	int fd;
+	zval client;
+	smart_str in;
+	size_t in_pos;
+	smart_str out;
+	size_t out_pos;
+} phalcon_socket_server_conn;
+
+static void phalcon_socket_server_conn_dtor(zval *zv)
+{
+	phalcon_socket_server_conn *conn = Z_PTR_P(zv);
+
+	zval_ptr_dtor(&conn->client);
+	smart_str_free(&conn->in);
+	smart_str_free(&conn->out);
+	efree(conn);
+}
+
+/**
+ * Calls the callback given to run(), or the method of the same name of a subclass
+ */
+static int phalcon_socket_server_event_call(zval *object, zval *callback, const char *method, size_t method_len, zval *client, zval *data)
+{
+	zval ret = {}, args[2], *params[2];
+	int status = 1, n = data ? 2 : 1;
+
+	ZVAL_COPY_VALUE(&args[0], client);
+	params[0] = client;
+	if (data) {
+		ZVAL_COPY_VALUE(&args[1], data);
+		params[1] = data;
+	}
+
+	if (callback && Z_TYPE_P(callback) > IS_NULL) {
+		phalcon_call_user_func_args(&ret, callback, args, n);
+	} else if (phalcon_method_exists_ex(object, method, method_len) == SUCCESS) {
+		phalcon_call_method_with_params(&ret, object, Z_OBJCE_P(object), phalcon_fcall_method, method, method_len, n, params);
+	}
+
+	if (PHALCON_IS_FALSE(&ret) || EG(exception)) {
+		status = -1;
+	}
+	zval_ptr_dtor(&ret);
+
+	return status;
+}
+
+static inline int phalcon_socket_server_conn_pending(phalcon_socket_server_conn *conn)
+{
+	return conn->out.s && conn->out_pos < ZSTR_LEN(conn->out.s);
+}
+
+/**
+ * Writes as much of the output as the socket takes, -1 when the client is gone
+ */
+static int phalcon_socket_server_conn_flush(phalcon_socket_server_conn *conn)
+{
+	ssize_t n;
+
+	while (phalcon_socket_server_conn_pending(conn)) {
+		n = send(conn->fd, ZSTR_VAL(conn->out.s) + conn->out_pos, ZSTR_LEN(conn->out.s) - conn->out_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+		}
+		conn->out_pos += n;
+	}
+
+	/* The buffer is kept for the next writes */
+	if (conn->out.s) {
+		ZSTR_LEN(conn->out.s) = 0;
+	}
+	conn->out_pos = 0;
+
+	return 0;
+}
+
+/**
+ * Reads until the socket is drained, edge-triggered epoll reports it only once
+ *
+ * Returns 1 when it stopped at the buffer limit, 0 when drained, -1 at the end of the
+ * stream and -2 on error.
+ */
+static int phalcon_socket_server_conn_read(phalcon_socket_server_conn *conn)
+{
+	size_t buffered, size;
+	ssize_t n;
+
+	while ((buffered = conn->in.s ? ZSTR_LEN(conn->in.s) - conn->in_pos : 0) < server->read_max) {
+		size = server->read_max - buffered;
+		if (size > PHALCON_SOCKET_SERVER_READ_SIZE) {
+			size = PHALCON_SOCKET_SERVER_READ_SIZE;
+		}
+		smart_str_alloc(&conn->in, size, 0);
+		n = recv(conn->fd, ZSTR_VAL(conn->in.s) + ZSTR_LEN(conn->in.s), size, MSG_DONTWAIT);
+		if (n > 0) {
+			ZSTR_LEN(conn->in.s) += n;
+			continue;
+		}
+		if (n == 0) {
+			return -1;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -2;
+	}
+
+	return 1;
+}
+
+/**
+ * Passes every complete frame of the input to the receive callback, the rest waits
+ */
+static int phalcon_socket_server_conn_frames(zval *object, phalcon_socket_server_conn *conn, phalcon_socket_server_callbacks *callbacks)
+{
+	const char *data, *found;
+	size_t len, frame_len = 0, header, trailer;
+	zval frame = {};
+	int i, status = 1;
+
+	while (conn->in.s && conn->in_pos < ZSTR_LEN(conn->in.s) && !zend_hash_index_exists(server->closing, conn->fd)) {
+		data = ZSTR_VAL(conn->in.s) + conn->in_pos;
+		len = ZSTR_LEN(conn->in.s) - conn->in_pos;
+		header = trailer = 0;
+
+		switch (server->framing) {
+			case PHALCON_SOCKET_SERVER_FRAMING_LENGTH:
+				if (len < (size_t)server->prefix_size) {
+					goto incomplete;
+				}
+				/* Network byte order */
+				for (frame_len = 0, i = 0; i < server->prefix_size; i++) {
+					frame_len = (frame_len << 8) | (unsigned char)data[i];
+				}
+				if (frame_len > server->max_frame) {
+					status = -1;
+					goto incomplete;
+				}
+				if (len - server->prefix_size < frame_len) {
+					goto incomplete;
+				}
+				header = server->prefix_size;
+				break;
+
+			case PHALCON_SOCKET_SERVER_FRAMING_DELIMITER:
+				found = zend_memnstr(data, ZSTR_VAL(server->delimiter), ZSTR_LEN(server->delimiter), data + len);
+				if (!found) {
+					/* A frame of max_frame bytes has its delimiter within the read limit */
+					if (len >= server->max_frame + ZSTR_LEN(server->delimiter)) {
+						status = -1;
+					}
+					goto incomplete;
+				}
+				if ((size_t)(found - data) > server->max_frame) {
+					status = -1;
+					goto incomplete;
+				}
+				frame_len = found - data;
+				trailer = ZSTR_LEN(server->delimiter);
+				break;
+
+			default:
+				frame_len = len;
+				break;
+		}
+
+		ZVAL_STRINGL(&frame, data + header, frame_len);
+		conn->in_pos += header + frame_len + trailer;
+
+		status = phalcon_socket_server_event_call(object, callbacks->onrecv, SL("onrecv"), &conn->client, &frame);
+		zval_ptr_dtor(&frame);
+		if (status < 0) {
+			break;
+		}
+	}
+
+incomplete:
+	/* Only the start of the next frame is kept, an idle connection holds no buffer */
+	if (conn->in_pos) {
+		len = ZSTR_LEN(conn->in.s) - conn->in_pos;
+		if (!len) {
+			smart_str_free(&conn->in);
+		} else {
+			memmove(ZSTR_VAL(conn->in.s), ZSTR_VAL(conn->in.s) + conn->in_pos, len);
+			ZSTR_LEN(conn->in.s) = len;
+		}
+		conn->in_pos = 0;
+	}
+
+	return status;
+}
+
+static void phalcon_socket_server_conn_close(zval *object, phalcon_socket_server_conn *conn, phalcon_socket_server_callbacks *callbacks)
+{
+	struct epoll_event ev = {0};
+	zval socket_id = {};
+	int fd = conn->fd;
+
+	phalcon_socket_server_event_call(object, callbacks->onclose, SL("onclose"), &conn->client, NULL);
+
+	epoll_ctl(server->epollfd, EPOLL_CTL_DEL, fd, &ev);
+	phalcon_call_method(NULL, &conn->client, "close", 0, NULL);
+
+	ZVAL_LONG(&socket_id, fd);
+	phalcon_unset_property_array(object, SL("_clients"), &socket_id);
+	zend_hash_index_del(server->closing, fd);
+	zend_hash_index_del(server->conns, fd);
+}
+
+static void phalcon_socket_server_event_accept(zval *object, int listenfd, phalcon_socket_server_callbacks *callbacks)
+{
+	struct sockaddr_in client_addr;
+	socklen_t client_addr_len;
+	struct epoll_event ev = {0};
+	phalcon_socket_server_conn *conn;
+	php_socket *client_sock;
+	zval client_socket = {}, client = {}, client_socket_id = {}, *params[1];
+	int client_fd;
+
+	while (1) {
+		client_addr_len = sizeof(client_addr);
+		client_fd = accept(listenfd, (struct sockaddr *) &client_addr, &client_addr_len);
+		if (client_fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		client_sock = php_create_socket();
+		client_sock->bsd_socket = client_fd;
+		client_sock->error = 0;
+		client_sock->blocking = 1;
+		client_sock->type = ((struct sockaddr *) &client_addr)->sa_family;
+
+		ZVAL_RES(&client_socket, zend_register_resource(client_sock, php_sockets_le_socket()));
+
+		object_init_ex(&client, phalcon_socket_client_ce);
+		params[0] = &client_socket;
+		phalcon_call_method(NULL, &client, "__construct", 1, params);
+		zval_ptr_dtor(&client_socket);
+		params[0] = &PHALCON_GLOBAL(z_false);
+		phalcon_call_method(NULL, &client, "setblocking", 1, params);
+
+		ZVAL_LONG(&client_socket_id, client_fd);
+		phalcon_update_property_array(object, SL("_clients"), &client_socket_id, &client);
+
+		conn = ecalloc(1, sizeof(phalcon_socket_server_conn));
+		conn->fd = client_fd;
+		ZVAL_COPY_VALUE(&conn->client, &client);
+		zend_hash_index_update_ptr(server->conns, client_fd, conn);
+
+		/* Both directions once, the edges tell when to read and when to write again */
+		ev.data.fd = client_fd;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+		if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, client_fd, &ev) < 0) {
+			phalcon_socket_server_conn_close(object, conn, callbacks);
+			continue;
+		}
+
+		setkeepalive(client_fd);
+		phalcon_socket_server_event_call(object, callbacks->onconnection, SL("onconnection"), &client, NULL);
+		if (EG(exception)) {
+			break;
+		}
+	}
+}
+
+/**
+ * Closes the clients passed to disconnect() whose output is written
+ */
+static void phalcon_socket_server_event_closing(zval *object, phalcon_socket_server_callbacks *callbacks)
+{
+	phalcon_socket_server_conn *conn;
+	HashTable *closing;
+	zend_ulong fd;
+
+	if (!zend_hash_num_elements(server->closing)) {
+		return;
+	}
+
+	/* The close callbacks may disconnect other clients, they go to a fresh set */
+	closing = server->closing;
+	ALLOC_HASHTABLE(server->closing);
+	zend_hash_init(server->closing, 8, NULL, NULL, 0);
+
+	ZEND_HASH_FOREACH_NUM_KEY(closing, fd) {
+		if ((conn = zend_hash_index_find_ptr(server->conns, fd)) == NULL) {
+			continue;
+		}
+		if (phalcon_socket_server_conn_flush(conn) < 0 || !phalcon_socket_server_conn_pending(conn)) {
+			phalcon_socket_server_conn_close(object, conn, callbacks);
+		} else {
+			zend_hash_index_add_empty_element(server->closing, fd);
+		}
+	} ZEND_HASH_FOREACH_END();
+
+	zend_hash_destroy(closing);
+	FREE_HASHTABLE(closing);
+}
+
+/**
+ * Event mode, one process and every client on edge-triggered epoll
+ */
+static void phalcon_socket_server_run_event(zval *object, int listenfd, phalcon_socket_server_callbacks *callbacks, int msec)
+{
+	struct epoll_event events[EPOLL_EVENT_SIZE];
+	struct epoll_event ev = {0};
+	phalcon_socket_server_conn *conn;
+	zval framing = {}, prefix_size = {}, delimiter = {}, max_frame = {};
+	size_t buffered;
+	int n, i, fd, status, pending;
+
+	phalcon_read_property(&framing, object, SL("_framing"), PH_NOISY|PH_READONLY);
+	phalcon_read_property(&prefix_size, object, SL("_prefixSize"), PH_NOISY|PH_READONLY);
+	phalcon_read_property(&delimiter, object, SL("_delimiter"), PH_NOISY|PH_READONLY);
+	phalcon_read_property(&max_frame, object, SL("_maxFrame"), PH_NOISY|PH_READONLY);
+
+	server->framing = phalcon_get_intval(&framing);
+	server->prefix_size = phalcon_get_intval(&prefix_size);
+	server->delimiter = zval_get_string(&delimiter);
+	server->max_frame = phalcon_get_intval(&max_frame);
+
+	/* Buffered at most, a whole frame with its prefix or delimiter */
+	switch (server->framing) {
+		case PHALCON_SOCKET_SERVER_FRAMING_LENGTH:
+			server->read_max = server->max_frame + server->prefix_size;
+			break;
+		case PHALCON_SOCKET_SERVER_FRAMING_DELIMITER:
+			server->read_max = server->max_frame + ZSTR_LEN(server->delimiter);
+			break;
+		default:
+			server->read_max = PHALCON_SOCKET_SERVER_READ_MAX;
+			break;
+	}
+
+	ALLOC_HASHTABLE(server->conns);
+	zend_hash_init(server->conns, 64, NULL, phalcon_socket_server_conn_dtor, 0);
+	ALLOC_HASHTABLE(server->closing);
+	zend_hash_init(server->closing, 8, NULL, NULL, 0);
+
+	server->epollfd = epoll_create1(0);
+	if (server->epollfd < 0) {
+		PHALCON_THROW_EXCEPTION_STR(phalcon_socket_exception_ce, "epoll: unable to initialize");
+		return;
+	}
+
+	ev.data.fd = listenfd;
+	ev.events = EPOLLIN | EPOLLET;
+	if (epoll_ctl(server->epollfd, EPOLL_CTL_ADD, listenfd, &ev) < 0) {
+		PHALCON_THROW_EXCEPTION_FORMAT(phalcon_socket_exception_ce, "epoll: unable to add fd %d", listenfd);
+		return;
+	}
+
+	while (server->running && !EG(exception)) {
+		n = epoll_wait(server->epollfd, events, EPOLL_EVENT_SIZE, msec);
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			PHALCON_THROW_EXCEPTION_FORMAT(phalcon_socket_exception_ce, "epoll_wait() returns %d", errno);
+			break;
+		}
+		if (n == 0) {
+			if (phalcon_method_exists_ex(object, SL("ontimeout")) == SUCCESS) {
+				phalcon_call_method(NULL, object, "ontimeout", 0, NULL);
+			}
+			if (callbacks->ontimeout && Z_TYPE_P(callbacks->ontimeout) > IS_NULL) {
+				phalcon_call_user_func_args(NULL, callbacks->ontimeout, NULL, 0);
+			}
+			continue;
+		}
+
+		for (i = 0; i < n && !EG(exception); i++) {
+			fd = events[i].data.fd;
+			if (fd == listenfd) {
+				phalcon_socket_server_event_accept(object, listenfd, callbacks);
+				continue;
+			}
+
+			/* Closed by an earlier event of the same batch */
+			if ((conn = zend_hash_index_find_ptr(server->conns, fd)) == NULL) {
+				continue;
+			}
+
+			status = 0;
+			if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+				do {
+					status = phalcon_socket_server_conn_read(conn);
+					buffered = conn->in.s ? ZSTR_LEN(conn->in.s) : 0;
+					if (phalcon_socket_server_conn_frames(object, conn, callbacks) < 0) {
+						status = -1;
+					} else if (status == 1 && conn->in.s && ZSTR_LEN(conn->in.s) == buffered) {
+						/* Nothing was taken from a full buffer, a client being closed keeps its input */
+						status = 0;
+					}
+				} while (status == 1);
+
+				if (status == -2) {
+					phalcon_socket_server_event_call(object, callbacks->onerror, SL("onerror"), &conn->client, NULL);
+				}
+			}
+
+			if (status >= 0 && (events[i].events & EPOLLOUT)) {
+				pending = phalcon_socket_server_conn_pending(conn);
+				if (phalcon_socket_server_conn_flush(conn) < 0) {
+					status = -1;
+				} else if (pending && !phalcon_socket_server_conn_pending(conn)) {
+					/* The output is drained, the application may send more */
+					status = phalcon_socket_server_event_call(object, callbacks->onsend, SL("onsend"), &conn->client, NULL);
+				}
+			}
+
+			if (status < 0 || (events[i].events & EPOLLERR)) {
+				phalcon_socket_server_conn_close(object, conn, callbacks);
+			}
+		}
+
+		phalcon_socket_server_event_closing(object, callbacks);
+	}
+
+	/* The close callbacks may call back into the server, the first client left is taken each time */
+	while (zend_hash_num_elements(server->conns)) {
+		zend_hash_internal_pointer_reset(server->conns);
+		conn = zend_hash_get_current_data_ptr(server->conns);
+		phalcon_socket_server_conn_close(object, conn, callbacks);
+	}
+}
+#endif
+
 /**
  * Run the Server
  *
@@ -535,7 +1064,7 @@ static int phalcon_socket_server_startup_workers(zval *object, int max_childs) {
 PHP_METHOD(Phalcon_Socket_Server, run)
 {
 	zval *_onconnection = NULL, *_onrecv = NULL, *_onsend = NULL, *_onclose = NULL, *_onerror = NULL, *_ontimeout = NULL, *timeout = NULL, *usec = NULL;
-	zval onconnection = {}, onrecv = {}, onsend = {}, onclose = {}, onerror = {}, ontimeout, socket = {}, maxlen = {}, event = {};
+	zval onconnection = {}, onrecv = {}, onsend = {}, onclose = {}, onerror = {}, ontimeout = {}, socket = {}, maxlen = {}, event = {};
 	zval daemon = {}, max_children = {};
 	php_socket *listen_php_sock;
 	struct sockaddr_in client_addr;
@@ -815,6 +1344,10 @@ worker:
 			} ZEND_HASH_FOREACH_END();
 		}
 #if HAVE_EPOLL
+	} else if (Z_LVAL(event) == 2) {
+		phalcon_socket_server_callbacks callbacks = { &onconnection, &onrecv, &onsend, &onclose, &onerror, &ontimeout };
+
+		phalcon_socket_server_run_event(getThis(), listenfd, &callbacks, Z_TYPE_P(timeout) == IS_LONG ? Z_LVAL_P(timeout) * 1000 : -1);
 	} else if (Z_LVAL(event) == 1) {
 		struct epoll_event events[EPOLL_EVENT_SIZE];
 		struct epoll_event ev = {0};
@@ -1020,3 +1553,135 @@ worker:
 
 	phalcon_socket_server_destroy();
 }
+
+/**
+ * Sets how the event mode splits what a client sends into the frames of the receive callback
+ *
+ *<code>
+ *	$server->setFraming(Phalcon\Socket\Server::FRAMING_LENGTH, 2);       // 16 bits length, network byte order
+ *	$server->setFraming(Phalcon\Socket\Server::FRAMING_DELIMITER, "\r\n");
+ *</code>
+ *
+ * @param int $framing one of the FRAMING_* constants
+ * @param int|string $option prefix size of 1, 2 or 4 bytes, or the delimiter
+ * @param int $maxFrame a larger frame closes the client, at most 64 MiB
+ * @return Phalcon\Socket\Server
+ */
+PHP_METHOD(Phalcon_Socket_Server, setFraming){
+
+	zval *framing, *option = NULL, *max_frame = NULL;
+
+	phalcon_fetch_params(0, 1, 2, &framing, &option, &max_frame);
+
+	if (max_frame && Z_TYPE_P(max_frame) != IS_NULL) {
+		if (Z_TYPE_P(max_frame) != IS_LONG || Z_LVAL_P(max_frame) <= 0 || Z_LVAL_P(max_frame) > PHALCON_SOCKET_SERVER_FRAME_MAX) {
+			PHALCON_THROW_EXCEPTION_STR(phalcon_socket_exception_ce, "The maximum frame size must be between 1 byte and 64 MiB");
+			return;
+		}
+	}
+
+	switch (phalcon_get_intval(framing)) {
+		case PHALCON_SOCKET_SERVER_FRAMING_NONE:
+			break;
+		case PHALCON_SOCKET_SERVER_FRAMING_LENGTH:
+			if (option && Z_TYPE_P(option) != IS_NULL) {
+				if (Z_TYPE_P(option) != IS_LONG || (Z_LVAL_P(option) != 1 && Z_LVAL_P(option) != 2 && Z_LVAL_P(option) != 4)) {
+					PHALCON_THROW_EXCEPTION_STR(phalcon_socket_exception_ce, "The length prefix must be of 1, 2 or 4 bytes");
+					return;
+				}
+				phalcon_update_property(getThis(), SL("_prefixSize"), option);
+			}
+			break;
+		case PHALCON_SOCKET_SERVER_FRAMING_DELIMITER:
+			if (option && Z_TYPE_P(option) != IS_NULL) {
+				if (Z_TYPE_P(option) != IS_STRING || !Z_STRLEN_P(option)) {
+					PHALCON_THROW_EXCEPTION_STR(phalcon_socket_exception_ce, "The delimiter must be a non empty string");
+					return;
+				}
+				phalcon_update_property(getThis(), SL("_delimiter"), option);
+			}
+			break;
+		default:
+			PHALCON_THROW_EXCEPTION_STR(phalcon_socket_exception_ce, "Invalid framing");
+			return;
+	}
+
+	phalcon_update_property(getThis(), SL("_framing"), framing);
+
+	if (max_frame && Z_TYPE_P(max_frame) == IS_LONG) {
+		phalcon_update_property(getThis(), SL("_maxFrame"), max_frame);
+	}
+
+	RETURN_THIS();
+}
+
+/**
+ * Queues data to a client of the event mode, framed like what it receives
+ *
+ * What the socket does not take at once is written by the event loop. When the output the
+ * client has not read yet and the data pass 4MB, the client is disconnected, its output is
+ * dropped and false is returned.
+ *
+ * @param int $socketId
+ * @param string $data
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Socket_Server, send){
+
+	zval *socket_id, *data;
+#if HAVE_EPOLL
+	phalcon_socket_server_conn *conn;
+	size_t len;
+	unsigned char prefix[4];
+	int i;
+#endif
+
+	phalcon_fetch_params(0, 2, 0, &socket_id, &data);
+
+#if HAVE_EPOLL
+	if (!server || !server->conns || Z_TYPE_P(socket_id) != IS_LONG || Z_TYPE_P(data) != IS_STRING) {
+		RETURN_FALSE;
+	}
+	if ((conn = zend_hash_index_find_ptr(server->conns, Z_LVAL_P(socket_id))) == NULL || zend_hash_index_exists(server->closing, conn->fd)) {
+		RETURN_FALSE;
+	}
+
+	len = Z_STRLEN_P(data);
+	if (server->framing == PHALCON_SOCKET_SERVER_FRAMING_LENGTH) {
+		if ((server->prefix_size < 4 && len >> (8 * server->prefix_size)) || (uint64_t)len > 0xffffffff) {
+			php_error_docref(NULL, E_WARNING, "The data is too long for a length prefix of %d bytes", server->prefix_size);
+			RETURN_FALSE;
+		}
+	}
+
+	/* Only what the socket does not take now counts, the data alone is never refused */
+	if (phalcon_socket_server_conn_flush(conn) < 0
+		|| (phalcon_socket_server_conn_pending(conn) && ZSTR_LEN(conn->out.s) - conn->out_pos + len > PHALCON_SOCKET_SERVER_WRITE_MAX)) {
+		smart_str_free(&conn->out);
+		conn->out_pos = 0;
+		zend_hash_index_add_empty_element(server->closing, conn->fd);
+		RETURN_FALSE;
+	}
+
+	if (server->framing == PHALCON_SOCKET_SERVER_FRAMING_LENGTH) {
+		for (i = server->prefix_size - 1; i >= 0; i--) {
+			prefix[i] = len & 0xff;
+			len >>= 8;
+		}
+		smart_str_appendl(&conn->out, (const char *)prefix, server->prefix_size);
+	}
+
+	smart_str_appendl(&conn->out, Z_STRVAL_P(data), Z_STRLEN_P(data));
+
+	if (server->framing == PHALCON_SOCKET_SERVER_FRAMING_DELIMITER) {
+		smart_str_append(&conn->out, server->delimiter);
+	}
+
+	/* A failed write is seen by the event loop as an error of the socket */
+	phalcon_socket_server_conn_flush(conn);
+
+	RETURN_TRUE;
+#else
+	RETURN_FALSE;
+#endif
+}
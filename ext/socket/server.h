@@ -23,6 +23,11 @@
 
 #include "php_phalcon.h"
 
+/* How the event mode splits the received bytes before the receive callback */
+#define PHALCON_SOCKET_SERVER_FRAMING_NONE		0
+#define PHALCON_SOCKET_SERVER_FRAMING_LENGTH	1
+#define PHALCON_SOCKET_SERVER_FRAMING_DELIMITER	2
+
 extern zend_class_entry *phalcon_socket_server_ce;
 
 PHALCON_INIT_CLASS(Phalcon_Socket_Server);
@@ -35,13 +35,22 @@ PHP_METHOD(Phalcon_Websocket_Connection, sendJson);
 PHP_METHOD(Phalcon_Websocket_Connection, isConnected);
 PHP_METHOD(Phalcon_Websocket_Connection, getUid);
 PHP_METHOD(Phalcon_Websocket_Connection, disconnect);
+PHP_METHOD(Phalcon_Websocket_Connection, setBackpressure);
+PHP_METHOD(Phalcon_Websocket_Connection, getStats);
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_connection_send, 0, 0, 1)
 	ZEND_ARG_TYPE_INFO(0, text, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, key, IS_STRING, 1)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_connection_sendjson, 0, 0, 1)
 	ZEND_ARG_TYPE_INFO(0, payload, 0, 0)
+	ZEND_ARG_TYPE_INFO(0, key, IS_STRING, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_connection_setbackpressure, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, maxBytes, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, policy, IS_LONG, 1)
 ZEND_END_ARG_INFO()
 
 const zend_function_entry phalcon_websocket_connection_method_entry[] = {
@@ -50,26 +59,181 @@ const zend_function_entry phalcon_websocket_connection_method_entry[] = {
 	PHP_ME(Phalcon_Websocket_Connection, isConnected, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Websocket_Connection, getUid, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Websocket_Connection, disconnect, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Connection, setBackpressure, arginfo_phalcon_websocket_connection_setbackpressure, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Connection, getStats, NULL, ZEND_ACC_PUBLIC)
 	PHP_FE_END
 };
 
-int phalcon_websocket_connection_write(phalcon_websocket_connection_object *conn, zend_string *text) {
+zend_string *phalcon_websocket_frame_new(const char *data, size_t len) {
+	zend_string *frame = zend_string_alloc(LWS_PRE + len, 0);
+
+	memcpy(ZSTR_VAL(frame) + LWS_PRE, data, len);
+	ZSTR_VAL(frame)[LWS_PRE + len] = '\0';
+
+	return frame;
+}
+
+static void phalcon_websocket_connection_account(phalcon_websocket_connection_object *conn, int frames, ssize_t bytes)
+{
+	conn->stats.queued_frames += frames;
+	conn->stats.queued_bytes += bytes;
+	if (conn->server_stats) {
+		conn->server_stats->queued_frames += frames;
+		conn->server_stats->queued_bytes += bytes;
+	}
+}
+
+/**
+ * Releases the oldest frame of the queue
+ */
+static void phalcon_websocket_connection_shift(phalcon_websocket_connection_object *conn)
+{
+	zend_string *frame = conn->buf[conn->read_ptr];
+
+	phalcon_websocket_connection_account(conn, -1, -(ssize_t)PHALCON_WEBSOCKET_FRAME_LEN(frame));
+	zend_string_release(frame);
+	if (conn->keys[conn->read_ptr]) {
+		zend_string_release(conn->keys[conn->read_ptr]);
+	}
+	conn->buf[conn->read_ptr] = NULL;
+	conn->keys[conn->read_ptr] = NULL;
+	conn->read_ptr = (conn->read_ptr + 1) & (conn->size - 1);
+}
+
+/**
+ * Doubles the ring, the queued frames are moved to its start
+ */
+static void phalcon_websocket_connection_grow(phalcon_websocket_connection_object *conn)
+{
+	unsigned int i, n = 0, size = conn->size ? conn->size * 2 : 8;
+	zend_string **buf = ecalloc(size, sizeof(zend_string*)), **keys = ecalloc(size, sizeof(zend_string*));
+
+	for (i = conn->read_ptr; i != conn->write_ptr; i = (i + 1) & (conn->size - 1)) {
+		buf[n] = conn->buf[i];
+		keys[n++] = conn->keys[i];
+	}
+
+	if (conn->buf) {
+		efree(conn->buf);
+		efree(conn->keys);
+	}
+	conn->buf = buf;
+	conn->keys = keys;
+	conn->size = size;
+	conn->read_ptr = 0;
+	conn->write_ptr = n;
+}
+
+/**
+ * Queues a frame, it is shared by reference with the other clients it is queued to
+ *
+ * With the coalesce policy a frame replaces the queued one with the same key. A full
+ * queue drops its oldest frames to make room, or closes the connection with the
+ * disconnect policy. A single frame larger than the limit is still queued alone.
+ */
+int phalcon_websocket_connection_write(phalcon_websocket_connection_object *conn, zend_string *frame, zend_string *key)
+{
+	size_t len = PHALCON_WEBSOCKET_FRAME_LEN(frame);
+	unsigned int i;
+
 	if (!conn->connected) {
 		php_error_docref(NULL, E_WARNING, "Client is disconnected\n");
 		return -1;
 	}
-	if (((conn->write_ptr + 1) % PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE) == conn->read_ptr) {
-		php_error_docref(NULL, E_WARNING, "Write buffer is full\n");
-		return -1;
+
+	if (key && conn->policy == PHALCON_WEBSOCKET_BACKPRESSURE_COALESCE) {
+		for (i = conn->read_ptr; i != conn->write_ptr; i = (i + 1) & (conn->size - 1)) {
+			if (conn->keys[i] && zend_string_equals(conn->keys[i], key)) {
+				phalcon_websocket_connection_account(conn, 0, (ssize_t)len - (ssize_t)PHALCON_WEBSOCKET_FRAME_LEN(conn->buf[i]));
+				zend_string_release(conn->buf[i]);
+				conn->buf[i] = zend_string_copy(frame);
+				conn->stats.coalesced++;
+				if (conn->server_stats) {
+					conn->server_stats->coalesced++;
+				}
+				return len;
+			}
+		}
 	}
 
-	zend_string_addref(text);
-	conn->buf[conn->write_ptr] = text;
-	conn->write_ptr = (conn->write_ptr + 1) % PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE;
+	while (conn->stats.queued_frames && (conn->stats.queued_frames >= PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE - 1 || conn->stats.queued_bytes + len > conn->max_bytes)) {
+		if (conn->policy == PHALCON_WEBSOCKET_BACKPRESSURE_DISCONNECT) {
+			zend_string *reason = zend_string_init(SL("Slow consumer"), 0);
+			if (conn->server_stats) {
+				conn->server_stats->disconnected++;
+			}
+			phalcon_websocket_connection_clear(conn);
+			phalcon_websocket_connection_close(conn, reason);
+			zend_string_release(reason);
+			return -1;
+		}
+
+		phalcon_websocket_connection_shift(conn);
+		conn->stats.dropped++;
+		if (conn->server_stats) {
+			conn->server_stats->dropped++;
+		}
+	}
+
+	if (((conn->write_ptr + 1) & (conn->size - 1)) == conn->read_ptr || !conn->size) {
+		phalcon_websocket_connection_grow(conn);
+	}
+
+	conn->buf[conn->write_ptr] = zend_string_copy(frame);
+	conn->keys[conn->write_ptr] = key ? zend_string_copy(key) : NULL;
+	conn->write_ptr = (conn->write_ptr + 1) & (conn->size - 1);
+	phalcon_websocket_connection_account(conn, 1, len);
 
 	lws_callback_on_writable(conn->wsi);
 
-	return text->len;
+	return len;
+}
+
+/**
+ * Writes the oldest frame, libwebsockets allows one write for each writeable callback
+ */
+int phalcon_websocket_connection_flush(phalcon_websocket_connection_object *conn)
+{
+	zend_string *frame;
+	size_t len;
+	int n;
+
+	if (!conn->stats.queued_frames) {
+		return 0;
+	}
+
+	frame = zend_string_copy(conn->buf[conn->read_ptr]);
+	len = PHALCON_WEBSOCKET_FRAME_LEN(frame);
+	phalcon_websocket_connection_shift(conn);
+
+	n = lws_write(conn->wsi, PHALCON_WEBSOCKET_FRAME_DATA(frame), len, LWS_WRITE_TEXT);
+	zend_string_release(frame);
+
+	if (n < 0) {
+		lwsl_err("Write to socket %lu failed with code %d\n", conn->id, n);
+		return -1;
+	}
+	if (n < (int)len) {
+		// TODO Implements partial write
+		lwsl_err("Partial write\n");
+		return -1;
+	}
+
+	if (conn->stats.queued_frames) {
+		lws_callback_on_writable(conn->wsi);
+	}
+
+	return n;
+}
+
+/**
+ * Releases every queued frame
+ */
+void phalcon_websocket_connection_clear(phalcon_websocket_connection_object *conn)
+{
+	while (conn->stats.queued_frames) {
+		phalcon_websocket_connection_shift(conn);
+	}
 }
 
 void phalcon_websocket_connection_close(phalcon_websocket_connection_object *conn, zend_string *reason) {
@@ -93,6 +257,8 @@ zend_object* phalcon_websocket_connection_object_create_handler(zend_class_entry
 	intern->wsi = NULL;
 	intern->read_ptr = 0;
 	intern->write_ptr = 0;
+	intern->max_bytes = PHALCON_WEBSOCKET_CONNECTION_MAX_BYTES;
+	intern->policy = PHALCON_WEBSOCKET_BACKPRESSURE_DROP_OLDEST;
 
 	return &intern->std;
 }
@@ -101,13 +267,15 @@ void phalcon_websocket_connection_object_free_handler(zend_object *object)
 {
 	phalcon_websocket_connection_object *intern;
 	intern = phalcon_websocket_connection_object_from_obj(object);
-	while (intern->read_ptr != intern->write_ptr) {
-		zend_string_delref(intern->buf[intern->read_ptr]);
-		if (zend_string_refcount(intern->buf[intern->read_ptr]) < 1) {
-			zend_string_free(intern->buf[intern->read_ptr]);
-		}
+	phalcon_websocket_connection_clear(intern);
+	if (intern->buf) {
+		efree(intern->buf);
+		efree(intern->keys);
+	}
 
-		intern->read_ptr = (intern->read_ptr + 1) % PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE;
+	if (intern->topics) {
+		zend_hash_destroy(intern->topics);
+		FREE_HASHTABLE(intern->topics);
 	}
 
 	zend_object_std_dtor(object);
@@ -120,25 +288,36 @@ PHALCON_INIT_CLASS(Phalcon_Websocket_Connection){
 
 	PHALCON_REGISTER_CLASS_CREATE_OBJECT(Phalcon\\Websocket, Connection, websocket_connection, phalcon_websocket_connection_method_entry, 0);
 
+	zend_declare_class_constant_long(phalcon_websocket_connection_ce, SL("BACKPRESSURE_DROP_OLDEST"), PHALCON_WEBSOCKET_BACKPRESSURE_DROP_OLDEST);
+	zend_declare_class_constant_long(phalcon_websocket_connection_ce, SL("BACKPRESSURE_COALESCE"), PHALCON_WEBSOCKET_BACKPRESSURE_COALESCE);
+	zend_declare_class_constant_long(phalcon_websocket_connection_ce, SL("BACKPRESSURE_DISCONNECT"), PHALCON_WEBSOCKET_BACKPRESSURE_DISCONNECT);
+
 	return SUCCESS;
 }
 
 /**
  * Send data to the client
+ *
+ * @param string $text
+ * @param string $key with the coalesce policy, replaces the queued message with the same key
+ * @return int|boolean
  */
 PHP_METHOD(Phalcon_Websocket_Connection, send)
 {
 	phalcon_websocket_connection_object *intern;
-	zend_string *text;
+	zend_string *text, *frame, *key = NULL;
 	int n;
 
-	ZEND_PARSE_PARAMETERS_START(1, 1);
+	ZEND_PARSE_PARAMETERS_START(1, 2);
 		Z_PARAM_STR(text)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_STR_EX(key, 1, 0)
 	ZEND_PARSE_PARAMETERS_END();
 
 	intern = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(getThis()));
-	n = phalcon_websocket_connection_write(intern, text);
-	efree(text);
+	frame = phalcon_websocket_frame_new(ZSTR_VAL(text), ZSTR_LEN(text));
+	n = phalcon_websocket_connection_write(intern, frame, key);
+	zend_string_release(frame);
 	if (-1 == n) {
 		RETURN_FALSE;
 	}
@@ -152,15 +331,21 @@ PHP_METHOD(Phalcon_Websocket_Connection, sendJson)
 {
 	phalcon_websocket_connection_object *intern;
 	zval *val, text = {};
+	zend_string *frame, *key = NULL;
 	int n;
 
-	ZEND_PARSE_PARAMETERS_START(1, 1);
+	ZEND_PARSE_PARAMETERS_START(1, 2);
 		Z_PARAM_ZVAL(val);
+		Z_PARAM_OPTIONAL
+		Z_PARAM_STR_EX(key, 1, 0)
 	ZEND_PARSE_PARAMETERS_END();
 
 	intern = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(getThis()));
 	RETURN_ON_FAILURE(phalcon_json_encode(&text, val, 0));
-	n = phalcon_websocket_connection_write(intern, Z_STR(text));
+	frame = phalcon_websocket_frame_new(Z_STRVAL(text), Z_STRLEN(text));
+	zval_ptr_dtor(&text);
+	n = phalcon_websocket_connection_write(intern, frame, key);
+	zend_string_release(frame);
 	if (-1 == n) {
 		RETURN_FALSE;
 	}
@@ -207,3 +392,64 @@ PHP_METHOD(Phalcon_Websocket_Connection, disconnect)
 	intern = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(getThis()));
 	phalcon_websocket_connection_close(intern, reason);
 }
+
+/**
+ * Limit the bytes waiting to be written to the client and what happens beyond it
+ *
+ *<code>
+ *	$connection->setBackpressure(65536, Phalcon\Websocket\Connection::BACKPRESSURE_COALESCE);
+ *	$connection->send(json_encode($quote), $quote['symbol']);
+ *</code>
+ *
+ * @param int $maxBytes
+ * @param int $policy one of the BACKPRESSURE_* constants, unchanged when omitted
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Websocket_Connection, setBackpressure)
+{
+	phalcon_websocket_connection_object *intern;
+	zend_long max_bytes, policy = -1;
+
+	ZEND_PARSE_PARAMETERS_START(1, 2);
+		Z_PARAM_LONG(max_bytes)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(policy)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (max_bytes <= 0) {
+		php_error_docref(NULL, E_WARNING, "The maximum of queued bytes must be positive");
+		RETURN_FALSE;
+	}
+	if (policy != -1 && (policy < PHALCON_WEBSOCKET_BACKPRESSURE_DROP_OLDEST || policy > PHALCON_WEBSOCKET_BACKPRESSURE_DISCONNECT)) {
+		php_error_docref(NULL, E_WARNING, "Invalid backpressure policy");
+		RETURN_FALSE;
+	}
+
+	intern = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(getThis()));
+	intern->max_bytes = max_bytes;
+	if (policy != -1) {
+		intern->policy = policy;
+	}
+
+	RETURN_TRUE;
+}
+
+/**
+ * Get the state of the write queue
+ *
+ * @return array with queued_frames, queued_bytes, dropped and coalesced
+ */
+PHP_METHOD(Phalcon_Websocket_Connection, getStats)
+{
+	phalcon_websocket_connection_object *intern;
+
+	intern = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(getThis()));
+
+	array_init(return_value);
+	add_assoc_long(return_value, "queued_frames", intern->stats.queued_frames);
+	add_assoc_long(return_value, "queued_bytes", intern->stats.queued_bytes);
+	add_assoc_long(return_value, "max_bytes", intern->max_bytes);
+	add_assoc_long(return_value, "policy", intern->policy);
+	add_assoc_long(return_value, "dropped", intern->stats.dropped);
+	add_assoc_long(return_value, "coalesced", intern->stats.coalesced);
+}
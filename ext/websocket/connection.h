@@ -27,7 +27,29 @@
 #include <libwebsockets.h>
 
 #define PHALCON_WEBSOCKET_FREQUENCY 0.2
-#define PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE 30
+/* Frames queued at most, the ring starts small and grows up to it */
+#define PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE 1024
+#define PHALCON_WEBSOCKET_CONNECTION_MAX_BYTES (1024 * 1024)
+
+/* What a full write queue does with a new frame */
+enum {
+	PHALCON_WEBSOCKET_BACKPRESSURE_DROP_OLDEST,
+	PHALCON_WEBSOCKET_BACKPRESSURE_COALESCE,
+	PHALCON_WEBSOCKET_BACKPRESSURE_DISCONNECT
+};
+
+typedef struct {
+	size_t queued_bytes;
+	zend_ulong queued_frames;
+	zend_ulong dropped;
+	zend_ulong coalesced;
+	zend_ulong disconnected;
+} phalcon_websocket_queue_stats;
+
+/* A frame keeps LWS_PRE bytes before the payload for the header lws_write() puts there,
+ * the header of a payload is the same for every client so one frame is queued to all */
+#define PHALCON_WEBSOCKET_FRAME_DATA(frame) ((unsigned char *)ZSTR_VAL(frame) + LWS_PRE)
+#define PHALCON_WEBSOCKET_FRAME_LEN(frame) (ZSTR_LEN(frame) - LWS_PRE)
 
 typedef struct _phalcon_websocket_connection_object {
 	// ID (unique on server)
@@ -36,10 +58,21 @@ typedef struct _phalcon_websocket_connection_object {
 	// Connection state (Connected/Disconnected)
 	zend_bool connected;
 
-	// Write buffer
-	zend_string *buf[PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE];
+	// Write queue, a ring of frames and of their coalescing keys
+	zend_string **buf;
+	zend_string **keys;
+	unsigned int size;
 	unsigned int read_ptr;
 	unsigned int write_ptr;
+	size_t max_bytes;
+	int policy;
+	phalcon_websocket_queue_stats stats;
+
+	// Totals of the server, NULL once the connection is closed
+	phalcon_websocket_queue_stats *server_stats;
+
+	// Subscribed topics, allocated on the first subscription
+	HashTable *topics;
 
 	// LibWebSockets context
 	struct lws *wsi;
@@ -50,7 +83,10 @@ static inline phalcon_websocket_connection_object *phalcon_websocket_connection_
 	return (phalcon_websocket_connection_object*)((char*)(obj) - XtOffsetOf(phalcon_websocket_connection_object, std));
 }
 
-int phalcon_websocket_connection_write(phalcon_websocket_connection_object *conn, zend_string *text);
+zend_string *phalcon_websocket_frame_new(const char *data, size_t len);
+int phalcon_websocket_connection_write(phalcon_websocket_connection_object *conn, zend_string *frame, zend_string *key);
+int phalcon_websocket_connection_flush(phalcon_websocket_connection_object *conn);
+void phalcon_websocket_connection_clear(phalcon_websocket_connection_object *conn);
 void phalcon_websocket_connection_close(phalcon_websocket_connection_object *conn, zend_string *reason);
 
 extern zend_class_entry *phalcon_websocket_connection_ce;
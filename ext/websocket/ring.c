@@ -0,0 +1,206 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#include "websocket/ring.h"
+
+#include <sched.h>
+#include <unistd.h>
+
+#define PHALCON_WEBSOCKET_RING_ALIGN(n) (((n) + 7) & ~((size_t)7))
+
+/**
+ * Bytes of the mapping taken by one ring of the given data size
+ */
+size_t phalcon_websocket_ring_bytes(size_t size)
+{
+	return PHALCON_WEBSOCKET_RING_HEADER + PHALCON_WEBSOCKET_RING_ALIGN(size);
+}
+
+phalcon_websocket_ring *phalcon_websocket_ring_at(void *rings, size_t size, int i)
+{
+	return (phalcon_websocket_ring *)((char *)rings + i * phalcon_websocket_ring_bytes(size));
+}
+
+void phalcon_websocket_ring_init(phalcon_websocket_ring *ring, size_t size)
+{
+	ring->lock = 0;
+	ring->closed = 0;
+	ring->head = 0;
+	ring->tail = 0;
+	ring->dropped = 0;
+	ring->size = PHALCON_WEBSOCKET_RING_ALIGN(size);
+	memset((void *)ring->topics, 0, sizeof(ring->topics));
+}
+
+/**
+ * Drops the unread messages and the topics of a worker that is started again
+ */
+void phalcon_websocket_ring_reset(phalcon_websocket_ring *ring)
+{
+	ring->tail = ring->head;
+	memset((void *)ring->topics, 0, sizeof(ring->topics));
+	__sync_synchronize();
+}
+
+/**
+ * Counts a topic that got its first subscriber in the worker, or lost its last one
+ */
+void phalcon_websocket_ring_subscribe(phalcon_websocket_ring *ring, zend_string *topic, int add)
+{
+	uint32_t i = ZSTR_HASH(topic) % PHALCON_WEBSOCKET_RING_TOPICS;
+
+	if (add) {
+		__sync_fetch_and_add(&ring->topics[i], 1);
+	} else {
+		__sync_fetch_and_sub(&ring->topics[i], 1);
+	}
+}
+
+/**
+ * Whether the worker reading the ring may deliver the message, a publish only when it
+ * has subscribers on a topic of the same bucket
+ */
+int phalcon_websocket_ring_wants(phalcon_websocket_ring *ring, int type, zend_string *topic)
+{
+	if (ring->closed) {
+		return 0;
+	}
+
+	return type != PHALCON_WEBSOCKET_RING_PUBLISH || ring->topics[ZSTR_HASH(topic) % PHALCON_WEBSOCKET_RING_TOPICS] != 0;
+}
+
+/**
+ * Appends a message, returns -1 when the reader is too far behind to make room for it
+ *
+ * A record never wraps, the end of the data left too short for it is skipped by the reader.
+ */
+int phalcon_websocket_ring_push(phalcon_websocket_ring *ring, int type, int64_t ignored, zend_string *topic, zend_string *key, zend_string *text)
+{
+	phalcon_websocket_ring_record *record;
+	size_t topic_len = topic ? ZSTR_LEN(topic) : 0, key_len = key ? ZSTR_LEN(key) : 0;
+	size_t need = PHALCON_WEBSOCKET_RING_ALIGN(sizeof(phalcon_websocket_ring_record) + topic_len + key_len + ZSTR_LEN(text));
+	size_t offset, skip;
+	uint64_t head;
+	pid_t self;
+
+	if (need > ring->size / 2) {
+		__sync_fetch_and_add(&ring->dropped, 1);
+		return -1;
+	}
+
+	self = getpid();
+	while (!__sync_bool_compare_and_swap(&ring->lock, 0, self)) {
+		sched_yield();
+	}
+
+	head = ring->head;
+	offset = head % ring->size;
+	skip = ring->size - offset < need ? ring->size - offset : 0;
+
+	__sync_synchronize();
+	if (head + skip + need - ring->tail > ring->size) {
+		__sync_lock_release(&ring->lock);
+		__sync_fetch_and_add(&ring->dropped, 1);
+		return -1;
+	}
+
+	if (skip >= sizeof(phalcon_websocket_ring_record)) {
+		record = (phalcon_websocket_ring_record *)(PHALCON_WEBSOCKET_RING_DATA(ring) + offset);
+		record->size = skip;
+		record->type = PHALCON_WEBSOCKET_RING_PAD;
+	}
+	head += skip;
+
+	record = (phalcon_websocket_ring_record *)(PHALCON_WEBSOCKET_RING_DATA(ring) + head % ring->size);
+	record->size = need;
+	record->type = type;
+	record->ignored = ignored;
+	record->topic_len = topic_len;
+	record->key_len = key_len;
+	record->text_len = ZSTR_LEN(text);
+	record->has_key = key != NULL;
+	if (topic_len) {
+		memcpy(PHALCON_WEBSOCKET_RING_TOPIC(record), ZSTR_VAL(topic), topic_len);
+	}
+	if (key_len) {
+		memcpy(PHALCON_WEBSOCKET_RING_KEY(record), ZSTR_VAL(key), key_len);
+	}
+	memcpy(PHALCON_WEBSOCKET_RING_TEXT(record), ZSTR_VAL(text), ZSTR_LEN(text));
+
+	/* The record is complete before the reader can see it */
+	__sync_synchronize();
+	ring->head = head + need;
+
+	__sync_lock_release(&ring->lock);
+
+	return 0;
+}
+
+/**
+ * Oldest unread message of the ring, NULL when there is none
+ */
+phalcon_websocket_ring_record *phalcon_websocket_ring_peek(phalcon_websocket_ring *ring)
+{
+	phalcon_websocket_ring_record *record;
+	uint64_t head, tail = ring->tail;
+	size_t offset;
+
+	head = ring->head;
+	__sync_synchronize();
+
+	while (tail != head) {
+		offset = tail % ring->size;
+		if (ring->size - offset < sizeof(phalcon_websocket_ring_record)) {
+			tail += ring->size - offset;
+			continue;
+		}
+
+		record = (phalcon_websocket_ring_record *)(PHALCON_WEBSOCKET_RING_DATA(ring) + offset);
+		if (record->type == PHALCON_WEBSOCKET_RING_PAD) {
+			tail += record->size;
+			continue;
+		}
+
+		ring->tail = tail;
+		return record;
+	}
+
+	ring->tail = tail;
+	return NULL;
+}
+
+/**
+ * Gives the space of the message returned by peek back to the writers
+ */
+void phalcon_websocket_ring_shift(phalcon_websocket_ring *ring, phalcon_websocket_ring_record *record)
+{
+	__sync_synchronize();
+	ring->tail += record->size;
+}
+
+/**
+ * Releases the lock a dead worker left taken, returns 1 when it held it
+ *
+ * The head only moves once a record is complete, what the worker was writing is not seen.
+ */
+int phalcon_websocket_ring_recover(phalcon_websocket_ring *ring, pid_t pid)
+{
+	return __sync_bool_compare_and_swap(&ring->lock, pid, 0);
+}
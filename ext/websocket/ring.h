@@ -0,0 +1,89 @@
+
+/*
+  +------------------------------------------------------------------------+
+  | Phalcon Framework                                                      |
+  +------------------------------------------------------------------------+
+  | Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+  +------------------------------------------------------------------------+
+  | This source file is subject to the New BSD License that is bundled     |
+  | with this package in the file docs/LICENSE.txt.                        |
+  |                                                                        |
+  | If you did not receive a copy of the license and are unable to         |
+  | obtain it through the world-wide-web, please send an email             |
+  | to license@phalconphp.com so we can send you a copy immediately.       |
+  +------------------------------------------------------------------------+
+  | Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+  |          Eduar Carvajal <eduar@phalconphp.com>                         |
+  |          ZhuZongXin <dreamsxin@qq.com>                                 |
+  +------------------------------------------------------------------------+
+*/
+
+#ifndef PHALCON_WEBSOCKET_RING_H
+#define PHALCON_WEBSOCKET_RING_H
+
+#include "php_phalcon.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Bytes of the ring of each worker and the largest message it takes, half of them */
+#define PHALCON_WEBSOCKET_RING_SIZE		(1024 * 1024)
+
+/* Record sizes are 32 bits, a message is at most half of the ring */
+#define PHALCON_WEBSOCKET_RING_MAX		(1024 * 1024 * 1024)
+
+/* Buckets of topic hashes a worker has subscribers on */
+#define PHALCON_WEBSOCKET_RING_TOPICS	256
+
+enum {
+	PHALCON_WEBSOCKET_RING_PAD,
+	PHALCON_WEBSOCKET_RING_BROADCAST,
+	PHALCON_WEBSOCKET_RING_PUBLISH
+};
+
+/* Followed by the topic, the key and the text, the whole record is 8 bytes aligned */
+typedef struct {
+	uint32_t size;
+	uint32_t type;
+	int64_t ignored;
+	uint32_t topic_len;
+	uint32_t key_len;
+	uint32_t text_len;
+	uint32_t has_key;
+} phalcon_websocket_ring_record;
+
+/*
+ * Messages sent to one worker by the others, it lives in shared memory. The writers take
+ * the lock, the worker reads without it. Positions only grow, modulo size in the data.
+ * The lock holds the pid of the writer, the master releases it when that worker dies.
+ * Only the worker counts its topics, the others read them to skip a publish it has no
+ * subscribers for. A closed ring belongs to a worker that exited and is not restarted.
+ */
+typedef struct {
+	volatile pid_t lock;
+	volatile uint32_t closed;
+	volatile uint64_t head;
+	volatile uint64_t tail;
+	volatile uint64_t dropped;
+	size_t size;
+	volatile uint32_t topics[PHALCON_WEBSOCKET_RING_TOPICS];
+} phalcon_websocket_ring;
+
+#define PHALCON_WEBSOCKET_RING_HEADER ((sizeof(phalcon_websocket_ring) + 63) & ~((size_t)63))
+#define PHALCON_WEBSOCKET_RING_DATA(ring) ((char *)(ring) + PHALCON_WEBSOCKET_RING_HEADER)
+#define PHALCON_WEBSOCKET_RING_TOPIC(record) ((char *)(record) + sizeof(phalcon_websocket_ring_record))
+#define PHALCON_WEBSOCKET_RING_KEY(record) (PHALCON_WEBSOCKET_RING_TOPIC(record) + (record)->topic_len)
+#define PHALCON_WEBSOCKET_RING_TEXT(record) (PHALCON_WEBSOCKET_RING_KEY(record) + (record)->key_len)
+
+size_t phalcon_websocket_ring_bytes(size_t size);
+phalcon_websocket_ring *phalcon_websocket_ring_at(void *rings, size_t size, int i);
+void phalcon_websocket_ring_init(phalcon_websocket_ring *ring, size_t size);
+void phalcon_websocket_ring_reset(phalcon_websocket_ring *ring);
+void phalcon_websocket_ring_subscribe(phalcon_websocket_ring *ring, zend_string *topic, int add);
+int phalcon_websocket_ring_wants(phalcon_websocket_ring *ring, int type, zend_string *topic);
+int phalcon_websocket_ring_push(phalcon_websocket_ring *ring, int type, int64_t ignored, zend_string *topic, zend_string *key, zend_string *text);
+phalcon_websocket_ring_record *phalcon_websocket_ring_peek(phalcon_websocket_ring *ring);
+void phalcon_websocket_ring_shift(phalcon_websocket_ring *ring, phalcon_websocket_ring_record *record);
+int phalcon_websocket_ring_recover(phalcon_websocket_ring *ring, pid_t pid);
+
+#endif /* PHALCON_WEBSOCKET_RING_H */
@@ -21,6 +21,7 @@
 #include "websocket/server.h"
 #include "websocket/eventloopinterface.h"
 #include "websocket/connection.h"
+#include "websocket/ring.h"
 
 #include <php_network.h>
 #include <zend_interfaces.h>
@@ -29,6 +30,14 @@
 #include "kernel/main.h"
 #include "kernel/fcall.h"
 
+#include <sched.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+
 /**
  * Phalcon\Websocket\Server
  *
@@ -45,6 +54,29 @@
  * });
  * $server->run();
  *<／code>
+ *
+ * Connections subscribed to a topic are reached by publish() without walking the others,
+ * the frame is built once and queued by reference to every subscriber:
+ *
+ *<code>
+ * $server->on(Phalcon\Websocket\Server::ON_DATA, function($server, $conn, $data){
+ *     $message = json_decode($data, true);
+ *     if ($message['type'] == 'join') {
+ *         $server->subscribe($conn, $message['room']);
+ *     } else {
+ *         $server->publish($message['room'], $message['text'], $conn->getUid());
+ *     }
+ * });
+ *</code>
+ *
+ * Each connection queues at most 1MB for a slow client, then drops its oldest messages.
+ * With the coalesce policy a message sent with a key replaces the queued one with the same key:
+ *
+ *<code>
+ * $server->setBackpressure(65536, Phalcon\Websocket\Connection::BACKPRESSURE_COALESCE);
+ * $server->publish('quotes', json_encode($quote), -1, $quote['symbol']);
+ * print_r($server->getStats());
+ *</code>
  */
 zend_class_entry *phalcon_websocket_server_ce;
 
@@ -54,6 +86,12 @@ PHP_METHOD(Phalcon_Websocket_Server, serviceFd);
 PHP_METHOD(Phalcon_Websocket_Server, run);
 PHP_METHOD(Phalcon_Websocket_Server, stop);
 PHP_METHOD(Phalcon_Websocket_Server, broadcast);
+PHP_METHOD(Phalcon_Websocket_Server, subscribe);
+PHP_METHOD(Phalcon_Websocket_Server, unsubscribe);
+PHP_METHOD(Phalcon_Websocket_Server, publish);
+PHP_METHOD(Phalcon_Websocket_Server, setBackpressure);
+PHP_METHOD(Phalcon_Websocket_Server, getStats);
+PHP_METHOD(Phalcon_Websocket_Server, setWorkers);
 PHP_METHOD(Phalcon_Websocket_Server, on);
 
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_server___construct, 0, 0, 0)
@@ -72,6 +110,34 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_server_broadcast, 0, 0, 1)
 	ZEND_ARG_TYPE_INFO(0, text, IS_STRING, 0)
 	ZEND_ARG_TYPE_INFO(0, ignored, IS_LONG, 1)
+	ZEND_ARG_TYPE_INFO(0, key, IS_STRING, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_server_subscribe, 0, 0, 2)
+	ZEND_ARG_INFO(0, connection)
+	ZEND_ARG_TYPE_INFO(0, topic, IS_STRING, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_server_unsubscribe, 0, 0, 1)
+	ZEND_ARG_INFO(0, connection)
+	ZEND_ARG_TYPE_INFO(0, topic, IS_STRING, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_server_publish, 0, 0, 2)
+	ZEND_ARG_TYPE_INFO(0, topic, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, text, IS_STRING, 0)
+	ZEND_ARG_TYPE_INFO(0, ignored, IS_LONG, 1)
+	ZEND_ARG_TYPE_INFO(0, key, IS_STRING, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_server_setbackpressure, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, maxBytes, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, policy, IS_LONG, 1)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_phalcon_websocket_server_setworkers, 0, 0, 1)
+	ZEND_ARG_TYPE_INFO(0, workers, IS_LONG, 0)
+	ZEND_ARG_TYPE_INFO(0, ringSize, IS_LONG, 1)
 ZEND_END_ARG_INFO()
 
 #if PHP_VERSION_ID >= 70200
@@ -94,16 +160,393 @@ static const zend_function_entry phalcon_websocket_server_method_entry[] = {
 	PHP_ME(Phalcon_Websocket_Server, stop, NULL, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Websocket_Server, on, arginfo_phalcon_websocket_server_on, ZEND_ACC_PUBLIC)
 	PHP_ME(Phalcon_Websocket_Server, broadcast, arginfo_phalcon_websocket_server_broadcast, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Server, subscribe, arginfo_phalcon_websocket_server_subscribe, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Server, unsubscribe, arginfo_phalcon_websocket_server_unsubscribe, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Server, publish, arginfo_phalcon_websocket_server_publish, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Server, setBackpressure, arginfo_phalcon_websocket_server_setbackpressure, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Server, getStats, NULL, ZEND_ACC_PUBLIC)
+	PHP_ME(Phalcon_Websocket_Server, setWorkers, arginfo_phalcon_websocket_server_setworkers, ZEND_ACC_PUBLIC)
 	PHP_FE_END
 };
 
+static void phalcon_websocket_server_topic_dtor(zval *zv)
+{
+	HashTable *members = Z_PTR_P(zv);
+
+	zend_hash_destroy(members);
+	FREE_HASHTABLE(members);
+}
+
+static int phalcon_websocket_server_subscribe(phalcon_websocket_server_object *intern, phalcon_websocket_connection_object *conn, zend_string *topic)
+{
+	HashTable *members;
+
+	if ((members = zend_hash_find_ptr(&intern->topics, topic)) == NULL) {
+		ALLOC_HASHTABLE(members);
+		zend_hash_init(members, 8, NULL, NULL, 0);
+		zend_hash_add_ptr(&intern->topics, topic, members);
+		if (intern->rings) {
+			phalcon_websocket_ring_subscribe(phalcon_websocket_ring_at(intern->rings, intern->ring_size, intern->worker), topic, 1);
+		}
+	}
+
+	if (!zend_hash_index_add_ptr(members, conn->id, conn)) {
+		return 0;
+	}
+
+	if (!conn->topics) {
+		ALLOC_HASHTABLE(conn->topics);
+		zend_hash_init(conn->topics, 4, NULL, NULL, 0);
+	}
+	zend_hash_add_empty_element(conn->topics, topic);
+
+	return 1;
+}
+
+static int phalcon_websocket_server_unsubscribe_member(phalcon_websocket_server_object *intern, phalcon_websocket_connection_object *conn, zend_string *topic)
+{
+	HashTable *members;
+
+	if ((members = zend_hash_find_ptr(&intern->topics, topic)) == NULL || zend_hash_index_del(members, conn->id) == FAILURE) {
+		return 0;
+	}
+
+	/* An empty topic is dropped, the index only holds topics with subscribers */
+	if (!zend_hash_num_elements(members)) {
+		if (intern->rings) {
+			phalcon_websocket_ring_subscribe(phalcon_websocket_ring_at(intern->rings, intern->ring_size, intern->worker), topic, 0);
+		}
+		zend_hash_del(&intern->topics, topic);
+	}
+
+	return 1;
+}
+
+static int phalcon_websocket_server_unsubscribe(phalcon_websocket_server_object *intern, phalcon_websocket_connection_object *conn, zend_string *topic)
+{
+	zend_string *key;
+	int n = 0;
+
+	if (!conn->topics) {
+		return 0;
+	}
+
+	if (topic) {
+		if (phalcon_websocket_server_unsubscribe_member(intern, conn, topic)) {
+			zend_hash_del(conn->topics, topic);
+			n = 1;
+		}
+		return n;
+	}
+
+	ZEND_HASH_FOREACH_STR_KEY(conn->topics, key) {
+		n += phalcon_websocket_server_unsubscribe_member(intern, conn, key);
+	} ZEND_HASH_FOREACH_END();
+	zend_hash_clean(conn->topics);
+
+	return n;
+}
+
+static phalcon_websocket_connection_object *phalcon_websocket_server_get_connection(phalcon_websocket_server_object *intern, zval *connection)
+{
+	zval *object;
+
+	if (Z_TYPE_P(connection) == IS_OBJECT && instanceof_function(Z_OBJCE_P(connection), phalcon_websocket_connection_ce)) {
+		return phalcon_websocket_connection_object_from_obj(Z_OBJ_P(connection));
+	}
+
+	if (Z_TYPE_P(connection) == IS_LONG && (object = zend_hash_index_find(Z_ARRVAL(intern->connections), Z_LVAL_P(connection))) != NULL) {
+		return phalcon_websocket_connection_object_from_obj(Z_OBJ_P(object));
+	}
+
+	return NULL;
+}
+
+/**
+ * Queues a message to the connections of this process, the subscribers of the topic with one
+ */
+static zend_long phalcon_websocket_server_deliver(phalcon_websocket_server_object *intern, const char *topic, size_t topic_len, const char *text, size_t text_len, zend_long ignored, zend_string *key)
+{
+	phalcon_websocket_connection_object *conn;
+	HashTable *members;
+	zend_string *frame;
+	zval *connection;
+	zend_long n = 0;
+
+	if (topic) {
+		if ((members = zend_hash_str_find_ptr(&intern->topics, topic, topic_len)) == NULL) {
+			return 0;
+		}
+	}
+
+	frame = phalcon_websocket_frame_new(text, text_len);
+	if (topic) {
+		ZEND_HASH_FOREACH_PTR(members, conn) {
+			if ((zend_long)conn->id == ignored || !conn->connected) {
+				continue;
+			}
+			if (phalcon_websocket_connection_write(conn, frame, key) >= 0) {
+				n++;
+			}
+		} ZEND_HASH_FOREACH_END();
+	} else {
+		ZEND_HASH_FOREACH_VAL(Z_ARRVAL(intern->connections), connection) {
+			conn = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(connection));
+			if ((zend_long)conn->id == ignored || !conn->connected) {
+				continue;
+			}
+			if (phalcon_websocket_connection_write(conn, frame, key) >= 0) {
+				n++;
+			}
+		} ZEND_HASH_FOREACH_END();
+	}
+	zend_string_release(frame);
+
+	return n;
+}
+
+/**
+ * Copies a message to the ring of every other worker that may deliver it and wakes it up
+ */
+static void phalcon_websocket_server_forward(phalcon_websocket_server_object *intern, int type, zend_long ignored, zend_string *topic, zend_string *key, zend_string *text)
+{
+	phalcon_websocket_ring *ring;
+	uint64_t one = 1;
+	int i;
+
+	if (!intern->rings) {
+		return;
+	}
+
+	for (i = 0; i < intern->num_workers; i++) {
+		if (i == intern->worker) {
+			continue;
+		}
+		ring = phalcon_websocket_ring_at(intern->rings, intern->ring_size, i);
+		if (phalcon_websocket_ring_wants(ring, type, topic) && !phalcon_websocket_ring_push(ring, type, ignored, topic, key, text)) {
+			/* The counter saturates long before a worker falls that much behind, EAGAIN is harmless */
+			if (write(intern->wakeups[i], &one, sizeof(one)) < 0 && errno != EAGAIN) {
+				perror("Unable to wake up websocket worker");
+			}
+		}
+	}
+}
+
+/**
+ * Delivers the messages the other workers left in the ring of this one, called when its eventfd is readable
+ */
+static void phalcon_websocket_server_receive(phalcon_websocket_server_object *intern)
+{
+	phalcon_websocket_ring *ring = phalcon_websocket_ring_at(intern->rings, intern->ring_size, intern->worker);
+	phalcon_websocket_ring_record *record;
+	zend_string *key;
+	uint64_t count;
+
+	/* Reset before the ring is read, a message pushed meanwhile signals it again */
+	while (read(intern->wakeups[intern->worker], &count, sizeof(count)) < 0 && errno == EINTR);
+
+	while ((record = phalcon_websocket_ring_peek(ring)) != NULL) {
+		key = record->has_key ? zend_string_init(PHALCON_WEBSOCKET_RING_KEY(record), record->key_len, 0) : NULL;
+		phalcon_websocket_server_deliver(intern,
+			record->type == PHALCON_WEBSOCKET_RING_PUBLISH ? PHALCON_WEBSOCKET_RING_TOPIC(record) : NULL, record->topic_len,
+			PHALCON_WEBSOCKET_RING_TEXT(record), record->text_len, record->ignored, key);
+		if (key) {
+			zend_string_release(key);
+		}
+		phalcon_websocket_ring_shift(ring, record);
+	}
+}
+
+static volatile sig_atomic_t phalcon_websocket_server_signaled = 0;
+
+static void phalcon_websocket_server_signal(int sig)
+{
+	phalcon_websocket_server_signaled = 1;
+}
+
+/**
+ * Returns 0 in the child, which goes on to run its own context on the shared port
+ */
+static pid_t phalcon_websocket_server_fork_worker(phalcon_websocket_server_object *intern, int i, sigset_t *mask)
+{
+	struct sigaction sa;
+	pid_t pid;
+#ifdef CPU_SET
+	cpu_set_t cmask;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	if ((pid = fork()) < 0) {
+		perror("Unable to fork websocket worker");
+		return pid;
+	} else if (pid > 0) {
+		intern->workers[i] = pid;
+		return pid;
+	}
+
+	intern->worker = i;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = phalcon_websocket_server_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigprocmask(SIG_SETMASK, mask, NULL);
+
+#ifdef CPU_SET
+	if (cpus > 0 && intern->num_workers <= cpus) {
+		CPU_ZERO(&cmask);
+		CPU_SET(i, &cmask);
+		if (sched_setaffinity(0, sizeof(cmask), &cmask) < 0) {
+			perror("Unable to bind websocket worker to its CPU");
+		}
+	}
+#endif
+
+	return 0;
+}
+
+static void phalcon_websocket_server_unmap(phalcon_websocket_server_object *intern)
+{
+	int i;
+
+	for (i = 0; i < intern->num_workers; i++) {
+		if (intern->wakeups[i] >= 0) {
+			close(intern->wakeups[i]);
+		}
+	}
+	efree(intern->wakeups);
+	intern->wakeups = NULL;
+
+	munmap(intern->rings, intern->num_workers * phalcon_websocket_ring_bytes(intern->ring_size));
+	intern->rings = NULL;
+}
+
+/**
+ * Forks the workers and supervises them until SIGINT or SIGTERM
+ *
+ * Returns 1 in a worker, 0 in the master once the workers are gone and -1 on failure.
+ * A worker killed by a signal is forked again, its ring starts over empty. A worker that
+ * exited, unable to listen for one, only gives up its slot and the others keep serving.
+ */
+static int phalcon_websocket_server_fork(phalcon_websocket_server_object *intern)
+{
+	phalcon_websocket_ring *ring;
+	sigset_t set, old;
+	pid_t pid;
+	int i, sig, status, alive, ret = 0;
+
+	intern->rings = mmap(NULL, intern->num_workers * phalcon_websocket_ring_bytes(intern->ring_size), PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
+	if (intern->rings == MAP_FAILED) {
+		intern->rings = NULL;
+		php_error_docref(NULL, E_WARNING, "Unable to map the rings of the workers");
+		return -1;
+	}
+	intern->wakeups = ecalloc(intern->num_workers, sizeof(int));
+	for (i = 0; i < intern->num_workers; i++) {
+		phalcon_websocket_ring_init(phalcon_websocket_ring_at(intern->rings, intern->ring_size, i), intern->ring_size);
+		intern->wakeups[i] = -1;
+	}
+	for (i = 0; i < intern->num_workers; i++) {
+		if ((intern->wakeups[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+			php_error_docref(NULL, E_WARNING, "Unable to create the eventfd of the workers");
+			phalcon_websocket_server_unmap(intern);
+			return -1;
+		}
+	}
+	intern->workers = ecalloc(intern->num_workers, sizeof(pid_t));
+
+	/* Blocked before the first fork, nothing is lost while the workers start */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	sigaddset(&set, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &set, &old);
+
+	alive = 0;
+	for (i = 0; i < intern->num_workers; i++) {
+		if ((pid = phalcon_websocket_server_fork_worker(intern, i, &old)) == 0) {
+			return 1;
+		}
+		if (pid < 0) {
+			break;
+		}
+		alive++;
+	}
+	if (alive < intern->num_workers) {
+		ret = -1;
+	}
+
+	while (!ret && alive > 0 && !intern->exit_request) {
+		if (sigwait(&set, &sig) != 0) {
+			continue;
+		}
+		if (sig != SIGCHLD) {
+			break;
+		}
+
+		while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+			/* A worker that died writing to a ring would hold its lock forever */
+			for (i = 0; i < intern->num_workers; i++) {
+				if (phalcon_websocket_ring_recover(phalcon_websocket_ring_at(intern->rings, intern->ring_size, i), pid)) {
+					lwsl_err("Websocket worker %d died holding the lock of ring %d, released\n", (int)pid, i);
+				}
+			}
+
+			for (i = 0; i < intern->num_workers; i++) {
+				if (intern->workers[i] != pid) {
+					continue;
+				}
+				intern->workers[i] = 0;
+				alive--;
+				ring = phalcon_websocket_ring_at(intern->rings, intern->ring_size, i);
+
+				/* A worker that returned, unable to listen for one, is not restarted */
+				if (!WIFSIGNALED(status)) {
+					lwsl_err("Websocket worker %d exited with status %d, %d left\n", i, WEXITSTATUS(status), alive);
+					ring->closed = 1;
+					break;
+				}
+
+				lwsl_err("Websocket worker %d killed by signal %d, restarting\n", i, WTERMSIG(status));
+				phalcon_websocket_ring_reset(ring);
+
+				if ((pid = phalcon_websocket_server_fork_worker(intern, i, &old)) == 0) {
+					return 1;
+				}
+				if (pid > 0) {
+					alive++;
+				}
+				break;
+			}
+		}
+	}
+
+	for (i = 0; i < intern->num_workers; i++) {
+		if (intern->workers[i] > 0) {
+			kill(intern->workers[i], SIGTERM);
+		}
+	}
+	for (i = 0; i < intern->num_workers; i++) {
+		if (intern->workers[i] > 0) {
+			waitpid(intern->workers[i], &status, 0);
+		}
+	}
+
+	sigprocmask(SIG_SETMASK, &old, NULL);
+
+	phalcon_websocket_server_unmap(intern);
+	efree(intern->workers);
+	intern->workers = NULL;
+
+	return ret;
+}
+
 static int phalcon_websocket_server_callback(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len)
 {
 	phalcon_websocket_server_object *intern = (phalcon_websocket_server_object*)lws_context_user(lws_get_context(wsi));
 	phalcon_websocket_connection_object *connection_object;
 	zval *connection = user, retval = {}, obj = {};
-	int n, return_code = 0, flag = 0;
-	zend_string *text;
+	int return_code = 0, flag = 0;
 	struct lws_pollargs *pa = in;
 
 	ZVAL_OBJ(&obj, &intern->std);
@@ -151,8 +594,12 @@ static int phalcon_websocket_server_callback(struct lws *wsi, enum lws_callback_
 			lwsl_notice("Accept\n");
 			object_init_ex(connection, phalcon_websocket_connection_ce);
 			connection_object = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(connection));
-			connection_object->id = ++intern->next_id;
+			// Unique across the workers, the others can skip it too
+			connection_object->id = ++intern->next_id * intern->num_workers + intern->worker;
 			connection_object->wsi = wsi;
+			connection_object->max_bytes = intern->max_bytes;
+			connection_object->policy = intern->policy;
+			connection_object->server_stats = &intern->stats;
 
 			add_index_zval(&intern->connections, connection_object->id, connection);
 
@@ -195,29 +642,9 @@ static int phalcon_websocket_server_callback(struct lws *wsi, enum lws_callback_
 				break;
 			}
 
-			while (connection_object->read_ptr != connection_object->write_ptr) {
-				text = connection_object->buf[connection_object->read_ptr];
-				n = lws_write(wsi, (unsigned char *)ZSTR_VAL(text), ZSTR_LEN(text), LWS_WRITE_TEXT);
-
-				if (n < 0) {
-					lwsl_err("Write to socket %lu failed with code %d\n", connection_object->id, n);
-					return 1;
-				}
-				if (n < (int) text->len) {
-					// TODO Implements partial write
-					connection_object->buf[connection_object->read_ptr] = NULL;
-					connection_object->read_ptr = (connection_object->read_ptr + 1) % PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE;
-					lwsl_err("Partial write\n");
-					return -1;
-				}
-
-				// Cleanup
-				connection_object->buf[connection_object->read_ptr] = NULL;
-				connection_object->read_ptr = (connection_object->read_ptr + 1) % PHALCON_WEBSOCKET_CONNECTION_BUFFER_SIZE;
-				zend_string_delref(text);
-				if (zend_string_refcount(text) < 1) {
-					zend_string_free(text);
-				}
+			// One frame at a time, the callback comes back while frames are queued
+			if (phalcon_websocket_connection_flush(connection_object) < 0) {
+				return -1;
 			}
 
 			break;
@@ -227,7 +654,10 @@ static int phalcon_websocket_server_callback(struct lws *wsi, enum lws_callback_
 			connection_object = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(connection));
 			connection_object->connected = 0;
 
-			// Drop from active connections
+			// Drop from active connections and topics, the unsent frames no longer count
+			phalcon_websocket_connection_clear(connection_object);
+			connection_object->server_stats = NULL;
+			phalcon_websocket_server_unsubscribe(intern, connection_object, NULL);
 			zend_hash_index_del(Z_ARRVAL(intern->connections), connection_object->id);
 
 			if (Z_TYPE(intern->callbacks[PHP_CB_SERVER_CLOSE]) == IS_CALLABLE) {
@@ -239,6 +669,15 @@ static int phalcon_websocket_server_callback(struct lws *wsi, enum lws_callback_
 			Z_TRY_DELREF_P(connection);
 			break;
 
+#ifdef PHALCON_USE_WEBSOCKET_WORKERS
+		case LWS_CALLBACK_RAW_RX_FILE:
+			// The eventfd of the worker, the only file adopted
+			if (intern->rings) {
+				phalcon_websocket_server_receive(intern);
+			}
+			break;
+#endif
+
 		case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
 			lwsl_notice("Error\n");
 			if (Z_TYPE(intern->callbacks[PHP_CB_SERVER_ERROR]) == IS_CALLABLE) {
@@ -306,6 +745,14 @@ zend_object* phalcon_websocket_server_object_create_handler(zend_class_entry *ce
 
 	intern->next_id = 0;
 	array_init(&intern->connections);
+	zend_hash_init(&intern->topics, 8, NULL, phalcon_websocket_server_topic_dtor, 0);
+
+	intern->max_bytes = PHALCON_WEBSOCKET_CONNECTION_MAX_BYTES;
+	intern->policy = PHALCON_WEBSOCKET_BACKPRESSURE_DROP_OLDEST;
+
+	intern->num_workers = 1;
+	intern->worker = 0;
+	intern->ring_size = PHALCON_WEBSOCKET_RING_SIZE;
 
 	return &intern->std;
 }
@@ -313,6 +760,7 @@ zend_object* phalcon_websocket_server_object_create_handler(zend_class_entry *ce
 void phalcon_websocket_server_object_free_handler(zend_object *object)
 {
 	phalcon_websocket_server_object *intern;
+	zval *connection;
 	int i;
 	intern = phalcon_websocket_server_object_from_obj(object);
 
@@ -337,6 +785,12 @@ void phalcon_websocket_server_object_free_handler(zend_object *object)
 	FREE_HASHTABLE(intern->eventloop_sockets);
 	intern->eventloop_sockets = NULL;
 
+	zend_hash_destroy(&intern->topics);
+
+	// Connections kept by the application must not point to the totals
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL(intern->connections), connection) {
+		phalcon_websocket_connection_object_from_obj(Z_OBJ_P(connection))->server_stats = NULL;
+	} ZEND_HASH_FOREACH_END();
 	zval_ptr_dtor(&intern->connections);
 	zend_object_std_dtor(object);
 }
@@ -492,13 +946,49 @@ PHP_METHOD(Phalcon_Websocket_Server, run)
 		PHALCON_CALL_METHOD(NULL, getThis(), "on", &event, tick);
 	}
 
-	// Start WebSocket
 	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
+
+	// Each worker listens on the same port, the master only supervises them
+	if (intern->num_workers > 1) {
+		if (zend_is_true(&intern->eventloop)) {
+			php_error_docref(NULL, E_WARNING, "Workers can't be used with an external event loop");
+			RETURN_FALSE;
+		}
+#ifdef PHALCON_USE_WEBSOCKET_WORKERS
+		intern->info.options |= LWS_SERVER_OPTION_ALLOW_LISTEN_SHARE;
+
+		n = phalcon_websocket_server_fork(intern);
+		if (n <= 0) {
+			RETURN_BOOL(n == 0);
+		}
+		n = 0;
+#else
+		php_error_docref(NULL, E_WARNING, "Phalcon was built with a libwebsockets that can't share the listen socket, running a single process");
+#endif
+	}
+
+	// Start WebSocket
 	intern->context = lws_create_context(&intern->info);
 	if (intern->context == NULL) {
+		if (intern->rings) {
+			exit(1);
+		}
         RETURN_FALSE;
     }
 
+#ifdef PHALCON_USE_WEBSOCKET_WORKERS
+	// The other workers signal the eventfd, lws polls it with the sockets
+	if (intern->rings) {
+		lws_sock_file_fd_type fd;
+		fd.filefd = intern->wakeups[intern->worker];
+		if (!lws_adopt_descriptor_vhost(lws_get_vhost_by_name(intern->context, "default"), LWS_ADOPT_RAW_FILE_DESC, fd, protocols[0].name, NULL)) {
+			lwsl_err("Websocket worker %d unable to poll its eventfd\n", intern->worker);
+			lws_context_destroy(intern->context);
+			exit(1);
+		}
+	}
+#endif
+
 	// If an external event loop is used, nothing more to do
 	if (zend_is_true(&intern->eventloop)) {
 		return;
@@ -506,7 +996,7 @@ PHP_METHOD(Phalcon_Websocket_Server, run)
 
 	gettimeofday(&tv, NULL);
 	oldMs = ms = (tv.tv_sec * 1000) + (tv.tv_usec / 1000);
-	while (n >= 0 && !intern->exit_request) {
+	while (n >= 0 && !intern->exit_request && !phalcon_websocket_server_signaled) {
 		if (nextTick <= 0) {
 			if (Z_TYPE(intern->callbacks[PHP_CB_SERVER_TICK]) != IS_NULL) {
 				int flag = 0;
@@ -528,8 +1018,9 @@ PHP_METHOD(Phalcon_Websocket_Server, run)
 
 	// Disconnect users
 	text = zend_string_init(ZEND_STRL("Server terminated"), 0);
+	zend_hash_clean(&intern->topics);
 	ZEND_HASH_FOREACH(Z_ARR(intern->connections), 0);
-		conn = (phalcon_websocket_connection_object *) Z_OBJ_P(_z);
+		conn = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(_z));
 		phalcon_websocket_connection_close(conn, text);
 		zval_delref_p(_z);
 		zend_hash_index_del(Z_ARR(intern->connections), _p->h);
@@ -537,6 +1028,11 @@ PHP_METHOD(Phalcon_Websocket_Server, run)
 
 	lws_context_destroy(intern->context);
 	intern->context = NULL;
+
+	// A worker never returns to the script, the master does once all of them stopped
+	if (intern->rings) {
+		exit(0);
+	}
 }
 
 /**
@@ -558,26 +1054,227 @@ PHP_METHOD(Phalcon_Websocket_Server, stop)
 PHP_METHOD(Phalcon_Websocket_Server, broadcast)
 {
 	phalcon_websocket_server_object *intern;
-	zend_string *str;
+	zend_string *str, *key = NULL;
+	zend_long ignoredId = -1;
+
+	ZEND_PARSE_PARAMETERS_START(1, 3)
+		Z_PARAM_STR(str)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(ignoredId)
+		Z_PARAM_STR_EX(key, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
+	phalcon_websocket_server_forward(intern, PHALCON_WEBSOCKET_RING_BROADCAST, ignoredId, NULL, key, str);
+	phalcon_websocket_server_deliver(intern, NULL, 0, ZSTR_VAL(str), ZSTR_LEN(str), ignoredId, key);
+}
+
+/**
+ * Subscribe a connection, or the id of one, to a topic
+ *
+ * @param Phalcon\Websocket\Connection|int $connection
+ * @param string $topic
+ * @return boolean false when the connection was already subscribed
+ */
+PHP_METHOD(Phalcon_Websocket_Server, subscribe)
+{
+	phalcon_websocket_server_object *intern;
 	phalcon_websocket_connection_object *conn;
-	long ignoredId = -1;
+	zval *connection;
+	zend_string *topic;
+
+	ZEND_PARSE_PARAMETERS_START(2, 2)
+		Z_PARAM_ZVAL(connection)
+		Z_PARAM_STR(topic)
+	ZEND_PARSE_PARAMETERS_END();
+
+	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
+	conn = phalcon_websocket_server_get_connection(intern, connection);
+	if (!conn || !conn->connected) {
+		RETURN_FALSE;
+	}
+
+	RETURN_BOOL(phalcon_websocket_server_subscribe(intern, conn, topic));
+}
+
+/**
+ * Unsubscribe a connection from a topic, from all of them without one
+ *
+ * @param Phalcon\Websocket\Connection|int $connection
+ * @param string $topic
+ * @return int the number of topics it was removed from
+ */
+PHP_METHOD(Phalcon_Websocket_Server, unsubscribe)
+{
+	phalcon_websocket_server_object *intern;
+	phalcon_websocket_connection_object *conn;
+	zval *connection;
+	zend_string *topic = NULL;
 
 	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_ZVAL(connection)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_STR_EX(topic, 1, 0)
+	ZEND_PARSE_PARAMETERS_END();
+
+	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
+	conn = phalcon_websocket_server_get_connection(intern, connection);
+	if (!conn) {
+		RETURN_LONG(0);
+	}
+
+	RETURN_LONG(phalcon_websocket_server_unsubscribe(intern, conn, topic));
+}
+
+/**
+ * Send a message to the subscribers of a topic, the others are not visited
+ *
+ * @param string $topic
+ * @param string $text
+ * @param int $ignored id of a connection to skip, usually the sender
+ * @param string $key with the coalesce policy, replaces the queued message with the same key
+ * @return int the number of connections of this process the message was queued to
+ */
+PHP_METHOD(Phalcon_Websocket_Server, publish)
+{
+	phalcon_websocket_server_object *intern;
+	zend_string *topic, *str, *key = NULL;
+	zend_long ignoredId = -1;
+
+	ZEND_PARSE_PARAMETERS_START(2, 4)
+		Z_PARAM_STR(topic)
 		Z_PARAM_STR(str)
 		Z_PARAM_OPTIONAL
 		Z_PARAM_LONG(ignoredId)
+		Z_PARAM_STR_EX(key, 1, 0)
 	ZEND_PARSE_PARAMETERS_END();
 
 	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
-	ZEND_HASH_FOREACH(Z_ARR(intern->connections), 0);
-		// TODO Test return? Interrupt if a write fail?
-		conn = (phalcon_websocket_connection_object *) Z_OBJ_P(_z);
-		if (conn->id == ignoredId) {
-			continue;
-		}
-		phalcon_websocket_connection_write(conn, str);
-	ZEND_HASH_FOREACH_END();
-	efree(str);
+	phalcon_websocket_server_forward(intern, PHALCON_WEBSOCKET_RING_PUBLISH, ignoredId, topic, key, str);
+
+	RETURN_LONG(phalcon_websocket_server_deliver(intern, ZSTR_VAL(topic), ZSTR_LEN(topic), ZSTR_VAL(str), ZSTR_LEN(str), ignoredId, key));
+}
+
+/**
+ * Limit the bytes queued to each client, for the current connections and the next ones
+ *
+ *<code>
+ *	$server->setBackpressure(262144, Phalcon\Websocket\Connection::BACKPRESSURE_DISCONNECT);
+ *</code>
+ *
+ * @param int $maxBytes
+ * @param int $policy one of the Phalcon\Websocket\Connection::BACKPRESSURE_* constants, unchanged when omitted
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Websocket_Server, setBackpressure)
+{
+	phalcon_websocket_server_object *intern;
+	phalcon_websocket_connection_object *conn;
+	zval *connection;
+	zend_long max_bytes, policy = -1;
+
+	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_LONG(max_bytes)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(policy)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (max_bytes <= 0) {
+		php_error_docref(NULL, E_WARNING, "The maximum of queued bytes must be positive");
+		RETURN_FALSE;
+	}
+	if (policy != -1 && (policy < PHALCON_WEBSOCKET_BACKPRESSURE_DROP_OLDEST || policy > PHALCON_WEBSOCKET_BACKPRESSURE_DISCONNECT)) {
+		php_error_docref(NULL, E_WARNING, "Invalid backpressure policy");
+		RETURN_FALSE;
+	}
+
+	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
+	intern->max_bytes = max_bytes;
+	if (policy != -1) {
+		intern->policy = policy;
+	}
+
+	ZEND_HASH_FOREACH_VAL(Z_ARRVAL(intern->connections), connection) {
+		conn = phalcon_websocket_connection_object_from_obj(Z_OBJ_P(connection));
+		conn->max_bytes = intern->max_bytes;
+		conn->policy = intern->policy;
+	} ZEND_HASH_FOREACH_END();
+
+	RETURN_TRUE;
+}
+
+/**
+ * Get the totals of the write queues of all the connections
+ *
+ * @return array with connections, queued_frames, queued_bytes, dropped, coalesced and disconnected,
+ * in a worker also its index and the messages of the others dropped from its ring
+ */
+PHP_METHOD(Phalcon_Websocket_Server, getStats)
+{
+	phalcon_websocket_server_object *intern;
+
+	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
+
+	array_init(return_value);
+	add_assoc_long(return_value, "connections", zend_hash_num_elements(Z_ARRVAL(intern->connections)));
+	add_assoc_long(return_value, "queued_frames", intern->stats.queued_frames);
+	add_assoc_long(return_value, "queued_bytes", intern->stats.queued_bytes);
+	add_assoc_long(return_value, "dropped", intern->stats.dropped);
+	add_assoc_long(return_value, "coalesced", intern->stats.coalesced);
+	add_assoc_long(return_value, "disconnected", intern->stats.disconnected);
+	if (intern->rings) {
+		add_assoc_long(return_value, "worker", intern->worker);
+		add_assoc_long(return_value, "ring_dropped", phalcon_websocket_ring_at(intern->rings, intern->ring_size, intern->worker)->dropped);
+	}
+}
+
+/**
+ * Run the server in several processes listening on the same port
+ *
+ * Each worker is bound to its own CPU when there are enough of them and serves its own
+ * connections. broadcast() and publish() also reach the connections of the other workers
+ * through a ring of shared memory per worker, a message that does not fit in the ring of
+ * a slow worker is dropped for it. Connection ids are unique across the workers.
+ *
+ *<code>
+ * $server = new Phalcon\Websocket\Server(8080);
+ * $server->setWorkers(4);
+ * $server->run();
+ *</code>
+ *
+ * @param int $workers
+ * @param int $ringSize bytes of the ring of each worker, 1MB by default and 1GB at most
+ * @return boolean
+ */
+PHP_METHOD(Phalcon_Websocket_Server, setWorkers)
+{
+	phalcon_websocket_server_object *intern;
+	zend_long workers, ring_size = PHALCON_WEBSOCKET_RING_SIZE;
+
+	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_LONG(workers)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_LONG(ring_size)
+	ZEND_PARSE_PARAMETERS_END();
+
+	intern = phalcon_websocket_server_object_from_obj(Z_OBJ_P(getThis()));
+	if (intern->context || intern->rings) {
+		php_error_docref(NULL, E_WARNING, "The server is already running");
+		RETURN_FALSE;
+	}
+	if (workers < 1 || workers > PHALCON_WEBSOCKET_MAX_WORKERS) {
+		php_error_docref(NULL, E_WARNING, "The number of workers must be between 1 and %d", PHALCON_WEBSOCKET_MAX_WORKERS);
+		RETURN_FALSE;
+	}
+	if (ring_size < 4096 || ring_size > PHALCON_WEBSOCKET_RING_MAX) {
+		php_error_docref(NULL, E_WARNING, "The ring size must be between 4096 and %d bytes", PHALCON_WEBSOCKET_RING_MAX);
+		RETURN_FALSE;
+	}
+
+	intern->num_workers = workers;
+	intern->ring_size = ring_size;
+
+	RETURN_TRUE;
 }
 
 /**
@@ -26,6 +26,10 @@
 #ifdef PHALCON_USE_WEBSOCKET
 #include <libwebsockets.h>
 
+#include "websocket/connection.h"
+
+#define PHALCON_WEBSOCKET_MAX_WORKERS 256
+
 enum php_server_callbacks {
 	PHP_CB_SERVER_ACCEPT,
 	PHP_CB_SERVER_CLOSE,
@@ -52,6 +56,22 @@ typedef struct _phalcon_websocket_server_object {
 	zend_ulong next_id;
 	zval connections;
 
+	// Topic => connection id => connection object
+	HashTable topics;
+
+	// Write queue limit of new connections and totals of all of them
+	size_t max_bytes;
+	int policy;
+	phalcon_websocket_queue_stats stats;
+
+	// Forked workers, each one reads its ring of the shared mapping when its eventfd is signaled
+	int num_workers;
+	int worker;
+	size_t ring_size;
+	void *rings;
+	int *wakeups;
+	pid_t *workers;
+
 	zend_bool exit_request;
 	zend_object std;
 } phalcon_websocket_server_object;
@@ -285,4 +285,70 @@ class DispatcherMvcTest extends PHPUnit_Framework_TestCase
 		$this->assertEquals(get_class($error), 'Phalcon\ContinueException');
 	}
 
+	public function testDispatcherHandlerCache()
+	{
+		Phalcon\Di::reset();
+
+		$di = new Phalcon\Di();
+
+		$dispatcher = new Phalcon\Mvc\Dispatcher();
+		$dispatcher->setDI($di);
+
+		$di->set('dispatcher', $dispatcher);
+
+		for ($i = 0; $i < 2; $i++) {
+			$dispatcher->setControllerName('test2');
+			$dispatcher->setActionName('another');
+			$dispatcher->setParams(array());
+			$dispatcher->dispatch();
+			$this->assertEquals($dispatcher->getReturnedValue(), 100);
+			$this->assertEquals(get_class($dispatcher->getActiveHandler()), 'Test2Controller');
+
+			$dispatcher->setControllerName('test2');
+			$dispatcher->setActionName('essai');
+			$dispatcher->setParams(array());
+
+			try {
+				$dispatcher->dispatch();
+				$this->assertTrue(FALSE, 'oh, Why?');
+			}
+			catch(Phalcon\Exception $e){
+				$this->assertEquals($e->getMessage(), "Action 'essai' was not found on handler 'test2'");
+			}
+		}
+
+		$dispatcher->setDefaultNamespace('A\B\C');
+		$dispatcher->setControllerName('test2');
+		$this->assertEquals($dispatcher->getHandlerClass(), 'A\B\C\Test2Controller');
+
+		try {
+			$dispatcher->setActionName('another');
+			$dispatcher->dispatch();
+			$this->assertTrue(FALSE, 'oh, Why?');
+		}
+		catch(Phalcon\Exception $e){
+			$this->assertEquals($e->getMessage(), "A\B\C\Test2Controller handler class cannot be loaded");
+		}
+
+		$dispatcher->setDefaultNamespace(NULL);
+		$dispatcher->setNamespaceName(NULL);
+
+		/* A service registered later still takes the place of the class */
+		$di->set('Test2Controller', function() {
+			return new Test1Controller();
+		});
+
+		$dispatcher->setControllerName('test2');
+		$dispatcher->setActionName('another');
+		$dispatcher->setParams(array());
+
+		try {
+			$dispatcher->dispatch();
+			$this->assertTrue(FALSE, 'oh, Why?');
+		}
+		catch(Phalcon\Exception $e){
+			$this->assertEquals($e->getMessage(), "Action 'another' was not found on handler 'test2'");
+		}
+	}
+
 }
@@ -200,6 +200,25 @@ class ResponseTest extends PHPUnit_Framework_TestCase
 		$this->assertEquals($this->_response->isSent(), true);
 	}
 
+	public function testSetFileToSendRange()
+	{
+		$filename = __FILE__;
+
+		$request = new ResponseTestRequest();
+		$request->setServer(array('HTTP_RANGE' => 'bytes=0-4'));
+		$this->_response->getDI()->setShared('request', $request);
+
+		$this->_response->setFileToSend($filename);
+		ob_start();
+		$this->_response->send();
+		$actual = ob_get_clean();
+		$this->assertEquals($actual, '<?php');
+
+		$headers = $this->_response->getHeaders()->toArray();
+		$this->assertEquals($headers['Status'], '206 Partial Content');
+		$this->assertArrayHasKey('Content-Range: bytes 0-4/'.filesize($filename), $headers);
+	}
+
 	public function testMultipleHttpHeadersBug1892()
 	{
 		$this->_response->resetHeaders();
@@ -230,3 +249,11 @@ class ResponseTest extends PHPUnit_Framework_TestCase
 		)), $this->_response->getHeaders());
 	}
 }
+
+class ResponseTestRequest extends Phalcon\Http\Request
+{
+	public function setServer($server)
+	{
+		$this->_server = $server;
+	}
+}
@@ -18,6 +18,30 @@
   +------------------------------------------------------------------------+
 */
 
+/**
+ * @RoutePrefix("/exported")
+ */
+class RouterExportController
+{
+
+	/**
+	 * @Get("/")
+	 */
+	public function indexAction()
+	{
+
+	}
+
+	/**
+	 * @Get("/edit/{id:[0-9]+}", name="edit-exported")
+	 */
+	public function editAction($id)
+	{
+
+	}
+
+}
+
 class RouterMvcTest extends PHPUnit_Framework_TestCase
 {
 
@@ -1037,4 +1061,185 @@ class RouterMvcTest extends PHPUnit_Framework_TestCase
 			$this->assertEquals($router->getActionName(), $paths['action']);
 		}
 	}
+
+	public function testMergedRoutes()
+	{
+		Phalcon\Mvc\Router\Route::reset();
+
+		$router = new Phalcon\Mvc\Router(false);
+
+		for ($i = 0; $i < 40; $i++) {
+			$router->add('/items' . $i . '/{id:[0-9]+}', array('controller' => 'items' . $i, 'action' => 'show'));
+		}
+		$router->add('#^/a|/b$#', array('controller' => 'alternation', 'action' => 'index'));
+		$router->add('/([a-z]+)/(\d+)', array('controller' => 1, 'action' => 'view', 'id' => 2));
+		$router->add('/([a-z]+)/(\1)', array('controller' => 'reference', 'action' => 'index'));
+		$router->add('/[|(]/{id:[0-9]+}', array('controller' => 'symbols', 'action' => 'index'));
+
+		$routes = array(
+			array('/items0/1', 'items0', 'show'),
+			array('/items39/25', 'items39', 'show'),
+			array('/items7/abc', NULL, NULL),
+			array('/abc/xyz/b', 'alternation', 'index'),
+			array('/a/whatever', 'alternation', 'index'),
+			array('/robots/12', 'robots', 'view'),
+			array('/same/same', 'reference', 'index'),
+			array('/|/5', 'symbols', 'index'),
+			array('/(/5', 'symbols', 'index'),
+		);
+
+		foreach ($routes as $route) {
+			$router->handle($route[0]);
+			$this->assertEquals($router->wasMatched(), $route[1] !== NULL, $route[0]);
+			$this->assertEquals($router->getControllerName(), $route[1], $route[0]);
+			$this->assertEquals($router->getActionName(), $route[2], $route[0]);
+		}
+
+		/* A route added later is checked first */
+		$router->add('/items3/{id:[0-9]+}', array('controller' => 'override', 'action' => 'show'));
+		$router->handle('/items3/4');
+		$this->assertEquals($router->getControllerName(), 'override');
+	}
+
+	public function testExportImport()
+	{
+		Phalcon\Mvc\Router\Route::reset();
+
+		$router = new Phalcon\Mvc\Router(false);
+		$router->add('/health', array('controller' => 'health', 'action' => 'index'))->setName('health');
+		$router->add('/posts/{id:[0-9]+}', array('controller' => 'posts', 'action' => 'show'))->via('GET');
+		$router->notFound(array('controller' => 'errors', 'action' => 'show404'));
+
+		$blob = $router->export('v1');
+		$this->assertTrue(is_string($blob));
+
+		$imported = new Phalcon\Mvc\Router(false);
+		$this->assertFalse($imported->import($blob, 'v2'));
+		$this->assertEquals(count($imported->getRoutes()), 0);
+
+		$this->assertTrue($imported->import($blob, 'v1'));
+		$this->assertEquals(count($imported->getRoutes()), 2);
+		$this->assertEquals($imported->getRouteByName('health')->getPattern(), '/health');
+
+		$_SERVER['REQUEST_METHOD'] = 'GET';
+		$imported->handle('/posts/10');
+		$this->assertEquals($imported->getControllerName(), 'posts');
+		$this->assertEquals($imported->getParams(), array('id' => '10'));
+
+		$imported->handle('/health');
+		$this->assertEquals($imported->getControllerName(), 'health');
+
+		$imported->handle('/missing');
+		$this->assertEquals($imported->getControllerName(), 'errors');
+
+		/* The routes added after an import do not take the ids of the imported ones */
+		$route = $imported->add('/about', array('controller' => 'about', 'action' => 'index'));
+		$this->assertTrue($route->getRouteId() > $imported->getRouteByName('health')->getRouteId());
+
+		/* Only the routes and the groups are restored as objects */
+		$header = substr($blob, 0, strpos($blob, "\n") + 1);
+		$tampered = $header . serialize(array('routes' => array(new ArrayObject()), 'names' => array(), 'notFound' => NULL, 'chunks' => array(), 'statics' => array(), 'caseSensitive' => FALSE));
+		$this->assertFalse($imported->import($tampered, 'v1'));
+		$this->assertFalse($imported->import(substr($blob, 0, -10), 'v1'));
+
+		$path = tempnam(sys_get_temp_dir(), 'router');
+		$this->assertTrue($router->save($path, 'v1'));
+
+		$loaded = new Phalcon\Mvc\Router(false);
+		$this->assertFalse($loaded->load($path, 'v2'));
+		$this->assertTrue($loaded->load($path, 'v1'));
+		$loaded->handle('/health');
+		$this->assertEquals($loaded->getControllerName(), 'health');
+		unlink($path);
+	}
+
+	public function testAnnotationsSaveLoad()
+	{
+		Phalcon\Mvc\Router\Route::reset();
+
+		$di = new Phalcon\Di();
+		$di['request'] = new Phalcon\Http\Request();
+		$di['annotations'] = new Phalcon\Annotations\Adapter\Memory();
+
+		$router = new Phalcon\Mvc\Router\Annotations(false);
+		$router->setDI($di);
+		$router->addResource('RouterExport');
+
+		$path = tempnam(sys_get_temp_dir(), 'router');
+		$this->assertTrue($router->save($path, 'v1'));
+		$this->assertEquals(count($router->getRoutes()), 2);
+
+		/* The loaded routes are not read again from the resources */
+		$loaded = new Phalcon\Mvc\Router\Annotations(false);
+		$loaded->setDI($di);
+		$loaded->addResource('RouterExport');
+		$this->assertTrue($loaded->load($path, 'v1'));
+		unlink($path);
+
+		$_SERVER['REQUEST_METHOD'] = 'GET';
+		$loaded->handle('/exported/edit/10');
+		$this->assertEquals(count($loaded->getRoutes()), 2);
+		$this->assertTrue($loaded->wasMatched());
+		$this->assertEquals($loaded->getMatchedRoute()->getName(), 'edit-exported');
+		$this->assertEquals($loaded->getActionName(), 'edit');
+		$this->assertEquals($loaded->getParams(), array('id' => '10'));
+	}
+
+	public function testStaticRoutes()
+	{
+		Phalcon\Mvc\Router\Route::reset();
+
+		$router = new Phalcon\Mvc\Router(false);
+
+		$router->add('/health', array('controller' => 'health', 'action' => 'index'));
+		$router->add('/about', array('controller' => 'about', 'action' => 'get'))->via('GET');
+		$router->add('/about', array('controller' => 'about', 'action' => 'post'))->via('POST');
+		$router->add('/{name}', array('controller' => 'pages', 'action' => 'show'));
+		$router->add('/contact', array('controller' => 'contact', 'action' => 'index'));
+		$router->add('/health', array('controller' => 'status', 'action' => 'index'));
+
+		$routes = array(
+			array('GET', '/health', 'status', 'index'),
+			array('GET', '/contact', 'contact', 'index'),
+			array('GET', '/about', 'pages', 'show'),
+		);
+
+		foreach ($routes as $route) {
+			$_SERVER['REQUEST_METHOD'] = $route[0];
+			$router->handle($route[1]);
+			$this->assertTrue($router->wasMatched());
+			$this->assertEquals($router->getControllerName(), $route[2]);
+			$this->assertEquals($router->getActionName(), $route[3]);
+		}
+
+		$router = new Phalcon\Mvc\Router(false);
+
+		$router->add('/health', array('controller' => 'health', 'action' => 'index'));
+		$router->add('/about', array('controller' => 'about', 'action' => 'get'))->via('GET');
+		$router->add('/about', array('controller' => 'about', 'action' => 'post'))->via('POST');
+		$router->add('/{name:[0-9]+}', array('controller' => 'pages', 'action' => 'show'));
+
+		$routes = array(
+			array('GET', '/health', 'health', 'index'),
+			array('GET', '/about', 'about', 'get'),
+			array('POST', '/about', 'about', 'post'),
+			array('GET', '/42', 'pages', 'show'),
+		);
+
+		foreach ($routes as $route) {
+			$_SERVER['REQUEST_METHOD'] = $route[0];
+			$router->handle($route[1]);
+			$this->assertTrue($router->wasMatched());
+			$this->assertEquals($router->getControllerName(), $route[2]);
+			$this->assertEquals($router->getActionName(), $route[3]);
+		}
+
+		$_SERVER['REQUEST_METHOD'] = 'PUT';
+		$router->handle('/about');
+		$this->assertFalse($router->wasMatched());
+
+		$_SERVER['REQUEST_METHOD'] = 'GET';
+		$router->handle('/missing');
+		$this->assertFalse($router->wasMatched());
+	}
 }
@@ -0,0 +1,107 @@
+<?php
+
+/*
+	+------------------------------------------------------------------------+
+	| Phalcon Framework                                                      |
+	+------------------------------------------------------------------------+
+	| Copyright (c) 2011-2014 Phalcon Team (http://www.phalconphp.com)       |
+	+------------------------------------------------------------------------+
+	| This source file is subject to the New BSD License that is bundled     |
+	| with this package in the file docs/LICENSE.txt.                        |
+	|                                                                        |
+	| If you did not receive a copy of the license and are unable to         |
+	| obtain it through the world-wide-web, please send an email             |
+	| to license@phalconphp.com so we can send you a copy immediately.       |
+	+------------------------------------------------------------------------+
+	| Authors: Andres Gutierrez <andres@phalconphp.com>                      |
+	|          Eduar Carvajal <eduar@phalconphp.com>                         |
+    |          ZhuZongXin <dreamsxin@qq.com>                                 |
+	+------------------------------------------------------------------------+
+*/
+
+class CoroutineController extends Phalcon\Mvc\Controller
+{
+	public function indexAction()
+	{
+		$this->response->setContent($this->request->getQuery('name') . ':');
+
+		// Yields to the other request of the worker until the backend answers
+		$client = new Phalcon\Socket\Client('127.0.0.1', ServerHttpTest::BACKEND_PORT);
+		$client->connect();
+		$client->write($this->request->getQuery('name'));
+		$reply = $client->read(64);
+		$client->close();
+
+		$this->response->appendContent($reply . ':' . $this->request->getQuery('name'));
+		return $this->response;
+	}
+}
+
+class ServerHttpTest extends PHPUnit_Framework_TestCase
+{
+	const PORT = 8991;
+
+	const BACKEND_PORT = 8992;
+
+	public function testCoroutineInterleavedRequests()
+	{
+		if (!class_exists('Phalcon\Server\Http') || !function_exists('pcntl_fork') || !function_exists('posix_kill')) {
+			$this->markTestSkipped('Test skipped');
+			return;
+		}
+
+		$backend = stream_socket_server('tcp://127.0.0.1:' . self::BACKEND_PORT, $errno, $errstr);
+		$this->assertNotFalse($backend, $errstr);
+
+		// Answers only once both requests are waiting on it, the second one first
+		$backendPid = pcntl_fork();
+		if ($backendPid == 0) {
+			$first = stream_socket_accept($backend, 10);
+			$second = stream_socket_accept($backend, 10);
+			$firstName = fread($first, 64);
+			$secondName = fread($second, 64);
+			fwrite($second, 'reply-' . $secondName);
+			fwrite($first, 'reply-' . $firstName);
+			fclose($first);
+			fclose($second);
+			exit(0);
+		}
+		fclose($backend);
+
+		$serverPid = pcntl_fork();
+		if ($serverPid == 0) {
+			Phalcon\Di::reset();
+			$di = new Phalcon\Di\FactoryDefault();
+
+			$application = new Phalcon\Mvc\Application();
+			$application->useImplicitView(false);
+			$application->setDI($di);
+
+			$server = new Phalcon\Server\Http(array('host' => '127.0.0.1', 'port' => self::PORT, 'worker' => 1, 'coroutine' => true));
+			$server->start($application);
+			exit(0);
+		}
+
+		usleep(500000);
+
+		$first = stream_socket_client('tcp://127.0.0.1:' . self::PORT, $errno, $errstr, 5);
+		fwrite($first, "GET /coroutine/index?name=first HTTP/1.0\r\nHost: localhost\r\n\r\n");
+		usleep(100000);
+		$second = stream_socket_client('tcp://127.0.0.1:' . self::PORT, $errno, $errstr, 5);
+		fwrite($second, "GET /coroutine/index?name=second HTTP/1.0\r\nHost: localhost\r\n\r\n");
+
+		stream_set_timeout($first, 10);
+		stream_set_timeout($second, 10);
+		$firstResponse = stream_get_contents($first);
+		$secondResponse = stream_get_contents($second);
+		fclose($first);
+		fclose($second);
+
+		posix_kill($serverPid, SIGTERM);
+		pcntl_waitpid($serverPid, $status);
+		pcntl_waitpid($backendPid, $status);
+
+		$this->assertStringEndsWith("\r\n\r\nfirst:reply-first:first", $firstResponse);
+		$this->assertStringEndsWith("\r\n\r\nsecond:reply-second:second", $secondResponse);
+	}
+}
@@ -46,4 +46,64 @@ class UrlTest extends PHPUnit_Framework_TestCase
 		$url = $di->url->get(array('for' => 'test', 'hostname' => true, 'controller' => 'index', 'action' => 'test'));
 		$this->assertEquals($url, 'phalconphp.com/index/test');
 	}
+
+	public function testUrlCache()
+	{
+		Phalcon\Di::reset();
+
+		$di = new Phalcon\Di();
+
+		$router = new Phalcon\Mvc\Router(FALSE);
+		$route = $router->add('/posts/{year}/{title}', array(
+			'controller' => 'posts',
+			'action' => 'show'
+		))->setName('post');
+		$di['router'] = $router;
+
+		$url = new UrlTestRouterUrl();
+		$url->setDI($di);
+		$url->setBaseUri('/');
+		$url->setCacheSize(2);
+
+		$args = array('for' => 'post', 'year' => 2014, 'title' => 'hello');
+
+		$this->assertEquals($url->get($args), '/posts/2014/hello');
+		$this->assertEquals($url->get($args), '/posts/2014/hello');
+		$this->assertEquals($url->get($args, array('page' => 2)), '/posts/2014/hello?page=2');
+		$this->assertEquals($url->get(array('for' => 'post', 'year' => '2014', 'title' => 'hello')), '/posts/2014/hello');
+		$this->assertEquals($url->get(array('for' => 'post', 'year' => 2015, 'title' => 'bye')), '/posts/2015/bye');
+		$this->assertEquals($url->get(array('for' => 'post', 'year' => 2016, 'title' => 'new')), '/posts/2016/new');
+		$this->assertEquals($url->get($args), '/posts/2014/hello');
+
+		$url->setBaseUri('/blog/');
+		$this->assertEquals($url->get($args), '/blog/posts/2014/hello');
+
+		$route->setHostname('phalconphp.com');
+		$this->assertEquals($url->get(array('for' => 'post', 'hostname' => true, 'year' => 2014, 'title' => 'hello')), 'phalconphp.com/blog/posts/2014/hello');
+
+		$route->reConfigure('/articles/{year}/{title}', array(
+			'controller' => 'posts',
+			'action' => 'show'
+		));
+		$this->assertEquals($url->get($args), '/blog/articles/2014/hello');
+
+		$route->setUrlGenerator(function($baseUri, $paths, $uri) {
+			return $baseUri . 'generated/' . $uri['title'];
+		});
+		$this->assertEquals($url->get($args), '/blog/generated/hello');
+
+		/* Another router */
+		$other = new Phalcon\Mvc\Router(FALSE);
+		$other->add('/other/{year}/{title}')->setName('post');
+		$url->setRouter($other);
+		$this->assertEquals($url->get($args), '/blog/other/2014/hello');
+	}
+}
+
+class UrlTestRouterUrl extends Phalcon\Mvc\Url
+{
+	public function setRouter($router)
+	{
+		$this->_router = $router;
+	}
 }